@@ -7,6 +7,10 @@
 
 #include <cstring>
 
+#if defined ( __GNUC__ ) && ( defined ( __i386__ ) || defined ( __x86_64__ ) )
+#include <cpuid.h>
+#endif
+
 using namespace std;
 
 
@@ -36,6 +40,95 @@ bool checkMD5 ( const string& str, const char md5[16] )
 }
 
 
+// Reflected CRC32C polynomial
+#define CRC32C_POLYNOMIAL ( 0x82F63B78 )
+
+// Generate the byte-wise lookup table, only called once
+static const uint32_t *makeCRC32CTable()
+{
+    static uint32_t table[256];
+
+    for ( uint32_t i = 0; i < 256; ++i )
+    {
+        uint32_t crc = i;
+
+        for ( int j = 0; j < 8; ++j )
+            crc = ( crc >> 1 ) ^ ( ( crc & 1 ) ? CRC32C_POLYNOMIAL : 0 );
+
+        table[i] = crc;
+    }
+
+    return table;
+}
+
+uint32_t getCRC32CPortable ( const char *bytes, size_t len )
+{
+    static const uint32_t *table = makeCRC32CTable();
+
+    uint32_t crc = 0xFFFFFFFF;
+
+    for ( size_t i = 0; i < len; ++i )
+        crc = table[ ( crc ^ ( uint8_t ) bytes[i] ) & 0xFF ] ^ ( crc >> 8 );
+
+    return ~crc;
+}
+
+#if defined ( __GNUC__ ) && ( defined ( __i386__ ) || defined ( __x86_64__ ) )
+
+bool hasCRC32CHardware()
+{
+    unsigned eax, ebx, ecx, edx;
+
+    if ( ! __get_cpuid ( 1, &eax, &ebx, &ecx, &edx ) )
+        return false;
+
+    return ( ecx & bit_SSE4_2 );
+}
+
+// Compiled for SSE4.2 only, so this must NOT be called unless hasCRC32CHardware is true
+__attribute__ ( ( target ( "sse4.2" ) ) )
+uint32_t getCRC32CHardware ( const char *bytes, size_t len )
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    // 4 bytes at a time, using memcpy for unaligned reads
+    for ( ; len >= 4; bytes += 4, len -= 4 )
+    {
+        uint32_t word;
+        memcpy ( &word, bytes, 4 );
+        crc = __builtin_ia32_crc32si ( crc, word );
+    }
+
+    for ( ; len > 0; ++bytes, --len )
+        crc = __builtin_ia32_crc32qi ( crc, ( uint8_t ) *bytes );
+
+    return ~crc;
+}
+
+#else
+
+bool hasCRC32CHardware()
+{
+    return false;
+}
+
+uint32_t getCRC32CHardware ( const char *bytes, size_t len )
+{
+    return getCRC32CPortable ( bytes, len );
+}
+
+#endif
+
+uint32_t getCRC32C ( const char *bytes, size_t len )
+{
+    // Select the implementation once, the result depends only on the CPU
+    static uint32_t ( *const impl ) ( const char *, size_t )
+        = ( hasCRC32CHardware() ? getCRC32CHardware : getCRC32CPortable );
+
+    return impl ( bytes, len );
+}
+
+
 size_t compress ( const char *src, size_t srcLen, char *dst, size_t dstLen, int level )
 {
     mz_ulong len = dstLen;
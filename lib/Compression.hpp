@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 
 
 // MD5 calculation
@@ -10,6 +11,15 @@ bool checkMD5 ( const char *bytes, size_t len, const char md5[16] );
 bool checkMD5 ( const std::string& str, const char md5[16] );
 
 
+// CRC32C (Castagnoli) calculation, uses the SSE4.2 crc32 instruction if the CPU supports it
+uint32_t getCRC32C ( const char *bytes, size_t len );
+
+// Specific CRC32C implementations, getCRC32CHardware is only valid if hasCRC32CHardware is true
+uint32_t getCRC32CPortable ( const char *bytes, size_t len );
+uint32_t getCRC32CHardware ( const char *bytes, size_t len );
+bool hasCRC32CHardware();
+
+
 // zlib compression
 size_t compress ( const char *src, size_t srcLen, char *dst, size_t dstLen, int level = 9 );
 size_t uncompress ( const char *src, size_t srcLen, char *dst, size_t dstLen );
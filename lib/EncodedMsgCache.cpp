@@ -0,0 +1,69 @@
+#include "EncodedMsgCache.hpp"
+#include "Socket.hpp"
+#include "Logger.hpp"
+
+using namespace std;
+
+
+EncodedMsgCache::Entry& EncodedMsgCache::getEntry ( const MsgPtr& msg, uint64_t key )
+{
+    ASSERT ( msg.get() != 0 );
+
+    Entry& entry = _entries[ { msg->getMsgType(), key } ];
+
+    if ( ! entry.msg )
+        entry.msg = msg;
+
+    entry.used = true;
+    return entry;
+}
+
+const MsgPtr& EncodedMsgCache::get ( const MsgPtr& msg, uint64_t key )
+{
+    return getEntry ( msg, key ).msg;
+}
+
+const string& EncodedMsgCache::encode ( const MsgPtr& msg, uint64_t key, uint8_t wireVersion )
+{
+    ASSERT ( wireVersion <= WIRE_VERSION_LATEST );
+
+    Entry& entry = getEntry ( msg, key );
+    string& bytes = entry.encoded[wireVersion];
+
+    if ( bytes.empty() )
+        bytes = Protocol::encode ( entry.msg, wireVersion );
+
+    return bytes;
+}
+
+bool EncodedMsgCache::send ( Socket *socket, const MsgPtr& msg, uint64_t key )
+{
+    const uint8_t wireVersion = socket->getWireVersion();
+
+    // Fallback for newer wire versions than this build knows about, which shouldn't happen
+    if ( wireVersion > WIRE_VERSION_LATEST )
+        return socket->send ( msg );
+
+    Entry& entry = getEntry ( msg, key );
+
+    // Sockets that can't use the encoded bytes still share the cached message
+    if ( ! socket->canSendEncoded() )
+        return socket->send ( entry.msg );
+
+    return socket->sendEncoded ( entry.msg, encode ( entry.msg, key, wireVersion ) );
+}
+
+void EncodedMsgCache::evictUnused()
+{
+    for ( auto it = _entries.begin(); it != _entries.end(); )
+    {
+        if ( ! it->second.used )
+        {
+            it = _entries.erase ( it );
+            continue;
+        }
+
+        it->second.used = false;
+        ++it;
+    }
+}
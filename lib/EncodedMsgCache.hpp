@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Protocol.hpp"
+
+#include <unordered_map>
+#include <array>
+
+
+class Socket;
+
+
+// Cache of encoded messages that are sent to many sockets, ie spectator broadcasts. Each message is identified by
+// its type and a key, and is only encoded once per wire version, no matter how many sockets it is sent to.
+// Messages with the same type and key MUST have identical contents.
+class EncodedMsgCache
+{
+public:
+
+    // Get the cached message with the same type and key, or cache this one if there is none
+    const MsgPtr& get ( const MsgPtr& msg, uint64_t key );
+
+    // Get the message encoded with the given wire version, this only encodes it the first time
+    const std::string& encode ( const MsgPtr& msg, uint64_t key, uint8_t wireVersion );
+
+    // Send the message to a socket, using the cached encoding for the socket's wire version
+    bool send ( Socket *socket, const MsgPtr& msg, uint64_t key );
+
+    // Remove the messages that haven't been used since the last call
+    void evictUnused();
+
+    void clear() { _entries.clear(); }
+
+    size_t size() const { return _entries.size(); }
+
+private:
+
+    struct Key
+    {
+        MsgType type;
+        uint64_t key;
+
+        bool operator== ( const Key& other ) const { return ( type == other.type && key == other.key ); }
+    };
+
+    struct KeyHash
+    {
+        size_t operator() ( const Key& a ) const
+        {
+            return std::hash<uint64_t>() ( a.key ^ ( uint64_t ( a.type ) << 56 ) );
+        }
+    };
+
+    struct Entry
+    {
+        MsgPtr msg;
+
+        // Encoded bytes for each wire version, empty if not encoded yet
+        std::array<std::string, WIRE_VERSION_LATEST + 1> encoded;
+
+        bool used = true;
+    };
+
+    std::unordered_map<Key, Entry, KeyHash> _entries;
+
+    Entry& getEntry ( const MsgPtr& msg, uint64_t key );
+};
@@ -4,9 +4,15 @@
 #include "ControllerManager.hpp"
 #include "Logger.hpp"
 
+#ifdef _WIN32
 #include <winsock2.h>
 #include <windows.h>
 #include <mmsystem.h>
+#else
+// Only needed for accurate select timeouts on Windows
+#define timeBeginPeriod(PERIOD)
+#define timeEndPeriod(PERIOD)
+#endif
 
 using namespace std;
 
@@ -41,34 +47,29 @@ void EventManager::checkEvents ( uint64_t timeout )
     ASSERT ( timeout > 0 );
 
     SocketManager::get().check ( timeout );
-}
 
-void EventManager::eventLoop()
-{
-    if ( TimerManager::get().isHiRes() )
-    {
-        timeBeginPeriod ( 1 ); // for select, see comment in SocketManager
+    if ( ! _running || _sources.empty() )
+        return;
 
-        while ( _running )
-        {
-            Sleep ( 1 );
-            checkEvents ( DEFAULT_TIMEOUT_MILLISECONDS );
-        }
+    // Copy first, since a source can remove any source while it is being checked
+    const vector<Source *> sources ( _sources.begin(), _sources.end() );
 
-        timeEndPeriod ( 1 ); // for select, see comment in SocketManager
-    }
-    else
+    for ( Source *source : sources )
     {
-        timeBeginPeriod ( 1 ); // for timeGetTime AND select
+        if ( hasSource ( source ) )
+            source->checkEvents();
+    }
+}
+
+void EventManager::eventLoop()
+{
+    // Sockets are only checked after timers, so this blocks until either the next timer or a socket event
+    timeBeginPeriod ( 1 ); // for timeGetTime AND select, see comment in SocketManager
 
-        while ( _running )
-        {
-            Sleep ( 1 );
-            checkEvents ( DEFAULT_TIMEOUT_MILLISECONDS );
-        }
+    while ( _running )
+        checkEvents ( DEFAULT_TIMEOUT_MILLISECONDS );
 
-        timeEndPeriod ( 1 ); // for timeGetTime AND select
-    }
+    timeEndPeriod ( 1 ); // for timeGetTime AND select, see comment in SocketManager
 }
 
 EventManager::EventManager() {}
@@ -95,6 +96,9 @@ bool EventManager::poll ( uint64_t timeout )
         now = TimerManager::get().getNow ( true );
     }
 
+    // Don't hold the messages sent during the last check until the next poll
+    SocketManager::get().flush();
+
     timeEndPeriod ( 1 ); // for select, see comment in SocketManager
 
     if ( _running )
@@ -135,17 +139,27 @@ void EventManager::stop()
 
     _running = false;
 
+    // Interrupt the event loop if it is waiting
+    SocketManager::get().wake();
+
     // LOG ( "Joining reaper thread" );
     // _reaperThread.join();
     // LOG ( "Joined reaper thread" );
 }
 
+void EventManager::wake()
+{
+    SocketManager::get().wake();
+}
+
 void EventManager::release()
 {
     LOG ( "Releasing everything" );
 
     _running = false;
 
+    SocketManager::get().wake();
+
     LOG ( "Releasing reaper thread" );
 
     _reaperThread.release();
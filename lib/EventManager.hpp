@@ -4,6 +4,7 @@
 #include "BlockingQueue.hpp"
 
 #include <memory>
+#include <unordered_set>
 
 
 #define CHECK_TIMERS        0x0001
@@ -15,6 +16,18 @@ class EventManager
 {
 public:
 
+    // Source of events that aren't timers or sockets, ie shared memory
+    struct Source
+    {
+        // Check for events, this is called on every iteration of the event loop, after the sockets
+        virtual void checkEvents() = 0;
+    };
+
+    // Add / remove a source of events, a source can remove any source while it is being checked
+    void addSource ( Source *source ) { _sources.insert ( source ); }
+    void removeSource ( Source *source ) { _sources.erase ( source ); }
+    bool hasSource ( Source *source ) const { return ( _sources.find ( source ) != _sources.end() ); }
+
     // Add a thread to be joined on the reaper thread, aka garbage collected when it finishes
     void addThread ( const ThreadPtr& thread );
 
@@ -30,6 +43,9 @@ public:
     // Stop the EventManager, can be called on a different thread
     void stop();
 
+    // Interrupt the current or next wait for events, ie when a source has events, can be called on a different thread
+    void wake();
+
     // Stop the EventManager and release background threads, can be called on a different thread
     void release();
 
@@ -58,6 +74,9 @@ private:
     // Flag to indicate the event loop is running
     volatile bool _running = false;
 
+    // Sources of events that aren't timers or sockets
+    std::unordered_set<Source *> _sources;
+
     // Check for events
     void checkEvents ( uint64_t timeout );
 
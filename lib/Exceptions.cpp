@@ -1,9 +1,6 @@
 #include "Exceptions.hpp"
 #include "StringUtils.hpp"
-
-#include <winsock2.h>
-#include <windows.h>
-#include <ws2tcpip.h>
+#include "SocketHeaders.hpp"
 
 using namespace std;
 
@@ -26,6 +23,7 @@ string WinException::str() const
 
 string WinException::getAsString ( int windowsErrorCode )
 {
+#ifdef _WIN32
     string str;
     char *errorString = 0;
     FormatMessage ( FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM,
@@ -33,11 +31,19 @@ string WinException::getAsString ( int windowsErrorCode )
     str = ( errorString ? trimmed ( errorString ) : "(null)" );
     LocalFree ( errorString );
     return str;
+#else
+    // Other platforms use errno codes
+    return strerror ( windowsErrorCode );
+#endif
 }
 
 string WinException::getLastError()
 {
+#ifdef _WIN32
     return getAsString ( GetLastError() );
+#else
+    return getAsString ( errno );
+#endif
 }
 
 string WinException::getLastSocketError()
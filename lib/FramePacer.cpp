@@ -0,0 +1,175 @@
+#include "FramePacer.hpp"
+#include "StringUtils.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <ctime>
+#endif
+
+using namespace std;
+
+
+FramePacer::SystemClock::SystemClock()
+{
+#ifdef _WIN32
+    QueryPerformanceFrequency ( ( LARGE_INTEGER * ) &_ticksPerSecond );
+#endif // _WIN32
+}
+
+uint64_t FramePacer::SystemClock::getNow()
+{
+#ifdef _WIN32
+    uint64_t ticks;
+    QueryPerformanceCounter ( ( LARGE_INTEGER * ) &ticks );
+
+    // Split to avoid overflowing after a long uptime
+    return ( ticks / _ticksPerSecond ) * 1000000 + ( ( ticks % _ticksPerSecond ) * 1000000 ) / _ticksPerSecond;
+#else
+    timespec ts;
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return uint64_t ( ts.tv_sec ) * 1000000 + ts.tv_nsec / 1000;
+#endif // _WIN32
+}
+
+void FramePacer::SystemClock::sleep ( uint32_t milliseconds )
+{
+#ifdef _WIN32
+    // Note: Sleep should be called between timeBeginPeriod / timeEndPeriod to ensure accuracy
+    Sleep ( milliseconds );
+#else
+    timespec ts;
+    ts.tv_sec = milliseconds / 1000;
+    ts.tv_nsec = long ( milliseconds % 1000 ) * 1000000;
+    nanosleep ( &ts, 0 );
+#endif // _WIN32
+}
+
+
+FramePacer::FramePacer ( Clock *clock ) : _clock ( clock )
+{
+    static SystemClock systemClock;
+
+    if ( ! _clock )
+        _clock = &systemClock;
+}
+
+void FramePacer::setFps ( double fps )
+{
+    if ( fps == _fps )
+        return;
+
+    _fps = fps;
+    _interval = ( ( fps > 0 && fps < 1000000 ) ? 1000000.0 / fps : 0 );
+}
+
+uint32_t FramePacer::getSpinUs() const
+{
+    return uint32_t ( min<double> ( settings.minSpinUs + _sleepOvershoot, settings.maxSpinUs ) );
+}
+
+void FramePacer::waitNextFrame()
+{
+    uint64_t now = _clock->getNow();
+
+    if ( ! _isStarted || _interval == 0 )
+    {
+        _isStarted = ( _interval > 0 );
+        _deadline = now;
+        frameStarted ( now );
+        return;
+    }
+
+    _deadline += _interval;
+
+    if ( now > _deadline )
+    {
+        ++_counters.late;
+
+        // Too late to catch up, so restart the schedule instead of rushing the next few frames
+        if ( now > _deadline + settings.maxLateFrames * _interval )
+        {
+            ++_counters.resyncs;
+            _deadline = now;
+        }
+    }
+
+    // Sleep in whole milliseconds until the spin margin before the deadline
+    for ( ;; )
+    {
+        const double remaining = _deadline - now - getSpinUs();
+
+        if ( remaining < 1000 )
+            break;
+
+        const uint32_t milliseconds = uint32_t ( remaining / 1000 );
+
+        _clock->sleep ( milliseconds );
+
+        const uint64_t after = _clock->getNow();
+        const double overshoot = double ( after - now ) - 1000.0 * milliseconds;
+
+        _sleepOvershoot = max ( overshoot, _sleepOvershoot * settings.overshootDecay );
+
+        ++_counters.sleeps;
+        _counters.sleepUs += after - now;
+        now = after;
+    }
+
+    // Spin the rest of the way
+    const uint64_t spinStart = now;
+
+    while ( now < _deadline )
+        now = _clock->getNow();
+
+    _counters.spinUs += now - spinStart;
+
+    frameStarted ( now );
+}
+
+void FramePacer::frameStarted ( uint64_t now )
+{
+    if ( _counters.frames > 0 )
+    {
+        _frameTimes.addSample ( double ( now - _lastFrame ) );
+        _lateness.addSample ( max ( 0.0, now - _deadline ) );
+    }
+
+    ++_counters.frames;
+    _lastFrame = now;
+
+    if ( _fpsCount == 0 )
+    {
+        _fpsStart = now;
+    }
+    else if ( _fpsCount == settings.fpsFrames && now > _fpsStart )
+    {
+        _actualFps = ( 1000000.0 * _fpsCount ) / ( now - _fpsStart );
+        _fpsStart = now;
+        _fpsCount = 0;
+    }
+
+    ++_fpsCount;
+}
+
+void FramePacer::resetTiming()
+{
+    _frameTimes.reset();
+    _lateness.reset();
+    _counters = Counters();
+}
+
+string FramePacer::str() const
+{
+    return format ( "fps=%.3f; actualFps=%.3f; frames=%llu; late=%llu; resyncs=%llu; spinMargin=%u us; "
+                    "frameTime=[p50=%u; p99=%u; p99.9=%u] us; lateness=[p50=%u; p99=%u; p99.9=%u] us; "
+                    "sleep=%llu us; spin=%llu us",
+                    _fps, _actualFps, _counters.frames, _counters.late, _counters.resyncs, getSpinUs(),
+                    _frameTimes.getPercentile ( 50 ), _frameTimes.getPercentile ( 99 ),
+                    _frameTimes.getPercentile ( 99.9 ), _lateness.getPercentile ( 50 ),
+                    _lateness.getPercentile ( 99 ), _lateness.getPercentile ( 99.9 ),
+                    _counters.sleepUs, _counters.spinUs );
+}
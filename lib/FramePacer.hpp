@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Statistics.hpp"
+
+#include <cstdint>
+#include <string>
+
+
+// Paces frames to a target frame rate using a microsecond clock. Each frame sleeps until shortly before its
+// deadline, then spins the rest of the way. The spin margin is calibrated from how much the sleeps overshoot.
+// Deadlines are spaced one frame interval from the previous deadline, not the previous frame, so errors don't drift.
+class FramePacer
+{
+public:
+
+    // Microsecond clock and a coarse millisecond sleep, replaced with a mock clock for testing
+    struct Clock
+    {
+        virtual uint64_t getNow() = 0;
+        virtual void sleep ( uint32_t milliseconds ) = 0;
+    };
+
+    // QueryPerformanceCounter and Sleep on Windows, otherwise clock_gettime and nanosleep
+    class SystemClock : public Clock
+    {
+    public:
+
+        SystemClock();
+
+        uint64_t getNow() override;
+        void sleep ( uint32_t milliseconds ) override;
+
+    private:
+
+        uint64_t _ticksPerSecond = 0;
+    };
+
+    struct Settings
+    {
+        // Range of the spin margin in microseconds, the sleep overshoot is added to the minimum
+        uint32_t minSpinUs = 1000, maxSpinUs = 4000;
+
+        // How fast the estimated sleep overshoot decays after a long sleep, per sleep
+        double overshootDecay = 0.95;
+
+        // The schedule restarts from the current time if a frame is more than this many frames late,
+        // otherwise the following frames are shortened to catch up.
+        double maxLateFrames = 2.0;
+
+        // Number of frames to measure the actual frame rate over
+        uint32_t fpsFrames = 60;
+    };
+
+    struct Counters
+    {
+        // Frames paced, frames that started after their deadline, and times the schedule restarted
+        uint64_t frames = 0, late = 0, resyncs = 0;
+
+        // Number of sleeps, and the total microseconds spent sleeping and spinning
+        uint64_t sleeps = 0, sleepUs = 0, spinUs = 0;
+    };
+
+    Settings settings;
+
+    // Uses the system clock if no clock is given
+    FramePacer ( Clock *clock = 0 );
+
+    // Change the frame rate from the next frame, without restarting the schedule.
+    // Frame rates that are not positive, or too high for a microsecond clock, disable pacing.
+    void setFps ( double fps );
+    double getFps() const { return _fps; }
+
+    // Restart the schedule from the next frame
+    void reset() { _isStarted = false; }
+
+    // Wait until the deadline of the next frame, this should be called once per frame
+    void waitNextFrame();
+
+    // Frame rate measured over the last settings.fpsFrames frames
+    double getActualFps() const { return _actualFps; }
+
+    // Current spin margin in microseconds
+    uint32_t getSpinUs() const;
+
+    // Microseconds between frames, and microseconds each frame was after its deadline
+    const LatencyHistogram& getFrameTimes() const { return _frameTimes; }
+    const LatencyHistogram& getLateness() const { return _lateness; }
+
+    const Counters& getCounters() const { return _counters; }
+
+    // Reset the histograms and counters, but not the schedule
+    void resetTiming();
+
+    std::string str() const;
+
+private:
+
+    Clock *_clock;
+
+    double _fps = 60.0;
+
+    // Frame interval in microseconds, 0 if pacing is disabled
+    double _interval = 1000000.0 / 60;
+
+    bool _isStarted = false;
+
+    // Deadline of the last frame in microseconds, kept fractional so the intervals average out exactly
+    double _deadline = 0;
+
+    // Time of the last frame
+    uint64_t _lastFrame = 0;
+
+    // Decaying peak of how many microseconds the sleeps overshoot
+    double _sleepOvershoot = 0;
+
+    // Start time and frame count of the current frame rate measurement
+    uint64_t _fpsStart = 0;
+    uint32_t _fpsCount = 0;
+
+    double _actualFps = 60.0;
+
+    LatencyHistogram _frameTimes, _lateness;
+
+    Counters _counters;
+
+    // Record the timing of a frame that started at the given time
+    void frameStarted ( uint64_t now );
+};
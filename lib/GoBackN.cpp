@@ -1,15 +1,32 @@
 #include "GoBackN.hpp"
+#include "TimerManager.hpp"
+#include "Algorithms.hpp"
 #include "Logger.hpp"
 
 #include <cereal/types/string.hpp>
 
 #include <string>
+#include <vector>
+#include <cmath>
 
 using namespace std;
 
 
-// TODO increase me
-#define MTU ( 256 )
+// Upper bound for the retransmit timeout in selective repeat mode
+#define MAX_RETRANSMIT_TIMEOUT ( 1000 )
+
+// Number of later messages that must be SACKed before a missing message is considered lost
+#define FAST_RETRANSMIT_THRESHOLD ( 3 )
+
+// Milliseconds between each split size probe, and the number of probes before giving up on a size
+#define PROBE_INTERVAL ( 200 )
+#define MAX_PROBE_ATTEMPTS ( 3 )
+
+// Number of times the oldest message can be resent before falling back to the smallest split size
+#define MAX_FRONT_RESENDS ( 8 )
+
+// Milliseconds to wait before probing again after falling back
+#define REPROBE_DELAY ( 5000 )
 
 
 string formatSerializableSequence ( const MsgPtr& msg )
@@ -35,6 +52,10 @@ void GoBackN::timerExpired ( Timer *timer )
         else
             owner->goBackNSendRaw ( this, NullMsg );
     }
+    else if ( _selectiveRepeat )
+    {
+        retransmitExpired();
+    }
     else
     {
         if ( _sendListPos == _sendList.cend() )
@@ -49,10 +70,19 @@ void GoBackN::timerExpired ( Timer *timer )
         LOG ( "Sending '%s'; sequence=%u; sendSequence=%d",
               msg, msg->getAs<SerializableSequence>().getSequence(), _sendSequence );
 
-        owner->goBackNSendRaw ( this, msg );
+        sendRaw ( msg );
         ++_sendListPos;
     }
 
+    // Either a loss spike, or the path can't carry the larger datagrams anymore
+    if ( _frontSendCount >= MAX_FRONT_RESENDS && _splitSize > MIN_SPLIT_SIZE )
+    {
+        LOG ( "Falling back from splitSize=%u; frontSendCount=%u", _splitSize, _frontSendCount );
+        restartProbing ( REPROBE_DELAY );
+    }
+
+    probeSplitSize();
+
     if ( _keepAlive )
     {
         LOG ( "this=%08x; keepAlive=%llu; countDown=%d", this, _keepAlive, _countDown );
@@ -72,6 +102,187 @@ void GoBackN::timerExpired ( Timer *timer )
     _sendTimer->start ( _interval );
 }
 
+void GoBackN::retransmitExpired()
+{
+    const uint64_t now = TimerManager::get().getNow ( true );
+
+    uint32_t count = 0;
+    bool backOff = false;
+
+    for ( const MsgPtr& msg : _sendList )
+    {
+        if ( count >= _sendWindow )
+            break;
+
+        const uint32_t sequence = msg->getAs<SerializableSequence>().getSequence();
+        const auto it = _inFlight.find ( sequence );
+
+        if ( it == _inFlight.end() || it->second.sacked )
+            continue;
+
+        const InFlight& inFlight = it->second;
+
+        if ( ! inFlight.lost )
+        {
+            if ( now < inFlight.sentTime + _rto )
+                continue;
+
+            // A retransmitted message timed out again
+            if ( inFlight.sendCount > 1 )
+                backOff = true;
+        }
+
+        LOG ( "Resending '%s'; sequence=%u; sendSequence=%d; rto=%llu", msg, sequence, _sendSequence, _rto );
+
+        sendRaw ( msg );
+        ++count;
+    }
+
+    // Back off until the next RTT sample
+    if ( backOff )
+        _rto = min<uint64_t> ( _rto * 2, MAX_RETRANSMIT_TIMEOUT );
+}
+
+void GoBackN::sendRaw ( const MsgPtr& msg )
+{
+    owner->goBackNSendRaw ( this, msg );
+
+    if ( !_sendList.empty() && msg == _sendList.front() )
+        ++_frontSendCount;
+
+    if ( ! _selectiveRepeat )
+        return;
+
+    // The first send adds the message to the in flight messages
+    InFlight& inFlight = _inFlight[msg->getAs<SerializableSequence>().getSequence()];
+    inFlight.sentTime = TimerManager::get().getNow ( true );
+    inFlight.lost = false;
+    ++inFlight.sendCount;
+}
+
+void GoBackN::updateRtt ( uint64_t rtt )
+{
+    // Same as TCP, see RFC 6298
+    if ( _srtt == 0 )
+    {
+        _srtt = rtt;
+        _rttVar = rtt / 2.0;
+    }
+    else
+    {
+        _rttVar = 0.75 * _rttVar + 0.25 * fabs ( _srtt - rtt );
+        _srtt = 0.875 * _srtt + 0.125 * rtt;
+    }
+
+    // Timeouts are only checked once per send interval, so there is no point going lower
+    _rto = clamped<uint64_t> ( _srtt + 4 * _rttVar, _interval, MAX_RETRANSMIT_TIMEOUT );
+}
+
+void GoBackN::probeSplitSize()
+{
+    if ( ! _probeSize )
+        return;
+
+    const uint64_t now = TimerManager::get().getNow ( true );
+
+    if ( now < _nextProbeTime )
+        return;
+
+    if ( _probeCount >= MAX_PROBE_ATTEMPTS )
+    {
+        LOG ( "No reply for probeSize=%u; splitSize=%u", _probeSize, _splitSize );
+        _probeSize = 0;
+        return;
+    }
+
+    MtuProbe *probe = new MtuProbe ( _probeSize, 0 );
+    probe->padding.assign ( getProbePadding ( _probeSize ), '\0' );
+
+    ++_probeCount;
+    _nextProbeTime = now + PROBE_INTERVAL;
+
+    LOG ( "Probing probeSize=%u; probeCount=%u; splitSize=%u", _probeSize, _probeCount, _splitSize );
+
+    owner->goBackNSendRaw ( this, MsgPtr ( probe ) );
+}
+
+void GoBackN::recvProbe ( const MtuProbe& probe )
+{
+    if ( ! probe.isReply )
+    {
+        owner->goBackNSendRaw ( this, MsgPtr ( new MtuProbe ( probe.size, 1 ) ) );
+        return;
+    }
+
+    // Ignore replies to older probes
+    if ( !_probeSize || probe.size != _probeSize )
+        return;
+
+    _splitSize = _probeSize;
+
+    LOG ( "splitSize=%u", _splitSize );
+
+    _probeSize = ( _splitSize < _maxSplitSize ? min ( 2 * _splitSize, _maxSplitSize ) : 0 );
+    _probeCount = 0;
+    _nextProbeTime = 0;
+}
+
+void GoBackN::restartProbing ( uint64_t delay )
+{
+    _splitSize = MIN_SPLIT_SIZE;
+    _probeSize = ( MIN_SPLIT_SIZE < _maxSplitSize ? min<uint32_t> ( 2 * MIN_SPLIT_SIZE, _maxSplitSize ) : 0 );
+    _probeCount = 0;
+    _nextProbeTime = TimerManager::get().getNow ( true ) + delay;
+    _frontSendCount = 0;
+}
+
+size_t GoBackN::getSplitOverhead() const
+{
+    ASSERT ( owner != 0 );
+
+    // The hash trailer depends on the wire version, so recalculate if the owner's wire version changed
+    const uint8_t wireVersion = owner->goBackNWireVersion ( this );
+
+    if ( ! _splitOverhead || _splitOverheadVersion != wireVersion )
+    {
+        _splitOverhead = ::Protocol::encode ( SplitMessage ( MsgType::SplitMessage, "" ), wireVersion ).size();
+        _splitOverheadVersion = wireVersion;
+    }
+
+    return _splitOverhead;
+}
+
+size_t GoBackN::getProbePadding ( uint32_t splitSize ) const
+{
+    ASSERT ( owner != 0 );
+
+    const uint8_t wireVersion = owner->goBackNWireVersion ( this );
+    const size_t probeOverhead = ::Protocol::encode ( MtuProbe ( splitSize, 0 ), wireVersion ).size();
+    const size_t splitOverhead = getSplitOverhead();
+
+    return ( splitSize + splitOverhead > probeOverhead ? splitSize + splitOverhead - probeOverhead : 0 );
+}
+
+size_t GoBackN::getDatagramSize() const
+{
+    return _splitSize + getSplitOverhead();
+}
+
+void GoBackN::setMaxSplitSize ( uint32_t size )
+{
+    ASSERT ( size >= MIN_SPLIT_SIZE );
+
+    _maxSplitSize = size;
+
+    if ( _splitSize > _maxSplitSize )
+        _splitSize = _maxSplitSize;
+
+    if ( _probeSize > _maxSplitSize )
+        _probeSize = ( _splitSize < _maxSplitSize ? _maxSplitSize : 0 );
+
+    LOG ( "maxSplitSize=%u; splitSize=%u; probeSize=%u", _maxSplitSize, _splitSize, _probeSize );
+}
+
 void GoBackN::checkAndStartTimer()
 {
     if ( ! _sendTimer )
@@ -100,7 +311,7 @@ void GoBackN::sendViaGoBackN ( const MsgPtr& msg )
         MsgPtr clone = msg->clone();
         clone->getAs<SerializableSequence>().setSequence ( ++_sendSequence );
 
-        owner->goBackNSendRaw ( this, clone );
+        sendRaw ( clone );
         _sendList.push_back ( clone );
     }
     else
@@ -108,23 +319,24 @@ void GoBackN::sendViaGoBackN ( const MsgPtr& msg )
         msg->getAs<SerializableSequence>().setSequence ( _sendSequence + 1 );
         string bytes = ::Protocol::encode ( msg );
 
-        if ( bytes.size() <= MTU )
+        if ( bytes.size() <= _splitSize )
         {
             ++_sendSequence;
-            owner->goBackNSendRaw ( this, msg );
+            sendRaw ( msg );
             _sendList.push_back ( msg );
         }
         else
         {
-            const uint32_t count = ( bytes.size() / MTU ) + ( bytes.size() % MTU == 0 ? 0 : 1 );
+            const uint32_t count = ( bytes.size() / _splitSize ) + ( bytes.size() % _splitSize == 0 ? 0 : 1 );
 
-            for ( uint32_t pos = 0, i = 0; pos < bytes.size(); pos += MTU, ++i )
+            for ( uint32_t pos = 0, i = 0; pos < bytes.size(); pos += _splitSize, ++i )
             {
-                SplitMessage *splitMsg = new SplitMessage ( msg->getMsgType(), bytes.substr ( pos, MTU ), i, count );
+                SplitMessage *splitMsg = new SplitMessage ( msg->getMsgType(), bytes.substr ( pos, _splitSize ),
+                                                            i, count );
                 splitMsg->setSequence ( ++_sendSequence );
 
                 MsgPtr msg ( splitMsg );
-                owner->goBackNSendRaw ( this, msg );
+                sendRaw ( msg );
                 _sendList.push_back ( msg );
             }
         }
@@ -152,6 +364,12 @@ void GoBackN::recvFromSocket ( const MsgPtr& msg )
     if ( ! msg.get() )
         return;
 
+    if ( msg->getMsgType() == MsgType::MtuProbe )
+    {
+        recvProbe ( msg->getAs<MtuProbe>() );
+        return;
+    }
+
     // Filter non-sequential messages
     if ( msg->getBaseType() != BaseType::SerializableSequence )
     {
@@ -165,23 +383,32 @@ void GoBackN::recvFromSocket ( const MsgPtr& msg )
     // Check for ACK messages
     if ( msg->getMsgType() == MsgType::AckSequence )
     {
-        if ( sequence > _ackSequence )
-            _ackSequence = sequence;
+        recvAck ( sequence, 0 );
+        return;
+    }
 
-        LOG ( "Got AckSequence; sequence=%u; sendSequence=%u", sequence, _sendSequence );
+    if ( msg->getMsgType() == MsgType::SelectiveAck )
+    {
+        recvAck ( sequence, &msg->getAs<SelectiveAck>() );
+        return;
+    }
 
-        // Remove messages from sendList with sequence <= the ACKed sequence
-        while ( !_sendList.empty() && _sendList.front()->getAs<SerializableSequence>().getSequence() <= sequence )
-            _sendList.pop_front();
-        _sendListPos = _sendList.cend();
+    if ( _selectiveRepeat && sequence != _recvSequence + 1 )
+    {
+        // Buffer out of order messages that fit in the SACK bitmap
+        if ( sequence > _recvSequence + 1 && sequence - _recvSequence - 2 < SELECTIVE_ACK_WINDOW )
+        {
+            LOG ( "Buffering '%s'; sequence=%u; recvSequence=%u", msg, sequence, _recvSequence );
+            _recvWindow.insert ( { sequence, msg } );
+        }
 
-        logSendList();
+        sendAck();
         return;
     }
 
     if ( sequence != _recvSequence + 1 )
     {
-        owner->goBackNSendRaw ( this, MsgPtr ( new AckSequence ( _recvSequence ) ) );
+        sendAck();
         return;
     }
 
@@ -189,8 +416,128 @@ void GoBackN::recvFromSocket ( const MsgPtr& msg )
 
     ++_recvSequence;
 
-    owner->goBackNSendRaw ( this, MsgPtr ( new AckSequence ( _recvSequence ) ) );
+    if ( _recvWindow.empty() )
+    {
+        sendAck();
+        recvInOrder ( msg );
+        return;
+    }
+
+    // Receive any buffered messages that are now in order
+    vector<MsgPtr> msgs ( 1, msg );
+
+    for ( auto it = _recvWindow.begin(); it != _recvWindow.end() && it->first <= _recvSequence + 1; )
+    {
+        if ( it->first == _recvSequence + 1 )
+        {
+            msgs.push_back ( it->second );
+            ++_recvSequence;
+        }
+
+        it = _recvWindow.erase ( it );
+    }
+
+    sendAck();
+
+    const uint32_t recvSequence = _recvSequence;
+
+    for ( const MsgPtr& msg : msgs )
+    {
+        // Stop if GoBackN was reset by the owner
+        if ( _recvSequence != recvSequence )
+            break;
+
+        recvInOrder ( msg );
+    }
+}
+
+void GoBackN::recvAck ( uint32_t sequence, const SelectiveAck *sack )
+{
+    if ( sequence > _ackSequence )
+        _ackSequence = sequence;
+
+    LOG ( "Got %s; sequence=%u; sendSequence=%u", ( sack ? sack->str() : "AckSequence" ), sequence, _sendSequence );
+
+    // Most recent send time of the newly ACKed messages that were only sent once, which gives the RTT sample
+    uint64_t lastSentTime = 0;
+
+    // Remove messages from sendList with sequence <= the ACKed sequence
+    while ( !_sendList.empty() && _sendList.front()->getAs<SerializableSequence>().getSequence() <= sequence )
+    {
+        if ( _selectiveRepeat )
+        {
+            const auto it = _inFlight.find ( _sendList.front()->getAs<SerializableSequence>().getSequence() );
+
+            if ( it != _inFlight.end() )
+            {
+                if ( it->second.sendCount == 1 && !it->second.sacked )
+                    lastSentTime = max ( lastSentTime, it->second.sentTime );
+
+                _inFlight.erase ( it );
+            }
+        }
+
+        _sendList.pop_front();
+        _frontSendCount = 0;
+    }
+    _sendListPos = _sendList.cend();
+
+    if ( sack && _selectiveRepeat )
+    {
+        uint32_t numSackedAfter = 0;
+
+        // Go backwards, so we know how many later messages were received before each missing one
+        for ( auto it = _sendList.crbegin(); it != _sendList.crend(); ++it )
+        {
+            const uint32_t sequence = ( **it ).getAs<SerializableSequence>().getSequence();
+            const auto jt = _inFlight.find ( sequence );
+
+            if ( jt == _inFlight.end() )
+                continue;
+
+            InFlight& inFlight = jt->second;
+
+            if ( sack->isReceived ( sequence ) )
+            {
+                if ( inFlight.sendCount == 1 && !inFlight.sacked )
+                    lastSentTime = max ( lastSentTime, inFlight.sentTime );
+
+                inFlight.sacked = true;
+                ++numSackedAfter;
+            }
+            else if ( numSackedAfter >= FAST_RETRANSMIT_THRESHOLD && inFlight.sendCount == 1 )
+            {
+                // Probably lost, since later messages were received, so don't wait for the retransmit timeout
+                inFlight.lost = true;
+            }
+        }
+    }
 
+    if ( lastSentTime )
+        updateRtt ( TimerManager::get().getNow ( true ) - lastSentTime );
+
+    logSendList();
+}
+
+void GoBackN::sendAck()
+{
+    if ( !_selectiveRepeat || _recvWindow.empty() )
+    {
+        owner->goBackNSendRaw ( this, MsgPtr ( new AckSequence ( _recvSequence ) ) );
+        return;
+    }
+
+    uint32_t received = 0;
+
+    for ( const auto& kv : _recvWindow )
+        if ( kv.first > _recvSequence + 1 && kv.first - _recvSequence - 2 < SELECTIVE_ACK_WINDOW )
+            received |= ( 1u << ( kv.first - _recvSequence - 2 ) );
+
+    owner->goBackNSendRaw ( this, MsgPtr ( new SelectiveAck ( _recvSequence, received ) ) );
+}
+
+void GoBackN::recvInOrder ( const MsgPtr& msg )
+{
     if ( msg->getMsgType() == MsgType::SplitMessage )
     {
         const SplitMessage& splitMsg = msg->getAs<SplitMessage>();
@@ -228,6 +575,7 @@ void GoBackN::setSendInterval ( uint64_t interval )
     ASSERT ( interval > 0 );
 
     _interval = interval;
+    _rto = max ( _rto, _interval );
 
     refreshKeepAlive();
 
@@ -243,6 +591,38 @@ void GoBackN::setKeepAlive ( uint64_t timeout )
     LOG ( "keepAlive=%llu; countDown=%d", _keepAlive, _countDown );
 }
 
+void GoBackN::setSelectiveRepeat ( bool enabled )
+{
+    _selectiveRepeat = enabled;
+
+    _inFlight.clear();
+    _recvWindow.clear();
+
+    // Messages already in the sendList are retransmitted on the next interval
+    resetInFlight();
+
+    LOG ( "selectiveRepeat=%u", _selectiveRepeat );
+}
+
+void GoBackN::resetInFlight()
+{
+    if ( ! _selectiveRepeat )
+        return;
+
+    // Never sent, so each message is due immediately
+    for ( const MsgPtr& msg : _sendList )
+        _inFlight[msg->getAs<SerializableSequence>().getSequence()] = InFlight();
+}
+
+void GoBackN::setSendWindow ( uint32_t window )
+{
+    ASSERT ( window > 0 );
+
+    _sendWindow = window;
+
+    LOG ( "sendWindow=%u", _sendWindow );
+}
+
 void GoBackN::reset()
 {
     LOG ( "this=%08x; sendTimer=%08x", this, _sendTimer.get() );
@@ -252,6 +632,13 @@ void GoBackN::reset()
     _sendListPos = _sendList.cend();
     _sendTimer.reset();
     _recvBuffer.clear();
+    _inFlight.clear();
+    _recvWindow.clear();
+    _srtt = _rttVar = 0;
+    _rto = _interval;
+
+    // Could be a different path now
+    restartProbing ( 0 );
 }
 
 GoBackN::GoBackN ( Owner *owner, uint64_t interval, uint64_t timeout )
@@ -259,10 +646,12 @@ GoBackN::GoBackN ( Owner *owner, uint64_t interval, uint64_t timeout )
     , _sendListPos ( _sendList.cend() )
     , _interval ( interval )
     , _keepAlive ( timeout )
+    , _rto ( interval )
 {
     ASSERT ( _interval > 0 );
 
     refreshKeepAlive();
+    restartProbing ( 0 );
 }
 
 GoBackN::GoBackN ( Owner *owner, const GoBackN& state )
@@ -286,6 +675,19 @@ GoBackN& GoBackN::operator= ( const GoBackN& other )
     _interval = other._interval;
     _keepAlive = other._keepAlive;
     _countDown = other._keepAlive;
+    _selectiveRepeat = other._selectiveRepeat;
+    _sendWindow = other._sendWindow;
+    _inFlight = other._inFlight;
+    _srtt = other._srtt;
+    _rttVar = other._rttVar;
+    _rto = other._rto;
+    _recvWindow = other._recvWindow;
+    _splitSize = other._splitSize;
+    _maxSplitSize = other._maxSplitSize;
+    _probeSize = other._probeSize;
+    _probeCount = other._probeCount;
+    _nextProbeTime = other._nextProbeTime;
+    _frontSendCount = other._frontSendCount;
 
     ASSERT ( _interval > 0 );
 
@@ -300,6 +702,14 @@ void GoBackN::save ( cereal::BinaryOutputArchive& ar ) const
 
     for ( const MsgPtr& msg : _sendList )
         ar ( Protocol::encode ( msg ) );
+
+    ar ( _splitSize, _maxSplitSize, _probeSize );
+
+    ar ( _selectiveRepeat, _sendWindow, _recvWindow.size() );
+
+    // Buffered messages must be kept, since the other side won't resend messages that were SACKed
+    for ( const auto& kv : _recvWindow )
+        ar ( kv.first, Protocol::encode ( kv.second ) );
 }
 
 void GoBackN::load ( cereal::BinaryInputArchive& ar )
@@ -315,6 +725,20 @@ void GoBackN::load ( cereal::BinaryInputArchive& ar )
         ar ( buffer );
         _sendList.push_back ( Protocol::decode ( &buffer[0], buffer.size(), consumed ) );
     }
+
+    ar ( _splitSize, _maxSplitSize, _probeSize );
+
+    ar ( _selectiveRepeat, _sendWindow, size );
+
+    uint32_t sequence;
+    for ( size_t i = 0; i < size; ++i )
+    {
+        ar ( sequence, buffer );
+        _recvWindow[sequence] = Protocol::decode ( &buffer[0], buffer.size(), consumed );
+    }
+
+    // The send times aren't shared, so the sendList is retransmitted on the next interval
+    resetInFlight();
 }
 
 void GoBackN::logSendList() const
@@ -4,12 +4,25 @@
 #include "Timer.hpp"
 
 #include <list>
+#include <map>
 
 
 #define DEFAULT_SEND_INTERVAL ( 50 )
 
+// Maximum number of messages retransmitted per send interval in selective repeat mode
+#define DEFAULT_SEND_WINDOW ( 8 )
 
-struct AckSequence : public SerializableSequence
+// Number of out of order messages buffered in selective repeat mode, this is also the size of the SACK bitmap
+#define SELECTIVE_ACK_WINDOW ( 32 )
+
+// Number of bytes per SplitMessage until a larger size is confirmed by probing
+#define MIN_SPLIT_SIZE ( 256 )
+
+// Largest split size to probe, so the datagram still fits in a 1500 byte ethernet MTU with some room for tunnels
+#define MAX_SPLIT_SIZE ( 1344 )
+
+
+struct AckSequence : public SerializableSequence // protocol: compress=0 integrity=CRC32C
 {
     AckSequence ( uint32_t sequence ) : SerializableSequence ( sequence ) {}
 
@@ -17,6 +30,46 @@ struct AckSequence : public SerializableSequence
 };
 
 
+struct SelectiveAck : public SerializableSequence // protocol: compress=0 integrity=CRC32C
+{
+    // Bit i is set if the message with sequence ( getSequence() + 2 + i ) was received out of order
+    uint32_t received = 0;
+
+    SelectiveAck ( uint32_t sequence, uint32_t received )
+        : SerializableSequence ( sequence ), received ( received ) {}
+
+    bool isReceived ( uint32_t sequence ) const
+    {
+        return ( sequence > getSequence() + 1 && sequence - getSequence() - 2 < SELECTIVE_ACK_WINDOW
+                 && ( received & ( 1u << ( sequence - getSequence() - 2 ) ) ) );
+    }
+
+    std::string str() const { return format ( "SelectiveAck[%u; %08x]", getSequence(), received ); }
+
+    PROTOCOL_MESSAGE_BOILERPLATE ( SelectiveAck, received )
+};
+
+
+// Probe to test if a SplitMessage of the given size can reach the other side. Older versions can't decode this
+// message type and just drop it, in which case the split size stays at MIN_SPLIT_SIZE.
+struct MtuProbe : public SerializableMessage // protocol: compress=0 integrity=CRC32C
+{
+    // The split size being tested or confirmed
+    uint16_t size = 0;
+
+    uint8_t isReply = 0;
+
+    // Padding so the probe datagram is as large as a SplitMessage of the given size
+    std::string padding;
+
+    MtuProbe ( uint16_t size, uint8_t isReply ) : size ( size ), isReply ( isReply ) {}
+
+    std::string str() const { return format ( "MtuProbe[%u%s]", size, ( isReply ? "; reply" : "" ) ); }
+
+    PROTOCOL_MESSAGE_BOILERPLATE ( MtuProbe, size, isReply, padding )
+};
+
+
 struct SplitMessage : public SerializableSequence
 {
     MsgType origMsgType;
@@ -58,6 +111,9 @@ public:
 
         // Timeout GoBackN if keep alive is enabled
         virtual void goBackNTimeout ( GoBackN *gbn ) = 0;
+
+        // Get the wire version the raw messages are encoded with, the SplitMessage overhead depends on it
+        virtual uint8_t goBackNWireVersion ( const GoBackN *gbn ) const { return WIRE_VERSION_LEGACY; }
     };
 
     Owner *owner = 0;
@@ -83,6 +139,29 @@ public:
     uint64_t getKeepAlive() const { return _keepAlive; }
     void setKeepAlive ( uint64_t timeout );
 
+    // Get / set selective repeat mode: out of order messages are buffered and ACKed with a SACK bitmap, and lost
+    // messages are retransmitted in bursts based on the round trip time. UdpSocket enables this for the compact wire
+    // version. The sides can switch at different times, since a side without it ignores the SACK bitmap.
+    bool isSelectiveRepeat() const { return _selectiveRepeat; }
+    void setSelectiveRepeat ( bool enabled );
+
+    // Get / set the maximum number of messages retransmitted per send interval in selective repeat mode
+    uint32_t getSendWindow() const { return _sendWindow; }
+    void setSendWindow ( uint32_t window );
+
+    // Get the current retransmit timeout in selective repeat mode
+    uint64_t getRetransmitTimeout() const { return _rto; }
+
+    // Get the number of bytes per SplitMessage, this grows up to the max split size as larger probes get through
+    uint32_t getSplitSize() const { return _splitSize; }
+
+    // Get the largest datagram that is known to get through, ie a SplitMessage of the current split size
+    size_t getDatagramSize() const;
+
+    // Get / set the largest split size to probe, ie a lower value for paths with extra overhead
+    uint32_t getMaxSplitSize() const { return _maxSplitSize; }
+    void setMaxSplitSize ( uint32_t size );
+
     // Get the number of messages sent and received
     uint32_t getSendCount() const { return _sendSequence; }
     uint32_t getRecvCount() const { return _recvSequence; }
@@ -133,9 +212,95 @@ private:
     // Delay sending the keep alive packet for one iteration
     bool _skipNextKeepAlive = false;
 
+    // Selective repeat mode, see setSelectiveRepeat
+    bool _selectiveRepeat = false;
+
+    // Maximum number of messages retransmitted per send interval
+    uint32_t _sendWindow = DEFAULT_SEND_WINDOW;
+
+    struct InFlight
+    {
+        // Last time this message was sent
+        uint64_t sentTime = 0;
+
+        // Number of times this message was sent, only messages sent once are used to measure the RTT
+        uint32_t sendCount = 0;
+
+        // Received out of order by the other side
+        bool sacked = false;
+
+        // Later messages were received, so this should be retransmitted without waiting for the timeout
+        bool lost = false;
+    };
+
+    // Send state of each message in the sendList, indexed by sequence
+    std::map<uint32_t, InFlight> _inFlight;
+
+    // Smoothed RTT, RTT variance, and retransmit timeout
+    double _srtt = 0, _rttVar = 0;
+    uint64_t _rto = DEFAULT_SEND_INTERVAL;
+
+    // Out of order messages waiting to be received, indexed by sequence
+    std::map<uint32_t, MsgPtr> _recvWindow;
+
+    // Current and largest number of bytes per SplitMessage
+    uint32_t _splitSize = MIN_SPLIT_SIZE, _maxSplitSize = MAX_SPLIT_SIZE;
+
+    // Split size currently being probed, 0 if not probing
+    uint32_t _probeSize = 0;
+
+    // Number of probes sent for the current probe size
+    uint32_t _probeCount = 0;
+
+    // When to send the next probe
+    uint64_t _nextProbeTime = 0;
+
+    // Number of times the front of the sendList was resent
+    uint32_t _frontSendCount = 0;
+
+    // Encoded size of a SplitMessage without any bytes, and the wire version it was calculated for
+    mutable size_t _splitOverhead = 0;
+    mutable uint8_t _splitOverheadVersion = 0;
+
     // Timer callback that sends the messages
     void timerExpired ( Timer *timer ) override;
 
+    // Retransmit the messages whose retransmit timeout has expired, up to the send window
+    void retransmitExpired();
+
+    // Send a message and record the send time
+    void sendRaw ( const MsgPtr& msg );
+
+    // Track every message in the sendList as in flight but never sent, for selective repeat
+    void resetInFlight();
+
+    // Handle an AckSequence or SelectiveAck
+    void recvAck ( uint32_t sequence, const SelectiveAck *sack );
+
+    // Receive the next in order message
+    void recvInOrder ( const MsgPtr& msg );
+
+    // Send the ACK for the current receive state
+    void sendAck();
+
+    // Update the retransmit timeout with a new RTT sample
+    void updateRtt ( uint64_t rtt );
+
+    // Send the next split size probe if one is due
+    void probeSplitSize();
+
+    // Handle a probe or a probe reply
+    void recvProbe ( const MtuProbe& probe );
+
+    // Start probing from the smallest split size again, after a delay
+    void restartProbing ( uint64_t delay );
+
+    // Get the encoded size of a SplitMessage without any bytes, for the owner's wire version
+    size_t getSplitOverhead() const;
+
+    // Get the padding needed for a probe to be as large as a SplitMessage with the given number of bytes
+    size_t getProbePadding ( uint32_t splitSize ) const;
+
     // Start the timer if necessary
     void checkAndStartTimer();
 
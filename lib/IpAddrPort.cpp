@@ -1,10 +1,7 @@
 #include "IpAddrPort.hpp"
 #include "Exceptions.hpp"
 #include "ErrorStrings.hpp"
-
-#include <winsock2.h>
-#include <windows.h>
-#include <ws2tcpip.h>
+#include "SocketHeaders.hpp"
 
 #include <cctype>
 
@@ -49,6 +46,7 @@ uint16_t getPortFromSockAddr ( const sockaddr *sa )
         return ntohs ( ( ( sockaddr_in6 * ) sa )->sin6_port );
 }
 
+#ifdef _WIN32
 const char *inet_ntop ( int af, const void *src, char *dst, size_t size )
 {
     if ( af == AF_INET )
@@ -72,6 +70,7 @@ const char *inet_ntop ( int af, const void *src, char *dst, size_t size )
 
     return 0;
 }
+#endif // _WIN32
 
 IpAddrPort::IpAddrPort ( const string& addrPort ) : addr ( addrPort ), port ( 0 ), isV4 ( true )
 {
@@ -19,7 +19,10 @@ std::string getAddrFromSockAddr ( const sockaddr *sa );
 
 uint16_t getPortFromSockAddr ( const sockaddr *sa );
 
+#ifdef _WIN32
+// Not provided by Windows XP
 const char *inet_ntop ( int af, const void *src, char *dst, size_t size );
+#endif
 
 
 // IP address with port
@@ -0,0 +1,329 @@
+#include "IpcRing.hpp"
+#include "MemoryStream.hpp"
+#include "Logger.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined ( __linux__ )
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+#else
+#include <unistd.h>
+#endif
+
+#include <new>
+
+using namespace std;
+using namespace cereal;
+
+
+#define IPC_RING_MAGIC ( 0x47524343 ) // "CCRG"
+
+// Each message is prefixed with its size, everything in the ring is aligned to this
+#define RECORD_HEADER_SIZE ( sizeof ( uint32_t ) )
+
+#define ALIGN_RECORD(SIZE) ( ( ( SIZE ) + RECORD_HEADER_SIZE - 1 ) & ~ ( RECORD_HEADER_SIZE - 1 ) )
+
+// Size prefix that means the rest of the ring until the end is unused
+#define RECORD_WRAP ( 0xFFFFFFFF )
+
+
+struct IpcRing::Header
+{
+    uint32_t magic;
+    uint32_t capacity;
+
+    // Free running positions, each only written by one side, so they are kept on separate cache lines
+    alignas ( 64 ) atomic<uint32_t> readPos;
+    alignas ( 64 ) atomic<uint32_t> writePos;
+
+    // Set while the reader is waiting, so the writer only has to wake it when needed
+    atomic<uint32_t> waiting;
+};
+
+static_assert ( sizeof ( atomic<uint32_t> ) == sizeof ( uint32_t ), "atomic<uint32_t> must be usable as a futex" );
+
+
+size_t IpcRing::getMemorySize ( uint32_t capacity )
+{
+    return sizeof ( Header ) + capacity;
+}
+
+bool IpcRing::init ( char *memory, uint32_t capacity, const string& name )
+{
+    detach();
+
+    ASSERT ( memory != 0 );
+    ASSERT ( ( ( uintptr_t ) memory ) % alignof ( Header ) == 0 );
+
+    if ( capacity < 2 * RECORD_HEADER_SIZE || ( capacity & ( capacity - 1 ) ) )
+    {
+        LOG ( "Invalid capacity=%u", capacity );
+        return false;
+    }
+
+    if ( ! openEvent ( name ) )
+        return false;
+
+    _header = new ( memory ) Header();
+    _header->magic = IPC_RING_MAGIC;
+    _header->capacity = capacity;
+
+    _data = memory + sizeof ( Header );
+    _capacity = capacity;
+    return true;
+}
+
+bool IpcRing::attach ( char *memory, size_t size, const string& name )
+{
+    detach();
+
+    ASSERT ( memory != 0 );
+    ASSERT ( ( ( uintptr_t ) memory ) % alignof ( Header ) == 0 );
+
+    Header *header = ( Header * ) memory;
+
+    if ( size < sizeof ( Header ) || header->magic != IPC_RING_MAGIC
+            || ( header->capacity & ( header->capacity - 1 ) ) || size < getMemorySize ( header->capacity ) )
+    {
+        LOG ( "Invalid ring; size=%u", size );
+        return false;
+    }
+
+    if ( ! openEvent ( name ) )
+        return false;
+
+    _header = header;
+    _data = memory + sizeof ( Header );
+    _capacity = header->capacity;
+    return true;
+}
+
+void IpcRing::detach()
+{
+    closeEvent();
+
+    _header = 0;
+    _data = 0;
+    _capacity = 0;
+}
+
+uint32_t IpcRing::serialize ( const Serializable& msg, uint32_t offset, uint32_t space )
+{
+    if ( space <= RECORD_HEADER_SIZE )
+        return 0;
+
+    MemoryOutputStream ss ( _data + offset + RECORD_HEADER_SIZE, space - RECORD_HEADER_SIZE );
+
+    try
+    {
+        BinaryOutputArchive archive ( ss );
+        Protocol::saveRaw ( msg, archive );
+    }
+    catch ( const cereal::Exception& exc )
+    {
+        return 0;
+    }
+
+    const uint32_t size = ss.getPosition();
+    * ( uint32_t * ) ( _data + offset ) = size;
+    return size;
+}
+
+bool IpcRing::write ( const Serializable& msg )
+{
+    ASSERT ( _header != 0 );
+
+    const uint32_t writePos = _header->writePos.load ( memory_order_relaxed );
+    const uint32_t readPos = _header->readPos.load ( memory_order_acquire );
+    const uint32_t space = _capacity - ( writePos - readPos );
+    const uint32_t offset = writePos & ( _capacity - 1 );
+    const uint32_t untilEnd = _capacity - offset;
+
+    // Serialize directly into the ring, if the message doesn't fit before the end, skip to the start of the ring
+    uint32_t skipped = 0;
+    uint32_t size = serialize ( msg, offset, min ( space, untilEnd ) );
+
+    if ( size == 0 && space > untilEnd )
+    {
+        skipped = untilEnd;
+        size = serialize ( msg, 0, space - untilEnd );
+    }
+
+    if ( size == 0 )
+    {
+        LOG ( "Not enough space for '%s'; space=%u", msg, space );
+        return false;
+    }
+
+    if ( skipped )
+        * ( uint32_t * ) ( _data + offset ) = RECORD_WRAP;
+
+    _header->writePos.store ( writePos + skipped + RECORD_HEADER_SIZE + ALIGN_RECORD ( size ), memory_order_release );
+
+    // The reader sets the flag before checking the write position, so one of them always sees the other's change
+    atomic_thread_fence ( memory_order_seq_cst );
+
+    if ( _header->waiting.load ( memory_order_relaxed ) )
+        wakeEvent();
+
+    return true;
+}
+
+MsgPtr IpcRing::read()
+{
+    ASSERT ( _header != 0 );
+
+    for ( ;; )
+    {
+        const uint32_t readPos = _header->readPos.load ( memory_order_relaxed );
+        const uint32_t writePos = _header->writePos.load ( memory_order_acquire );
+
+        if ( readPos == writePos )
+            return NullMsg;
+
+        const uint32_t offset = readPos & ( _capacity - 1 );
+        const uint32_t size = * ( uint32_t * ) ( _data + offset );
+
+        if ( size == RECORD_WRAP )
+        {
+            _header->readPos.store ( readPos + _capacity - offset, memory_order_release );
+            continue;
+        }
+
+        if ( size > _capacity - offset - RECORD_HEADER_SIZE )
+        {
+            LOG ( "Invalid size=%u at offset=%u, discarding everything", size, offset );
+            _header->readPos.store ( writePos, memory_order_release );
+            return NullMsg;
+        }
+
+        // The message is copied out of the ring before the space is released to the writer
+        MsgPtr msg = Protocol::loadRaw ( _data + offset + RECORD_HEADER_SIZE, size );
+
+        _header->readPos.store ( readPos + RECORD_HEADER_SIZE + ALIGN_RECORD ( size ), memory_order_release );
+
+        if ( msg )
+            return msg;
+
+        LOG ( "Failed to load [ %u bytes ] at offset=%u", size, offset );
+    }
+}
+
+bool IpcRing::isEmpty() const
+{
+    ASSERT ( _header != 0 );
+
+    return ( _header->readPos.load ( memory_order_relaxed ) == _header->writePos.load ( memory_order_acquire ) );
+}
+
+uint32_t IpcRing::getWritePosition() const
+{
+    ASSERT ( _header != 0 );
+
+    return _header->writePos.load ( memory_order_acquire );
+}
+
+bool IpcRing::waitForWrite ( uint32_t position, uint64_t timeout )
+{
+    ASSERT ( _header != 0 );
+
+    if ( getWritePosition() != position )
+        return true;
+
+    _header->waiting.store ( 1, memory_order_seq_cst );
+
+    if ( _header->writePos.load ( memory_order_seq_cst ) == position )
+        waitEvent ( position, timeout );
+
+    _header->waiting.store ( 0, memory_order_relaxed );
+
+    return ( getWritePosition() != position );
+}
+
+void IpcRing::wake()
+{
+    if ( _header )
+        wakeEvent();
+}
+
+#ifdef _WIN32
+
+bool IpcRing::openEvent ( const string& name )
+{
+    // Auto-reset event, both sides use the same name, so the second call opens the existing event
+    _event = CreateEvent ( 0, FALSE, FALSE, name.c_str() );
+
+    if ( ! _event )
+    {
+        LOG ( "CreateEvent failed: '%s'", name );
+        return false;
+    }
+
+    return true;
+}
+
+void IpcRing::closeEvent()
+{
+    if ( _event )
+        CloseHandle ( ( HANDLE ) _event );
+
+    _event = 0;
+}
+
+void IpcRing::waitEvent ( uint32_t position, uint64_t timeout )
+{
+    WaitForSingleObject ( ( HANDLE ) _event, timeout );
+}
+
+void IpcRing::wakeEvent()
+{
+    SetEvent ( ( HANDLE ) _event );
+}
+
+#elif defined ( __linux__ )
+
+// The write position itself is the futex, so the kernel also checks that it hasn't changed before sleeping
+
+bool IpcRing::openEvent ( const string& name )
+{
+    return true;
+}
+
+void IpcRing::closeEvent() {}
+
+void IpcRing::waitEvent ( uint32_t position, uint64_t timeout )
+{
+    timespec ts;
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = ( timeout % 1000 ) * 1000000L;
+
+    syscall ( SYS_futex, &_header->writePos, FUTEX_WAIT, position, &ts, 0, 0 );
+}
+
+void IpcRing::wakeEvent()
+{
+    syscall ( SYS_futex, &_header->writePos, FUTEX_WAKE, INT_MAX, 0, 0, 0 );
+}
+
+#else
+
+// Other platforms just poll the write position
+
+bool IpcRing::openEvent ( const string& name )
+{
+    return true;
+}
+
+void IpcRing::closeEvent() {}
+
+void IpcRing::waitEvent ( uint32_t position, uint64_t timeout )
+{
+    usleep ( 1000 );
+}
+
+void IpcRing::wakeEvent() {}
+
+#endif // _WIN32
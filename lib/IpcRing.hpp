@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Protocol.hpp"
+
+#include <atomic>
+#include <string>
+
+
+// Default number of bytes for the messages in each ring, must be a power of 2
+#define DEFAULT_IPC_RING_CAPACITY ( 1024 * 1024 )
+
+
+// Single producer, single consumer ring of messages in memory shared between two processes. Messages are serialized
+// in place with Protocol::saveRaw, without the header, integrity check, or compression of Protocol::encode.
+// The reader can block until the next write, using a futex on Linux, or a named event on Windows.
+class IpcRing
+{
+public:
+
+    IpcRing() {}
+    ~IpcRing() { detach(); }
+
+    // Bytes of memory needed for a ring with the given capacity
+    static size_t getMemorySize ( uint32_t capacity );
+
+    // Initialize a new empty ring in the given memory, the name is used for the event to wait on.
+    // Returns false on failure, the capacity must be a power of 2.
+    bool init ( char *memory, uint32_t capacity, const std::string& name );
+
+    // Attach to a ring that was initialized by the other process, returns false if it isn't a valid ring
+    bool attach ( char *memory, size_t size, const std::string& name );
+
+    // Detach from the memory, this doesn't free it
+    void detach();
+
+    bool isAttached() const { return ( _header != 0 ); }
+
+    // Write a message, returns false if there isn't enough space
+    bool write ( const Serializable& msg );
+
+    // Read the next message, returns NullMsg if the ring is empty
+    MsgPtr read();
+
+    bool isEmpty() const;
+
+    // Total number of bytes written, this only changes when a message is written
+    uint32_t getWritePosition() const;
+
+    // Block until the write position is different from the given one, or the timeout in milliseconds.
+    // Returns false on timeout. Only the reading side should wait.
+    bool waitForWrite ( uint32_t position, uint64_t timeout );
+
+    // Wake the reader even if nothing was written, ie when closing
+    void wake();
+
+private:
+
+    struct Header;
+
+    Header *_header = 0;
+
+    char *_data = 0;
+
+    uint32_t _capacity = 0;
+
+    // Platform specific event handle for waking the reader
+    void *_event = 0;
+
+    // Serialize a message at the offset, returns the size of the message, or 0 if it didn't fit in the given space
+    uint32_t serialize ( const Serializable& msg, uint32_t offset, uint32_t space );
+
+    // Platform specific wait and wake
+    bool openEvent ( const std::string& name );
+    void closeEvent();
+    void waitEvent ( uint32_t position, uint64_t timeout );
+    void wakeEvent();
+
+    // Not copyable
+    IpcRing ( const IpcRing& ) = delete;
+    const IpcRing& operator= ( const IpcRing& ) = delete;
+};
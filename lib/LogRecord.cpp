@@ -0,0 +1,369 @@
+#include "LogRecord.hpp"
+#include "Logger.hpp"
+#include "TimerManager.hpp"
+
+#include <ctime>
+#include <unordered_map>
+
+using namespace std;
+
+
+string formatLogLine ( uint32_t options, int64_t seconds, uint16_t milliseconds,
+                       const char *srcFile, int srcLine, const char *srcFunc, const char *logMessage )
+{
+    char buffer[256];
+    string line;
+
+    if ( options & ( LOG_GM_TIME | LOG_LOCAL_TIME ) )
+    {
+        const time_t t = seconds;
+
+        tm *ts;
+        if ( options & LOG_GM_TIME )
+            ts = gmtime ( &t );
+        else
+            ts = localtime ( &t );
+
+        const size_t len = ( ts ? strftime ( buffer, sizeof ( buffer ), "%H:%M:%S", ts ) : 0 );
+        snprintf ( buffer + len, sizeof ( buffer ) - len, ".%03u:", milliseconds );
+        line += buffer;
+    }
+
+    if ( options & LOG_FILE_LINE )
+    {
+        snprintf ( buffer, sizeof ( buffer ), ":%3d:", srcLine );
+        line += srcFile;
+        line += buffer;
+    }
+
+    if ( options & LOG_FUNC_NAME )
+    {
+        const char *end = strchr ( srcFunc, '(' );
+        line.append ( srcFunc, end ? end - srcFunc : strlen ( srcFunc ) );
+        line += ':';
+    }
+
+    if ( ! line.empty() )
+        line += ' ';
+
+    line += logMessage;
+    line += '\n';
+    return line;
+}
+
+void getLogTime ( int64_t& seconds, uint16_t& milliseconds )
+{
+    seconds = time ( 0 );
+    milliseconds = TimerManager::get().getNow ( true ) % 1000;
+}
+
+void LogRecordWriter::writeHeader ( const LogSite& site )
+{
+    const LogSite *ptr = &site;
+    int64_t seconds;
+    uint16_t milliseconds;
+
+    getLogTime ( seconds, milliseconds );
+
+    memcpy ( _buffer, &ptr, sizeof ( ptr ) );
+    memcpy ( _buffer + sizeof ( ptr ), &seconds, sizeof ( seconds ) );
+    memcpy ( _buffer + sizeof ( ptr ) + sizeof ( seconds ), &milliseconds, sizeof ( milliseconds ) );
+
+    _pos = sizeof ( ptr ) + sizeof ( seconds ) + sizeof ( milliseconds );
+}
+
+
+namespace
+{
+
+struct LogArg
+{
+    uint8_t type;
+    uint64_t bits;
+    double d;
+    long double ld;
+    string str;
+};
+
+struct DecodedSite
+{
+    string file, func, format;
+    int line;
+};
+
+// Bounds checked reader over the log data
+class LogReader
+{
+public:
+
+    LogReader ( const char *bytes, size_t len ) : _pos ( bytes ), _end ( bytes + len ) {}
+
+    size_t remaining() const { return _end - _pos; }
+
+    bool read ( void *value, size_t len )
+    {
+        if ( len > remaining() )
+            return false;
+
+        memcpy ( value, _pos, len );
+        _pos += len;
+        return true;
+    }
+
+    // Returns the skipped bytes, or null if there aren't enough
+    const char *skip ( size_t len )
+    {
+        if ( len > remaining() )
+            return 0;
+
+        const char *ptr = _pos;
+        _pos += len;
+        return ptr;
+    }
+
+    bool readString ( string& str )
+    {
+        uint32_t len;
+        const char *ptr;
+
+        if ( ! read ( &len, sizeof ( len ) ) || ! ( ptr = skip ( len ) ) )
+            return false;
+
+        str.assign ( ptr, len );
+        return true;
+    }
+
+private:
+
+    const char *_pos, *_end;
+};
+
+} // namespace
+
+
+// Same as printToString, with the argument type known at runtime
+static void printArg ( char *buffer, size_t len, const char *fmt, const LogArg& arg )
+{
+    switch ( arg.type )
+    {
+        case LOG_ARG_INT32:
+            snprintf ( buffer, len, fmt, ( uint32_t ) arg.bits );
+            break;
+
+        case LOG_ARG_INT64:
+            snprintf ( buffer, len, fmt, arg.bits );
+            break;
+
+        case LOG_ARG_DOUBLE:
+            snprintf ( buffer, len, fmt, arg.d );
+            break;
+
+        case LOG_ARG_LONG_DOUBLE:
+            snprintf ( buffer, len, fmt, arg.ld );
+            break;
+
+        case LOG_ARG_POINTER:
+            snprintf ( buffer, len, fmt, ( const void * ) ( uintptr_t ) arg.bits );
+            break;
+
+        case LOG_ARG_STRING:
+            snprintf ( buffer, len, fmt, arg.str.c_str() );
+            break;
+
+        default:
+            snprintf ( buffer, len, fmt, ( const char * ) 0 );
+            break;
+    }
+}
+
+// Same as format, with the arguments known at runtime
+static string formatArgs ( const string& fmt, const vector<LogArg>& args, size_t i )
+{
+    if ( i == args.size() )
+        return format ( fmt );
+
+    string first, rest;
+    splitFormat ( fmt, first, rest );
+
+    if ( first.empty() )
+        return rest;
+
+    char buffer[4096];
+    printArg ( buffer, sizeof ( buffer ), first.c_str(), args[i] );
+
+    if ( rest.empty() )
+        return buffer;
+
+    return buffer + formatArgs ( rest, args, i + 1 );
+}
+
+static bool readArgs ( LogReader& reader, vector<LogArg>& args )
+{
+    args.clear();
+
+    while ( reader.remaining() )
+    {
+        args.push_back ( LogArg() );
+        LogArg& arg = args.back();
+
+        if ( ! reader.read ( &arg.type, 1 ) )
+            return false;
+
+        bool ok;
+        uint32_t value32 = 0;
+
+        switch ( arg.type )
+        {
+            case LOG_ARG_INT32:
+                ok = reader.read ( &value32, sizeof ( value32 ) );
+                arg.bits = value32;
+                break;
+
+            case LOG_ARG_INT64:
+            case LOG_ARG_POINTER:
+                ok = reader.read ( &arg.bits, sizeof ( arg.bits ) );
+                break;
+
+            case LOG_ARG_DOUBLE:
+                ok = reader.read ( &arg.d, sizeof ( arg.d ) );
+                break;
+
+            case LOG_ARG_LONG_DOUBLE:
+                ok = reader.read ( &arg.ld, sizeof ( arg.ld ) );
+                break;
+
+            case LOG_ARG_STRING:
+                ok = reader.readString ( arg.str );
+                break;
+
+            case LOG_ARG_NULL_STRING:
+                ok = reader.read ( &value32, 1 );
+                break;
+
+            default:
+                ok = false;
+                break;
+        }
+
+        if ( ! ok )
+            return false;
+    }
+
+    return true;
+}
+
+bool decodeLog ( const char *bytes, size_t len, string& text )
+{
+    LogReader reader ( bytes, len );
+
+    uint32_t options = 0;
+    unordered_map<uint32_t, DecodedSite> sites;
+    vector<LogArg> args;
+
+    while ( reader.remaining() )
+    {
+        uint8_t type;
+        reader.read ( &type, 1 );
+
+        if ( type == LOG_MAGIC[0] )
+        {
+            char magic[4];
+            uint32_t version;
+
+            if ( ! reader.read ( magic + 1, 3 )
+                    || memcmp ( magic + 1, LOG_MAGIC + 1, 3 ) != 0
+                    || ! reader.read ( &version, sizeof ( version ) )
+                    || version != LOG_VERSION
+                    || ! reader.read ( &options, sizeof ( options ) ) )
+            {
+                return false;
+            }
+
+            sites.clear();
+            continue;
+        }
+
+        switch ( type )
+        {
+            case LOG_ENTRY_SITE:
+            {
+                uint32_t id, line;
+                DecodedSite site;
+
+                if ( ! reader.read ( &id, sizeof ( id ) )
+                        || ! reader.read ( &line, sizeof ( line ) )
+                        || ! reader.readString ( site.file )
+                        || ! reader.readString ( site.func )
+                        || ! reader.readString ( site.format ) )
+                {
+                    return false;
+                }
+
+                site.line = line;
+                sites[id] = site;
+                break;
+            }
+
+            case LOG_ENTRY_RECORD:
+            {
+                uint32_t id, size;
+                const char *payload;
+                int64_t seconds;
+                uint16_t milliseconds;
+
+                if ( ! reader.read ( &id, sizeof ( id ) )
+                        || ! reader.read ( &size, sizeof ( size ) )
+                        || ! ( payload = reader.skip ( size ) )
+                        || sites.find ( id ) == sites.end() )
+                {
+                    return false;
+                }
+
+                LogReader record ( payload, size );
+
+                if ( ! record.read ( &seconds, sizeof ( seconds ) )
+                        || ! record.read ( &milliseconds, sizeof ( milliseconds ) )
+                        || ! readArgs ( record, args ) )
+                {
+                    return false;
+                }
+
+                const DecodedSite& site = sites[id];
+
+                // Without arguments, format prints the format string as is
+                const string message = ( args.empty() ? site.format : formatArgs ( site.format, args, 0 ) );
+
+                text += formatLogLine ( options, seconds, milliseconds,
+                                        site.file.c_str(), site.line, site.func.c_str(), message.c_str() );
+                break;
+            }
+
+            case LOG_ENTRY_TEXT:
+            {
+                string str;
+
+                if ( ! reader.readString ( str ) )
+                    return false;
+
+                text += str;
+                break;
+            }
+
+            case LOG_ENTRY_DROPPED:
+            {
+                uint32_t count;
+
+                if ( ! reader.read ( &count, sizeof ( count ) ) )
+                    return false;
+
+                text += format ( "Dropped %u log records\n", count );
+                break;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+#include "StringUtils.hpp"
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+
+// Binary log file format, written by Logger with LOG_ASYNC, all integers are little endian:
+//
+//   Header:    "CCLG", uint32 version, uint32 logger options
+//
+//   Entries:   uint8 type, followed by:
+//              LOG_ENTRY_SITE:     uint32 site id, uint32 line, uint32 length + file, uint32 length + function,
+//                                  uint32 length + format
+//              LOG_ENTRY_RECORD:   uint32 site id, uint32 length, int64 seconds, uint16 milliseconds, arguments
+//              LOG_ENTRY_TEXT:     uint32 length + bytes, already formatted text
+//              LOG_ENTRY_DROPPED:  uint32 number of records dropped because a ring buffer was full
+//
+//   Arguments: uint8 type, followed by the value, see LOG_ARG_*
+//
+// Each site is written once before its first record. A header can appear again when the file is appended to,
+// which resets the site ids.
+#define LOG_MAGIC               "CCLG"
+#define LOG_VERSION             ( 1 )
+
+#define LOG_ENTRY_SITE          ( 1 )
+#define LOG_ENTRY_RECORD        ( 2 )
+#define LOG_ENTRY_TEXT          ( 3 )
+#define LOG_ENTRY_DROPPED       ( 4 )
+
+#define LOG_ARG_INT32           ( 1 )   // uint32, integers up to 32 bits, after integer promotion
+#define LOG_ARG_INT64           ( 2 )   // uint64
+#define LOG_ARG_DOUBLE          ( 3 )   // double, floats are promoted
+#define LOG_ARG_LONG_DOUBLE     ( 4 )   // long double
+#define LOG_ARG_POINTER         ( 5 )   // uint64 address
+#define LOG_ARG_STRING          ( 6 )   // uint32 length + bytes, types without a printf conversion are pre-formatted
+#define LOG_ARG_NULL_STRING     ( 7 )   // uint8 0, a null char pointer
+
+// Maximum size of an encoded record, longer strings are truncated
+#define LOG_MAX_RECORD_SIZE     ( 4096 )
+
+
+// A LOG call site, this is a static constant so it can be identified by its address. The FormatString is never freed,
+// so sites can still log during static destruction.
+struct LogSite
+{
+    const char *file;
+    int line;
+    const char *func;
+    const char *format;
+
+    // The format parsed once for this site
+    const FormatString *formatString;
+};
+
+
+// Format a log line the same way as Logger, including the prefix enabled by the options, and the trailing newline
+std::string formatLogLine ( uint32_t options, int64_t seconds, uint16_t milliseconds,
+                            const char *srcFile, int srcLine, const char *srcFunc, const char *logMessage );
+
+// Get the current time for a log record
+void getLogTime ( int64_t& seconds, uint16_t& milliseconds );
+
+// Decode a binary log file to text, returns false if the data is invalid or truncated, in which case the output
+// contains everything up to that point.
+bool decodeLog ( const char *bytes, size_t len, std::string& text );
+
+
+// Byte ring buffer with one producer thread and one consumer thread. Records are length prefixed, and either pushed
+// whole or dropped if there isn't enough space, so the producer never blocks.
+class LogRing
+{
+public:
+
+    // The size must be a power of 2
+    LogRing ( uint32_t size ) : _buffer ( size ), _mask ( size - 1 ) {}
+
+    // Push a record, returns false and counts it as dropped if the ring is full. Producer thread only.
+    bool push ( const char *record, uint32_t len )
+    {
+        const uint32_t head = _head.load ( std::memory_order_relaxed );
+        const uint32_t tail = _tail.load ( std::memory_order_acquire );
+
+        if ( _buffer.size() - ( head - tail ) < sizeof ( len ) + len )
+        {
+            _dropped.fetch_add ( 1, std::memory_order_relaxed );
+            return false;
+        }
+
+        copyIn ( head, ( const char * ) &len, sizeof ( len ) );
+        copyIn ( head + sizeof ( len ), record, len );
+
+        _head.store ( head + sizeof ( len ) + len, std::memory_order_release );
+        return true;
+    }
+
+    // Pop the next record into the buffer, which must be at least LOG_MAX_RECORD_SIZE bytes.
+    // Returns the length of the record, or 0 if empty. Consumer thread only.
+    uint32_t pop ( char *record )
+    {
+        const uint32_t tail = _tail.load ( std::memory_order_relaxed );
+        const uint32_t head = _head.load ( std::memory_order_acquire );
+
+        if ( head == tail )
+            return 0;
+
+        uint32_t len;
+        copyOut ( tail, ( char * ) &len, sizeof ( len ) );
+        copyOut ( tail + sizeof ( len ), record, len );
+
+        _tail.store ( tail + sizeof ( len ) + len, std::memory_order_release );
+        return len;
+    }
+
+    // Get and reset the number of dropped records
+    uint32_t takeDropped() { return _dropped.exchange ( 0, std::memory_order_relaxed ); }
+
+private:
+
+    std::vector<char> _buffer;
+
+    uint32_t _mask;
+
+    // Free running positions, only the lower bits index the buffer, kept on separate cache lines
+    std::atomic<uint32_t> _head { 0 };
+    char _pad0[60];
+    std::atomic<uint32_t> _tail { 0 };
+    char _pad1[60];
+    std::atomic<uint32_t> _dropped { 0 };
+
+    void copyIn ( uint32_t pos, const char *bytes, uint32_t len )
+    {
+        const uint32_t i = pos & _mask;
+        const uint32_t first = std::min<uint32_t> ( len, _buffer.size() - i );
+
+        memcpy ( &_buffer[i], bytes, first );
+        memcpy ( &_buffer[0], bytes + first, len - first );
+    }
+
+    void copyOut ( uint32_t pos, char *bytes, uint32_t len ) const
+    {
+        const uint32_t i = pos & _mask;
+        const uint32_t first = std::min<uint32_t> ( len, _buffer.size() - i );
+
+        memcpy ( bytes, &_buffer[i], first );
+        memcpy ( bytes + first, &_buffer[0], len - first );
+    }
+};
+
+
+// Encodes a record into a fixed size buffer: the LogSite pointer, the timestamp, then the arguments. Once an argument
+// doesn't fit, it and every following argument are left out, so the record can always be decoded.
+class LogRecordWriter
+{
+public:
+
+    LogRecordWriter ( char *buffer, size_t size ) : _buffer ( buffer ), _size ( size ) {}
+
+    // Write the site and current time, this must be first
+    void writeHeader ( const LogSite& site );
+
+    template<typename T>
+    void writeArg ( uint8_t type, const T& value )
+    {
+        if ( _full || _pos + 1 + sizeof ( value ) > _size )
+        {
+            _full = true;
+            return;
+        }
+
+        _buffer[_pos++] = type;
+        memcpy ( _buffer + _pos, &value, sizeof ( value ) );
+        _pos += sizeof ( value );
+    }
+
+    void writeString ( const char *str, size_t len )
+    {
+        if ( _full || _pos + 1 + sizeof ( uint32_t ) > _size )
+        {
+            _full = true;
+            return;
+        }
+
+        // Truncate the string to the remaining space
+        const uint32_t truncated = std::min<size_t> ( len, _size - _pos - 1 - sizeof ( uint32_t ) );
+
+        _buffer[_pos++] = LOG_ARG_STRING;
+        memcpy ( _buffer + _pos, &truncated, sizeof ( truncated ) );
+        memcpy ( _buffer + _pos + sizeof ( truncated ), str, truncated );
+        _pos += sizeof ( truncated ) + truncated;
+
+        _full = ( truncated < len );
+    }
+
+    const char *data() const { return _buffer; }
+
+    size_t size() const { return _pos; }
+
+private:
+
+    char *_buffer;
+
+    size_t _size, _pos = 0;
+
+    bool _full = false;
+};
+
+
+// Encode a log argument, so that it is formatted exactly like format() would when decoded
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value>::type encodeLogArg ( LogRecordWriter& record, const T& val )
+{
+    if ( sizeof ( T ) <= sizeof ( uint32_t ) )
+        record.writeArg ( LOG_ARG_INT32, ( uint32_t ) val );
+    else
+        record.writeArg ( LOG_ARG_INT64, ( uint64_t ) val );
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type encodeLogArg ( LogRecordWriter& record,
+                                                                                        const T& val )
+{
+    if ( sizeof ( T ) > sizeof ( double ) )
+        record.writeArg ( LOG_ARG_LONG_DOUBLE, ( long double ) val );
+    else
+        record.writeArg ( LOG_ARG_DOUBLE, ( double ) val );
+}
+
+template<typename T>
+inline void encodeLogArg ( LogRecordWriter& record, T *val )
+{
+    record.writeArg ( LOG_ARG_POINTER, ( uint64_t ) ( uintptr_t ) val );
+}
+
+inline void encodeLogArg ( LogRecordWriter& record, const char *val )
+{
+    if ( val )
+        record.writeString ( val, strlen ( val ) );
+    else
+        record.writeArg ( LOG_ARG_NULL_STRING, '\0' );
+}
+
+inline void encodeLogArg ( LogRecordWriter& record, char *val )
+{
+    encodeLogArg ( record, ( const char * ) val );
+}
+
+template<size_t N>
+inline void encodeLogArg ( LogRecordWriter& record, const char ( &val ) [N] )
+{
+    record.writeString ( val, strnlen ( val, N ) );
+}
+
+inline void encodeLogArg ( LogRecordWriter& record, const std::string& val )
+{
+    // Strings are escaped by format
+    if ( val.find ( "%%" ) == std::string::npos )
+    {
+        record.writeString ( val.c_str(), val.size() );
+        return;
+    }
+
+    const std::string str = format ( val );
+    record.writeString ( str.c_str(), str.size() );
+}
+
+// Other types are formatted with operator<< now, since they may not be valid later
+template<typename T>
+inline typename std::enable_if < ! std::is_arithmetic<T>::value && ! std::is_pointer<T>::value >::type
+encodeLogArg ( LogRecordWriter& record, const T& val )
+{
+    const std::string str = format ( val );
+    record.writeString ( str.c_str(), str.size() );
+}
+
+inline void encodeLogArgs ( LogRecordWriter& record ) {}
+
+template<typename T, typename ... V>
+inline void encodeLogArgs ( LogRecordWriter& record, const T& val, const V& ... vals )
+{
+    encodeLogArg ( record, val );
+    encodeLogArgs ( record, vals... );
+}
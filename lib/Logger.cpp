@@ -2,30 +2,112 @@
 #include "Algorithms.hpp"
 #include "TimerManager.hpp"
 
+#include <sched.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#define _getpid getpid
+#endif
+
 using namespace std;
 
 
+// Maximum number of LOG_ASYNC loggers each thread caches its ring buffer for
+#define MAX_CACHED_RINGS ( 4 )
+
+
 #ifdef DISABLE_LOGGING
 
 void Logger::initialize ( const string& filePath, uint32_t _options ) {}
 void Logger::deinitialize() {}
 void Logger::flush() {}
 void Logger::log ( const char *srcFile, int srcLine, const char *srcFunc, const char *logMessage ) {}
+void Logger::push ( const LogRecordWriter& record ) {}
+void Logger::writeText ( const string& text ) {}
+size_t Logger::getNumRings() { return 0; }
 
 #else
 
+class Logger::Writer : public Thread
+{
+public:
+
+    Writer ( Logger& logger ) : _logger ( logger ) {}
+
+    void stop()
+    {
+        {
+            LOCK ( _mutex );
+            _running = false;
+            _cond.signal();
+        }
+
+        join();
+    }
+
+    void run() override
+    {
+        for ( ;; )
+        {
+            {
+                LOCK ( _mutex );
+
+                if ( _running )
+                    _cond.wait ( _mutex, LOG_WRITE_INTERVAL );
+
+                if ( ! _running )
+                    return;
+            }
+
+            _logger.drain();
+        }
+    }
+
+private:
+
+    Logger& _logger;
+
+    bool _running = true;
+
+    Mutex _mutex;
+
+    CondVar _cond;
+};
+
+
+// Ring buffer used by this thread for a logger
+struct CachedRing
+{
+    const Logger *logger;
+    uint32_t generation;
+    LogRing *ring;
+};
+
+static thread_local CachedRing cachedRings[MAX_CACHED_RINGS];
+
+static thread_local size_t nextCachedRing = 0;
+
+// Generations are unique across all loggers, so a new logger at the same address doesn't match old cached rings
+static atomic<uint32_t> lastGeneration { 0 };
+
+
 void Logger::initialize ( const string& filePath, uint32_t _options )
 {
 #ifdef LOGGER_MUTEXED
     LOCK ( _mutex );
 #endif
 
-    bool same = _initialized && ( _filePath == filePath );
+    stopWriter();
+
+    // Text and binary records can't be mixed in the same file
+    bool same = _initialized && ( _filePath == filePath ) && ! ( ( this->_options ^ _options ) & LOG_ASYNC );
 
     this->_options = _options;
 
     if ( filePath.empty() )
     {
+        // Binary logs are only written to files
+        this->_options &= ~LOG_ASYNC;
         _filePath.clear();
         _fd = stdout;
     }
@@ -51,13 +133,33 @@ void Logger::initialize ( const string& filePath, uint32_t _options )
         }
 
         // Append to the file if the path is the same
-        _fd = fopen ( _filePath.c_str(), same ? "a" : "w" );
+        if ( _options & LOG_ASYNC )
+            _fd = fopen ( _filePath.c_str(), same ? "ab" : "wb" );
+        else
+            _fd = fopen ( _filePath.c_str(), same ? "a" : "w" );
     }
 
     if ( ! _initialized )
         _logId = generateRandomId();
 
     _initialized = true;
+
+    if ( ! _fd || ! ( this->_options & LOG_ASYNC ) )
+        return;
+
+    // The file starts with a header each time it is opened, since the site ids start over
+    const uint32_t version = LOG_VERSION;
+
+    fwrite ( LOG_MAGIC, 1, 4, _fd );
+    fwrite ( &version, sizeof ( version ), 1, _fd );
+    fwrite ( &this->_options, sizeof ( this->_options ), 1, _fd );
+
+    nextGeneration();
+
+    LOCK ( _ringsMutex );
+
+    _writer.reset ( new Writer ( *this ) );
+    _writer->start();
 }
 
 void Logger::deinitialize()
@@ -69,6 +171,8 @@ void Logger::deinitialize()
     LOCK ( _mutex );
 #endif
 
+    stopWriter();
+
     if ( _fd && _fd != stdout )
         fclose ( _fd );
 
@@ -86,7 +190,10 @@ void Logger::flush()
     LOCK ( _mutex );
 #endif
 
-    fflush ( _fd );
+    if ( _writer )
+        drain();
+    else
+        fflush ( _fd );
 }
 
 void Logger::log ( const char *srcFile, int srcLine, const char *srcFunc, const char *logMessage )
@@ -98,45 +205,218 @@ void Logger::log ( const char *srcFile, int srcLine, const char *srcFunc, const
     LOCK ( _mutex );
 #endif
 
-    bool hasPrefix = false;
+    int64_t seconds = 0;
+    uint16_t milliseconds = 0;
 
     if ( _options & ( LOG_GM_TIME | LOG_LOCAL_TIME ) )
+        getLogTime ( seconds, milliseconds );
+
+    writeText ( formatLogLine ( _options, seconds, milliseconds, srcFile, srcLine, srcFunc, logMessage ) );
+
+    if ( ! _writer )
+        fflush ( _fd );
+}
+
+void Logger::writeText ( const string& text )
+{
+    if ( ! _writer )
     {
-        time_t t;
-        time ( &t );
+        fputs ( text.c_str(), _fd );
+        return;
+    }
 
-        tm *ts;
-        if ( _options & LOG_GM_TIME )
-            ts = gmtime ( &t );
-        else
-            ts = localtime ( &t );
+    const uint32_t len = text.size();
 
-        strftime ( _buffer, sizeof ( _buffer ), "%H:%M:%S", ts );
+    string bytes ( ( const char * ) &len, sizeof ( len ) );
+    bytes += text;
 
-        const uint64_t now = TimerManager::get().getNow ( true );
+    LOCK ( _writeMutex );
+
+    // Write the records before this first, so the text stays in order with the records from this thread
+    drain();
+    writeEntry ( LOG_ENTRY_TEXT, bytes );
+}
 
-        fprintf ( _fd, "%s.%03u:", _buffer, ( uint32_t ) ( now % 1000 ) );
-        hasPrefix = true;
+void Logger::writeEntry ( uint8_t type, const string& bytes )
+{
+    fputc ( type, _fd );
+    fwrite ( bytes.c_str(), 1, bytes.size(), _fd );
+}
+
+void Logger::push ( const LogRecordWriter& record )
+{
+    const uint32_t generation = _generation;
+
+    // Counted before checking the generation again, so stopWriter either waits for this push, or this sees the new
+    // generation. Pushes for the new generation are counted separately, so the wait ends even if logging never stops.
+    atomic<uint32_t>& pushing = _pushing[generation & 1];
+    ++pushing;
+
+    if ( generation == _generation )
+    {
+        LogRing *ring = getRing ( generation );
+
+        if ( ring )
+            ring->push ( record.data(), record.size() );
+    }
+
+    --pushing;
+}
+
+uint32_t Logger::nextGeneration()
+{
+    // Unique across loggers, with the low bit alternating
+    const uint32_t generation = _generation;
+    _generation = ( ( ++lastGeneration ) << 1 ) | ( ~generation & 1 );
+    return generation;
+}
+
+LogRing *Logger::getRing ( uint32_t generation )
+{
+    for ( const CachedRing& cached : cachedRings )
+    {
+        if ( cached.logger == this && cached.generation == generation )
+            return cached.ring;
     }
 
-    if ( _options & LOG_FILE_LINE )
+    LOCK ( _ringsMutex );
+
+    if ( ! _writer )
+        return 0;
+
+    // This thread may already have a ring that was evicted from its cache. A thread id can be reused once its thread
+    // exits, but the new thread is then the only producer for that ring.
+    const pthread_t thread = pthread_self();
+    LogRing *ring = 0;
+
+    for ( const auto& it : _rings )
+    {
+        if ( pthread_equal ( it.first, thread ) )
+        {
+            ring = it.second.get();
+            break;
+        }
+    }
+
+    if ( ! ring )
+    {
+        _rings.push_back ( { thread, make_shared<LogRing> ( LOG_RING_SIZE ) } );
+        ring = _rings.back().second.get();
+    }
+
+    // Replace an empty or stale entry for this logger if there is one, otherwise evict the entries in turn
+    size_t i = 0;
+
+    for ( ; i < MAX_CACHED_RINGS; ++i )
+    {
+        if ( ! cachedRings[i].logger || cachedRings[i].logger == this )
+            break;
+    }
+
+    if ( i == MAX_CACHED_RINGS )
+        i = ( nextCachedRing++ ) % MAX_CACHED_RINGS;
+
+    cachedRings[i] = { this, generation, ring };
+    return ring;
+}
+
+size_t Logger::getNumRings()
+{
+    LOCK ( _ringsMutex );
+    return _rings.size();
+}
+
+void Logger::drain()
+{
+    LOCK ( _writeMutex );
+
+    vector<LogRing *> rings;
+
     {
-        fprintf ( _fd, "%s:%3d:", srcFile, srcLine );
-        hasPrefix = true;
+        LOCK ( _ringsMutex );
+
+        for ( const auto& it : _rings )
+            rings.push_back ( it.second.get() );
     }
 
-    if ( _options & LOG_FUNC_NAME )
+    char record[LOG_MAX_RECORD_SIZE];
+    string bytes;
+
+    for ( LogRing *ring : rings )
     {
-        string shortFunc ( srcFunc );
-        shortFunc = shortFunc.substr ( 0, shortFunc.find ( '(' ) );
-        fprintf ( _fd, "%s:", shortFunc.c_str() );
-        hasPrefix = true;
+        while ( const uint32_t len = ring->pop ( record ) )
+        {
+            const LogSite *site;
+            memcpy ( &site, record, sizeof ( site ) );
+
+            auto it = _siteIds.find ( site );
+
+            // Write each site before its first record
+            if ( it == _siteIds.end() )
+            {
+                it = _siteIds.insert ( { site, ( uint32_t ) _siteIds.size() } ).first;
+
+                const uint32_t line = site->line;
+
+                bytes.assign ( ( const char * ) &it->second, sizeof ( it->second ) );
+                bytes.append ( ( const char * ) &line, sizeof ( line ) );
+
+                for ( const char *str : { site->file, site->func, site->format } )
+                {
+                    const uint32_t strLen = strlen ( str );
+                    bytes.append ( ( const char * ) &strLen, sizeof ( strLen ) );
+                    bytes.append ( str, strLen );
+                }
+
+                writeEntry ( LOG_ENTRY_SITE, bytes );
+            }
+
+            // The rest of the record is written as is
+            const uint32_t size = len - sizeof ( site );
+
+            bytes.assign ( ( const char * ) &it->second, sizeof ( it->second ) );
+            bytes.append ( ( const char * ) &size, sizeof ( size ) );
+            bytes.append ( record + sizeof ( site ), size );
+
+            writeEntry ( LOG_ENTRY_RECORD, bytes );
+        }
+
+        const uint32_t dropped = ring->takeDropped();
+
+        if ( dropped )
+            writeEntry ( LOG_ENTRY_DROPPED, string ( ( const char * ) &dropped, sizeof ( dropped ) ) );
     }
 
-    fprintf ( _fd, ( hasPrefix ? " %s\n" : "%s\n" ), logMessage );
     fflush ( _fd );
 }
 
+void Logger::stopWriter()
+{
+    if ( ! _writer )
+        return;
+
+    _writer->stop();
+
+    // No new rings are created once the writer is reset
+    {
+        LOCK ( _ringsMutex );
+        _writer.reset();
+    }
+
+    // Invalidate the rings cached by each thread, then wait for any pushes that still have one
+    const uint32_t generation = nextGeneration();
+
+    while ( _pushing[generation & 1] )
+        sched_yield();
+
+    drain();
+
+    LOCK ( _ringsMutex );
+
+    _rings.clear();
+    _siteIds.clear();
+}
+
 #endif // DISABLE_LOGGING
 
 Logger& Logger::get()
@@ -2,10 +2,15 @@
 
 #include "Thread.hpp"
 #include "StringUtils.hpp"
+#include "LogRecord.hpp"
 
 #include <string>
 #include <cstdio>
 #include <ctime>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
 
 
 #define LOG_GM_TIME     ( 0x01 )    // Log the gmtime timestamp per message
@@ -13,6 +18,15 @@
 #define LOG_FILE_LINE   ( 0x04 )    // Log file:line per message
 #define LOG_FUNC_NAME   ( 0x08 )    // Log the function name per message
 #define PID_IN_FILENAME ( 0x10 )    // Add the PID to the log filename
+#define LOG_ASYNC       ( 0x20 )    // Write binary records from a background thread, only for log files
+
+// Binary log files are decoded back to text with tools/LogDecoder.cpp, ie: logdecoder.exe dll.log dll.txt
+
+// Size of the ring buffer for each thread that logs with LOG_ASYNC, must be a power of 2
+#define LOG_RING_SIZE       ( 256 * 1024 )
+
+// Milliseconds between each write of the LOG_ASYNC ring buffers to the log file
+#define LOG_WRITE_INTERVAL  ( 10 )
 
 #define LOG_DEFAULT_OPTIONS ( LOG_GM_TIME | LOG_FILE_LINE | LOG_FUNC_NAME )
 
@@ -40,6 +54,37 @@ public:
     // Log a message with source file, line, and function
     void log ( const char *srcFile, int srcLine, const char *srcFunc, const char *logMessage );
 
+    // Log a formatted message from a call site. With LOG_ASYNC, the arguments are only encoded into this thread's
+    // ring buffer, and formatting happens when the log file is decoded.
+    template<typename ... V>
+    void log ( const LogSite& site, const V& ... vals )
+    {
+        if ( ! _fd )
+            return;
+
+        if ( ! ( _options & LOG_ASYNC ) )
+        {
+            char message[4096];
+
+            if ( site.formatString->print ( message, sizeof ( message ), vals... ) < sizeof ( message ) )
+                log ( site.file, site.line, site.func, message );
+            else
+                log ( site.file, site.line, site.func, format ( site.format, vals... ).c_str() );
+            return;
+        }
+
+        char buffer[LOG_MAX_RECORD_SIZE];
+        LogRecordWriter record ( buffer, sizeof ( buffer ) );
+
+        record.writeHeader ( site );
+        encodeLogArgs ( record, vals... );
+
+        push ( record );
+    }
+
+    // Number of LOG_ASYNC ring buffers, one per thread that has logged since the writer started
+    size_t getNumRings();
+
     // Get the singleton instance
     static Logger& get();
 
@@ -57,9 +102,6 @@ private:
     // Log file descriptor
     FILE *_fd = 0;
 
-    // Main character buffer
-    char _buffer[4096];
-
     // Flag to indicate if initialized
     bool _initialized = false;
 
@@ -67,6 +109,48 @@ private:
 #ifdef LOGGER_MUTEXED
     Mutex _mutex;
 #endif
+
+    // Background thread for LOG_ASYNC
+    class Writer;
+    std::shared_ptr<Writer> _writer;
+
+    // Ring buffers for LOG_ASYNC and the thread that pushes to each, these are only freed when the writer is stopped
+    std::vector<std::pair<pthread_t, std::shared_ptr<LogRing>>> _rings;
+    Mutex _ringsMutex;
+
+    // Changes each time the rings are reset, so threads know when their cached ring is no longer valid
+    std::atomic<uint32_t> _generation { 0 };
+
+    // Number of threads currently pushing a record, indexed by the low bit of the generation they are pushing for.
+    // The rings are only freed once the count for their generation is 0.
+    std::atomic<uint32_t> _pushing[2] { { 0 }, { 0 } };
+
+    // Mapping: LogSite -> id in the log file, only used by the writer
+    std::unordered_map<const LogSite *, uint32_t> _siteIds;
+
+    // Locks the writing of binary log entries
+    Mutex _writeMutex;
+
+    // Push a record to this thread's ring buffer
+    void push ( const LogRecordWriter& record );
+
+    // Get the ring buffer for this thread in the given generation, creating it if needed
+    LogRing *getRing ( uint32_t generation );
+
+    // Start a new generation of rings and return the old one
+    uint32_t nextGeneration();
+
+    // Write all the records from the ring buffers to the log file
+    void drain();
+
+    // Stop the writer thread and write any remaining records
+    void stopWriter();
+
+    // Write already formatted text, this is encoded as a text entry with LOG_ASYNC
+    void writeText ( const std::string& text );
+
+    // Write a binary log entry
+    void writeEntry ( uint8_t type, const std::string& bytes );
 };
 
 
@@ -80,12 +164,16 @@ private:
 
 #define LOG_TO(LOGGER, FORMAT, ...)                                                                                    \
     do {                                                                                                               \
-        LOGGER.log ( __BASE_FILE__, __LINE__, __PRETTY_FUNCTION__, format ( FORMAT, ## __VA_ARGS__ ).c_str() );        \
+        static const LogSite logSite =                                                                                 \
+            { __BASE_FILE__, __LINE__, __PRETTY_FUNCTION__, FORMAT, new FormatString ( FORMAT ) };                     \
+        LOGGER.log ( logSite, ## __VA_ARGS__ );                                                                        \
     } while ( 0 )
 
 #define LOG(FORMAT, ...)                                                                                               \
     do {                                                                                                               \
-        Logger::get().log ( __BASE_FILE__, __LINE__, __PRETTY_FUNCTION__, format ( FORMAT, ## __VA_ARGS__ ).c_str() ); \
+        static const LogSite logSite =                                                                                 \
+            { __BASE_FILE__, __LINE__, __PRETTY_FUNCTION__, FORMAT, new FormatString ( FORMAT ) };                     \
+        Logger::get().log ( logSite, ## __VA_ARGS__ );                                                                 \
     } while ( 0 )
 
 #define LOG_LIST(LIST, TO_STRING)                                                                                      \
@@ -12,26 +12,29 @@ void Logger::logVersion() {}
 
 void Logger::logVersion()
 {
-    fprintf ( _fd, "LogId '%s'\n", _logId.c_str() );
-    fprintf ( _fd, "Version '%s' { '%s', '%s', '%s' }\n", LocalVersion.code.c_str(),
-              LocalVersion.major().c_str(), LocalVersion.minor().c_str(), LocalVersion.suffix().c_str() );
-    fprintf ( _fd, "Revision '%s' { isCustom=%d }\n", LocalVersion.revision.c_str(), LocalVersion.isCustom() );
-    fprintf ( _fd, "BuildTime '%s'\n", LocalVersion.buildTime.c_str() );
+    string text;
+
+    text += format ( "LogId '%s'\n", _logId );
+    text += format ( "Version '%s' { '%s', '%s', '%s' }\n", LocalVersion.code,
+                     LocalVersion.major(), LocalVersion.minor(), LocalVersion.suffix() );
+    text += format ( "Revision '%s' { isCustom=%d }\n", LocalVersion.revision, LocalVersion.isCustom() );
+    text += format ( "BuildTime '%s'\n", LocalVersion.buildTime );
 
 #if defined(DEBUG)
-    fprintf ( _fd, "BuildType 'debug'\n" );
+    text += "BuildType 'debug'\n";
 #elif defined(LOGGING)
-    fprintf ( _fd, "BuildType 'logging'\n" );
+    text += "BuildType 'logging'\n";
 #elif defined(RELEASE)
-    fprintf ( _fd, "BuildType 'release'\n" );
+    text += "BuildType 'release'\n";
 #else
-    fprintf ( _fd, "BuildType 'unknown'\n" );
+    text += "BuildType 'unknown'\n";
 #endif
 
     if ( ! sessionId.empty() )
-        fprintf ( _fd, "SessionId '%s'\n", sessionId.c_str() );
+        text += format ( "SessionId '%s'\n", sessionId );
 
-    fflush ( _fd );
+    writeText ( text );
+    flush();
 }
 
 #endif
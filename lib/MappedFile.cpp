@@ -0,0 +1,131 @@
+#include "MappedFile.hpp"
+#include "Logger.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <cstdint>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+#ifdef _WIN32
+
+bool MappedFile::open ( const string& filename )
+{
+    close();
+
+    HANDLE file = CreateFile ( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0 );
+
+    if ( file == INVALID_HANDLE_VALUE )
+    {
+        LOG ( "CreateFile failed: '%s'", filename );
+        return false;
+    }
+
+    LARGE_INTEGER size;
+
+    if ( ! GetFileSizeEx ( file, &size ) || size.QuadPart <= 0 || ( uint64_t ) size.QuadPart > SIZE_MAX )
+    {
+        LOG ( "Invalid file size: '%s'", filename );
+        CloseHandle ( file );
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMapping ( file, 0, PAGE_READONLY, 0, 0, 0 );
+
+    if ( ! mapping )
+    {
+        LOG ( "CreateFileMapping failed: '%s'", filename );
+        CloseHandle ( file );
+        return false;
+    }
+
+    const void *data = MapViewOfFile ( mapping, FILE_MAP_READ, 0, 0, 0 );
+
+    if ( ! data )
+    {
+        LOG ( "MapViewOfFile failed: '%s'", filename );
+        CloseHandle ( mapping );
+        CloseHandle ( file );
+        return false;
+    }
+
+    _file = file;
+    _mapping = mapping;
+    _data = ( const char * ) data;
+    _size = size.QuadPart;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if ( _data )
+        UnmapViewOfFile ( _data );
+
+    if ( _mapping )
+        CloseHandle ( ( HANDLE ) _mapping );
+
+    if ( _file )
+        CloseHandle ( ( HANDLE ) _file );
+
+    _data = 0;
+    _size = 0;
+    _file = _mapping = 0;
+}
+
+#else
+
+bool MappedFile::open ( const string& filename )
+{
+    close();
+
+    const int fd = ::open ( filename.c_str(), O_RDONLY );
+
+    if ( fd < 0 )
+    {
+        LOG ( "open failed: '%s'", filename );
+        return false;
+    }
+
+    struct stat st;
+
+    if ( fstat ( fd, &st ) != 0 || st.st_size == 0 )
+    {
+        LOG ( "Invalid file size: '%s'", filename );
+        ::close ( fd );
+        return false;
+    }
+
+    void *data = mmap ( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+    // The mapping stays valid after closing the file descriptor
+    ::close ( fd );
+
+    if ( data == MAP_FAILED )
+    {
+        LOG ( "mmap failed: '%s'", filename );
+        return false;
+    }
+
+    _data = ( const char * ) data;
+    _size = st.st_size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if ( _data )
+        munmap ( ( void * ) _data, _size );
+
+    _data = 0;
+    _size = 0;
+}
+
+#endif // _WIN32
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+
+// Read-only memory mapping of a whole file. Pages are only read from disk when they are accessed.
+class MappedFile
+{
+public:
+
+    MappedFile() {}
+    ~MappedFile() { close(); }
+
+    // Map the given file, returns false on failure
+    bool open ( const std::string& filename );
+
+    // Unmap the file
+    void close();
+
+    bool isOpen() const { return ( _data != 0 ); }
+
+    const char *data() const { return _data; }
+
+    size_t size() const { return _size; }
+
+private:
+
+    const char *_data = 0;
+
+    size_t _size = 0;
+
+    // Platform specific handles
+    void *_file = 0, *_mapping = 0;
+
+    // Not copyable
+    MappedFile ( const MappedFile& ) = delete;
+    const MappedFile& operator= ( const MappedFile& ) = delete;
+};
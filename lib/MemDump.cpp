@@ -121,6 +121,66 @@ void MemDumpList::update()
     totalSize = 0;
     for ( const MemDump& mem : addrs )
         totalSize += mem.getTotalSize();
+
+    compile();
+}
+
+void MemDumpList::compile()
+{
+    _ops.clear();
+    _slots.assign ( 1, 0 );
+    _slotsUsed = 0;
+
+    for ( const MemDump& mem : addrs )
+        compile ( mem, 0, ( size_t ) mem.addr );
+}
+
+void MemDumpList::compile ( const MemDumpBase& mem, uint32_t slot, size_t offset )
+{
+    MemDumpOp *last = ( _ops.empty() ? 0 : &_ops.back() );
+
+    // Continuous static ranges are merged into a single copy
+    if ( slot == 0 && last && ! last->resolve && last->slot == 0 && last->offset + last->size == offset )
+        last->size += mem.size;
+    else
+        _ops.push_back ( { false, slot, offset, mem.size } );
+
+    for ( const MemDumpPtr& ptr : mem.ptrs )
+    {
+        // Resolve the pointer into a new slot, the static parent address is folded into the offset
+        _ops.push_back ( { true, slot, offset + ptr.srcOffset, ptr.dstOffset } );
+        _slots.push_back ( 0 );
+
+        compile ( ptr, _slots.size() - 1, 0 );
+    }
+}
+
+void MemDumpList::saveDump ( char *dump ) const
+{
+    ASSERT ( dump != 0 );
+
+    forEachRange ( [&] ( const char *addr, size_t size )
+    {
+        if ( addr )
+            memcpy ( dump, addr, size );
+        else
+            memset ( dump, 0, size );
+
+        dump += size;
+    } );
+}
+
+void MemDumpList::loadDump ( const char *dump ) const
+{
+    ASSERT ( dump != 0 );
+
+    forEachRange ( [&] ( char *addr, size_t size )
+    {
+        if ( addr )
+            memcpy ( addr, dump, size );
+
+        dump += size;
+    } );
 }
 
 void MemDumpBase::save ( BinaryOutputArchive& ar ) const
@@ -138,7 +198,7 @@ void MemDumpPtr::save ( BinaryOutputArchive& ar ) const
 
 void MemDump::save ( BinaryOutputArchive& ar ) const
 {
-    uint32_t val = ( uint32_t ) addr;
+    uint32_t val = ( uint32_t ) ( uintptr_t ) addr;
     ar ( val );
     MemDumpBase::save ( ar );
 }
@@ -181,10 +241,12 @@ void MemDumpList::load ( BinaryInputArchive& ar )
         ar ( addr, size, ptrsCount );
 
         if ( ptrsCount )
-            append ( { ( char * ) addr, size, loadPtrs ( ptrsCount, ar ) } );
+            append ( { ( char * ) ( uintptr_t ) addr, size, loadPtrs ( ptrsCount, ar ) } );
         else
-            append ( { ( char * ) addr, size } );
+            append ( { ( char * ) ( uintptr_t ) addr, size } );
     }
+
+    compile();
 }
 
 bool MemDumpList::save ( const string& filename ) const
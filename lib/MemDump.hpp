@@ -137,11 +137,11 @@ public:
 
     // Construct a memory dump with a memory range
     MemDump ( uint32_t start, uint32_t end )
-        : MemDumpBase ( end - start ), addr ( ( char * ) start ) {}
+        : MemDumpBase ( end - start ), addr ( ( char * ) ( uintptr_t ) start ) {}
 
     // Construct a memory dump with a memory range, with child pointers
     MemDump ( uint32_t start, uint32_t end, const std::vector<MemDumpPtr>& ptrs )
-        : MemDumpBase ( end - start, ptrs ), addr ( ( char * ) start ) {}
+        : MemDumpBase ( end - start, ptrs ), addr ( ( char * ) ( uintptr_t ) start ) {}
 
     // Copy constructor
     MemDump ( const MemDump& a )
@@ -162,11 +162,28 @@ public:
 };
 
 
+// A single operation of a compiled MemDumpList, see MemDumpList::forEachRange
+struct MemDumpOp
+{
+    // Resolve a pointer into the next address slot, otherwise copy a range of memory
+    bool resolve;
+
+    // Address slot to use as the base address, or 0 if the offset is a static address
+    uint32_t slot;
+
+    // Copy: offset from the base address. Resolve: offset of the pointer from the base address.
+    size_t offset;
+
+    // Copy: number of bytes. Resolve: offset to add to the pointer's value.
+    size_t size;
+};
+
+
 class MemDumpList
 {
 public:
 
-    // Total size of memory dumps, only valid after calling update()
+    // Total size of memory dumps, only valid after calling update() or load()
     size_t totalSize = 0;
 
     // List of memory dumps
@@ -177,6 +194,8 @@ public:
     {
         totalSize = 0;
         addrs.clear();
+        _ops.clear();
+        _slots.clear();
     }
 
     // True only if addrs.empty()
@@ -211,13 +230,65 @@ public:
             append ( addr, addAddrOffset );
     }
 
-    // Update the list of memory dumps: merge continuous address ranges, then compute total size
+    // Update the list of memory dumps: merge continuous address ranges, then compute total size and compile
     void update();
 
+    // Compile the memory dumps into a flat list of operations, only valid until the memory dumps are changed.
+    // This is called by update() and load(), so it only needs to be called after manually changing addrs.
+    void compile();
+
+    // Save / load all the memory dumps to / from the given pointer, which must have totalSize bytes.
+    // Uses the compiled operations, so this is the same as calling saveDump / loadDump on each memory dump.
+    void saveDump ( char *dump ) const;
+    void loadDump ( const char *dump ) const;
+
+    // Call func ( addr, size ) for each range of memory in the same order as the dump, addr is null if the range
+    // is behind a null pointer. Pointers are resolved after the previous ranges are processed, so func can write.
+    template<typename F>
+    void forEachRange ( const F& func ) const
+    {
+        for ( const MemDumpOp& op : _ops )
+        {
+            char *addr;
+
+            if ( op.slot == 0 )
+                addr = ( char * ) op.offset;
+            else if ( _slots[op.slot] )
+                addr = _slots[op.slot] + op.offset;
+            else
+                addr = 0;
+
+            if ( ! op.resolve )
+            {
+                func ( addr, op.size );
+                continue;
+            }
+
+            if ( addr && * ( char ** ) addr )
+                _slots[++_slotsUsed] = * ( char ** ) addr + op.size;
+            else
+                _slots[++_slotsUsed] = 0;
+        }
+
+        _slotsUsed = 0;
+    }
+
     // Serialization
     void save ( cereal::BinaryOutputArchive& ar ) const;
     void load ( cereal::BinaryInputArchive& ar );
     bool save ( const std::string& filename ) const;
     bool load ( const std::string& filename );
     bool load ( const char *data, size_t size );
+
+private:
+
+    // Compiled operations
+    std::vector<MemDumpOp> _ops;
+
+    // Resolved addresses, slot 0 is unused because it indicates a static address
+    mutable std::vector<char *> _slots;
+    mutable size_t _slotsUsed = 0;
+
+    // Compile a memory dump, using the given slot as the base address
+    void compile ( const MemDumpBase& mem, uint32_t slot, size_t offset );
 };
@@ -0,0 +1,376 @@
+#include "MemDumpSnapshots.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+// Find the offset of the first different byte, returns len if all the bytes are equal
+static size_t mismatchPortable ( const char *a, const char *b, size_t len )
+{
+    size_t i = 0;
+
+    // One word at a time, using memcpy for unaligned reads
+    for ( ; i + sizeof ( uintptr_t ) <= len; i += sizeof ( uintptr_t ) )
+    {
+        uintptr_t x, y;
+        memcpy ( &x, a + i, sizeof ( x ) );
+        memcpy ( &y, b + i, sizeof ( y ) );
+
+        if ( x != y )
+            break;
+    }
+
+    for ( ; i < len && a[i] == b[i]; ++i );
+
+    return i;
+}
+
+#if defined ( __GNUC__ ) && ( defined ( __i386__ ) || defined ( __x86_64__ ) )
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+static bool hasSSE2()
+{
+    unsigned eax, ebx, ecx, edx;
+
+    if ( ! __get_cpuid ( 1, &eax, &ebx, &ecx, &edx ) )
+        return false;
+
+    return ( edx & bit_SSE2 );
+}
+
+// Compiled for SSE2 only, so this must NOT be called unless hasSSE2 is true
+__attribute__ ( ( target ( "sse2" ) ) )
+static size_t mismatchSSE2 ( const char *a, const char *b, size_t len )
+{
+    size_t i = 0;
+
+    // Unchanged memory is the common case, so check 64 bytes at a time with a single branch
+    for ( ; i + 64 <= len; i += 64 )
+    {
+        __m128i eq = _mm_cmpeq_epi8 ( _mm_loadu_si128 ( ( const __m128i * ) ( a + i ) ),
+                                      _mm_loadu_si128 ( ( const __m128i * ) ( b + i ) ) );
+
+        for ( size_t j = 16; j < 64; j += 16 )
+        {
+            eq = _mm_and_si128 ( eq, _mm_cmpeq_epi8 ( _mm_loadu_si128 ( ( const __m128i * ) ( a + i + j ) ),
+                                                      _mm_loadu_si128 ( ( const __m128i * ) ( b + i + j ) ) ) );
+        }
+
+        if ( _mm_movemask_epi8 ( eq ) != 0xFFFF )
+            break;
+    }
+
+    // Then 16 bytes at a time to find the first different byte
+    for ( ; i + 16 <= len; i += 16 )
+    {
+        const __m128i x = _mm_loadu_si128 ( ( const __m128i * ) ( a + i ) );
+        const __m128i y = _mm_loadu_si128 ( ( const __m128i * ) ( b + i ) );
+        const int mask = _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( x, y ) );
+
+        if ( mask != 0xFFFF )
+            return i + __builtin_ctz ( ~mask );
+    }
+
+    for ( ; i < len && a[i] == b[i]; ++i );
+
+    return i;
+}
+
+static bool hasAVX2()
+{
+    unsigned eax, ebx, ecx, edx;
+
+    if ( ! __get_cpuid ( 1, &eax, &ebx, &ecx, &edx ) || ! ( ecx & bit_OSXSAVE ) || ! ( ecx & bit_AVX ) )
+        return false;
+
+    // The OS must also save the upper halves of the registers
+    __asm__ ( "xgetbv" : "=a" ( eax ), "=d" ( edx ) : "c" ( 0 ) );
+
+    if ( ( eax & 0x6 ) != 0x6 )
+        return false;
+
+    if ( __get_cpuid_max ( 0, 0 ) < 7 )
+        return false;
+
+    __cpuid_count ( 7, 0, eax, ebx, ecx, edx );
+
+    return ( ebx & bit_AVX2 );
+}
+
+// Compiled for AVX2 only, so this must NOT be called unless hasAVX2 is true
+__attribute__ ( ( target ( "avx2" ) ) )
+static size_t mismatchAVX2 ( const char *a, const char *b, size_t len )
+{
+    size_t i = 0;
+
+    // Same as mismatchSSE2, but 128 bytes at a time. Both reads are bound by memory bandwidth, so this only helps
+    // because it retires half the instructions per byte.
+    for ( ; i + 128 <= len; i += 128 )
+    {
+        __m256i eq = _mm256_cmpeq_epi8 ( _mm256_loadu_si256 ( ( const __m256i * ) ( a + i ) ),
+                                         _mm256_loadu_si256 ( ( const __m256i * ) ( b + i ) ) );
+
+        for ( size_t j = 32; j < 128; j += 32 )
+        {
+            eq = _mm256_and_si256 ( eq, _mm256_cmpeq_epi8 ( _mm256_loadu_si256 ( ( const __m256i * ) ( a + i + j ) ),
+                                                            _mm256_loadu_si256 ( ( const __m256i * ) ( b + i + j ) ) ) );
+        }
+
+        if ( _mm256_movemask_epi8 ( eq ) != -1 )
+            break;
+    }
+
+    for ( ; i + 32 <= len; i += 32 )
+    {
+        const __m256i x = _mm256_loadu_si256 ( ( const __m256i * ) ( a + i ) );
+        const __m256i y = _mm256_loadu_si256 ( ( const __m256i * ) ( b + i ) );
+        const unsigned mask = _mm256_movemask_epi8 ( _mm256_cmpeq_epi8 ( x, y ) );
+
+        if ( mask != 0xFFFFFFFF )
+            return i + __builtin_ctz ( ~mask );
+    }
+
+    return i + mismatchSSE2 ( a + i, b + i, len - i );
+}
+
+#else
+
+static bool hasSSE2()
+{
+    return false;
+}
+
+static bool hasAVX2()
+{
+    return false;
+}
+
+static size_t mismatchSSE2 ( const char *a, const char *b, size_t len )
+{
+    return mismatchPortable ( a, b, len );
+}
+
+static size_t mismatchAVX2 ( const char *a, const char *b, size_t len )
+{
+    return mismatchPortable ( a, b, len );
+}
+
+#endif
+
+static size_t mismatch ( const char *a, const char *b, size_t len )
+{
+    // Select the implementation once, the result depends only on the CPU
+    static size_t ( *const impl ) ( const char *, const char *, size_t )
+        = ( hasAVX2() ? mismatchAVX2 : ( hasSSE2() ? mismatchSSE2 : mismatchPortable ) );
+
+    return impl ( a, b, len );
+}
+
+
+void MemDumpSnapshots::allocate ( const MemDumpList& addrs, size_t maxSnapshots )
+{
+    ASSERT ( maxSnapshots > 0 );
+
+    _addrs = &addrs;
+    _newest.assign ( addrs.totalSize, 0 );
+    _deltas.resize ( maxSnapshots );
+
+    clear();
+}
+
+void MemDumpSnapshots::deallocate()
+{
+    _addrs = 0;
+    _order.clear();
+
+    vector<char>().swap ( _newest );
+    vector<Delta>().swap ( _deltas );
+    vector<size_t>().swap ( _freeIds );
+
+    _merged = Delta();
+}
+
+size_t MemDumpSnapshots::save()
+{
+    ASSERT ( _addrs != 0 );
+    ASSERT ( full() == false );
+
+    const size_t id = _freeIds.back();
+    _freeIds.pop_back();
+
+    if ( _order.empty() )
+    {
+        // The first snapshot is a full copy
+        _addrs->saveDump ( &_newest[0] );
+    }
+    else
+    {
+        // Otherwise the previous newest snapshot keeps the blocks that changed
+        Delta& delta = _deltas[_order.back()];
+        size_t offset = 0;
+
+        ASSERT ( delta.blocks.empty() == true );
+
+        _addrs->forEachRange ( [&] ( const char *addr, size_t size )
+        {
+            saveChanges ( addr, size, offset, delta );
+        } );
+
+        ASSERT ( offset == _newest.size() );
+    }
+
+    _order.push_back ( id );
+    return id;
+}
+
+void MemDumpSnapshots::load ( size_t id )
+{
+    ASSERT ( find ( _order.begin(), _order.end(), id ) != _order.end() );
+
+    // Undo changes until the requested snapshot is the newest
+    while ( _order.back() != id )
+    {
+        _freeIds.push_back ( _order.back() );
+        _order.pop_back();
+
+        Delta& delta = _deltas[_order.back()];
+        undo ( delta );
+        delta.clear();
+    }
+
+    _addrs->loadDump ( &_newest[0] );
+}
+
+void MemDumpSnapshots::erase ( size_t id )
+{
+    auto it = find ( _order.begin(), _order.end(), id );
+
+    ASSERT ( it != _order.end() );
+
+    if ( it != _order.begin() )
+    {
+        Delta& older = _deltas[* ( prev ( it ) )];
+
+        if ( next ( it ) == _order.end() )
+        {
+            // The previous snapshot becomes the newest
+            undo ( older );
+            older.clear();
+        }
+        else
+        {
+            // The previous snapshot takes over the changes of this one
+            merge ( older, _deltas[id], _merged );
+            swap ( older, _merged );
+        }
+    }
+
+    _deltas[id].clear();
+    _order.erase ( it );
+    _freeIds.push_back ( id );
+}
+
+void MemDumpSnapshots::clear()
+{
+    _order.clear();
+    _freeIds.clear();
+
+    // Reversed so the ids are used in increasing order
+    for ( size_t i = _deltas.size(); i > 0; --i )
+    {
+        _deltas[i - 1].clear();
+        _freeIds.push_back ( i - 1 );
+    }
+}
+
+size_t MemDumpSnapshots::getUsedBytes() const
+{
+    size_t usedBytes = _newest.size();
+
+    for ( const Delta& delta : _deltas )
+        usedBytes += delta.data.size() + delta.blocks.size() * sizeof ( Block );
+
+    return usedBytes;
+}
+
+void MemDumpSnapshots::saveChanges ( const char *addr, size_t size, size_t& offset, Delta& delta )
+{
+    static const char zeros[MEMDUMP_BLOCK_SIZE] = { 0 };
+
+    // Null pointers are saved as zeros, the same as MemDumpBase::saveDump
+    char *newest = &_newest[offset];
+
+    for ( size_t i = 0; i < size; )
+    {
+        // Skip directly to the next changed byte
+        if ( addr )
+            i += mismatch ( addr + i, newest + i, size - i );
+        else
+            i += mismatch ( zeros, newest + i, min<size_t> ( MEMDUMP_BLOCK_SIZE, size - i ) );
+
+        if ( i >= size )
+            break;
+
+        // Blocks are aligned from the start of each range
+        const size_t start = i - ( i % MEMDUMP_BLOCK_SIZE );
+        const size_t len = min<size_t> ( MEMDUMP_BLOCK_SIZE, size - start );
+
+        delta.blocks.push_back ( { uint32_t ( offset + start ), uint32_t ( len ) } );
+        delta.data.insert ( delta.data.end(), newest + start, newest + start + len );
+
+        memcpy ( newest + start, ( addr ? addr + start : zeros ), len );
+
+        i = start + len;
+    }
+
+    offset += size;
+}
+
+void MemDumpSnapshots::undo ( const Delta& delta )
+{
+    const char *data = delta.data.data();
+
+    for ( const Block& block : delta.blocks )
+    {
+        memcpy ( &_newest[block.offset], data, block.size );
+        data += block.size;
+    }
+
+    ASSERT ( data == delta.data.data() + delta.data.size() );
+}
+
+void MemDumpSnapshots::merge ( const Delta& older, const Delta& newer, Delta& merged ) const
+{
+    merged.clear();
+
+    size_t i = 0, j = 0;
+    const char *a = older.data.data();
+    const char *b = newer.data.data();
+
+    // Both lists of blocks are sorted by offset, and blocks at the same offset have the same size
+    while ( i < older.blocks.size() || j < newer.blocks.size() )
+    {
+        const bool takeOlder = ( j == newer.blocks.size()
+                                 || ( i < older.blocks.size() && older.blocks[i].offset <= newer.blocks[j].offset ) );
+
+        if ( takeOlder )
+        {
+            if ( j < newer.blocks.size() && newer.blocks[j].offset == older.blocks[i].offset )
+                b += newer.blocks[j++].size;
+
+            merged.blocks.push_back ( older.blocks[i] );
+            merged.data.insert ( merged.data.end(), a, a + older.blocks[i].size );
+            a += older.blocks[i++].size;
+        }
+        else
+        {
+            merged.blocks.push_back ( newer.blocks[j] );
+            merged.data.insert ( merged.data.end(), b, b + newer.blocks[j].size );
+            b += newer.blocks[j++].size;
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "MemDump.hpp"
+
+#include <vector>
+#include <list>
+
+
+// Granularity of the changes stored between snapshots, one cache line
+#define MEMDUMP_BLOCK_SIZE ( 64 )
+
+
+// Incremental snapshots of the memory described by a MemDumpList.
+//
+// Only the newest snapshot is stored in full. Every older snapshot is stored as the blocks that changed before
+// the next snapshot was saved, with their previous contents. So saving only compares the memory against the newest
+// snapshot and copies the changed blocks, and loading a recent snapshot only undoes a few sets of blocks.
+class MemDumpSnapshots
+{
+public:
+
+    // Allocate for up to maxSnapshots snapshots of the given memory dumps, which must stay valid until deallocate
+    void allocate ( const MemDumpList& addrs, size_t maxSnapshots );
+
+    // Deallocate all memory
+    void deallocate();
+
+    // Save the current memory as the newest snapshot, returns the snapshot id. Must NOT be full.
+    size_t save();
+
+    // Load a snapshot into memory, all newer snapshots are erased
+    void load ( size_t id );
+
+    // Erase any snapshot, the other snapshots remain valid
+    void erase ( size_t id );
+
+    // Erase all snapshots, but keep the allocated memory
+    void clear();
+
+    // Number of snapshots currently saved
+    size_t size() const { return _order.size(); }
+
+    bool empty() const { return _order.empty(); }
+
+    bool full() const { return _freeIds.empty(); }
+
+    // Total bytes currently used to store snapshots
+    size_t getUsedBytes() const;
+
+private:
+
+    // A changed block in the snapshot data
+    struct Block
+    {
+        uint32_t offset, size;
+    };
+
+    // The blocks that changed between a snapshot and the next one, with the contents of this snapshot
+    struct Delta
+    {
+        std::vector<Block> blocks;
+        std::vector<char> data;
+
+        void clear()
+        {
+            blocks.clear();
+            data.clear();
+        }
+    };
+
+    // The memory dumps to snapshot
+    const MemDumpList *_addrs = 0;
+
+    // The newest snapshot, stored in full
+    std::vector<char> _newest;
+
+    // Deltas indexed by snapshot id, the newest snapshot's delta is always empty
+    std::vector<Delta> _deltas;
+
+    // Snapshot ids in chronological order
+    std::list<size_t> _order;
+
+    // Unused snapshot ids
+    std::vector<size_t> _freeIds;
+
+    // Temporary delta used when merging
+    Delta _merged;
+
+    // Compare a range of the current memory against the newest snapshot, saving the changed blocks to the delta
+    void saveChanges ( const char *addr, size_t size, size_t& offset, Delta& delta );
+
+    // Restore the contents of the delta's blocks into the newest snapshot
+    void undo ( const Delta& delta );
+
+    // Merge an older delta with the next newer delta, the older contents take priority
+    void merge ( const Delta& older, const Delta& newer, Delta& merged ) const;
+};
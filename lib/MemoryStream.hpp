@@ -0,0 +1,103 @@
+#pragma once
+
+#include <streambuf>
+#include <istream>
+#include <ostream>
+
+
+// Read-only stream buffer over an existing region of memory, the bytes are NOT copied.
+// The memory must remain valid for the lifetime of this buffer.
+class MemoryStreamBuffer : public std::streambuf
+{
+public:
+
+    MemoryStreamBuffer ( const char *bytes, size_t len )
+    {
+        char *begin = const_cast<char *> ( bytes );
+        setg ( begin, begin, begin + len );
+    }
+
+    // Number of bytes read so far
+    size_t getPosition() const { return ( gptr() - eback() ); }
+
+    // Number of bytes left to read
+    size_t getRemaining() const { return ( egptr() - gptr() ); }
+
+    // Pointer to the next unread byte
+    const char *getReadPtr() const { return gptr(); }
+
+    // Skip over bytes without reading them, returns false if there are not enough bytes left
+    bool skip ( size_t len )
+    {
+        if ( len > getRemaining() )
+            return false;
+
+        gbump ( ( int ) len );
+        return true;
+    }
+
+protected:
+
+    std::streamsize showmanyc() override
+    {
+        return ( getRemaining() ? std::streamsize ( getRemaining() ) : -1 );
+    }
+};
+
+
+// Binary input stream over an existing region of memory, see MemoryStreamBuffer
+class MemoryInputStream : public std::istream
+{
+public:
+
+    MemoryInputStream ( const char *bytes, size_t len ) : std::istream ( 0 ), _buffer ( bytes, len )
+    {
+        rdbuf ( &_buffer );
+    }
+
+    size_t getPosition() const { return _buffer.getPosition(); }
+
+    size_t getRemaining() const { return _buffer.getRemaining(); }
+
+    const char *getReadPtr() const { return _buffer.getReadPtr(); }
+
+    bool skip ( size_t len ) { return _buffer.skip ( len ); }
+
+private:
+
+    MemoryStreamBuffer _buffer;
+};
+
+
+// Write-only stream buffer over an existing region of memory, writing past the end fails instead of growing.
+// The memory must remain valid for the lifetime of this buffer.
+class MemoryOutputStreamBuffer : public std::streambuf
+{
+public:
+
+    MemoryOutputStreamBuffer ( char *bytes, size_t len )
+    {
+        setp ( bytes, bytes + len );
+    }
+
+    // Number of bytes written so far
+    size_t getPosition() const { return ( pptr() - pbase() ); }
+};
+
+
+// Binary output stream over an existing region of memory, see MemoryOutputStreamBuffer
+class MemoryOutputStream : public std::ostream
+{
+public:
+
+    MemoryOutputStream ( char *bytes, size_t len ) : std::ostream ( 0 ), _buffer ( bytes, len )
+    {
+        rdbuf ( &_buffer );
+    }
+
+    size_t getPosition() const { return _buffer.getPosition(); }
+
+private:
+
+    MemoryOutputStreamBuffer _buffer;
+};
@@ -0,0 +1,234 @@
+#include "NetworkImpairment.hpp"
+#include "TimerManager.hpp"
+#include "KeyValueStore.hpp"
+#include "StringUtils.hpp"
+#include "Logger.hpp"
+
+#include <cmath>
+
+using namespace std;
+
+
+bool NetworkProfile::isEnabled() const
+{
+    return ( latency || jitter || loss > 0 || burstEnter > 0 || reorder > 0 || duplicate > 0 || bandwidth );
+}
+
+bool NetworkProfile::load ( const string& file )
+{
+    KeyValueStore config;
+
+    // Set the current values first, so their types are known, and missing keys are unchanged
+    config.setInteger ( "latency", latency );
+    config.setInteger ( "jitter", jitter );
+    config.setInteger ( "normalJitter", normalJitter );
+    config.setDouble ( "loss", loss );
+    config.setDouble ( "burstEnter", burstEnter );
+    config.setDouble ( "burstExit", burstExit );
+    config.setDouble ( "burstLoss", burstLoss );
+    config.setDouble ( "reorder", reorder );
+    config.setInteger ( "reorderDelay", reorderDelay );
+    config.setDouble ( "duplicate", duplicate );
+    config.setInteger ( "bandwidth", bandwidth );
+    config.setInteger ( "queueLimit", queueLimit );
+
+    if ( ! config.load ( file ) )
+    {
+        LOG ( "Failed to load network profile: '%s'", file );
+        return false;
+    }
+
+    latency = max ( 0, config.getInteger ( "latency" ) );
+    jitter = max ( 0, config.getInteger ( "jitter" ) );
+    normalJitter = config.getInteger ( "normalJitter" );
+    loss = config.getDouble ( "loss" );
+    burstEnter = config.getDouble ( "burstEnter" );
+    burstExit = config.getDouble ( "burstExit" );
+    burstLoss = config.getDouble ( "burstLoss" );
+    reorder = config.getDouble ( "reorder" );
+    reorderDelay = max ( 0, config.getInteger ( "reorderDelay" ) );
+    duplicate = config.getDouble ( "duplicate" );
+    bandwidth = max ( 0, config.getInteger ( "bandwidth" ) );
+    queueLimit = max ( 0, config.getInteger ( "queueLimit" ) );
+
+    LOG ( "Loaded network profile '%s': %s", file, str() );
+    return true;
+}
+
+bool NetworkProfile::save ( const string& file ) const
+{
+    KeyValueStore config;
+
+    config.setInteger ( "latency", latency );
+    config.setInteger ( "jitter", jitter );
+    config.setInteger ( "normalJitter", normalJitter );
+    config.setDouble ( "loss", loss );
+    config.setDouble ( "burstEnter", burstEnter );
+    config.setDouble ( "burstExit", burstExit );
+    config.setDouble ( "burstLoss", burstLoss );
+    config.setDouble ( "reorder", reorder );
+    config.setInteger ( "reorderDelay", reorderDelay );
+    config.setDouble ( "duplicate", duplicate );
+    config.setInteger ( "bandwidth", bandwidth );
+    config.setInteger ( "queueLimit", queueLimit );
+
+    return config.save ( file );
+}
+
+string NetworkProfile::str() const
+{
+    return format ( "latency=%u; jitter=%u%s; loss=%.1f; burst={ %.1f, %.1f, %.1f }; reorder=%.1f (%u ms); "
+                    "duplicate=%.1f; bandwidth=%u kbps (%u bytes)", latency, jitter, ( normalJitter ? " (normal)" : "" ),
+                    loss, burstEnter, burstExit, burstLoss, reorder, reorderDelay, duplicate, bandwidth, queueLimit );
+}
+
+
+NetworkImpairment::NetworkImpairment ( Owner *owner, const NetworkProfile& profile, bool isStream )
+    : owner ( owner ), isStream ( isStream ), _profile ( profile ), _random ( random_device()() ), _timer ( this )
+{
+}
+
+bool NetworkImpairment::chance ( double percentage )
+{
+    if ( percentage <= 0 )
+        return false;
+
+    return ( uniform_real_distribution<double> ( 0, 100 ) ( _random ) < percentage );
+}
+
+double NetworkImpairment::getDelay()
+{
+    double delay = _profile.latency;
+
+    if ( _profile.jitter )
+    {
+        if ( _profile.normalJitter )
+            delay += normal_distribution<double> ( 0, _profile.jitter ) ( _random );
+        else
+            delay += uniform_real_distribution<double> ( - ( double ) _profile.jitter, _profile.jitter ) ( _random );
+    }
+
+    return max ( 0.0, delay );
+}
+
+void NetworkImpairment::push ( const char *bytes, size_t len, const IpAddrPort& address )
+{
+    push ( bytes, len, address, TimerManager::get().getNow ( true ) );
+}
+
+void NetworkImpairment::push ( const char *bytes, size_t len, const IpAddrPort& address, uint64_t now )
+{
+    ++_counters.packets;
+    _counters.bytes += len;
+
+    // Gilbert-Elliott state transition, then loss depending on the state
+    if ( _burst )
+        _burst = ! chance ( _profile.burstExit );
+    else
+        _burst = chance ( _profile.burstEnter );
+
+    const bool lost = chance ( _burst ? _profile.burstLoss : _profile.loss );
+
+    if ( lost && ! isStream )
+    {
+        ++_counters.lost;
+        return;
+    }
+
+    double start = now;
+
+    // Wait for the link to be free, and drop the packet if too many bytes are already waiting
+    if ( _profile.bandwidth )
+    {
+        const double bytesPerMs = _profile.bandwidth / 8.0;
+
+        start = max ( start, _linkFree );
+
+        if ( ( start - now ) * bytesPerMs > _profile.queueLimit )
+        {
+            ++_counters.dropped;
+            return;
+        }
+
+        _linkFree = start + len / bytesPerMs;
+        start = _linkFree;
+    }
+
+    double delay = getDelay();
+
+    if ( isStream )
+    {
+        // A lost packet is retransmitted after a round trip, and a stream is always released in order
+        if ( lost )
+        {
+            ++_counters.lost;
+            delay += 2 * _profile.latency;
+        }
+
+        const uint64_t release = max<uint64_t> ( _lastStreamRelease, ( uint64_t ) llround ( start + delay ) );
+
+        _lastStreamRelease = release;
+        _queue.push ( { release, _order++, string ( bytes, len ), address } );
+    }
+    else
+    {
+        if ( chance ( _profile.reorder ) )
+        {
+            ++_counters.reordered;
+            delay += _profile.reorderDelay;
+        }
+
+        _queue.push ( { ( uint64_t ) llround ( start + delay ), _order++, string ( bytes, len ), address } );
+
+        // Duplicates get their own delay
+        if ( chance ( _profile.duplicate ) )
+        {
+            ++_counters.duplicated;
+            _queue.push ( { ( uint64_t ) llround ( start + getDelay() ), _order++, string ( bytes, len ), address } );
+        }
+    }
+
+    schedule ( now );
+}
+
+bool NetworkImpairment::release ( uint64_t now )
+{
+    while ( ! _queue.empty() && _queue.top().release <= now )
+    {
+        const Packet packet = _queue.top();
+        _queue.pop();
+
+        ++_counters.released;
+
+        if ( owner && ! owner->impairmentReleased ( this, packet.bytes, packet.address ) )
+            return false;
+    }
+
+    schedule ( now );
+    return true;
+}
+
+uint64_t NetworkImpairment::getNextRelease() const
+{
+    if ( _queue.empty() )
+        return UINT64_MAX;
+
+    return _queue.top().release;
+}
+
+void NetworkImpairment::schedule ( uint64_t now )
+{
+    if ( _queue.empty() )
+    {
+        _timer.stop();
+        return;
+    }
+
+    // Timers need a non-zero delay
+    _timer.start ( max<uint64_t> ( 1, getNextRelease() > now ? getNextRelease() - now : 0 ) );
+}
+
+void NetworkImpairment::timerExpired ( Timer *timer )
+{
+    release ( TimerManager::get().getNow() );
+}
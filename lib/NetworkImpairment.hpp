@@ -0,0 +1,149 @@
+#pragma once
+
+#include "IpAddrPort.hpp"
+#include "Timer.hpp"
+
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// Network conditions to emulate on a socket, for testing purposes
+struct NetworkProfile
+{
+    // One way latency and jitter in milliseconds
+    uint32_t latency = 0, jitter = 0;
+
+    // Jitter is uniform within +/- jitter, otherwise normal with jitter as the standard deviation
+    bool normalJitter = false;
+
+    // Packet loss percentage, this is the loss in the good state of the Gilbert-Elliott model
+    double loss = 0;
+
+    // Gilbert-Elliott burst loss, the percentage chance for each packet to enter and leave the bad state,
+    // and the packet loss percentage in the bad state. The mean burst length is 100 / burstExit packets.
+    double burstEnter = 0, burstExit = 100, burstLoss = 100;
+
+    // Percentage of packets that are held back an extra reorderDelay milliseconds, so later packets overtake them
+    double reorder = 0;
+    uint32_t reorderDelay = 0;
+
+    // Percentage of packets that are sent twice
+    double duplicate = 0;
+
+    // Bandwidth cap in kilobits per second, 0 is unlimited.
+    // Packets wait in a queue for the link, and are dropped if more than queueLimit bytes are already waiting.
+    uint32_t bandwidth = 0, queueLimit = 64 * 1024;
+
+    // If this profile changes anything
+    bool isEnabled() const;
+
+    // Load from a file of key=value lines with the same names as above, missing keys keep their current values
+    bool load ( const std::string& file );
+
+    bool save ( const std::string& file ) const;
+
+    std::string str() const;
+};
+
+
+// Send or receive shim that delays, drops, duplicates, and reorders packets according to a NetworkProfile.
+// Packets are released to the owner by a timer, so this only works while the TimerManager is being checked.
+// Streams (ie TCP) are never reordered or duplicated, and lost packets are delayed like they were retransmitted.
+class NetworkImpairment : private Timer::Owner
+{
+public:
+
+    struct Owner
+    {
+        // Packet released after its delay, returns false if this impairment was deleted by the owner
+        virtual bool impairmentReleased ( NetworkImpairment *impairment,
+                                          const std::string& bytes, const IpAddrPort& address ) = 0;
+    };
+
+    // Counters for each fate of a packet
+    struct Counters
+    {
+        uint64_t packets = 0, bytes = 0, lost = 0, dropped = 0, duplicated = 0, reordered = 0, released = 0;
+    };
+
+    Owner *owner = 0;
+
+    const bool isStream;
+
+    NetworkImpairment ( Owner *owner, const NetworkProfile& profile, bool isStream );
+
+    // Changing the profile only affects packets pushed after this
+    void setProfile ( const NetworkProfile& profile ) { _profile = profile; }
+    const NetworkProfile& getProfile() const { return _profile; }
+
+    // Seed the random number generator, for reproducible tests
+    void seed ( uint32_t seed ) { _random.seed ( seed ); }
+
+    // Push a packet, it is released to the owner after its delay, unless it is lost
+    void push ( const char *bytes, size_t len, const IpAddrPort& address );
+
+    // Push a packet at the given time in milliseconds
+    void push ( const char *bytes, size_t len, const IpAddrPort& address, uint64_t now );
+
+    // Release all the packets that are due at the given time in milliseconds.
+    // Returns false if this impairment was deleted by the owner.
+    bool release ( uint64_t now );
+
+    // Number of packets waiting to be released
+    size_t getQueued() const { return _queue.size(); }
+
+    // The time the next packet will be released, or UINT64_MAX if none
+    uint64_t getNextRelease() const;
+
+    const Counters& getCounters() const { return _counters; }
+
+private:
+
+    struct Packet
+    {
+        uint64_t release, order;
+        std::string bytes;
+        IpAddrPort address;
+
+        // Reversed for priority_queue, so the earliest packet is on top
+        bool operator< ( const Packet& other ) const
+        {
+            return ( release != other.release ? release > other.release : order > other.order );
+        }
+    };
+
+    NetworkProfile _profile;
+
+    std::priority_queue<Packet> _queue;
+
+    // Incremented for each packet, so packets with the same release time are released in order
+    uint64_t _order = 0;
+
+    // If in the bad state of the Gilbert-Elliott model
+    bool _burst = false;
+
+    // The time in milliseconds when the link is free to send the next packet, for the bandwidth cap
+    double _linkFree = 0;
+
+    // Release time of the last packet of a stream, to keep it in order
+    uint64_t _lastStreamRelease = 0;
+
+    std::mt19937 _random;
+
+    Counters _counters;
+
+    Timer _timer;
+
+    // Percentage chance
+    bool chance ( double percentage );
+
+    // Delay in milliseconds for one packet, excluding the bandwidth cap
+    double getDelay();
+
+    // Start the timer for the next release
+    void schedule ( uint64_t now );
+
+    void timerExpired ( Timer *timer ) override;
+};
@@ -5,7 +5,7 @@
 #include "Statistics.hpp"
 
 
-struct Ping : public SerializableMessage
+struct Ping : public SerializableMessage // protocol: compress=0 integrity=CRC32C
 {
     uint64_t timestamp;
 
@@ -46,6 +46,7 @@ public:
 
     void gotPong ( const MsgPtr& ping );
 
+    // One way latency in milliseconds, including a histogram of every sample for percentiles
     const Statistics& getStats() const { return _stats; }
 
     uint8_t getPacketLoss() const { return _packetLoss; }
@@ -0,0 +1,328 @@
+#include "Poller.hpp"
+#include "Exceptions.hpp"
+#include "ErrorStrings.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include <climits>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+
+// Maximum number of events returned by each epoll_wait, the rest are returned by the next wait
+#define MAX_EPOLL_EVENTS ( 256 )
+
+#ifdef _WIN32
+
+#define THROW_SOCKET_EXCEPTION(DEBUG)                                                           \
+    THROW_WIN_EXCEPTION ( WSAGetLastError(), DEBUG, ERROR_NETWORK_GENERIC )
+
+#define CLOSE_SOCKET(FD) closesocket ( FD )
+
+typedef int socklen_t;
+
+#else
+
+#define THROW_SOCKET_EXCEPTION(DEBUG)                                                           \
+    THROW_EXCEPTION ( DEBUG ": %s", ERROR_NETWORK_GENERIC, strerror ( errno ) )
+
+#define CLOSE_SOCKET(FD) ::close ( FD )
+
+#endif // _WIN32
+
+
+PollerPtr Poller::create()
+{
+#ifdef __linux__
+    PollerPtr poller ( new EpollPoller() );
+#else
+    PollerPtr poller ( new SelectPoller() );
+#endif
+
+    LOG ( "Using %s poller", poller->getName() );
+
+    return poller;
+}
+
+
+struct SelectPoller::FdSets
+{
+    fd_set read, write;
+};
+
+SelectPoller::SelectPoller() : _sets ( new FdSets() )
+{
+    FD_ZERO ( &_sets->read );
+    FD_ZERO ( &_sets->write );
+
+    // Select can't wait on anything else, so wake with a datagram from a loopback socket to itself
+    _wakeFd = ::socket ( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+
+#ifdef _WIN32
+    if ( _wakeFd == ( int ) INVALID_SOCKET )
+#else
+    if ( _wakeFd < 0 )
+#endif
+        THROW_SOCKET_EXCEPTION ( "socket failed" );
+
+    sockaddr_in sa;
+    socklen_t saLen = sizeof ( sa );
+
+    memset ( &sa, 0, sizeof ( sa ) );
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+    sa.sin_port = 0;
+
+    if ( ::bind ( _wakeFd, ( sockaddr * ) &sa, sizeof ( sa ) ) != 0
+            || getsockname ( _wakeFd, ( sockaddr * ) &sa, &saLen ) != 0
+            || ::connect ( _wakeFd, ( sockaddr * ) &sa, sizeof ( sa ) ) != 0 )
+    {
+        CLOSE_SOCKET ( _wakeFd );
+        THROW_SOCKET_EXCEPTION ( "Failed to create wake socket" );
+    }
+
+#ifdef _WIN32
+    u_long flag = 1;
+    ioctlsocket ( _wakeFd, FIONBIO, &flag );
+#else
+    fcntl ( _wakeFd, F_SETFL, fcntl ( _wakeFd, F_GETFL ) | O_NONBLOCK );
+#endif
+
+    FD_SET ( _wakeFd, &_sets->read );
+    _maxFd = _wakeFd;
+}
+
+SelectPoller::~SelectPoller()
+{
+    CLOSE_SOCKET ( _wakeFd );
+}
+
+void SelectPoller::set ( int fd, uint8_t events, void *data )
+{
+    if ( _fds.find ( fd ) == _fds.end() )
+    {
+#ifdef _WIN32
+        // WinSock fd_sets are arrays of FD_SETSIZE sockets, including the wake socket
+        if ( _fds.size() + 1 >= FD_SETSIZE )
+#else
+        // POSIX fd_sets are bitmaps of FD_SETSIZE bits
+        if ( fd >= FD_SETSIZE )
+#endif
+            THROW_EXCEPTION ( "Too many sockets for select", ERROR_NETWORK_GENERIC );
+    }
+
+    _fds[fd] = { events, data };
+
+    FD_CLR ( fd, &_sets->read );
+    FD_CLR ( fd, &_sets->write );
+
+    if ( events & POLL_READ )
+        FD_SET ( fd, &_sets->read );
+
+    if ( events & POLL_WRITE )
+        FD_SET ( fd, &_sets->write );
+
+    _maxFd = max ( _maxFd, fd );
+}
+
+void SelectPoller::remove ( int fd )
+{
+    if ( ! _fds.erase ( fd ) )
+        return;
+
+    FD_CLR ( fd, &_sets->read );
+    FD_CLR ( fd, &_sets->write );
+
+    if ( fd < _maxFd )
+        return;
+
+    _maxFd = _wakeFd;
+
+    for ( const auto& kv : _fds )
+        _maxFd = max ( _maxFd, kv.first );
+}
+
+void SelectPoller::wait ( uint64_t timeout, vector<Event>& events )
+{
+    events.clear();
+
+    FdSets ready = *_sets;
+
+    timeval tv;
+    tv.tv_sec = timeout / 1000UL;
+    tv.tv_usec = ( timeout * 1000UL ) % 1000000UL;
+
+    // Note: select should be called between timeBeginPeriod / timeEndPeriod to ensure accurate timeouts
+    const int count = select ( _maxFd + 1, &ready.read, &ready.write, 0, &tv );
+
+#ifdef _WIN32
+    if ( count == SOCKET_ERROR )
+        THROW_SOCKET_EXCEPTION ( "select failed" );
+#else
+    if ( count < 0 && errno == EINTR )
+        return;
+
+    if ( count < 0 )
+        THROW_SOCKET_EXCEPTION ( "select failed" );
+#endif
+
+    if ( count == 0 )
+        return;
+
+    if ( FD_ISSET ( _wakeFd, &ready.read ) )
+    {
+        char buffer[64];
+        while ( ::recv ( _wakeFd, buffer, sizeof ( buffer ), 0 ) > 0 );
+    }
+
+    for ( const auto& kv : _fds )
+    {
+        uint8_t ev = 0;
+
+        if ( ( kv.second.events & POLL_READ ) && FD_ISSET ( kv.first, &ready.read ) )
+            ev |= POLL_READ;
+
+        if ( ( kv.second.events & POLL_WRITE ) && FD_ISSET ( kv.first, &ready.write ) )
+            ev |= POLL_WRITE;
+
+        if ( ev )
+            events.push_back ( { kv.second.data, ev } );
+    }
+}
+
+void SelectPoller::wake()
+{
+    const char byte = 0;
+    ::send ( _wakeFd, &byte, 1, 0 );
+}
+
+
+#ifdef __linux__
+
+EpollPoller::EpollPoller()
+{
+    _epollFd = epoll_create1 ( EPOLL_CLOEXEC );
+
+    if ( _epollFd < 0 )
+        THROW_SOCKET_EXCEPTION ( "epoll_create1 failed" );
+
+    _wakeFd = eventfd ( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+    if ( _wakeFd < 0 )
+    {
+        ::close ( _epollFd );
+        THROW_SOCKET_EXCEPTION ( "eventfd failed" );
+    }
+
+    // The wake fd is identified by pointing to itself
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &_wakeFd;
+
+    if ( epoll_ctl ( _epollFd, EPOLL_CTL_ADD, _wakeFd, &ev ) != 0 )
+    {
+        ::close ( _wakeFd );
+        ::close ( _epollFd );
+        THROW_SOCKET_EXCEPTION ( "epoll_ctl failed" );
+    }
+
+    _buffer.resize ( 1 );
+}
+
+EpollPoller::~EpollPoller()
+{
+    ::close ( _wakeFd );
+    ::close ( _epollFd );
+}
+
+void EpollPoller::set ( int fd, uint8_t events, void *data )
+{
+    epoll_event ev;
+    ev.events = ( ( events & POLL_READ ) ? EPOLLIN : 0 ) | ( ( events & POLL_WRITE ) ? EPOLLOUT : 0 );
+    ev.data.ptr = data;
+
+    if ( epoll_ctl ( _epollFd, EPOLL_CTL_ADD, fd, &ev ) != 0 )
+    {
+        if ( errno != EEXIST || epoll_ctl ( _epollFd, EPOLL_CTL_MOD, fd, &ev ) != 0 )
+            THROW_SOCKET_EXCEPTION ( "epoll_ctl failed" );
+    }
+
+    _fds.insert ( fd );
+    _buffer.resize ( min<size_t> ( _fds.size() + 1, MAX_EPOLL_EVENTS ) );
+}
+
+void EpollPoller::remove ( int fd )
+{
+    if ( ! _fds.erase ( fd ) )
+        return;
+
+    // Closed fds are already removed from the epoll set, so errors are ignored
+    epoll_event ev;
+    epoll_ctl ( _epollFd, EPOLL_CTL_DEL, fd, &ev );
+}
+
+void EpollPoller::wait ( uint64_t timeout, vector<Event>& events )
+{
+    events.clear();
+
+    const int count = epoll_wait ( _epollFd, &_buffer[0], _buffer.size(), min<uint64_t> ( timeout, INT_MAX ) );
+
+    if ( count < 0 && errno == EINTR )
+        return;
+
+    if ( count < 0 )
+        THROW_SOCKET_EXCEPTION ( "epoll_wait failed" );
+
+    for ( int i = 0; i < count; ++i )
+    {
+        const epoll_event& ev = _buffer[i];
+
+        if ( ev.data.ptr == &_wakeFd )
+        {
+            uint64_t value;
+            while ( ::read ( _wakeFd, &value, sizeof ( value ) ) > 0 );
+            continue;
+        }
+
+        uint8_t ready = 0;
+
+        if ( ev.events & EPOLLIN )
+            ready |= POLL_READ;
+
+        if ( ev.events & EPOLLOUT )
+            ready |= POLL_WRITE;
+
+        // Errors are reported as both, like select, so the socket can find the error when it reads or connects
+        if ( ev.events & ( EPOLLERR | EPOLLHUP ) )
+            ready |= ( POLL_READ | POLL_WRITE );
+
+        events.push_back ( { ev.data.ptr, ready } );
+    }
+}
+
+void EpollPoller::wake()
+{
+    const uint64_t value = 1;
+
+    if ( ::write ( _wakeFd, &value, sizeof ( value ) ) < 0 )
+        LOG ( "eventfd write failed: %s", strerror ( errno ) );
+}
+
+#endif // __linux__
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+
+// Readiness events to wait for
+#define POLL_READ       ( 0x01 )
+#define POLL_WRITE      ( 0x02 )
+
+
+class Poller;
+
+typedef std::shared_ptr<Poller> PollerPtr;
+
+
+// Waits for readiness events on a set of sockets. The set of sockets persists between waits, so it only needs to be
+// updated when a socket is added, removed, or changes the events it is waiting for.
+class Poller
+{
+public:
+
+    struct Event
+    {
+        // The data the socket was set with
+        void *data;
+
+        // POLL_READ and / or POLL_WRITE
+        uint8_t events;
+    };
+
+    virtual ~Poller() {}
+
+    // Add a socket or update the events to wait for, the data is returned with each event
+    virtual void set ( int fd, uint8_t events, void *data ) = 0;
+
+    // Remove a socket, the socket may already be closed
+    virtual void remove ( int fd ) = 0;
+
+    // Wait for events, returns after the timeout in milliseconds, or as soon as there are any events, or after wake
+    virtual void wait ( uint64_t timeout, std::vector<Event>& events ) = 0;
+
+    // Interrupt the current or next wait, can be called on a different thread
+    virtual void wake() = 0;
+
+    // Get the name of the backend
+    virtual const char *getName() const = 0;
+
+    // Create the best backend for this platform, throws Exception on failure
+    static PollerPtr create();
+};
+
+
+// Backend using select, this works with WinSock and POSIX sockets
+class SelectPoller : public Poller
+{
+public:
+
+    // Throws Exception on failure
+    SelectPoller();
+    ~SelectPoller() override;
+
+    void set ( int fd, uint8_t events, void *data ) override;
+    void remove ( int fd ) override;
+    void wait ( uint64_t timeout, std::vector<Event>& events ) override;
+    void wake() override;
+
+    const char *getName() const override { return "select"; }
+
+private:
+
+    struct Interest
+    {
+        uint8_t events;
+        void *data;
+    };
+
+    // Mapping: fd -> events and data
+    std::unordered_map<int, Interest> _fds;
+
+    // Persistent fd_sets, copied for each select call
+    struct FdSets;
+    std::unique_ptr<FdSets> _sets;
+
+    // Largest fd for POSIX select
+    int _maxFd = 0;
+
+    // Loopback UDP socket connected to itself, used to wake select
+    int _wakeFd = 0;
+};
+
+
+#ifdef __linux__
+
+// Backend using epoll, only the ready sockets are returned, so waiting doesn't depend on the number of sockets
+class EpollPoller : public Poller
+{
+public:
+
+    // Throws Exception on failure
+    EpollPoller();
+    ~EpollPoller() override;
+
+    void set ( int fd, uint8_t events, void *data ) override;
+    void remove ( int fd ) override;
+    void wait ( uint64_t timeout, std::vector<Event>& events ) override;
+    void wake() override;
+
+    const char *getName() const override { return "epoll"; }
+
+private:
+
+    int _epollFd = -1;
+
+    // eventfd used to wake epoll_wait
+    int _wakeFd = -1;
+
+    // Registered sockets, used to size the event buffer
+    std::unordered_set<int> _fds;
+
+    // Buffer for epoll_wait
+    std::vector<epoll_event> _buffer;
+};
+
+#endif // __linux__
@@ -2,6 +2,7 @@
 #include "Protocol.include.hpp"
 #include "Protocol.inlineimpl.hpp"
 #include "Compression.hpp"
+#include "MemoryStream.hpp"
 #include "Logger.hpp"
 #include "Enum.hpp"
 
@@ -20,72 +21,171 @@ using namespace cereal;
 Compressed:
 
     1 byte  message type
-    1 byte  compression level
+    1 byte  header
     4 byte  uncompressed size
-    4 byte  compressed data size
+    8 byte  compressed data size
     ...     compressed data
             ========================
             ...     raw data
-            16 byte hash
+            ...     hash
             ========================
 
 Not compressed:
 
     1 byte  message type
-    1 byte  compression level
+    1 byte  header
     ========================
     ...     raw data
-    16 byte hash
+    ...     hash
     ========================
 
+Header:
+
+    WIRE_VERSION_LEGACY: compression level, the hash is always a 16 byte MD5
+
+    WIRE_VERSION_POLICY: 0x80 | ( integrity << 4 ) | compression level, the hash size depends on the integrity check
+
+    WIRE_VERSION_COMPACT: same as WIRE_VERSION_POLICY | 0x40, the raw data may use a compact encoding
+
 */
 
 
+// Header flag indicating WIRE_VERSION_POLICY, legacy compression levels never set this
+#define HEADER_POLICY_FLAG ( 0x80 )
+
+// Header flag indicating WIRE_VERSION_COMPACT
+#define HEADER_COMPACT_FLAG ( 0x40 )
+
 // Encode with compression
-string encodeStageTwo ( const MsgPtr& msg, const string& msgData );
+string encodeStageTwo ( const MsgPtr& msg, const string& msgData,
+                        uint8_t wireVersion, const MsgPolicy& policy, Integrity integrity );
 
 // Result of the decode
 ENUM ( DecodeResult, Failed, NotCompressed, Compressed );
 
-// Decode with compression. Must manually update the value of consumed if the data was not compressed.
-DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, MsgType& type, string& msgData );
+// Decode with compression. On success msgData points to the message data, which is either in the original bytes,
+// or in the decompressed buffer. Must manually update the value of consumed if the data was not compressed.
+DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, MsgType& type,
+                              uint8_t& wireVersion, Integrity& integrity,
+                              const char *& msgData, size_t& msgLen, string& buffer );
+
+// Size of the hash appended for each integrity check
+static size_t getHashSize ( Integrity integrity )
+{
+    switch ( integrity.value )
+    {
+        case Integrity::None:
+            return 0;
+
+        case Integrity::CRC32C:
+            return 4;
+
+        default:
+            return 16;
+    }
+}
+
+// Calculate the hash for an integrity check
+static void getHash ( Integrity integrity, const char *bytes, size_t len, char *hash )
+{
+    switch ( integrity.value )
+    {
+        case Integrity::None:
+            break;
+
+        case Integrity::CRC32C:
+        {
+            // Always little endian on the wire
+            const uint32_t crc = getCRC32C ( bytes, len );
+            hash[0] = ( crc & 0xFF );
+            hash[1] = ( ( crc >> 8 ) & 0xFF );
+            hash[2] = ( ( crc >> 16 ) & 0xFF );
+            hash[3] = ( ( crc >> 24 ) & 0xFF );
+            break;
+        }
 
+        default:
+            getMD5 ( bytes, len, hash );
+            break;
+    }
+}
 
-string Protocol::encode ( const Serializable& message )
+// Check the hash for an integrity check
+static bool checkHash ( Integrity integrity, const char *bytes, size_t len, const char *hash )
+{
+    char expected[16];
+    getHash ( integrity, bytes, len, expected );
+    return !memcmp ( expected, hash, getHashSize ( integrity ) );
+}
+
+
+MsgPolicy Protocol::getPolicy ( MsgType type )
+{
+    MsgPolicy policy;
+
+    switch ( type )
+    {
+#include "Protocol.policy.hpp"
+
+        default:
+            break;
+    }
+
+    return policy;
+}
+
+Integrity Protocol::getIntegrity ( MsgType type, uint8_t wireVersion )
+{
+    if ( wireVersion < WIRE_VERSION_POLICY )
+        return Integrity::MD5;
+
+    return getPolicy ( type ).integrity;
+}
+
+string Protocol::encode ( const Serializable& message, uint8_t wireVersion )
 {
     MsgPtr msg ( const_cast<Serializable *> ( &message ), ignoreMsgPtr );
-    return encode ( msg );
+    return encode ( msg, wireVersion );
 }
 
-string Protocol::encode ( Serializable *message )
+string Protocol::encode ( Serializable *message, uint8_t wireVersion )
 {
     if ( ! message )
         return "";
 
     MsgPtr msg ( message );
-    return encode ( msg );
+    return encode ( msg, wireVersion );
 }
 
-string Protocol::encode ( const MsgPtr& msg )
+string Protocol::encode ( const MsgPtr& msg, uint8_t wireVersion )
 {
     if ( ! msg.get() )
         return "";
 
+    const MsgPolicy policy = getPolicy ( msg->getMsgType() );
+    const Integrity integrity = ( wireVersion < WIRE_VERSION_POLICY ? Integrity::MD5 : policy.integrity );
+
     ostringstream ss ( stringstream::binary );
     BinaryOutputArchive archive ( ss );
 
     // Encode base message data
     msg->saveBase ( archive );
 
+    // The hash must be recalculated if the message data was last encoded with a different wire version
+    const bool wireVersionChanged = ( msg->_wireVersion != wireVersion );
+    msg->_wireVersion = wireVersion;
+
     // Encode actual message data
     msg->save ( archive );
 
 #ifndef DISABLE_UPDATE_HASH
-    // Update the hash
-    if ( msg->_hashValid )
+    // Update the hash, also if it was calculated for a different integrity check
+    if ( msg->_hashValid || msg->_hashIntegrity != integrity.value || wireVersionChanged )
     {
-        getMD5 ( ss.str(), &msg->_hash[0] );
+        const string data = ss.str();
+        getHash ( integrity, &data[0], data.size(), &msg->_hash[0] );
         msg->_hashValid = false;
+        msg->_hashIntegrity = integrity.value;
 
 #ifdef LOG_PROTOCOL
         LOG ( "%s", msg->getMsgType() );
@@ -97,10 +197,66 @@ string Protocol::encode ( const MsgPtr& msg )
 #endif // NOT DISABLE_UPDATE_HASH
 
     // Encode hash at the end of message data
-    archive ( msg->_hash );
+    archive ( binary_data ( &msg->_hash[0], getHashSize ( integrity ) ) );
 
     // Encode with compression
-    return encodeStageTwo ( msg, ss.str() );
+    return encodeStageTwo ( msg, ss.str(), wireVersion, policy, integrity );
+}
+
+void Protocol::saveRaw ( const Serializable& msg, BinaryOutputArchive& archive )
+{
+    // Both ends are the same build, so always use the latest encoding, but keep the wire version the hash is for
+    const uint8_t wireVersion = msg._wireVersion;
+    msg._wireVersion = WIRE_VERSION_LATEST;
+
+    try
+    {
+        archive ( msg.getMsgType() );
+        msg.saveBase ( archive );
+        msg.save ( archive );
+    }
+    catch ( ... )
+    {
+        msg._wireVersion = wireVersion;
+        throw;
+    }
+
+    msg._wireVersion = wireVersion;
+}
+
+MsgPtr Protocol::loadRaw ( const char *bytes, size_t len )
+{
+    MemoryInputStream ss ( bytes, len );
+    BinaryInputArchive archive ( ss );
+    MsgPtr msg;
+
+    try
+    {
+        MsgType type;
+        archive ( type );
+
+        // Construct the correct message type
+        switch ( type )
+        {
+#include "Protocol.switchdecode.hpp"
+
+            default:
+                return NullMsg;
+        }
+
+        msg->_wireVersion = WIRE_VERSION_LATEST;
+        msg->loadBase ( archive );
+        msg->load ( archive );
+    }
+    catch ( const std::exception& exc )
+    {
+#ifdef LOG_PROTOCOL
+        LOG ( "std::exception: '%s'", exc.what() );
+#endif
+        return NullMsg;
+    }
+
+    return msg;
 }
 
 MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
@@ -114,10 +270,14 @@ MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
     }
 
     MsgType type;
-    string data;
+    uint8_t wireVersion;
+    Integrity integrity;
+    const char *data = 0;
+    size_t dataLen = 0;
+    string buffer;
 
     // Decode with compression
-    DecodeResult result = decodeStageTwo ( bytes, len, consumed, type, data );
+    DecodeResult result = decodeStageTwo ( bytes, len, consumed, type, wireVersion, integrity, data, dataLen, buffer );
 
 #ifdef LOG_PROTOCOL
     LOG ( "decodeStageTwo: result=%s", result );
@@ -130,11 +290,12 @@ MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
     }
 
 #ifdef LOG_PROTOCOL
-    if ( data.size() <= 256 )
-        LOG ( "decodeStageTwo: data=[ %s ]", formatAsHex ( data ) );
+    if ( dataLen <= 256 )
+        LOG ( "decodeStageTwo: data=[ %s ]", formatAsHex ( data, dataLen ) );
 #endif
 
-    istringstream ss ( data, stringstream::binary );
+    // Read directly from the message data without copying it
+    MemoryInputStream ss ( data, dataLen );
     BinaryInputArchive archive ( ss );
 
     try
@@ -149,6 +310,8 @@ MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
                 return NullMsg;
         }
 
+        msg->_wireVersion = wireVersion;
+
         // Decode base message data
         msg->loadBase ( archive );
 
@@ -156,8 +319,9 @@ MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
         msg->load ( archive );
 
         // Decode hash at end of message data
-        archive ( msg->_hash );
+        archive ( binary_data ( &msg->_hash[0], getHashSize ( integrity ) ) );
         msg->_hashValid = false;
+        msg->_hashIntegrity = integrity.value;
     }
     catch ( const cereal::Exception& exc )
     {
@@ -187,31 +351,32 @@ MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
         return NullMsg;
     }
 
-    size_t dataSize = data.size();
+    // Size of the message data that was actually read
+    const size_t dataSize = ss.getPosition();
 
     // decodeStageTwo does not update the value of consumed if the data was not compressed
     if ( result == DecodeResult::NotCompressed )
     {
-        // Check for unread bytes
-        size_t remaining = ss.rdbuf()->in_avail();
-        ASSERT ( len >= remaining );
-        consumed = ( len - remaining );
-        dataSize = ( data.size() - remaining );
+        ASSERT ( data >= bytes );
+        ASSERT ( ( data - bytes ) + dataSize <= len );
+        consumed = ( data - bytes ) + dataSize;
     }
 
 #ifndef DISABLE_UPDATE_HASH
+    const size_t hashSize = getHashSize ( integrity );
+
     // Check if the hash is correct
-    if ( ! checkMD5 ( &data[0], dataSize - msg->_hash.size(), &msg->_hash[0] ) )
+    if ( ! checkHash ( integrity, data, dataSize - hashSize, &msg->_hash[0] ) )
     {
 #ifdef LOG_PROTOCOL
-        LOG ( "hash check failed for %s", type );
-        LOG ( "data=[ %s ]", formatAsHex ( &data[0], dataSize - msg->_hash.size() ) );
-        LOG ( "hash    =[ %s ]", formatAsHex ( msg->_hash, msg->_hash.size() ) );
+        LOG ( "%s check failed for %s", integrity, type );
+        LOG ( "data=[ %s ]", formatAsHex ( data, dataSize - hashSize ) );
+        LOG ( "hash    =[ %s ]", formatAsHex ( &msg->_hash[0], hashSize ) );
 
-        char hash[msg->_hash.size()];
-        gethash ( &data[0], dataSize - msg->_hash.size(), hash );
+        char hash[16];
+        getHash ( integrity, data, dataSize - hashSize, hash );
 
-        LOG ( "expected=[ %s ]", formatAsHex ( hash, msg->_hash.size() ) );
+        LOG ( "expected=[ %s ]", formatAsHex ( hash, hashSize ) );
 #endif
         return NullMsg;
     }
@@ -220,7 +385,8 @@ MsgPtr Protocol::decode ( const char *bytes, size_t len, size_t& consumed )
     return msg;
 }
 
-string encodeStageTwo ( const MsgPtr& msg, const string& msgData )
+string encodeStageTwo ( const MsgPtr& msg, const string& msgData,
+                        uint8_t wireVersion, const MsgPolicy& policy, Integrity integrity )
 {
     ostringstream ss ( stringstream::binary );
     BinaryOutputArchive archive ( ss );
@@ -228,21 +394,37 @@ string encodeStageTwo ( const MsgPtr& msg, const string& msgData )
     // Encode message type first without compression
     archive ( msg->getMsgType() );
 
+    // The header flags are only added for newer wire versions
+    uint8_t flags = 0;
+
+    if ( wireVersion >= WIRE_VERSION_POLICY )
+        flags |= HEADER_POLICY_FLAG | ( integrity.value << 4 );
+
+    if ( wireVersion >= WIRE_VERSION_COMPACT )
+        flags |= HEADER_COMPACT_FLAG;
+
+    // The policy limits the compression level, ie so small frequent messages never try to compress
+    const uint8_t compressionLevel = min ( msg->compressionLevel, policy.compressionLevel );
+
     // Compress message data if needed
-    if ( msg->compressionLevel )
+#ifdef FORCE_COMPRESSION
+    if ( compressionLevel )
+#else
+    if ( compressionLevel && msgData.size() >= policy.minCompressSize )
+#endif
     {
         string buffer ( compressBound ( msgData.size() ), ( char ) 0 );
-        size_t size = compress ( &msgData[0], msgData.size(), &buffer[0], buffer.size(), msg->compressionLevel );
+        size_t size = compress ( &msgData[0], msgData.size(), &buffer[0], buffer.size(), compressionLevel );
         buffer.resize ( size );
 
         // Only use compressed message data if actually smaller after the overhead
 #ifndef FORCE_COMPRESSION
-        if ( sizeof ( msgData.size() ) + sizeof ( buffer.size() ) + buffer.size() < msgData.size() )
+        if ( sizeof ( uint32_t ) + sizeof ( size_type ) + buffer.size() < msgData.size() )
 #endif
         {
-            archive ( msg->compressionLevel );
-            archive ( msgData.size() );         // uncompressed size
-            archive ( buffer );                 // compressed size + compressed data
+            archive ( uint8_t ( flags | compressionLevel ) );
+            archive ( uint32_t ( msgData.size() ) );    // uncompressed size
+            archive ( buffer );                         // compressed size + compressed data
             return ss.str();
         }
 
@@ -251,35 +433,58 @@ string encodeStageTwo ( const MsgPtr& msg, const string& msgData )
     }
 
     // uncompressed data does not include uncompressedSize or any other sizes
-    archive ( msg->compressionLevel );
+    archive ( flags );
     return ss.str() + msgData;
 }
 
-DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, MsgType& type, string& msgData )
+DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, MsgType& type,
+                              uint8_t& wireVersion, Integrity& integrity,
+                              const char *& msgData, size_t& msgLen, string& buffer )
 {
-    istringstream ss ( string ( bytes, len ), stringstream::binary );
+    // Parse the header in place, without copying the bytes
+    MemoryInputStream ss ( bytes, len );
     BinaryInputArchive archive ( ss );
 
-    uint8_t compressionLevel;
+    uint8_t header, compressionLevel;
     uint32_t uncompressedSize;
+    size_type compressedSize;
 
     try
     {
         // Decode message type first before decompression
         archive ( type );
-        archive ( compressionLevel );
+        archive ( header );
+
+        if ( header & HEADER_POLICY_FLAG )
+        {
+            wireVersion = ( ( header & HEADER_COMPACT_FLAG ) ? WIRE_VERSION_COMPACT : WIRE_VERSION_POLICY );
+            integrity = Integrity::Enum ( ( header >> 4 ) & 0x03 );
+            compressionLevel = ( header & 0x0F );
+
+            if ( integrity.value == Integrity::Unknown || integrity.value > Integrity::MD5 )
+            {
+                consumed = 0;
+                return DecodeResult::Failed;
+            }
+        }
+        else
+        {
+            wireVersion = WIRE_VERSION_LEGACY;
+            integrity = Integrity::MD5;
+            compressionLevel = header;
+        }
 
         // Only compressed data includes uncompressedSize + a compressed data buffer
         if ( compressionLevel )
         {
-            archive ( uncompressedSize );       // uncompressed size
-            archive ( msgData );                // compressed size + compressed data
+            archive ( uncompressedSize );                   // uncompressed size
+            archive ( make_size_tag ( compressedSize ) );   // compressed size
         }
     }
     catch ( const cereal::Exception& exc )
     {
 #ifdef LOG_PROTOCOL
-        LOG ( "cereal::Exception: '%s'", type, exc.what() );
+        LOG ( "cereal::Exception: '%s'", exc.what() );
 #endif
         consumed = 0;
         return DecodeResult::Failed;
@@ -287,7 +492,7 @@ DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, M
     catch ( const std::exception& exc )
     {
 #ifdef LOG_PROTOCOL
-        LOG ( "std::exception: '%s'", type, exc.what() );
+        LOG ( "std::exception: '%s'", exc.what() );
 #endif
         consumed = 0;
         return DecodeResult::Failed;
@@ -301,15 +506,20 @@ DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, M
         return DecodeResult::Failed;
     }
 
-    // Get remaining bytes
-    size_t remaining = ss.rdbuf()->in_avail();
-    ASSERT ( len >= remaining );
-
     // Decompress message data if needed
     if ( compressionLevel )
     {
-        string buffer ( uncompressedSize, ( char ) 0 );
-        size_t size = uncompress ( &msgData[0], msgData.size(), &buffer[0], buffer.size() );
+        // The compressed data is still in the original bytes
+        const char *compressed = ss.getReadPtr();
+
+        if ( ! ss.skip ( compressedSize ) )
+        {
+            consumed = 0;
+            return DecodeResult::Failed;
+        }
+
+        buffer.resize ( uncompressedSize );
+        size_t size = uncompress ( compressed, compressedSize, &buffer[0], buffer.size() );
 
         if ( size != uncompressedSize )
         {
@@ -318,14 +528,15 @@ DecodeResult decodeStageTwo ( const char *bytes, size_t len, size_t& consumed, M
         }
 
         // Update consumed bytes
-        consumed = len - remaining;
-        msgData = buffer;
+        consumed = ss.getPosition();
+        msgData = &buffer[0];
+        msgLen = buffer.size();
         return DecodeResult::Compressed;
     }
 
-    // Get remaining bytes
-    msgData.resize ( remaining );
-    ss.rdbuf()->sgetn ( &msgData[0], remaining );
+    // Message data is just the remaining bytes
+    msgData = ss.getReadPtr();
+    msgLen = ss.getRemaining();
     return DecodeResult::NotCompressed;
 }
 
@@ -5,6 +5,7 @@
 #include <cereal/archives/binary.hpp>
 
 #include <string>
+#include <array>
 #include <memory>
 #include <iostream>
 #include <sstream>
@@ -30,6 +31,34 @@
     void load ( cereal::BinaryInputArchive& ar ) { ar ( __VA_ARGS__ ); }
 
 
+// Variable length unsigned integer, 7 bits per byte, low bits first
+inline void saveVarint ( cereal::BinaryOutputArchive& ar, uint32_t value )
+{
+    for ( ; value >= 0x80; value >>= 7 )
+        ar ( uint8_t ( ( value & 0x7F ) | 0x80 ) );
+
+    ar ( uint8_t ( value ) );
+}
+
+inline uint32_t loadVarint ( cereal::BinaryInputArchive& ar )
+{
+    uint32_t value = 0;
+
+    for ( uint32_t shift = 0; shift < 32; shift += 7 )
+    {
+        uint8_t byte;
+        ar ( byte );
+
+        value |= uint32_t ( byte & 0x7F ) << shift;
+
+        if ( ! ( byte & 0x80 ) )
+            return value;
+    }
+
+    throw cereal::Exception ( "Varint is too long" );
+}
+
+
 // Message types, auto-generated from scanning all the headers
 enum class MsgType : uint8_t
 {
@@ -43,6 +72,34 @@ enum class MsgType : uint8_t
 // Base message type
 ENUM ( BaseType, SerializableMessage, SerializableSequence );
 
+// Integrity check appended to the message data
+ENUM ( Integrity, None, CRC32C, MD5 );
+
+
+// Wire format versions. Every version can decode all the previous versions, but messages should only be encoded
+// with a newer version once the remote end has indicated that it supports it.
+#define WIRE_VERSION_LEGACY     ( 0 )   // Compression level header byte, always MD5
+#define WIRE_VERSION_POLICY     ( 1 )   // Per message type integrity check, see MsgPolicy
+#define WIRE_VERSION_COMPACT    ( 2 )   // Compact message data, see Serializable::getWireVersion
+#define WIRE_VERSION_LATEST     ( WIRE_VERSION_COMPACT )
+
+
+// Per message type encoding policy, auto-generated from "// protocol:" annotations on the message declaration, eg:
+//
+//   struct PlayerInputs : public SerializableMessage // protocol: compress=0 min-compress=64 integrity=CRC32C
+//
+struct MsgPolicy
+{
+    // Maximum compression level, 0 disables compression
+    uint8_t compressionLevel = 9;
+
+    // Minimum size of the message data before trying to compress it
+    uint32_t minCompressSize = 32;
+
+    // Integrity check, only used if the wire version supports it, otherwise always MD5
+    Integrity integrity = Integrity::MD5;
+};
+
 // Common declarations
 struct Serializable;
 typedef std::shared_ptr<Serializable> MsgPtr;
@@ -63,19 +120,30 @@ class Protocol
 {
 public:
 
-    // Encode a message to a series of bytes
-    static std::string encode ( const Serializable& message );
-    static std::string encode ( Serializable *message );
-    static std::string encode ( const MsgPtr& msg );
+    // Encode a message to a series of bytes, using the given wire format version
+    static std::string encode ( const Serializable& message, uint8_t wireVersion = WIRE_VERSION_LEGACY );
+    static std::string encode ( Serializable *message, uint8_t wireVersion = WIRE_VERSION_LEGACY );
+    static std::string encode ( const MsgPtr& msg, uint8_t wireVersion = WIRE_VERSION_LEGACY );
 
     // Decode a series of bytes into a message, consumed indicates the number of bytes read.
     // This returns null if the message failed to decode, NOTE consumed will still be updated.
     static MsgPtr decode ( const char *bytes, size_t len, size_t& consumed );
 
+    // Save / load a message without a header, integrity check, or compression, only for trusted local transports.
+    // saveRaw throws cereal::Exception if the archive fails to write, loadRaw returns null if it fails to load.
+    static void saveRaw ( const Serializable& msg, cereal::BinaryOutputArchive& archive );
+    static MsgPtr loadRaw ( const char *bytes, size_t len );
+
     static bool checkMsgType ( MsgType type )
     {
         return ( type > MsgType::FirstType && type < MsgType::LastType );
     }
+
+    // Get the encoding policy for a message type
+    static MsgPolicy getPolicy ( MsgType type );
+
+    // Get the integrity check used when encoding a message type with the given wire format version
+    static Integrity getIntegrity ( MsgType type, uint8_t wireVersion );
 };
 
 
@@ -112,13 +180,22 @@ public:
     // Flag to indicate compression level
     mutable uint8_t compressionLevel;
 
+protected:
+
+    // Wire format version of the current encode or decode, messages with a compact encoding should check this
+    uint8_t getWireVersion() const { return _wireVersion; }
+
 private:
 
     typedef std::array<char, 16> HashType;
 
-    // Cached hash data
+    // Cached hash data, and the integrity check it was calculated with
     mutable HashType _hash;
     mutable bool _hashValid = true;
+    mutable Integrity::Enum _hashIntegrity = Integrity::Unknown;
+
+    // Wire format version of the last encode or decode, the hash depends on it
+    mutable uint8_t _wireVersion = WIRE_VERSION_LEGACY;
 
     // Serialize and deserialize the base type
     virtual void saveBase ( cereal::BinaryOutputArchive& ar ) const {}
@@ -32,3 +32,6 @@ VersionConfig,
 JoysticksChanged,
 TransitionIndex,
 PaletteManager,
+RelayStatus,
+SelectiveAck,
+MtuProbe,
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Logger.hpp"
+
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+
+#define READ_BUFFER_MIN_CAPACITY ( 4096 )
+
+
+// Growable buffer for reading from a socket. The unread bytes are always contiguous, so they can be decoded in place.
+// Consuming bytes from the front is O(1); unread bytes are only moved to the front when there is no space at the end.
+// No memory is allocated until the first reserve, and it only grows as large as the biggest backlog.
+class ReadBuffer
+{
+public:
+
+    // The unread bytes
+    const char *data() const { return _buffer.data() + _begin; }
+    size_t size() const { return _end - _begin; }
+    bool empty() const { return ( _begin == _end ); }
+
+    // Total allocated bytes
+    size_t capacity() const { return _buffer.size(); }
+
+    // The space available for writing at the end of the unread bytes
+    char *writePtr() { return &_buffer[0] + _end; }
+    size_t writable() const { return _buffer.size() - _end; }
+
+    // Make sure at least len bytes are writable, by moving the unread bytes to the front or growing the buffer
+    void reserve ( size_t len )
+    {
+        if ( writable() >= len )
+            return;
+
+        if ( _begin > 0 )
+        {
+            memmove ( &_buffer[0], &_buffer[_begin], size() );
+            _end -= _begin;
+            _begin = 0;
+
+            if ( writable() >= len )
+                return;
+        }
+
+        size_t capacity = std::max<size_t> ( _buffer.size(), READ_BUFFER_MIN_CAPACITY );
+
+        while ( capacity < _end + len )
+            capacity *= 2;
+
+        _buffer.resize ( capacity );
+    }
+
+    // Append len bytes that were written starting at writePtr
+    void commit ( size_t len )
+    {
+        ASSERT ( len <= writable() );
+        _end += len;
+    }
+
+    // Consume len bytes from the front of the unread bytes
+    void consume ( size_t len )
+    {
+        ASSERT ( len <= size() );
+        _begin += len;
+
+        if ( _begin == _end )
+            _begin = _end = 0;
+    }
+
+    // Replace the unread bytes with a copy of the given bytes
+    void assign ( const char *bytes, size_t len )
+    {
+        clear();
+        reserve ( len );
+        memcpy ( writePtr(), bytes, len );
+        commit ( len );
+    }
+
+    // Discard the unread bytes, but keep the allocated memory
+    void clear()
+    {
+        _begin = _end = 0;
+    }
+
+    // Discard the unread bytes and free the allocated memory
+    void free()
+    {
+        clear();
+        std::string().swap ( _buffer );
+    }
+
+private:
+
+    std::string _buffer;
+
+    // Range of unread bytes [_begin, _end)
+    size_t _begin = 0, _end = 0;
+};
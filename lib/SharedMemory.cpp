@@ -0,0 +1,202 @@
+#include "SharedMemory.hpp"
+#include "Logger.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <cstdint>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+#ifdef _WIN32
+
+bool SharedMemory::create ( const string& name, size_t size )
+{
+    close();
+
+    HANDLE mapping = CreateFileMapping ( INVALID_HANDLE_VALUE, 0, PAGE_READWRITE,
+                                         ( uint64_t ) size >> 32, size & 0xFFFFFFFF, name.c_str() );
+
+    if ( ! mapping )
+    {
+        LOG ( "CreateFileMapping failed: '%s'", name );
+        return false;
+    }
+
+    if ( GetLastError() == ERROR_ALREADY_EXISTS )
+    {
+        LOG ( "Already exists: '%s'", name );
+        CloseHandle ( mapping );
+        return false;
+    }
+
+    void *data = MapViewOfFile ( mapping, FILE_MAP_ALL_ACCESS, 0, 0, size );
+
+    if ( ! data )
+    {
+        LOG ( "MapViewOfFile failed: '%s'", name );
+        CloseHandle ( mapping );
+        return false;
+    }
+
+    // The name is removed by the system when the last handle is closed
+    _mapping = mapping;
+    _data = ( char * ) data;
+    _size = size;
+    return true;
+}
+
+bool SharedMemory::open ( const string& name )
+{
+    close();
+
+    HANDLE mapping = OpenFileMapping ( FILE_MAP_ALL_ACCESS, FALSE, name.c_str() );
+
+    if ( ! mapping )
+    {
+        LOG ( "OpenFileMapping failed: '%s'", name );
+        return false;
+    }
+
+    void *data = MapViewOfFile ( mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0 );
+
+    if ( ! data )
+    {
+        LOG ( "MapViewOfFile failed: '%s'", name );
+        CloseHandle ( mapping );
+        return false;
+    }
+
+    MEMORY_BASIC_INFORMATION info;
+
+    if ( ! VirtualQuery ( data, &info, sizeof ( info ) ) )
+    {
+        LOG ( "VirtualQuery failed: '%s'", name );
+        UnmapViewOfFile ( data );
+        CloseHandle ( mapping );
+        return false;
+    }
+
+    _mapping = mapping;
+    _data = ( char * ) data;
+    _size = info.RegionSize;
+    return true;
+}
+
+void SharedMemory::close()
+{
+    if ( _data )
+        UnmapViewOfFile ( _data );
+
+    if ( _mapping )
+        CloseHandle ( ( HANDLE ) _mapping );
+
+    _data = 0;
+    _size = 0;
+    _mapping = 0;
+}
+
+#else
+
+// POSIX shared memory names must start with a slash
+static string getPosixName ( const string& name )
+{
+    return ( name.empty() || name[0] != '/' ) ? "/" + name : name;
+}
+
+bool SharedMemory::create ( const string& name, size_t size )
+{
+    close();
+
+    const string posixName = getPosixName ( name );
+    const int fd = shm_open ( posixName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600 );
+
+    if ( fd < 0 )
+    {
+        LOG ( "shm_open failed: '%s'", posixName );
+        return false;
+    }
+
+    if ( ftruncate ( fd, size ) != 0 )
+    {
+        LOG ( "ftruncate failed: '%s'", posixName );
+        ::close ( fd );
+        shm_unlink ( posixName.c_str() );
+        return false;
+    }
+
+    void *data = mmap ( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+    // The mapping stays valid after closing the file descriptor
+    ::close ( fd );
+
+    if ( data == MAP_FAILED )
+    {
+        LOG ( "mmap failed: '%s'", posixName );
+        shm_unlink ( posixName.c_str() );
+        return false;
+    }
+
+    _ownedName = posixName;
+    _data = ( char * ) data;
+    _size = size;
+    return true;
+}
+
+bool SharedMemory::open ( const string& name )
+{
+    close();
+
+    const string posixName = getPosixName ( name );
+    const int fd = shm_open ( posixName.c_str(), O_RDWR, 0600 );
+
+    if ( fd < 0 )
+    {
+        LOG ( "shm_open failed: '%s'", posixName );
+        return false;
+    }
+
+    struct stat st;
+
+    if ( fstat ( fd, &st ) != 0 || st.st_size == 0 )
+    {
+        LOG ( "Invalid size: '%s'", posixName );
+        ::close ( fd );
+        return false;
+    }
+
+    void *data = mmap ( 0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+    ::close ( fd );
+
+    if ( data == MAP_FAILED )
+    {
+        LOG ( "mmap failed: '%s'", posixName );
+        return false;
+    }
+
+    _data = ( char * ) data;
+    _size = st.st_size;
+    return true;
+}
+
+void SharedMemory::close()
+{
+    if ( _data )
+        munmap ( _data, _size );
+
+    if ( ! _ownedName.empty() )
+        shm_unlink ( _ownedName.c_str() );
+
+    _data = 0;
+    _size = 0;
+    _ownedName.clear();
+}
+
+#endif // _WIN32
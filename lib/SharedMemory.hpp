@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+
+
+// Named region of read-write memory shared between processes. The process that creates it owns the name,
+// so it is removed when that process closes it, but the memory stays valid until every process has closed it.
+class SharedMemory
+{
+public:
+
+    SharedMemory() {}
+    ~SharedMemory() { close(); }
+
+    // Create a new zeroed region, returns false on failure, ie if the name is already used
+    bool create ( const std::string& name, size_t size );
+
+    // Open a region that was created by another process, returns false on failure
+    bool open ( const std::string& name );
+
+    // Unmap the region, and remove the name if this created it
+    void close();
+
+    bool isOpen() const { return ( _data != 0 ); }
+
+    char *data() const { return _data; }
+
+    size_t size() const { return _size; }
+
+private:
+
+    char *_data = 0;
+
+    size_t _size = 0;
+
+    // Name to remove when closing, only if this created the region
+    std::string _ownedName;
+
+    // Platform specific handle
+    void *_mapping = 0;
+
+    // Not copyable
+    SharedMemory ( const SharedMemory& ) = delete;
+    const SharedMemory& operator= ( const SharedMemory& ) = delete;
+};
@@ -0,0 +1,218 @@
+#include "SharedMemoryIpc.hpp"
+#include "Logger.hpp"
+
+#include <new>
+
+using namespace std;
+
+
+#define SHARED_MEMORY_IPC_MAGIC ( 0x43504943 ) // "CIPC"
+
+// Milliseconds the wait thread waits before checking if it should stop
+#define WAIT_THREAD_TIMEOUT ( 1000 )
+
+#define ALIGN_CACHE_LINE(SIZE) ( ( ( SIZE ) + 63 ) & ~ size_t ( 63 ) )
+
+
+struct SharedMemoryIpc::Header
+{
+    uint32_t magic;
+
+    // Bytes for each ring, including the ring header
+    uint32_t ringSize;
+
+    // Set when the other process opens the channel
+    atomic<uint32_t> peerOpen;
+};
+
+#define HEADER_SIZE ALIGN_CACHE_LINE ( sizeof ( Header ) )
+
+
+bool SharedMemoryIpc::create ( const string& name, uint32_t capacity )
+{
+    close();
+
+    const size_t ringSize = ALIGN_CACHE_LINE ( IpcRing::getMemorySize ( capacity ) );
+
+    if ( ! _memory.create ( name, HEADER_SIZE + 2 * ringSize ) )
+        return false;
+
+    Header *header = new ( _memory.data() ) Header();
+    header->ringSize = ringSize;
+
+    if ( ! attach ( name, true, capacity ) )
+        return false;
+
+    header->magic = SHARED_MEMORY_IPC_MAGIC;
+    return true;
+}
+
+bool SharedMemoryIpc::open ( const string& name )
+{
+    close();
+
+    if ( ! _memory.open ( name ) )
+        return false;
+
+    Header *header = ( Header * ) _memory.data();
+
+    if ( _memory.size() < HEADER_SIZE || header->magic != SHARED_MEMORY_IPC_MAGIC
+            || _memory.size() < HEADER_SIZE + 2 * size_t ( header->ringSize ) )
+    {
+        LOG ( "Invalid channel: '%s'", name );
+        _memory.close();
+        return false;
+    }
+
+    if ( ! attach ( name, false, 0 ) )
+        return false;
+
+    header->peerOpen.store ( 1 );
+    return true;
+}
+
+bool SharedMemoryIpc::attach ( const string& name, bool isCreator, uint32_t capacity )
+{
+    Header *header = ( Header * ) _memory.data();
+
+    // The first ring is from the creator to the other process, the second ring is the other direction
+    char *rings[2] = { _memory.data() + HEADER_SIZE, _memory.data() + HEADER_SIZE + header->ringSize };
+    const string events[2] = { name + "_0", name + "_1" };
+
+    bool success;
+
+    if ( isCreator )
+    {
+        success = _sendRing.init ( rings[0], capacity, events[0] ) && _recvRing.init ( rings[1], capacity, events[1] );
+    }
+    else
+    {
+        success = _recvRing.attach ( rings[0], header->ringSize, events[0] )
+                  && _sendRing.attach ( rings[1], header->ringSize, events[1] );
+    }
+
+    if ( ! success )
+    {
+        LOG ( "Failed to attach rings: '%s'", name );
+        _sendRing.detach();
+        _recvRing.detach();
+        _memory.close();
+        return false;
+    }
+
+    LOG ( "name='%s'; isCreator=%u; size=%u", name, isCreator, _memory.size() );
+
+    EventManager::get().addSource ( this );
+
+    _waitThread.stopping = false;
+    _waitThread.start();
+    return true;
+}
+
+void SharedMemoryIpc::close()
+{
+    if ( ! isOpen() )
+        return;
+
+    LOG ( "Closing" );
+
+    EventManager::get().removeSource ( this );
+
+    _waitThread.stopping = true;
+    _recvRing.wake();
+    _waitThread.join();
+
+    _sendRing.detach();
+    _recvRing.detach();
+    _memory.close();
+
+    _pending.clear();
+    _reading = false;
+}
+
+bool SharedMemoryIpc::isPeerOpen() const
+{
+    if ( ! isOpen() )
+        return false;
+
+    return ( ( const Header * ) _memory.data() )->peerOpen.load();
+}
+
+void SharedMemoryIpc::setReading ( bool enabled )
+{
+    _reading = enabled;
+
+    // Read anything that was written before reading was enabled
+    if ( enabled )
+        EventManager::get().wake();
+}
+
+bool SharedMemoryIpc::send ( const Serializable& msg )
+{
+    if ( ! isOpen() )
+        return false;
+
+    if ( sendPending() && _sendRing.write ( msg ) )
+        return true;
+
+    // Keep a copy, since the message may not outlive this call
+    _pending.push_back ( msg.clone() );
+    return true;
+}
+
+bool SharedMemoryIpc::send ( const MsgPtr& msg )
+{
+    if ( ! msg )
+        return false;
+
+    return send ( *msg );
+}
+
+bool SharedMemoryIpc::sendPending()
+{
+    while ( ! _pending.empty() )
+    {
+        if ( ! _sendRing.write ( *_pending.front() ) )
+            return false;
+
+        _pending.pop_front();
+    }
+
+    return true;
+}
+
+void SharedMemoryIpc::checkEvents()
+{
+    sendPending();
+
+    while ( _reading )
+    {
+        MsgPtr msg = _recvRing.read();
+
+        if ( ! msg )
+            return;
+
+        if ( owner )
+            owner->sharedMemoryRead ( this, msg );
+
+        // Abort if the channel was closed or deleted by the owner
+        if ( ! EventManager::get().hasSource ( this ) )
+            return;
+    }
+}
+
+void SharedMemoryIpc::WaitThread::run()
+{
+    IpcRing& ring = _ipc._recvRing;
+    uint32_t position = ring.getWritePosition();
+
+    while ( ! stopping )
+    {
+        if ( ! ring.waitForWrite ( position, WAIT_THREAD_TIMEOUT ) )
+            continue;
+
+        position = ring.getWritePosition();
+
+        EventManager::get().wake();
+    }
+}
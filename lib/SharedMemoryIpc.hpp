@@ -0,0 +1,91 @@
+#pragma once
+
+#include "IpcRing.hpp"
+#include "SharedMemory.hpp"
+#include "EventManager.hpp"
+#include "Thread.hpp"
+
+#include <list>
+
+
+// IPC channel between two processes, using a pair of IpcRings in one SharedMemory region, one for each direction.
+// Messages are read on the event loop thread. A background thread only waits for writes, and wakes the event loop.
+class SharedMemoryIpc : private EventManager::Source
+{
+public:
+
+    struct Owner
+    {
+        // Read event, only while reading is enabled
+        virtual void sharedMemoryRead ( SharedMemoryIpc *ipc, const MsgPtr& msg ) = 0;
+    };
+
+    Owner *owner = 0;
+
+    SharedMemoryIpc ( Owner *owner ) : owner ( owner ), _waitThread ( *this ) {}
+    ~SharedMemoryIpc() { close(); }
+
+    // Create the channel, the other process should open it with the same name. Returns false on failure.
+    bool create ( const std::string& name, uint32_t capacity = DEFAULT_IPC_RING_CAPACITY );
+
+    // Open a channel created by the other process, returns false on failure
+    bool open ( const std::string& name );
+
+    void close();
+
+    bool isOpen() const { return _memory.isOpen(); }
+
+    // If the other process has opened the channel, ie messages sent now will be read
+    bool isPeerOpen() const;
+
+    // Start / stop reading, messages wait in the ring while not reading
+    bool isReading() const { return _reading; }
+    void setReading ( bool enabled );
+
+    // Send a message, messages that don't fit in the ring are kept in order, and sent when there is space
+    bool send ( const Serializable& msg );
+    bool send ( const MsgPtr& msg );
+
+private:
+
+    struct Header;
+
+    class WaitThread : public Thread
+    {
+    public:
+
+        WaitThread ( SharedMemoryIpc& ipc ) : _ipc ( ipc ) {}
+
+        void run() override;
+
+        volatile bool stopping = false;
+
+    private:
+
+        SharedMemoryIpc& _ipc;
+    };
+
+    SharedMemory _memory;
+
+    IpcRing _sendRing, _recvRing;
+
+    bool _reading = false;
+
+    // Messages waiting for space in the send ring
+    std::list<MsgPtr> _pending;
+
+    WaitThread _waitThread;
+
+    // Attach to the rings after the memory is mapped
+    bool attach ( const std::string& name, bool isCreator, uint32_t capacity );
+
+    // Send the pending messages, returns false if some are still pending
+    bool sendPending();
+
+    // Called on every iteration of the event loop
+    void checkEvents() override;
+
+    // Not copyable
+    SharedMemoryIpc ( const SharedMemoryIpc& ) = delete;
+    const SharedMemoryIpc& operator= ( const SharedMemoryIpc& ) = delete;
+};
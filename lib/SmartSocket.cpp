@@ -2,8 +2,7 @@
 #include "TcpSocket.hpp"
 #include "UdpSocket.hpp"
 #include "Logger.hpp"
-
-#include <ws2tcpip.h>
+#include "SocketHeaders.hpp"
 
 using namespace std;
 
@@ -12,6 +11,9 @@ using namespace std;
 
 #define SEND_INTERVAL ( 50 )
 
+// Hole punched paths are more likely to drop large datagrams, so don't probe as far
+#define TUNNEL_MAX_SPLIT_SIZE ( 512 )
+
 static const vector<IpAddrPort> relayServers =
 {
     "104.206.199.123:3939",
@@ -329,8 +331,10 @@ void SmartSocket::socketRead ( Socket *socket, const char *buffer, size_t len, c
 {
     ASSERT ( socket == _vpsSocket.get() );
 
-    _vpsSocket->_readPos += len;
-    LOG ( "Read [ %u bytes ] from '%s'; %u bytes remaining in buffer", len, address, _vpsSocket->_readPos );
+    ASSERT ( buffer == _vpsSocket->_readBuffer.writePtr() );
+
+    _vpsSocket->_readBuffer.commit ( len );
+    LOG ( "Read [ %u bytes ] from '%s'; %u bytes remaining in buffer", len, address, _vpsSocket->_readBuffer.size() );
 
     if ( len > 0 && len <= 256 )
         LOG ( "Hex: %s", formatAsHex ( buffer, len ) );
@@ -341,7 +345,7 @@ void SmartSocket::socketRead ( Socket *socket, const char *buffer, size_t len, c
 
     for ( ;; )
     {
-        id = MatchInfo::decode ( &_vpsSocket->_readBuffer[0], _vpsSocket->_readPos, consumed );
+        id = MatchInfo::decode ( _vpsSocket->_readBuffer.data(), _vpsSocket->_readBuffer.size(), consumed );
 
         if ( id )
         {
@@ -353,7 +357,7 @@ void SmartSocket::socketRead ( Socket *socket, const char *buffer, size_t len, c
             continue;
         }
 
-        tun = TunInfo::decode ( &_vpsSocket->_readBuffer[0], _vpsSocket->_readPos, consumed );
+        tun = TunInfo::decode ( _vpsSocket->_readBuffer.data(), _vpsSocket->_readBuffer.size(), consumed );
 
         if ( tun.matchId )
         {
@@ -504,6 +508,7 @@ void SmartSocket::gotTunInfo ( uint32_t matchId, const IpAddrPort& address )
         ASSERT ( _tunSocket->isUDP() == true );
 
         _tunSocket->getAsUDP().connect ( address );
+        _tunSocket->getAsUDP().setMaxSplitSize ( TUNNEL_MAX_SPLIT_SIZE );
     }
 }
 
@@ -544,6 +549,8 @@ SocketPtr SmartSocket::accept ( Socket::Owner *owner )
     if ( ! socket )
         return 0;
 
+    socket->getAsUDP().setMaxSplitSize ( TUNNEL_MAX_SPLIT_SIZE );
+
     auto it = _pendingClients.begin();
 
     for ( ; it != _pendingClients.end(); ++it )
@@ -569,10 +576,14 @@ SocketPtr SmartSocket::accept ( Socket::Owner *owner )
     do {                                                                                \
         if ( ! isConnected() )                                                          \
             return false;                                                               \
-        if ( _directSocket && _directSocket->isConnected() )                            \
+        if ( _directSocket && _directSocket->isConnected() ) {                          \
+            _directSocket->setWireVersion ( _wireVersion );                             \
             return _directSocket->send ( __VA_ARGS__ );                                 \
-        if ( _tunSocket && _tunSocket->isConnected() )                                  \
+        }                                                                               \
+        if ( _tunSocket && _tunSocket->isConnected() ) {                                \
+            _tunSocket->setWireVersion ( _wireVersion );                                \
             return _tunSocket->send ( __VA_ARGS__ );                                    \
+        }                                                                               \
         return false;                                                                   \
     } while ( 0 )
 
@@ -600,3 +611,14 @@ bool SmartSocket::send ( const MsgPtr& message, const IpAddrPort& address )
 {
     BOILERPLATE_SEND ( message, address );
 }
+
+void SmartSocket::setWireVersion ( uint8_t version )
+{
+    Socket::setWireVersion ( version );
+
+    if ( _directSocket )
+        _directSocket->setWireVersion ( version );
+
+    if ( _tunSocket )
+        _tunSocket->setWireVersion ( version );
+}
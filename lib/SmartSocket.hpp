@@ -52,6 +52,9 @@ public:
     bool send ( SerializableSequence *message, const IpAddrPort& address = NullAddress ) override;
     bool send ( const MsgPtr& message, const IpAddrPort& address = NullAddress ) override;
 
+    // Set the wire version of the direct or tunnel socket too
+    void setWireVersion ( uint8_t version ) override;
+
 private:
 
     // Child UDP socket enum type for choosing the right constructor
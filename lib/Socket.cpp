@@ -5,10 +5,7 @@
 #include "SmartSocket.hpp"
 #include "Exceptions.hpp"
 #include "ErrorStrings.hpp"
-
-#include <winsock2.h>
-#include <windows.h>
-#include <ws2tcpip.h>
+#include "SocketHeaders.hpp"
 
 #include <cereal/types/unordered_map.hpp>
 
@@ -18,7 +15,14 @@
 using namespace std;
 
 
-#define READ_BUFFER_SIZE ( 1024 * 4096 )
+// Minimum free space in the read buffer before each TCP read
+#define READ_CHUNK_SIZE ( 4096 )
+
+// UDP reads need enough space for the largest possible datagram, otherwise the rest of it is discarded
+#define MAX_DATAGRAM_SIZE ( 65536 )
+
+// The read buffer is reset if the unread bytes grow larger than this without decoding
+#define MAX_READ_BUFFER_SIZE ( 1024 * 4096 )
 
 #define SET_NON_BLOCKING_MODE(VALUE)                                                                                \
     do {                                                                                                            \
@@ -34,11 +38,14 @@ using namespace std;
 
 static bool enableForceReusePort = true;
 
+static NetworkProfile defaultImpairment;
+
 
 Socket::Socket ( Owner *owner, const IpAddrPort& address, Protocol protocol, bool isRaw )
     : owner ( owner ), address ( address ), protocol ( protocol ), _isRaw ( isRaw )
 {
-    resetBuffer();
+    if ( protocol != Protocol::Smart )
+        setSendImpairment ( defaultImpairment );
 }
 
 Socket::~Socket()
@@ -60,6 +67,10 @@ void Socket::disconnect()
     freeBuffer();
 
     _packetLoss = _hashFailRate = 0;
+
+    // Any packets still waiting in the impairments are discarded
+    _sendImpairment.reset();
+    _recvImpairment.reset();
 }
 
 void Socket::init()
@@ -100,11 +111,11 @@ void Socket::init()
 
         if ( enableForceReusePort && ( isServer() || isUDP() ) )
         {
-            const char yes = 1;
+            const int yes = 1;
 
             // SO_REUSEADDR can replace existing port binds
             // SO_EXCLUSIVEADDRUSE only replaces if not exact match
-            if ( setsockopt ( _fd, SOL_SOCKET, SO_REUSEADDR, &yes, 1 ) == SOCKET_ERROR )
+            if ( setsockopt ( _fd, SOL_SOCKET, SO_REUSEADDR, ( const char * ) &yes, sizeof ( yes ) ) == SOCKET_ERROR )
             {
                 exc = WinException ( WSAGetLastError(), "setsockopt failed", ERROR_NETWORK_GENERIC );
                 LOG_SOCKET ( this, "%s", exc );
@@ -123,7 +134,7 @@ void Socket::init()
                     int error = WSAGetLastError();
 
                     // Successful non-blocking connect
-                    if ( error == WSAEWOULDBLOCK || error == WSAEINVAL )
+                    if ( error == WSAEWOULDBLOCK || error == WSAEINVAL || error == WSAEINPROGRESS )
                         break;
 
                     exc = WinException ( error, "connect failed", ERROR_NETWORK_GENERIC );
@@ -198,7 +209,7 @@ void Socket::init()
     if ( address.port == 0 )
     {
         sockaddr_storage sas;
-        int saLen = sizeof ( sas );
+        socklen_t saLen = sizeof ( sas );
 
         if ( getsockname ( _fd, ( sockaddr * ) &sas, &saLen ) == SOCKET_ERROR )
         {
@@ -214,6 +225,32 @@ void Socket::init()
 }
 
 bool Socket::send ( const char *buffer, size_t len )
+{
+#ifndef RELEASE
+    if ( _sendImpairment && _fd && ! isDisconnected() )
+    {
+        _sendImpairment->push ( buffer, len, NullAddress );
+        return true;
+    }
+#endif
+
+    return sendImmediately ( buffer, len );
+}
+
+bool Socket::send ( const char *buffer, size_t len, const IpAddrPort& address )
+{
+#ifndef RELEASE
+    if ( _sendImpairment && _fd && ! isDisconnected() )
+    {
+        _sendImpairment->push ( buffer, len, address );
+        return true;
+    }
+#endif
+
+    return sendImmediately ( buffer, len, address );
+}
+
+bool Socket::sendImmediately ( const char *buffer, size_t len )
 {
     if ( _fd == 0 || isDisconnected() )
     {
@@ -272,7 +309,7 @@ bool Socket::send ( const char *buffer, size_t len )
     return true;
 }
 
-bool Socket::send ( const char *buffer, size_t len, const IpAddrPort& address )
+bool Socket::sendImmediately ( const char *buffer, size_t len, const IpAddrPort& address )
 {
     if ( _fd == 0 || isDisconnected() )
     {
@@ -331,7 +368,7 @@ int Socket::recvfrom ( char *buffer, size_t& len, IpAddrPort& address )
     ASSERT ( _fd != 0 );
 
     sockaddr_storage sas;
-    int saLen = sizeof ( sas );
+    socklen_t saLen = sizeof ( sas );
 
     int recvBytes = ::recvfrom ( _fd, buffer, len, 0, ( sockaddr * ) &sas, &saLen );
 
@@ -345,37 +382,28 @@ int Socket::recvfrom ( char *buffer, size_t& len, IpAddrPort& address )
 
 void Socket::resetBuffer()
 {
-    _readBuffer.reserve ( READ_BUFFER_SIZE );
-    _readBuffer.resize ( READ_BUFFER_SIZE, ( char ) 0 );
-    _readPos = 0;
+    _readBuffer.clear();
 }
 
 void Socket::freeBuffer()
 {
-    _readBuffer.clear();
-    _readBuffer.shrink_to_fit();
-    _readPos = 0;
+    _readBuffer.free();
 }
 
 void Socket::consumeBuffer ( size_t bytes )
 {
-    if ( bytes == 0 )
-        return;
-
-    // Erase the consumed bytes (shifting the array)
-    ASSERT ( bytes <= _readPos );
-    _readBuffer.erase ( 0, bytes );
-    _readBuffer.reserve ( READ_BUFFER_SIZE );
-    _readBuffer.resize ( READ_BUFFER_SIZE, ( char ) 0 );
-    _readPos -= bytes;
+    // Just advances the start of the unread bytes, nothing is shifted
+    _readBuffer.consume ( bytes );
 }
 
 void Socket::socketRead()
 {
-    ASSERT ( _readPos < _readBuffer.size() );
+    // Make sure there is space at the end of the read buffer, this only allocates on the first read,
+    // or if there are large messages pending.
+    _readBuffer.reserve ( isUDP() ? MAX_DATAGRAM_SIZE : READ_CHUNK_SIZE );
 
-    char *bufferStart = &_readBuffer[_readPos];
-    size_t bufferLen = _readBuffer.size() - _readPos;
+    char *bufferStart = _readBuffer.writePtr();
+    size_t bufferLen = _readBuffer.writable();
 
     IpAddrPort address = getRemoteAddress();
     int error = 0;
@@ -416,8 +444,22 @@ void Socket::socketRead()
         LOG ( "Discarding [ %u bytes ] from '%s'", bufferLen, address );
         return;
     }
+
+    // Simulated network conditions, the bytes are read again when they are released
+    if ( _recvImpairment )
+    {
+        _recvImpairment->push ( bufferStart, bufferLen, address );
+        return;
+    }
 #endif
 
+    bufferRead ( bufferLen, address );
+}
+
+void Socket::bufferRead ( size_t bufferLen, const IpAddrPort& address )
+{
+    char *bufferStart = _readBuffer.writePtr();
+
     // Raw read mode
     if ( _isRaw )
     {
@@ -428,9 +470,9 @@ void Socket::socketRead()
         return;
     }
 
-    // Increment the buffer position
-    _readPos += bufferLen;
-    LOG ( "Read [ %u bytes ] from '%s'; %u bytes remaining in buffer", bufferLen, address, _readPos );
+    // Append the bytes that were read
+    _readBuffer.commit ( bufferLen );
+    LOG ( "Read [ %u bytes ] from '%s'; %u bytes remaining in buffer", bufferLen, address, _readBuffer.size() );
 
     // Handle zero byte packets
     if ( bufferLen == 0 )
@@ -444,7 +486,7 @@ void Socket::socketRead()
         LOG ( "Hex: %s", formatAsHex ( bufferStart, bufferLen ) );
 
     // Check if the first byte is a valid message type
-    if ( _readPos >= sizeof ( MsgType ) && ! ::Protocol::checkMsgType ( * ( MsgType * ) &_readBuffer[0] ) )
+    if ( _readBuffer.size() >= sizeof ( MsgType ) && ! ::Protocol::checkMsgType ( * ( MsgType * ) _readBuffer.data() ) )
     {
         LOG ( "Clearing invalid buffer!" );
         resetBuffer();
@@ -455,14 +497,31 @@ void Socket::socketRead()
     for ( ;; )
     {
         size_t consumedBytes = 0;
-        MsgPtr msg = ::Protocol::decode ( &_readBuffer[0], _readPos, consumedBytes );
+        MsgPtr msg = ::Protocol::decode ( _readBuffer.data(), _readBuffer.size(), consumedBytes );
         consumeBuffer ( consumedBytes );
 
         // Abort if a message could not be decoded
         if ( ! msg.get() )
+        {
+            // Each datagram is decoded on its own, the next one never continues a partial message
+            if ( isUDP() && _readBuffer.size() > 0 )
+            {
+                LOG ( "Discarding [ %u bytes ] that could not be decoded", _readBuffer.size() );
+                resetBuffer();
+                return;
+            }
+
+            // Don't let the buffer grow forever if the pending bytes never decode
+            if ( _readBuffer.size() >= MAX_READ_BUFFER_SIZE )
+            {
+                LOG ( "Clearing full buffer!" );
+                resetBuffer();
+            }
             return;
+        }
 
-        LOG ( "Decoded '%s' using [ %u bytes ]; %u bytes remaining in buffer", msg, consumedBytes, _readPos );
+        LOG ( "Decoded '%s' using [ %u bytes ]; %u bytes remaining in buffer",
+              msg, consumedBytes, _readBuffer.size() );
         socketRead ( msg, address );
 
         // Abort if the socket is de-allocated
@@ -477,6 +536,10 @@ void Socket::socketRead()
 
 MsgPtr Socket::share ( int processId )
 {
+#ifndef _WIN32
+    // Sockets are only shared with the game process on Windows
+    THROW_EXCEPTION ( "Socket sharing is not supported", ERROR_NETWORK_GENERIC );
+#else
     shared_ptr<WSAPROTOCOL_INFO> info ( new WSAPROTOCOL_INFO() );
 
     if ( WSADuplicateSocket ( _fd, processId, info.get() ) )
@@ -499,26 +562,32 @@ MsgPtr Socket::share ( int processId )
     LOG ( "Sharing:" );
     LOG ( "address='%s'; protocol=%s; state=%s", address, protocol, _state );
 
-    return MsgPtr ( new SocketShareData ( address, protocol, _readBuffer, _readPos, _state, info ) );
+    // Only the unread bytes need to be shared
+    const string readBuffer ( _readBuffer.data(), _readBuffer.size() );
+
+    MsgPtr data ( new SocketShareData ( address, protocol, readBuffer, _state, info ) );
+    data->getAs<SocketShareData>().wireVersion = _wireVersion;
+    return data;
+#endif // _WIN32
 }
 
 SocketShareData::SocketShareData ( const IpAddrPort& address,
                                    Socket::Protocol protocol,
                                    const string& readBuffer,
-                                   size_t readPos,
                                    Socket::State state,
                                    const shared_ptr<WSAPROTOCOL_INFO>& info )
     : address ( address )
     , protocol ( protocol )
     , readBuffer ( readBuffer )
-    , readPos ( readPos )
     , state ( state )
     , info ( info ) {}
 
 void SocketShareData::save ( cereal::BinaryOutputArchive& ar ) const
 {
-    ar ( address, protocol, readBuffer, readPos, isRaw, state, connectTimeout,
-         info->dwServiceFlags1,
+    ar ( address, protocol, readBuffer, isRaw, wireVersion, state, connectTimeout );
+
+#ifdef _WIN32
+    ar ( info->dwServiceFlags1,
          info->dwServiceFlags2,
          info->dwServiceFlags3,
          info->dwServiceFlags4,
@@ -542,16 +611,19 @@ void SocketShareData::save ( cereal::BinaryOutputArchive& ar ) const
          info->dwMessageSize,
          info->dwProviderReserved,
          info->szProtocol );
+#endif
 
     ar ( udpType, Protocol::encode ( gbnState ), childSockets );
 }
 
 void SocketShareData::load ( cereal::BinaryInputArchive& ar )
 {
+    ar ( address, protocol, readBuffer, isRaw, wireVersion, state, connectTimeout );
+
+#ifdef _WIN32
     info.reset ( new WSAPROTOCOL_INFO() );
 
-    ar ( address, protocol, readBuffer, readPos, isRaw, state, connectTimeout,
-         info->dwServiceFlags1,
+    ar ( info->dwServiceFlags1,
          info->dwServiceFlags2,
          info->dwServiceFlags3,
          info->dwServiceFlags4,
@@ -575,6 +647,7 @@ void SocketShareData::load ( cereal::BinaryInputArchive& ar )
          info->dwMessageSize,
          info->dwProviderReserved,
          info->szProtocol );
+#endif
 
     string buffer;
     ar ( udpType, buffer, childSockets );
@@ -644,3 +717,49 @@ void Socket::setCheckSumFail ( uint8_t percentage )
     _hashFailRate = percentage;
 }
 
+void Socket::setSendImpairment ( const NetworkProfile& profile )
+{
+    if ( ! profile.isEnabled() )
+        _sendImpairment.reset();
+    else if ( _sendImpairment )
+        _sendImpairment->setProfile ( profile );
+    else
+        _sendImpairment.reset ( new NetworkImpairment ( this, profile, isTCP() ) );
+}
+
+void Socket::setRecvImpairment ( const NetworkProfile& profile )
+{
+    if ( ! profile.isEnabled() )
+        _recvImpairment.reset();
+    else if ( _recvImpairment )
+        _recvImpairment->setProfile ( profile );
+    else
+        _recvImpairment.reset ( new NetworkImpairment ( this, profile, isTCP() ) );
+}
+
+void Socket::setDefaultImpairment ( const NetworkProfile& profile )
+{
+    defaultImpairment = profile;
+}
+
+bool Socket::impairmentReleased ( NetworkImpairment *impairment, const string& bytes, const IpAddrPort& address )
+{
+    if ( impairment == _sendImpairment.get() )
+    {
+        if ( address.empty() )
+            sendImmediately ( &bytes[0], bytes.size() );
+        else
+            sendImmediately ( &bytes[0], bytes.size(), address );
+    }
+    else
+    {
+        _readBuffer.reserve ( bytes.size() );
+        copy ( bytes.begin(), bytes.end(), _readBuffer.writePtr() );
+        bufferRead ( bytes.size(), address );
+    }
+
+    // The socket may have been disconnected or deleted while handling the packet
+    return ( SocketManager::get().isAllocated ( this ) && ( impairment == _sendImpairment.get()
+                                                           || impairment == _recvImpairment.get() ) );
+}
+
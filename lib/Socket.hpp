@@ -2,6 +2,8 @@
 
 #include "IpAddrPort.hpp"
 #include "GoBackN.hpp"
+#include "NetworkImpairment.hpp"
+#include "ReadBuffer.hpp"
 #include "Enum.hpp"
 
 #include <vector>
@@ -29,7 +31,7 @@ typedef std::shared_ptr<Socket> SocketPtr;
 
 
 // Generic socket base class
-class Socket
+class Socket : private NetworkImpairment::Owner
 {
 public:
 
@@ -110,12 +112,37 @@ public:
         return send ( MsgPtr ( const_cast<Serializable *> ( &message ), ignoreMsgPtr ), address );
     }
 
+    // If this socket can send a message that was already encoded with its wire version, see EncodedMsgCache.
+    // Sockets that add per socket data when encoding, ie UDP sequences, must encode each message themselves.
+    virtual bool canSendEncoded() const { return false; }
+
+    // Send a message that was already encoded with this socket's wire version, otherwise encode it normally
+    virtual bool sendEncoded ( const MsgPtr& message, const std::string& bytes ) { return send ( message ); }
+
+    // Send any messages that were queued to be sent together, see SocketManager::flushLater
+    virtual void flush() {}
+
     // Set the packet loss for testing purposes
     void setPacketLoss ( uint8_t percentage );
 
     // Set the check sum fail percentage for testing purposes
     void setCheckSumFail ( uint8_t percentage );
 
+    // Emulate network conditions on the raw bytes sent or received by this socket, for testing purposes.
+    // A disabled profile removes the impairment. UDP child sockets send using their parent socket's impairment.
+    void setSendImpairment ( const NetworkProfile& profile );
+    void setRecvImpairment ( const NetworkProfile& profile );
+    const NetworkImpairment *getSendImpairment() const { return _sendImpairment.get(); }
+    const NetworkImpairment *getRecvImpairment() const { return _recvImpairment.get(); }
+
+    // Set the send impairment of all sockets created after this, for testing purposes
+    static void setDefaultImpairment ( const NetworkProfile& profile );
+
+    // Set the wire format version used to encode sent messages, any version can always be decoded.
+    // This should only be raised after the remote end has indicated that it supports the newer version.
+    virtual void setWireVersion ( uint8_t version ) { _wireVersion = version; }
+    uint8_t getWireVersion() const { return _wireVersion; }
+
     // Cast this to another socket type
     TcpSocket& getAsTCP();
     const TcpSocket& getAsTCP() const;
@@ -135,13 +162,10 @@ public:
 
 protected:
 
-    // Socket read buffer
-    std::string _readBuffer;
-
-    // The position for the next read event.
-    // In raw mode, this should be manually updated, otherwise each read will at the same position.
+    // Socket read buffer.
+    // In raw mode, bytes should be manually committed, otherwise each read will at the same position.
     // In message mode, this is automatically managed, and is only reset when a decode fails.
-    size_t _readPos = 0;
+    ReadBuffer _readBuffer;
 
     // Raw socket type flag
     bool _isRaw = false;
@@ -161,7 +185,13 @@ protected:
     // Hash failure percentage for testing purposes
     uint8_t _hashFailRate = 0;
 
-    // Reset the read buffer to its initial size
+    // Emulated network conditions for testing purposes
+    std::shared_ptr<NetworkImpairment> _sendImpairment, _recvImpairment;
+
+    // Wire format version used to encode sent messages
+    uint8_t _wireVersion = WIRE_VERSION_LEGACY;
+
+    // Discard any unread bytes in the read buffer
     void resetBuffer();
 
     // Free the read buffer
@@ -178,6 +208,9 @@ protected:
     // Read event callback, calls the function below if NOT isRaw
     virtual void socketRead();
 
+    // Handle bytes that were read into the end of the read buffer
+    void bufferRead ( size_t len, const IpAddrPort& address );
+
     // Read protocol message callback, must be implemented, only called if NOT isRaw
     virtual void socketRead ( const MsgPtr& msg, const IpAddrPort& address ) = 0;
 
@@ -187,6 +220,14 @@ protected:
     // Read raw bytes directly, 0 on success, otherwise returns the socket error code
     int recv ( char *buffer, size_t& len );
     int recvfrom ( char *buffer, size_t& len, IpAddrPort& address );
+
+    // Send raw bytes directly, without any impairment
+    bool sendImmediately ( const char *buffer, size_t len );
+    bool sendImmediately ( const char *buffer, size_t len, const IpAddrPort& address );
+
+    // NetworkImpairment callback
+    bool impairmentReleased ( NetworkImpairment *impairment,
+                              const std::string& bytes, const IpAddrPort& address ) override;
 };
 
 
@@ -195,9 +236,9 @@ struct SocketShareData : public SerializableSequence
 {
     IpAddrPort address;
     Socket::Protocol protocol;
-    std::string readBuffer;
-    size_t readPos = 0;
+    std::string readBuffer;     // Only the unread bytes
     uint8_t isRaw = 0;
+    uint8_t wireVersion = WIRE_VERSION_LEGACY;
     Socket::State state;
     uint64_t connectTimeout = DEFAULT_CONNECT_TIMEOUT;
     std::shared_ptr<WSAPROTOCOL_INFO> info;
@@ -210,7 +251,6 @@ struct SocketShareData : public SerializableSequence
     SocketShareData ( const IpAddrPort& address,
                       Socket::Protocol protocol,
                       const std::string& readBuffer,
-                      size_t readPos,
                       Socket::State state,
                       const std::shared_ptr<WSAPROTOCOL_INFO>& info );
 
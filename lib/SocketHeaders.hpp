@@ -0,0 +1,47 @@
+#pragma once
+
+// Platform socket headers. The socket code is written against Winsock, so the Winsock names it uses are mapped to
+// POSIX sockets on other platforms, eg for the native simulator build.
+
+#ifdef _WIN32
+
+#include <winsock2.h>
+#include <windows.h>
+#include <ws2tcpip.h>
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#define INVALID_SOCKET      ( -1 )
+#define SOCKET_ERROR        ( -1 )
+
+#define WSAEWOULDBLOCK      EWOULDBLOCK
+#define WSAEINPROGRESS      EINPROGRESS
+#define WSAEINVAL           EINVAL
+#define WSAECONNRESET       ECONNRESET
+
+#define WSAGetLastError()   ( errno )
+
+#define ZeroMemory(PTR, LEN) memset ( PTR, 0, LEN )
+
+inline int closesocket ( int fd )
+{
+    return ::close ( fd );
+}
+
+inline int ioctlsocket ( int fd, unsigned long cmd, unsigned long *arg )
+{
+    int value = *arg;
+    return ::ioctl ( fd, cmd, &value );
+}
+
+#endif // _WIN32
@@ -4,8 +4,10 @@
 #include "Exceptions.hpp"
 #include "ErrorStrings.hpp"
 
+#ifdef _WIN32
 #include <winsock2.h>
 #include <windows.h>
+#endif
 
 using namespace std;
 
@@ -15,73 +17,62 @@ void SocketManager::check ( uint64_t timeout )
     if ( ! _initialized )
         return;
 
+    // Send everything queued since the last check before waiting
+    flush();
+
     if ( _changed )
     {
-        for ( Socket *socket : _allocatedSockets )
+        // Remove first, in case a new socket has the same fd as a removed one
+        for ( auto it = _activeSockets.begin(); it != _activeSockets.end(); )
         {
-            if ( _activeSockets.find ( socket ) != _activeSockets.end() )
+            if ( _allocatedSockets.find ( it->first ) != _allocatedSockets.end() )
+            {
+                ++it;
                 continue;
+            }
 
-            LOG_SOCKET ( socket, "added" );
-            _activeSockets.insert ( socket );
+            LOG ( "socket=%08x removed", it->first ); // Don't log any extra data cus already deleted
+
+            if ( it->second.fd )
+                _poller->remove ( it->second.fd );
+
+            _activeSockets.erase ( it++ );
         }
 
-        for ( auto it = _activeSockets.cbegin(); it != _activeSockets.cend(); )
+        for ( Socket *socket : _allocatedSockets )
         {
-            if ( _allocatedSockets.find ( *it ) != _allocatedSockets.end() )
-            {
-                ++it;
+            if ( _activeSockets.find ( socket ) != _activeSockets.end() )
                 continue;
-            }
 
-            LOG ( "socket=%08x removed", *it ); // Don't log any extra data cus already deleted
-            _activeSockets.erase ( it++ );
+            LOG_SOCKET ( socket, "added" );
+            _activeSockets[socket] = Registration();
         }
 
         _changed = false;
     }
 
-    if ( _activeSockets.empty() )
-        return;
-
-    fd_set readFds, writeFds;
-    FD_ZERO ( &readFds );
-    FD_ZERO ( &writeFds );
-
-    for ( Socket *socket : _activeSockets )
-    {
-        if ( socket->isConnecting() && socket->isTCP() )
-            FD_SET ( socket->_fd, &writeFds );
-        else
-            FD_SET ( socket->_fd, &readFds );
-    }
+    updateRegistrations();
 
     ASSERT ( timeout > 0 );
 
-    timeval tv;
-    tv.tv_sec = timeout / 1000UL;
-    tv.tv_usec = ( timeout * 1000UL ) % 1000000UL;
-
-    // Note: select should be called between timeBeginPeriod / timeEndPeriod to ensure accurate timeouts
-    int count = select ( 0, &readFds, &writeFds, 0, &tv );
-
-    if ( count == SOCKET_ERROR )
-        THROW_WIN_EXCEPTION ( WSAGetLastError(), "select failed", ERROR_NETWORK_GENERIC );
+    _poller->wait ( timeout, _events );
 
-    if ( count == 0 )
+    if ( _events.empty() )
         return;
 
     ASSERT ( TimerManager::get().isInitialized() == true );
     TimerManager::get().updateNow();
 
-    for ( Socket *socket : _activeSockets )
+    for ( const Poller::Event& event : _events )
     {
+        Socket *socket = ( Socket * ) event.data;
+
         if ( _allocatedSockets.find ( socket ) == _allocatedSockets.end() )
             continue;
 
         if ( socket->isConnecting() && socket->isTCP() )
         {
-            if ( ! FD_ISSET ( socket->_fd, &writeFds ) )
+            if ( ! ( event.events & POLL_WRITE ) )
                 continue;
 
             LOG_SOCKET ( socket, "socketConnected" );
@@ -89,7 +80,7 @@ void SocketManager::check ( uint64_t timeout )
         }
         else
         {
-            if ( ! FD_ISSET ( socket->_fd, &readFds ) )
+            if ( ! ( event.events & POLL_READ ) )
                 continue;
 
             if ( socket->isServer() && socket->isTCP() )
@@ -106,6 +97,55 @@ void SocketManager::check ( uint64_t timeout )
     }
 }
 
+void SocketManager::updateRegistrations()
+{
+    // Unregister changed fds first, in case a new fd reuses the number of a closed one
+    for ( auto& kv : _activeSockets )
+    {
+        if ( kv.second.fd == 0 || kv.second.fd == kv.first->_fd )
+            continue;
+
+        _poller->remove ( kv.second.fd );
+        kv.second = Registration();
+    }
+
+    for ( auto& kv : _activeSockets )
+    {
+        Socket *socket = kv.first;
+
+        if ( socket->_fd == 0 )
+            continue;
+
+        const uint8_t events = ( socket->isConnecting() && socket->isTCP() ) ? POLL_WRITE : POLL_READ;
+
+        if ( kv.second.fd == socket->_fd && kv.second.events == events )
+            continue;
+
+        _poller->set ( socket->_fd, events, socket );
+        kv.second.fd = socket->_fd;
+        kv.second.events = events;
+    }
+}
+
+void SocketManager::flush()
+{
+    if ( _flushSockets.empty() )
+        return;
+
+    // Swap first, so the set doesn't change while iterating
+    unordered_set<Socket *> sockets;
+    sockets.swap ( _flushSockets );
+
+    for ( Socket *socket : sockets )
+        socket->flush();
+}
+
+void SocketManager::wake()
+{
+    if ( _poller )
+        _poller->wake();
+}
+
 void SocketManager::add ( Socket *socket )
 {
     LOG_SOCKET ( socket, "Adding socket" );
@@ -131,8 +171,15 @@ void SocketManager::clear()
     for ( auto it = _allocatedSockets.begin(); it != _allocatedSockets.end(); )
         ( *it++ )->disconnect();
 
+    for ( const auto& kv : _activeSockets )
+    {
+        if ( _poller && kv.second.fd )
+            _poller->remove ( kv.second.fd );
+    }
+
     _activeSockets.clear();
     _allocatedSockets.clear();
+    _flushSockets.clear();
     _changed = true;
 }
 
@@ -145,12 +192,16 @@ void SocketManager::initialize()
 
     _initialized = true;
 
+#ifdef _WIN32
     // Initialize WinSock
     WSADATA wsaData;
     int error = WSAStartup ( MAKEWORD ( 2, 2 ), &wsaData );
 
     if ( error != NO_ERROR )
         THROW_WIN_EXCEPTION ( error, "WSAStartup failed", ERROR_NETWORK_INIT );
+#endif
+
+    _poller = Poller::create();
 }
 
 void SocketManager::deinitialize()
@@ -162,7 +213,11 @@ void SocketManager::deinitialize()
 
     SocketManager::get().clear();
 
+    _poller.reset();
+
+#ifdef _WIN32
     WSACleanup();
+#endif
 }
 
 SocketManager& SocketManager::get()
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "Poller.hpp"
+
 #include <unordered_set>
+#include <unordered_map>
 
 
 class Socket;
@@ -13,6 +16,16 @@ public:
     // Check for socket events
     void check ( uint64_t timeout );
 
+    // Interrupt the current or next check, can be called on a different thread
+    void wake();
+
+    // Flush the sockets with queued messages, this is done before each check waits
+    void flush();
+
+    // Queue a socket to be flushed, or cancel it, ie when the socket is destroyed
+    void flushLater ( Socket *socket ) { _flushSockets.insert ( socket ); }
+    void cancelFlush ( Socket *socket ) { _flushSockets.erase ( socket ); }
+
     // Add / remove / clear socket instances
     void add ( Socket *socket );
     void remove ( Socket *socket );
@@ -34,8 +47,27 @@ public:
 
 private:
 
-    // Sets of active and allocated socket instances
-    std::unordered_set<Socket *> _activeSockets, _allocatedSockets;
+    // The fd and events a socket is registered with in the poller, fd is 0 if not registered
+    struct Registration
+    {
+        int fd = 0;
+        uint8_t events = 0;
+    };
+
+    // Active socket instances and their registrations
+    std::unordered_map<Socket *, Registration> _activeSockets;
+
+    // Set of allocated socket instances
+    std::unordered_set<Socket *> _allocatedSockets;
+
+    // Sockets with queued messages, these may be child sockets that aren't allocated here
+    std::unordered_set<Socket *> _flushSockets;
+
+    // Waits for socket events, created when initialized
+    PollerPtr _poller;
+
+    // Buffer for the events from each wait
+    std::vector<Poller::Event> _events;
 
     // Flag to indicate the set of allocated sockets has changed
     bool _changed = false;
@@ -43,6 +75,9 @@ private:
     // Flag to indicate if initialized
     bool _initialized = false;
 
+    // Update the poller registrations, since the fd and events of a socket change as it connects and disconnects
+    void updateRegistrations();
+
     // Private constructor, etc. for singleton class
     SocketManager();
     SocketManager ( const SocketManager& );
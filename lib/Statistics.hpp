@@ -6,6 +6,167 @@
 #include <cmath>
 #include <limits>
 #include <algorithm>
+#include <vector>
+
+
+// Each power of 2 is split into 2^LATENCY_HISTOGRAM_SUB_BITS buckets, so a bucket is within 1/16 of its values
+#define LATENCY_HISTOGRAM_SUB_BITS  ( 4 )
+#define LATENCY_HISTOGRAM_SUB_COUNT ( 1u << LATENCY_HISTOGRAM_SUB_BITS )
+
+
+// HDR style histogram of non-negative integer samples, ie latencies in milliseconds, with log sized buckets.
+// Values below LATENCY_HISTOGRAM_SUB_COUNT are exact, larger values keep LATENCY_HISTOGRAM_SUB_BITS significant bits.
+class LatencyHistogram
+{
+public:
+
+    void addSample ( double value )
+    {
+        addSample ( uint32_t ( std::min<double> ( std::max ( 0.0, std::round ( value ) ),
+                                                  std::numeric_limits<uint32_t>::max() ) ) );
+    }
+
+    void addSample ( uint32_t value, uint32_t count = 1 )
+    {
+        const size_t index = getBucketIndex ( value );
+
+        if ( index >= _counts.size() )
+            _counts.resize ( index + 1, 0 );
+
+        _counts[index] += count;
+        _total += count;
+    }
+
+    void reset()
+    {
+        _counts.clear();
+        _total = 0;
+    }
+
+    size_t getNumSamples() const
+    {
+        return _total;
+    }
+
+    // Buckets in order of value, the empty buckets after the last sample are not included
+    size_t getNumBuckets() const { return _counts.size(); }
+    uint32_t getBucketCount ( size_t index ) const { return _counts[index]; }
+
+    // The highest value equivalent to the sample at the given percentile, ie 99.9, or 0 if there are no samples
+    uint32_t getPercentile ( double percentile ) const
+    {
+        if ( _total == 0 )
+            return 0;
+
+        const uint64_t rank = std::max<uint64_t> ( 1, std::ceil ( std::min ( percentile, 100.0 ) * _total / 100 ) );
+        uint64_t count = 0;
+
+        for ( size_t i = 0; i < _counts.size(); ++i )
+        {
+            count += _counts[i];
+
+            if ( count >= rank )
+                return getBucketMax ( i );
+        }
+
+        return getBucketMax ( _counts.size() - 1 );
+    }
+
+    void merge ( const LatencyHistogram& histogram )
+    {
+        if ( histogram._counts.size() > _counts.size() )
+            _counts.resize ( histogram._counts.size(), 0 );
+
+        for ( size_t i = 0; i < histogram._counts.size(); ++i )
+            _counts[i] += histogram._counts[i];
+
+        _total += histogram._total;
+    }
+
+    // Only the non-empty buckets are encoded, as varint pairs of the index delta and count
+    void save ( cereal::BinaryOutputArchive& ar ) const
+    {
+        saveVarint ( ar, std::count_if ( _counts.begin(), _counts.end(), [] ( uint32_t c ) { return c > 0; } ) );
+
+        for ( size_t i = 0, last = 0; i < _counts.size(); ++i )
+        {
+            if ( ! _counts[i] )
+                continue;
+
+            saveVarint ( ar, i - last );
+            saveVarint ( ar, _counts[i] );
+            last = i;
+        }
+    }
+
+    void load ( cereal::BinaryInputArchive& ar )
+    {
+        reset();
+
+        const size_t maxIndex = getBucketIndex ( std::numeric_limits<uint32_t>::max() );
+        const uint32_t buckets = loadVarint ( ar );
+
+        // Each bucket is encoded at most once
+        if ( buckets > maxIndex + 1 )
+            throw cereal::Exception ( "Invalid histogram bucket count" );
+
+        // 64 bits so a large delta can't wrap around to a valid index
+        uint64_t index = 0;
+
+        for ( uint32_t i = 0; i < buckets; ++i )
+        {
+            index += loadVarint ( ar );
+
+            if ( index > maxIndex )
+                throw cereal::Exception ( "Invalid histogram bucket" );
+
+            _counts.resize ( index + 1, 0 );
+            _counts[index] = loadVarint ( ar );
+            _total += _counts[index];
+        }
+    }
+
+    static size_t getBucketIndex ( uint32_t value )
+    {
+        if ( value < LATENCY_HISTOGRAM_SUB_COUNT )
+            return value;
+
+        // Number of low bits dropped so that LATENCY_HISTOGRAM_SUB_BITS + 1 significant bits remain
+        uint32_t shift = 0;
+        while ( ( value >> shift ) >= 2 * LATENCY_HISTOGRAM_SUB_COUNT )
+            ++shift;
+
+        return shift * LATENCY_HISTOGRAM_SUB_COUNT + ( value >> shift );
+    }
+
+    static uint32_t getBucketMax ( size_t index )
+    {
+        if ( index < 2 * LATENCY_HISTOGRAM_SUB_COUNT )
+            return index;
+
+        const uint32_t shift = index / LATENCY_HISTOGRAM_SUB_COUNT - 1;
+        const uint64_t lower = uint64_t ( index - shift * LATENCY_HISTOGRAM_SUB_COUNT ) << shift;
+
+        return uint32_t ( lower + ( 1ull << shift ) - 1 );
+    }
+
+    static uint32_t getBucketMin ( size_t index )
+    {
+        return ( index == 0 ? 0 : getBucketMax ( index - 1 ) + 1 );
+    }
+
+    // The middle of the bucket, for modelling the samples in it
+    static double getBucketMid ( size_t index )
+    {
+        return ( double ( getBucketMin ( index ) ) + getBucketMax ( index ) ) / 2;
+    }
+
+private:
+
+    std::vector<uint32_t> _counts;
+
+    uint64_t _total = 0;
+};
 
 
 // Template class to calculate stats with an online algorithm
@@ -26,6 +187,8 @@ public:
         ++_count;
         _mean += delta / _count;
         _sumOfSquaredDeltas += delta * ( value - _mean );
+
+        _histogram.addSample ( double ( value ) );
     }
 
     void reset()
@@ -33,6 +196,7 @@ public:
         _count = 0;
         _worst = -std::numeric_limits<double>::infinity();
         _mean = _sumOfSquaredDeltas = 0.0;
+        _histogram.reset();
     }
 
     size_t getNumSamples() const
@@ -76,14 +240,30 @@ public:
         return getStdDev() / std::sqrt ( _count );
     }
 
+    // Percentile of the samples, ie 50, 90, 99, 99.9, rounded up to the histogram bucket
+    double getPercentile ( double percentile ) const
+    {
+        return _histogram.getPercentile ( percentile );
+    }
+
+    // Samples rounded to integers, this may have fewer samples than getNumSamples if merged with stats from an
+    // older version, or deserialized without the histogram, see PingStats
+    const LatencyHistogram& getHistogram() const { return _histogram; }
+    LatencyHistogram& getHistogram() { return _histogram; }
+
     void merge ( const Statistics& stats )
     {
+        if ( _count + stats._count == 0 )
+            return;
+
         _worst = std::max ( _worst, stats._worst );
         _mean = ( _mean * _count + stats._mean * stats._count ) / ( _count + stats._count );
         _sumOfSquaredDeltas += stats._sumOfSquaredDeltas;
         _count += stats._count;
+        _histogram.merge ( stats._histogram );
     }
 
+    // The histogram is not included, so this stays compatible with older versions
     PROTOCOL_MESSAGE_BOILERPLATE ( Statistics, _count, _worst, _mean, _sumOfSquaredDeltas )
 
 private:
@@ -98,5 +278,7 @@ private:
 
     // Sum of (latency - mean)^2 for each latency value
     double _sumOfSquaredDeltas = 0.0;
+
+    LatencyHistogram _histogram;
 };
 
@@ -38,16 +38,107 @@ void splitFormat ( const string& fmt, string& first, string& rest )
     rest = ( i < fmt.size() ? fmt.substr ( i ) : "" );
 }
 
-string formatAsHex ( const string& bytes )
+void FormatBuffer::appendInteger ( char conversion, uint32_t val )
 {
-    if ( bytes.empty() )
-        return "";
+    char digits[16];
+    char *end = digits + sizeof ( digits ), *pos = end;
+
+    const bool negative = ( ( conversion == 'd' || conversion == 'i' ) && ( int32_t ) val < 0 );
+
+    if ( negative )
+        val = 0u - val;
+
+    if ( conversion == 'x' || conversion == 'X' )
+    {
+        const char *hex = ( conversion == 'x' ? "0123456789abcdef" : "0123456789ABCDEF" );
+
+        do
+        {
+            *--pos = hex[val & 0xF];
+            val >>= 4;
+        }
+        while ( val );
+    }
+    else
+    {
+        do
+        {
+            *--pos = '0' + ( val % 10 );
+            val /= 10;
+        }
+        while ( val );
+    }
+
+    if ( negative )
+        *--pos = '-';
+
+    append ( pos, end - pos );
+}
+
+FormatString::FormatString ( const char *fmt ) : _fmt ( fmt )
+{
+    string rest = _fmt;
+
+    // Split the same way as format, until there are no more conversions
+    while ( ! rest.empty() )
+    {
+        string first, next;
+        splitFormat ( rest, first, next );
+
+        Piece piece;
+
+        if ( first.empty() )
+        {
+            piece.tail = true;
+            piece.rawTail = rest;
+            piece.literal = format ( rest );
+            _pieces.push_back ( piece );
+            break;
+        }
+
+        // Find the single % that starts the conversion
+        size_t i;
+        for ( i = 0; i < first.size(); ++i )
+        {
+            if ( first[i] != '%' )
+                continue;
 
-    string str;
-    for ( char c : bytes )
-        str += format ( "%02x ", ( unsigned char ) c );
+            if ( i + 1 < first.size() && first[i + 1] == '%' )
+                ++i;
+            else
+                break;
+        }
+
+        piece.literal = format ( first.substr ( 0, i ) );
+
+        if ( i < first.size() )
+        {
+            piece.spec = first.substr ( i );
 
-    return str.substr ( 0, str.size() - 1 );
+            if ( piece.spec.size() == 2 && strchr ( "diuxXs", piece.spec[1] ) )
+                piece.conversion = piece.spec[1];
+        }
+
+        _pieces.push_back ( piece );
+        rest = next;
+    }
+}
+
+void FormatString::printRemaining ( FormatBuffer& out, size_t i ) const
+{
+    // Like format, the rest of the string is unescaped, but the conversions are left as is
+    for ( ; i < _pieces.size(); ++i )
+    {
+        out.append ( _pieces[i].literal );
+
+        if ( ! _pieces[i].tail )
+            out.append ( _pieces[i].spec );
+    }
+}
+
+string formatAsHex ( const string& bytes )
+{
+    return formatAsHex ( bytes.c_str(), bytes.size() );
 }
 
 string formatAsHex ( const void *bytes, size_t len )
@@ -55,11 +146,19 @@ string formatAsHex ( const void *bytes, size_t len )
     if ( len == 0 )
         return "";
 
-    string str;
+    static const char *hex = "0123456789abcdef";
+
+    // Same as "%02x" for each byte, separated by spaces
+    string str ( 3 * len - 1, ' ' );
+
     for ( size_t i = 0; i < len; ++i )
-        str += format ( "%02x ", static_cast<const unsigned char *> ( bytes ) [i] );
+    {
+        const unsigned char c = static_cast<const unsigned char *> ( bytes ) [i];
+        str[3 * i] = hex[c >> 4];
+        str[3 * i + 1] = hex[c & 0xF];
+    }
 
-    return str.substr ( 0, str.size() - 1 );
+    return str;
 }
 
 string trimmed ( string str, const string& ws )
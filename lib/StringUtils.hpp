@@ -5,6 +5,8 @@
 #include <sstream>
 #include <iostream>
 #include <cstdio>
+#include <cstring>
+#include <cstdint>
 #include <cctype>
 #include <type_traits>
 #include <algorithm>
@@ -90,6 +92,230 @@ inline std::string format ( const std::string& fmt, const T& val, V ... vals )
 }
 
 
+// Output buffer for FormatString, always null terminated, and counts the length that would have been written
+class FormatBuffer
+{
+public:
+
+    FormatBuffer ( char *buffer, size_t size ) : _buffer ( buffer ), _size ( size ) {}
+
+    void append ( const char *str, size_t len )
+    {
+        if ( _len + 1 < _size )
+            std::memcpy ( _buffer + _len, str, std::min ( len, _size - _len - 1 ) );
+
+        _len += len;
+    }
+
+    void append ( const std::string& str ) { append ( str.c_str(), str.size() ); }
+
+    // Append a 32-bit integer after integer promotion, for the conversions d, i, u, x, and X
+    void appendInteger ( char conversion, uint32_t val );
+
+    template<typename T>
+    void appendPrintf ( const char *spec, const T& val )
+    {
+        const size_t offset = std::min ( _len, _size ? _size - 1 : 0 );
+        const int len = std::snprintf ( _buffer + offset, _size - offset, spec, val );
+
+        if ( len > 0 )
+            _len += len;
+    }
+
+    // Null terminate and return the formatted length, which is larger than the buffer if it was truncated
+    size_t finish()
+    {
+        if ( _size )
+            _buffer[std::min ( _len, _size - 1 )] = '\0';
+
+        return _len;
+    }
+
+private:
+
+    char *_buffer;
+
+    size_t _size, _len = 0;
+};
+
+
+// Format string that is parsed once, then formats directly into a buffer. The output is the same as format, but
+// there are no heap allocations for arithmetic, pointer, and string arguments. Other types are still printed with
+// operator<< for %s. Plain %d, %i, %u, %x, %X, and %s are converted without snprintf.
+class FormatString
+{
+public:
+
+    FormatString ( const char *fmt );
+
+    // Format into the buffer, which is truncated if needed. Returns the formatted length like snprintf, so the output
+    // was truncated if the return value is not less than the size.
+    template<typename ... V>
+    size_t print ( char *buffer, size_t size, const V& ... vals ) const
+    {
+        FormatBuffer out ( buffer, size );
+
+        // Like format, there is no unescaping without any arguments
+        if ( sizeof ... ( vals ) == 0 )
+            out.append ( _fmt );
+        else
+            printArgs ( out, 0, vals... );
+
+        return out.finish();
+    }
+
+    // Format to a string, this only allocates the result if it fits in a stack buffer
+    template<typename ... V>
+    std::string str ( const V& ... vals ) const
+    {
+        char buffer[1024];
+        const size_t len = print ( buffer, sizeof ( buffer ), vals... );
+
+        if ( len < sizeof ( buffer ) )
+            return std::string ( buffer, len );
+
+        std::string result ( len + 1, '\0' );
+        print ( &result[0], result.size(), vals... );
+        result.resize ( len );
+        return result;
+    }
+
+private:
+
+    // Each piece is what format passes to a single snprintf call
+    struct Piece
+    {
+        // Text before the conversion, with %% already unescaped
+        std::string literal;
+
+        // Conversion specification, eg "%08x", empty if there are no more conversions
+        std::string spec;
+
+        // Conversion if it can be done without snprintf, otherwise 0
+        char conversion = 0;
+
+        // Text ending in a single %, which is output as is, and unescaped as the literal if there are no arguments left
+        bool tail = false;
+        std::string rawTail;
+    };
+
+    std::string _fmt;
+
+    std::vector<Piece> _pieces;
+
+    // Output the remaining pieces when there are no arguments left
+    void printRemaining ( FormatBuffer& out, size_t i ) const;
+
+    void printArgs ( FormatBuffer& out, size_t i ) const { printRemaining ( out, i ); }
+
+    template<typename T, typename ... V>
+    void printArgs ( FormatBuffer& out, size_t i, const T& val, const V& ... vals ) const
+    {
+        // Extra arguments are ignored
+        if ( i == _pieces.size() )
+            return;
+
+        const Piece& piece = _pieces[i];
+
+        if ( piece.tail )
+        {
+            out.append ( piece.rawTail );
+            return;
+        }
+
+        out.append ( piece.literal );
+
+        if ( piece.spec.empty() )
+            return;
+
+        printArg ( out, piece, val, bool2type < std::is_arithmetic<T>::value || std::is_pointer<T>::value > () );
+        printArgs ( out, i + 1, vals... );
+    }
+
+    // For arithmetic and pointer types
+    template<typename T>
+    static void printArg ( FormatBuffer& out, const Piece& piece, const T& val, bool2type<true> )
+    {
+        printNumber ( out, piece, val, bool2type < std::is_integral<T>::value
+                      && sizeof ( T ) <= sizeof ( uint32_t ) > () );
+    }
+
+    // Integers up to 32 bits, which are promoted to 32 bits like snprintf would
+    template<typename T>
+    static void printNumber ( FormatBuffer& out, const Piece& piece, const T& val, bool2type<true> )
+    {
+        if ( piece.conversion && piece.conversion != 's' )
+            out.appendInteger ( piece.conversion, ( uint32_t ) val );
+        else
+            out.appendPrintf ( piece.spec.c_str(), val );
+    }
+
+    template<typename T>
+    static void printNumber ( FormatBuffer& out, const Piece& piece, const T& val, bool2type<false> )
+    {
+        out.appendPrintf ( piece.spec.c_str(), val );
+    }
+
+    static void printArg ( FormatBuffer& out, const Piece& piece, const char *val, bool2type<true> )
+    {
+        if ( val && piece.conversion == 's' )
+            out.append ( val, std::strlen ( val ) );
+        else
+            out.appendPrintf ( piece.spec.c_str(), val );
+    }
+
+    static void printArg ( FormatBuffer& out, const Piece& piece, char *val, bool2type<true> )
+    {
+        printArg ( out, piece, ( const char * ) val, bool2type<true>() );
+    }
+
+    // Strings are printed like format ( val ) would
+    static void printString ( FormatBuffer& out, const Piece& piece, const char *str, size_t len )
+    {
+        if ( piece.conversion == 's' )
+            out.append ( str, len );
+        else
+            out.appendPrintf ( piece.spec.c_str(), str );
+    }
+
+    template<size_t N>
+    static void printArg ( FormatBuffer& out, const Piece& piece, const char ( &val ) [N], bool2type<false> )
+    {
+        printString ( out, piece, val, std::strlen ( val ) );
+    }
+
+    static void printArg ( FormatBuffer& out, const Piece& piece, const std::string& val, bool2type<false> )
+    {
+        if ( val.find ( "%%" ) == std::string::npos )
+        {
+            printString ( out, piece, val.c_str(), val.size() );
+            return;
+        }
+
+        const std::string str = format ( val );
+        printString ( out, piece, str.c_str(), str.size() );
+    }
+
+    // For other types, which are printed with operator<<
+    template<typename T>
+    static void printArg ( FormatBuffer& out, const Piece& piece, const T& val, bool2type<false> )
+    {
+        const std::string str = format ( val );
+        printString ( out, piece, str.c_str(), str.size() );
+    }
+};
+
+
+// Format into a buffer with a FormatString that is only parsed once for each call site, returns the formatted length.
+// The FormatString is never freed, so this can still be used during static destruction.
+#define FORMAT_TO(BUFFER, SIZE, FORMAT, ...)                                                                           \
+    ( [&]() -> size_t                                                                                                  \
+    {                                                                                                                  \
+        static const FormatString *formatString = new FormatString ( FORMAT );                                         \
+        return formatString->print ( BUFFER, SIZE, ## __VA_ARGS__ );                                                   \
+    } () )
+
+
 // Parse a hex string
 template <typename T>
 inline T parseHex ( const std::string& str )
@@ -3,10 +3,7 @@
 #include "Protocol.hpp"
 #include "Exceptions.hpp"
 #include "ErrorStrings.hpp"
-
-#include <winsock2.h>
-#include <windows.h>
-#include <ws2tcpip.h>
+#include "SocketHeaders.hpp"
 
 #include <algorithm>
 
@@ -54,9 +51,10 @@ TcpSocket::TcpSocket ( Socket::Owner *owner, const SocketShareData& data )
 
     _connectTimeout = data.connectTimeout;
     _state = data.state;
-    _readBuffer = data.readBuffer;
-    _readPos = data.readPos;
+    _readBuffer.assign ( data.readBuffer.data(), data.readBuffer.size() );
+    _wireVersion = data.wireVersion;
 
+#ifdef _WIN32
     ASSERT ( data.info->iSocketType == SOCK_STREAM );
     ASSERT ( data.info->iProtocol == IPPROTO_TCP );
 
@@ -68,6 +66,10 @@ TcpSocket::TcpSocket ( Socket::Owner *owner, const SocketShareData& data )
         _fd = 0;
         THROW_WIN_EXCEPTION ( WSAGetLastError(), "WSASocket failed", ERROR_NETWORK_GENERIC );
     }
+#else
+    // Shared sockets are only created by WSADuplicateSocket
+    THROW_EXCEPTION ( "Socket sharing is not supported", ERROR_NETWORK_GENERIC );
+#endif
 
     SocketManager::get().add ( this );
 }
@@ -102,7 +104,7 @@ SocketPtr TcpSocket::accept ( Socket::Owner *owner )
         return 0;
 
     sockaddr_storage sas;
-    int saLen = sizeof ( sas );
+    socklen_t saLen = sizeof ( sas );
 
     const int newFd = ::accept ( _fd, ( sockaddr * ) &sas, &saLen );
 
@@ -128,7 +130,7 @@ bool TcpSocket::send ( SerializableSequence *message, const IpAddrPort& address
 
 bool TcpSocket::send ( const MsgPtr& msg, const IpAddrPort& address )
 {
-    const string buffer = ::Protocol::encode ( msg );
+    const string buffer = ::Protocol::encode ( msg, _wireVersion );
 
     LOG ( "Encoded '%s' to [ %u bytes ]", msg, buffer.size() );
 
@@ -138,6 +140,13 @@ bool TcpSocket::send ( const MsgPtr& msg, const IpAddrPort& address )
     return Socket::send ( &buffer[0], buffer.size() );
 }
 
+bool TcpSocket::sendEncoded ( const MsgPtr& msg, const string& bytes )
+{
+    LOG ( "Sending encoded '%s' [ %u bytes ]", msg, bytes.size() );
+
+    return Socket::send ( &bytes[0], bytes.size() );
+}
+
 SocketPtr TcpSocket::shared ( Socket::Owner *owner, const SocketShareData& data )
 {
     if ( data.protocol != Protocol::TCP )
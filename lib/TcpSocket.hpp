@@ -34,6 +34,10 @@ public:
     bool send ( SerializableSequence *message, const IpAddrPort& address = NullAddress ) override;
     bool send ( const MsgPtr& message, const IpAddrPort& address = NullAddress ) override;
 
+    // Send an already encoded message
+    bool canSendEncoded() const override { return true; }
+    bool sendEncoded ( const MsgPtr& message, const std::string& bytes ) override;
+
 protected:
 
     // Socket event callbacks
@@ -17,9 +17,13 @@ Timer::~Timer()
 void Timer::start ( uint64_t delay )
 {
     _delay = delay;
+
+    TimerManager::get().schedule ( this );
 }
 
 void Timer::stop()
 {
+    TimerManager::get().cancel ( this );
+
     _delay = _expiry = 0;
 }
@@ -31,6 +31,9 @@ public:
 private:
 
     uint64_t _delay = 0, _expiry = 0;
+
+    // Slot in the TimerManager
+    uint32_t _slot = 0;
 };
 
 typedef std::shared_ptr<Timer> TimerPtr;
@@ -2,8 +2,15 @@
 #include "Timer.hpp"
 #include "Logger.hpp"
 
+#include <algorithm>
+#include <functional>
+
+#ifdef _WIN32
 #include <windows.h>
 #include <mmsystem.h>
+#else
+#include <ctime>
+#endif
 
 using namespace std;
 
@@ -13,6 +20,7 @@ void TimerManager::updateNow()
     if ( ! _initialized )
         return;
 
+#ifdef _WIN32
     if ( _useHiResTimer )
     {
         QueryPerformanceCounter ( ( LARGE_INTEGER * ) &_ticks );
@@ -23,6 +31,11 @@ void TimerManager::updateNow()
         // Note: timeGetTime should be called between timeBeginPeriod / timeEndPeriod to ensure accuracy
         _now = timeGetTime();
     }
+#else
+    timespec ts;
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    _now = uint64_t ( ts.tv_sec ) * 1000 + ts.tv_nsec / 1000000;
+#endif // _WIN32
 }
 
 void TimerManager::check()
@@ -30,97 +43,153 @@ void TimerManager::check()
     if ( ! _initialized )
         return;
 
-    if ( _changed )
+    updateNow();
+
+    // Expiries are popped one at a time, since the callbacks can start, stop, or delete any timer
+    while ( ! _heap.empty() && _heap.front().expiry <= _now )
     {
-        for ( Timer *timer : _allocatedTimers )
-        {
-            if ( _activeTimers.find ( timer ) != _activeTimers.end() )
-                continue;
+        const Expiry top = _heap.front();
 
-            LOG ( "Added timer %08x; delay='%llu ms'", timer, timer->_delay );
-            _activeTimers.insert ( timer );
-        }
+        pop_heap ( _heap.begin(), _heap.end(), greater<Expiry>() );
+        _heap.pop_back();
 
-        for ( auto it = _activeTimers.begin(); it != _activeTimers.end(); )
+        if ( _slots[top.slot].generation != top.generation )
         {
-            if ( _allocatedTimers.find ( *it ) != _allocatedTimers.end() )
-            {
-                ++it;
-                continue;
-            }
-
-            LOG ( "Removed timer %08x", *it ); // Don't log any extra data cus already de-allocated
-            _activeTimers.erase ( it++ );
+            --_cancelled;
+            continue;
         }
 
-        _changed = false;
-    }
+        Timer *timer = _slots[top.slot].timer;
 
-    _nextExpiry = UINT64_MAX;
+        ++_slots[top.slot].generation;
 
-    if ( _activeTimers.empty() )
-        return;
+        LOG ( "Expired timer %08x", timer );
 
-    updateNow();
+        timer->_delay = timer->_expiry = 0;
+
+        if ( timer->owner )
+            timer->owner->timerExpired ( timer );
+    }
 
-    for ( Timer *timer : _activeTimers )
+    // Start the pending timers after the expired ones, so they are started relative to the same time
+    for ( size_t i = 0; i < _pending.size(); ++i )
     {
-        if ( _allocatedTimers.find ( timer ) == _allocatedTimers.end() )
+        Timer *timer = _slots[_pending[i]].timer;
+
+        // Skip freed, stopped, or already started timers
+        if ( ! timer || timer->_delay == 0 )
             continue;
 
-        if ( timer->_expiry > 0 && _now >= timer->_expiry )
-        {
-            LOG ( "Expired timer %08x", timer );
+        LOG ( "Started timer %08x; delay='%llu ms'", timer, timer->_delay );
 
-            timer->_delay = timer->_expiry = 0;
+        invalidate ( timer );
 
-            if ( timer->owner )
-            {
-                timer->owner->timerExpired ( timer );
+        timer->_expiry = _now + timer->_delay;
+        timer->_delay = 0;
 
-                if ( _allocatedTimers.find ( timer ) == _allocatedTimers.end() )
-                    continue;
-            }
-        }
+        _heap.push_back ( { timer->_expiry, _sequence++, timer->_slot, _slots[timer->_slot].generation } );
+        push_heap ( _heap.begin(), _heap.end(), greater<Expiry>() );
+    }
 
-        if ( timer->_delay > 0 )
-        {
-            LOG ( "Started timer %08x; delay='%llu ms'", timer, timer->_delay );
+    _pending.clear();
 
-            timer->_expiry = _now + timer->_delay;
-            timer->_delay = 0;
-        }
+    pruneHeap();
 
-        if ( timer->_expiry > 0 && timer->_expiry < _nextExpiry )
-            _nextExpiry = timer->_expiry;
+    _nextExpiry = ( _heap.empty() ? UINT64_MAX : _heap.front().expiry );
+}
+
+bool TimerManager::isAllocated ( Timer *timer ) const
+{
+    return ( timer->_slot < _slots.size() && _slots[timer->_slot].timer == timer );
+}
+
+void TimerManager::invalidate ( Timer *timer )
+{
+    ++_slots[timer->_slot].generation;
+
+    if ( timer->_expiry > 0 )
+        ++_cancelled;
+}
+
+void TimerManager::pruneHeap()
+{
+    while ( ! _heap.empty() && _slots[_heap.front().slot].generation != _heap.front().generation )
+    {
+        pop_heap ( _heap.begin(), _heap.end(), greater<Expiry>() );
+        _heap.pop_back();
+        --_cancelled;
     }
+
+    // Timers that are restarted often leave cancelled expiries behind, so rebuild once they are most of the heap
+    if ( _cancelled < 64 || _cancelled * 2 < _heap.size() )
+        return;
+
+    auto it = remove_if ( _heap.begin(), _heap.end(), [this] ( const Expiry& e )
+    {
+        return ( _slots[e.slot].generation != e.generation );
+    } );
+
+    _heap.erase ( it, _heap.end() );
+    make_heap ( _heap.begin(), _heap.end(), greater<Expiry>() );
+    _cancelled = 0;
 }
 
 void TimerManager::add ( Timer *timer )
 {
     LOG ( "Adding timer %08x", timer );
 
-    _allocatedTimers.insert ( timer );
-    _changed = true;
+    if ( _freeSlots.empty() )
+    {
+        timer->_slot = _slots.size();
+        _slots.push_back ( Slot() );
+    }
+    else
+    {
+        timer->_slot = _freeSlots.back();
+        _freeSlots.pop_back();
+    }
+
+    _slots[timer->_slot].timer = timer;
 }
 
 void TimerManager::remove ( Timer *timer )
 {
-    if ( _allocatedTimers.erase ( timer ) )
-    {
-        LOG ( "Removing timer %08x", timer );
+    if ( ! isAllocated ( timer ) )
+        return;
 
-        _changed = true;
-    }
+    LOG ( "Removing timer %08x", timer );
+
+    invalidate ( timer );
+
+    _slots[timer->_slot].timer = 0;
+    _freeSlots.push_back ( timer->_slot );
+}
+
+void TimerManager::schedule ( Timer *timer )
+{
+    if ( timer->_delay == 0 || ! isAllocated ( timer ) )
+        return;
+
+    _pending.push_back ( timer->_slot );
+}
+
+void TimerManager::cancel ( Timer *timer )
+{
+    if ( ! isAllocated ( timer ) )
+        return;
+
+    invalidate ( timer );
 }
 
 void TimerManager::clear()
 {
     LOG ( "Clearing timers" );
 
-    _activeTimers.clear();
-    _allocatedTimers.clear();
-    _changed = true;
+    _slots.clear();
+    _freeSlots.clear();
+    _heap.clear();
+    _pending.clear();
+    _cancelled = 0;
 }
 
 TimerManager::TimerManager() : _useHiResTimer ( true ) {}
@@ -135,6 +204,7 @@ void TimerManager::initialize()
     // Seed the RNG in this thread because Windows has per-thread RNG, and timers are also thread specific
     srand ( time ( 0 ) );
 
+#ifdef _WIN32
     // Make sure we are using a single core on a dual core machine, otherwise timings will be off.
     DWORD_PTR oldMask = SetThreadAffinityMask ( GetCurrentThread(), 1 );
 
@@ -147,6 +217,7 @@ void TimerManager::initialize()
 
         SetThreadAffinityMask ( GetCurrentThread(), oldMask );
     }
+#endif // _WIN32
 }
 
 void TimerManager::deinitialize()
@@ -1,6 +1,8 @@
 #pragma once
 
-#include <unordered_set>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
 
 
 class Timer;
@@ -21,6 +23,12 @@ public:
     void remove ( Timer *timer );
     void clear();
 
+    // Schedule a timer after it is started, the expiry is set on the next check
+    void schedule ( Timer *timer );
+
+    // Cancel the expiry of a stopped timer
+    void cancel ( Timer *timer );
+
     // Initialize / deinitialize timer manager
     void initialize();
     void deinitialize();
@@ -41,8 +49,41 @@ public:
 
 private:
 
-    // Sets of active and allocated timer instances
-    std::unordered_set<Timer *> _activeTimers, _allocatedTimers;
+    // Each timer is allocated a slot. The generation changes whenever the timer is rescheduled or freed,
+    // so expiries in the heap are cancelled by just changing the generation.
+    struct Slot
+    {
+        Timer *timer = 0;
+        uint32_t generation = 0;
+    };
+
+    struct Expiry
+    {
+        uint64_t expiry, sequence;
+        uint32_t slot, generation;
+
+        // Ordered by expiry, then by when it was scheduled
+        bool operator> ( const Expiry& other ) const
+        {
+            return ( expiry != other.expiry ? expiry > other.expiry : sequence > other.sequence );
+        }
+    };
+
+    // Timer slots indexed by Timer::_slot, and the free slots
+    std::vector<Slot> _slots;
+    std::vector<uint32_t> _freeSlots;
+
+    // Min-heap of expiries, including cancelled ones until they are popped
+    std::vector<Expiry> _heap;
+
+    // Number of cancelled expiries in the heap
+    size_t _cancelled = 0;
+
+    // Incremented for each expiry, so timers with the same expiry fire in the order they were scheduled
+    uint64_t _sequence = 0;
+
+    // Slots of timers started since the last check
+    std::vector<uint32_t> _pending;
 
     // Indicates if the hi-res timer should be used
     bool _useHiResTimer;
@@ -56,12 +97,18 @@ private:
     // The next time when a timer will expire
     uint64_t _nextExpiry = 0;
 
-    // Flag to indicate the set of allocated timers has changed
-    bool _changed = false;
-
     // Flag to indicate if initialized
     bool _initialized = false;
 
+    // Check if the timer is allocated a slot
+    bool isAllocated ( Timer *timer ) const;
+
+    // Invalidate the current expiry of a timer, if any
+    void invalidate ( Timer *timer );
+
+    // Remove cancelled expiries from the top of the heap, and rebuild the heap if most of it is cancelled
+    void pruneHeap();
+
     // Private constructor, etc. for singleton class
     TimerManager();
     TimerManager ( const TimerManager& );
@@ -3,10 +3,7 @@
 #include "Protocol.hpp"
 #include "Exceptions.hpp"
 #include "ErrorStrings.hpp"
-
-#include <winsock2.h>
-#include <windows.h>
-#include <ws2tcpip.h>
+#include "SocketHeaders.hpp"
 
 #include <typeinfo>
 #include <algorithm>
@@ -54,9 +51,10 @@ UdpSocket::UdpSocket ( Socket::Owner *owner, const SocketShareData& data )
 
     _connectTimeout = data.connectTimeout;
     _state = data.state;
-    _readBuffer = data.readBuffer;
-    _readPos = data.readPos;
+    _readBuffer.assign ( data.readBuffer.data(), data.readBuffer.size() );
+    _wireVersion = data.wireVersion;
 
+#ifdef _WIN32
     ASSERT ( data.info->iSocketType == SOCK_DGRAM );
     ASSERT ( data.info->iProtocol == IPPROTO_UDP );
 
@@ -68,6 +66,10 @@ UdpSocket::UdpSocket ( Socket::Owner *owner, const SocketShareData& data )
         _fd = 0;
         THROW_WIN_EXCEPTION ( WSAGetLastError(), "WSASocket failed", ERROR_NETWORK_GENERIC );
     }
+#else
+    // Shared sockets are only created by WSADuplicateSocket
+    THROW_EXCEPTION ( "Socket sharing is not supported", ERROR_NETWORK_GENERIC );
+#endif
 
     LOG ( "Shared:" );
 
@@ -132,6 +134,10 @@ UdpSocket::~UdpSocket()
 
 void UdpSocket::disconnect()
 {
+    // Send the coalesced messages before the disconnect messages
+    flush();
+    SocketManager::get().cancelFlush ( this );
+
     // Send 3 UdpControl::Disconnect messages if not connection-less
     if ( !isConnectionLess() && ( isConnected() || isServer() ) )
     {
@@ -263,6 +269,8 @@ bool UdpSocket::sendRaw ( const MsgPtr& msg, const IpAddrPort& address )
             for ( char& byte : msg->_hash )
                 byte = ( rand() % 0x100 );
             msg->_hashValid = false;
+            msg->_hashIntegrity = ::Protocol::getIntegrity ( msg->getMsgType(), _wireVersion ).value;
+            msg->_wireVersion = _wireVersion;
         }
         else
         {
@@ -271,25 +279,119 @@ bool UdpSocket::sendRaw ( const MsgPtr& msg, const IpAddrPort& address )
     }
 #endif // NOT RELEASE
 
-    const string buffer = ::Protocol::encode ( msg );
+    const string buffer = ::Protocol::encode ( msg, _wireVersion );
 
     LOG ( "Encoded '%s' to [ %u bytes ]", msg, buffer.size() );
 
     if ( !buffer.empty() && buffer.size() <= 256 )
         LOG ( "Hex: %s", formatAsHex ( buffer ) );
 
+    if ( coalesce ( msg, buffer, address ) )
+        return true;
+
+    return sendDatagram ( buffer, address.empty() ? this->address : address );
+}
+
+bool UdpSocket::sendDatagram ( const string& buffer, const IpAddrPort& address )
+{
     // Real UDP sockets send directly
-    if ( isReal()  )
-        return Socket::send ( &buffer[0], buffer.size(), address.empty() ? this->address : address );
+    if ( isReal() )
+        return Socket::send ( &buffer[0], buffer.size(), address );
 
     // Child UDP sockets send via parent if not disconnected
     if ( isChild() && _parentSocket )
-        return _parentSocket->Socket::send ( &buffer[0], buffer.size(), address.empty() ? this->address : address );
+        return _parentSocket->Socket::send ( &buffer[0], buffer.size(), address );
 
     LOG_UDP_SOCKET ( this, "Cannot send over disconnected socket" );
     return false;
 }
 
+bool UdpSocket::coalesce ( const MsgPtr& msg, const string& buffer, const IpAddrPort& address )
+{
+    if ( !_coalescing || !isConnectionBased() || isDisconnected() || ( isChild() && !_parentSocket ) )
+        return false;
+
+    // Keep alive packets aren't needed if there is anything else to send
+    if ( !msg )
+        return !( _coalesced.empty() && _coalescedAck.empty() );
+
+    // Messages to other addresses, probes that must be sent at their exact size, and the disconnect message
+    // are sent directly, but only after the coalesced messages, so the order is preserved.
+    if ( ( !address.empty() && address != getRemoteAddress() )
+            || msg->getMsgType() == MsgType::MtuProbe
+            || ( msg->getMsgType() == MsgType::UdpControl
+                 && msg->getAs<UdpControl>().value == UdpControl::Disconnect ) )
+    {
+        flush();
+        return false;
+    }
+
+    const bool isAck = ( msg->getMsgType() == MsgType::AckSequence || msg->getMsgType() == MsgType::SelectiveAck );
+
+    // Only coalesce up to the largest datagram that is known to get through
+    const size_t maxSize = _gbn.getDatagramSize();
+
+    if ( _coalesced.size() + ( isAck ? 0 : _coalescedAck.size() ) + buffer.size() > maxSize )
+        flush();
+
+    if ( buffer.size() > maxSize )
+        return false;
+
+    if ( isAck )
+        _coalescedAck = buffer;
+    else
+        _coalesced += buffer;
+
+    if ( _coalesceWindow == 0 )
+    {
+        SocketManager::get().flushLater ( this );
+    }
+    else if ( !_coalesceTimer || !_coalesceTimer->isStarted() )
+    {
+        if ( !_coalesceTimer )
+            _coalesceTimer.reset ( new Timer ( this ) );
+
+        _coalesceTimer->start ( _coalesceWindow );
+    }
+
+    return true;
+}
+
+void UdpSocket::flush()
+{
+    if ( _coalesceTimer )
+        _coalesceTimer->stop();
+
+    if ( _coalesced.empty() && _coalescedAck.empty() )
+        return;
+
+    // The ACK goes first, since the messages after it may take longer to handle
+    string buffer;
+    buffer.swap ( _coalescedAck );
+    buffer += _coalesced;
+    _coalesced.clear();
+
+    LOG_UDP_SOCKET ( this, "Flushing [ %u bytes ]", buffer.size() );
+
+    sendDatagram ( buffer, getRemoteAddress() );
+}
+
+void UdpSocket::setCoalescing ( bool enabled, uint64_t window )
+{
+    if ( !enabled )
+        flush();
+
+    _coalescing = enabled;
+    _coalesceWindow = window;
+}
+
+void UdpSocket::timerExpired ( Timer *timer )
+{
+    ASSERT ( timer == _coalesceTimer.get() );
+
+    flush();
+}
+
 void UdpSocket::goBackNSendRaw ( GoBackN *gbn, const MsgPtr& msg )
 {
     ASSERT ( gbn == &_gbn );
@@ -435,6 +537,14 @@ void UdpSocket::goBackNTimeout ( GoBackN *gbn )
         owner->socketDisconnected ( this );
 }
 
+uint8_t UdpSocket::goBackNWireVersion ( const GoBackN *gbn ) const
+{
+    ASSERT ( gbn == &_gbn );
+
+    // GoBackN messages are encoded by sendRaw with this socket's wire version
+    return _wireVersion;
+}
+
 void UdpSocket::socketRead ( const MsgPtr& msg, const IpAddrPort& address )
 {
     if ( isConnectionLess() )
@@ -503,6 +613,12 @@ MsgPtr UdpSocket::share ( int processId )
     if ( isChild() )
         return NullMsg;
 
+    // The other process can't send the coalesced messages
+    flush();
+
+    for ( const auto& kv : _childSockets )
+        kv.second->flush();
+
     MsgPtr data = Socket::share ( processId );
 
     ASSERT ( typeid ( *data ) == typeid ( SocketShareData ) );
@@ -608,6 +724,16 @@ void UdpSocket::setKeepAlive ( uint64_t timeout )
         _gbn.setKeepAlive ( _keepAlive = timeout );
 }
 
+void UdpSocket::setWireVersion ( uint8_t version )
+{
+    Socket::setWireVersion ( version );
+
+    const bool selectiveRepeat = ( version >= WIRE_VERSION_COMPACT );
+
+    if ( isConnectionBased() && _gbn.isSelectiveRepeat() != selectiveRepeat )
+        _gbn.setSelectiveRepeat ( selectiveRepeat );
+}
+
 void UdpSocket::resetGbnState()
 {
     _gbn.reset();
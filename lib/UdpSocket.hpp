@@ -7,7 +7,7 @@
 #define DEFAULT_KEEP_ALIVE_TIMEOUT ( 20000 )
 
 
-struct UdpControl : public SerializableSequence
+struct UdpControl : public SerializableSequence // protocol: compress=0 integrity=CRC32C
 {
     ENUM_BOILERPLATE ( UdpControl, ConnectRequest, ConnectReply, ConnectFinal, Disconnect )
 
@@ -18,6 +18,7 @@ struct UdpControl : public SerializableSequence
 class UdpSocket
     : public Socket
     , private GoBackN::Owner
+    , private Timer::Owner
 {
 public:
 
@@ -94,6 +95,24 @@ public:
     // Reset the state of the GoBackN instance
     void resetGbnState();
 
+    // Set the largest split size that GoBackN will probe for
+    void setMaxSplitSize ( uint32_t size ) { _gbn.setMaxSplitSize ( size ); }
+
+    // Also enables GoBackN selective repeat for WIRE_VERSION_COMPACT, since every version that can send the
+    // compact wire format can also decode a SelectiveAck. Only connection-based sockets use GoBackN.
+    void setWireVersion ( uint8_t version ) override;
+
+    // If GoBackN is in selective repeat mode
+    bool isSelectiveRepeat() const { return _gbn.isSelectiveRepeat(); }
+
+    // Get / set if messages to the remote address are coalesced into one datagram, only for connection-based sockets.
+    // Coalesced messages are sent when the event loop is about to wait, or after the window in milliseconds if non-zero.
+    bool isCoalescing() const { return _coalescing; }
+    void setCoalescing ( bool enabled, uint64_t window = 0 );
+
+    // Send the coalesced messages now
+    void flush() override;
+
 private:
 
     // UDP child socket enum type for choosing the right constructor
@@ -117,6 +136,19 @@ private:
     // Currently accepted socket
     SocketPtr _acceptedSocket;
 
+    // If coalescing, and the window to wait before sending the coalesced messages, 0 to wait for the event loop
+    bool _coalescing = true;
+    uint64_t _coalesceWindow = 0;
+
+    // Encoded messages waiting to be sent in one datagram
+    std::string _coalesced;
+
+    // Only the latest ACK is sent, since it supersedes the earlier ones
+    std::string _coalescedAck;
+
+    // Timer for the coalesce window
+    TimerPtr _coalesceTimer;
+
     // Socket read event callback
     void socketRead ( const MsgPtr& msg, const IpAddrPort& address ) override;
 
@@ -125,6 +157,7 @@ private:
     void goBackNRecvRaw ( GoBackN *gbn, const MsgPtr& msg ) override;
     void goBackNRecvMsg ( GoBackN *gbn, const MsgPtr& msg ) override;
     void goBackNTimeout ( GoBackN *gbn ) override;
+    uint8_t goBackNWireVersion ( const GoBackN *gbn ) const override;
 
     // Callback into the correctly addressed socket
     void socketReadAddressed ( const MsgPtr& msg, const IpAddrPort& address );
@@ -132,6 +165,15 @@ private:
     // Send a protocol message directly, not over GoBackN
     bool sendRaw ( const MsgPtr& msg, const IpAddrPort& address );
 
+    // Send an encoded datagram, from the parent socket if this is a child socket
+    bool sendDatagram ( const std::string& buffer, const IpAddrPort& address );
+
+    // Add an encoded message to the coalesced datagram, returns false if it should be sent directly
+    bool coalesce ( const MsgPtr& msg, const std::string& buffer, const IpAddrPort& address );
+
+    // Timer callback
+    void timerExpired ( Timer *timer ) override;
+
     // Construct a server socket
     UdpSocket ( Socket::Owner *owner, uint16_t port, const Type& type, bool isRaw );
 
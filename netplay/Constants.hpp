@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <climits>
 #include <iostream>
 
 #include "Controller.hpp"
@@ -56,6 +57,10 @@
 #define CC_INTRO_STATE_ADDR         ( ( uint8_t * )  0x55D20B ) // 2 (character intros), 1 (pre-game), 0 (in-game)
 #define CC_HIT_SPARKS_ADDR          ( ( uint32_t * ) 0x67BD78 ) // Number of hit sparks?
 
+#define CC_EFFECTS_ARRAY_ADDR       ( ( char * )     0x67BDE8 ) // Array of effects, ie hit sparks and projectiles
+#define CC_EFFECTS_ARRAY_COUNT      ( 1000 )
+#define CC_EFFECT_ELEMENT_SIZE      ( 0x33C )
+
 #define CC_STAGE_SELECTOR_ADDR      ( ( uint32_t * ) 0x74FD98 ) // Currently selected stage, can be assigned to directly
 #define CC_FPS_COUNTER_ADDR         ( ( uint32_t * ) 0x774A70 ) // Value of the displayed FPS counter
 #define CC_PERF_FREQ_ADDR           ( ( uint64_t * ) 0x774A80 ) // Value of QueryPerformanceFrequency for game FPS
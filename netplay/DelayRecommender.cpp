@@ -0,0 +1,237 @@
+#include "DelayRecommender.hpp"
+#include "StringUtils.hpp"
+
+#include <cmath>
+#include <numeric>
+
+using namespace std;
+
+
+// Normal distribution of the frame jitter, sampled at -2, -1, 0, 1, 2 standard deviations
+static const double jitterOffsets[] = { -2, -1, 0, 1, 2 };
+static const double jitterWeights[] = { 0.054, 0.242, 0.399, 0.242, 0.054 };
+static const double jitterWeightSum = accumulate ( jitterWeights, jitterWeights + 5, 0.0 );
+
+// Lost inputs arrive with the next packet one frame later, this is the most consecutive losses modelled
+#define MAX_CONSECUTIVE_LOSSES ( 4 )
+
+
+string DelayRecommender::Result::str() const
+{
+    return format ( "delay=%u; rollback=%u; rollbackRate=%.3f; rollbackFrames=%.3f; rollbackCost=%.3f; "
+                    "stallRate=%.3f; stallFrames=%.3f; score=%.2f", delay, rollback, rollbackRate, rollbackFrames,
+                    rollbackCost, stallRate, stallFrames, score );
+}
+
+void DelayRecommender::addLiveSample ( uint32_t frames )
+{
+    _live.addSample ( frames );
+
+    if ( _live.getNumSamples() >= settings.liveWindow )
+    {
+        _previousLive = _live;
+        _live.reset();
+    }
+}
+
+void DelayRecommender::resetLive()
+{
+    _live.reset();
+    _previousLive.reset();
+}
+
+LatencyHistogram DelayRecommender::getLive() const
+{
+    LatencyHistogram live = _previousLive;
+    live.merge ( _live );
+    return live;
+}
+
+DelayRecommender::Arrivals DelayRecommender::getArrivals() const
+{
+    Arrivals arrivals;
+
+    // Live samples are already in whole frames, and include the frame jitter and lost packets
+    if ( getNumLiveSamples() >= settings.minLiveSamples )
+    {
+        const LatencyHistogram live = getLive();
+
+        for ( size_t i = 0; i < live.getNumBuckets(); ++i )
+        {
+            if ( live.getBucketCount ( i ) )
+                arrivals.push_back ( { LatencyHistogram::getBucketMid ( i ),
+                                       live.getBucketCount ( i ) / double ( live.getNumSamples() ) } );
+        }
+
+        return arrivals;
+    }
+
+    const LatencyHistogram& latency = _latency;
+
+    if ( latency.getNumSamples() == 0 )
+        return arrivals;
+
+    const double loss = min ( max ( _packetLoss / 100, 0.0 ), 1.0 );
+    const size_t numJitters = ( settings.frameJitter <= 0 ? 1 : sizeof ( jitterOffsets ) / sizeof ( jitterOffsets[0] ) );
+
+    for ( size_t i = 0; i < latency.getNumBuckets(); ++i )
+    {
+        if ( ! latency.getBucketCount ( i ) )
+            continue;
+
+        const double bucketProbability = latency.getBucketCount ( i ) / double ( latency.getNumSamples() );
+        const double value = LatencyHistogram::getBucketMid ( i );
+
+        for ( size_t j = 0; j < numJitters; ++j )
+        {
+            const double jitterProbability = ( numJitters == 1 ? 1.0 : jitterWeights[j] / jitterWeightSum );
+            const double jitter = ( numJitters == 1 ? 0.0 : jitterOffsets[j] * settings.frameJitter );
+            const double frames = max ( 0.0, value + jitter ) / settings.frameMs;
+
+            double lossProbability = 1.0;
+
+            for ( uint32_t k = 0; k <= MAX_CONSECUTIVE_LOSSES; ++k )
+            {
+                // The last one includes all the longer runs of losses
+                const double p = ( k < MAX_CONSECUTIVE_LOSSES ? lossProbability * ( 1 - loss ) : lossProbability );
+
+                if ( p > 0 )
+                    arrivals.push_back ( { frames + k, bucketProbability * jitterProbability * p } );
+
+                lossProbability *= loss;
+            }
+        }
+    }
+
+    return arrivals;
+}
+
+DelayRecommender::Result DelayRecommender::evaluate ( const Arrivals& arrivals, uint8_t delay, uint8_t rollback ) const
+{
+    Result result;
+    result.delay = delay;
+    result.rollback = rollback;
+
+    for ( const auto& arrival : arrivals )
+    {
+        // Frames late after the input delay, an input that arrives exactly on its frame is on time
+        const double late = ceil ( arrival.first - delay - 1e-9 );
+
+        if ( late <= 0 )
+            continue;
+
+        const double p = arrival.second;
+
+        if ( late <= rollback )
+        {
+            result.rollbackRate += p;
+            result.rollbackFrames += p * late;
+            result.rollbackCost += p * late * late;
+            continue;
+        }
+
+        // Stall until the input is only rollback frames late, then roll back
+        result.stallRate += p;
+        result.stallFrames += p * ( late - rollback );
+
+        if ( rollback )
+        {
+            result.rollbackRate += p;
+            result.rollbackFrames += p * rollback;
+            result.rollbackCost += p * rollback * rollback;
+        }
+    }
+
+    result.rollbackCost *= settings.inputChangeRate;
+
+    result.score = settings.delayWeight * delay
+                   + settings.rollbackWeight * result.rollbackCost
+                   + settings.stallWeight * result.stallFrames
+                   + settings.rollbackCapacityWeight * rollback;
+
+    return result;
+}
+
+DelayRecommender::Result DelayRecommender::evaluate ( uint8_t delay, uint8_t rollback ) const
+{
+    return evaluate ( getArrivals(), delay, rollback );
+}
+
+vector<DelayRecommender::Result> DelayRecommender::evaluate() const
+{
+    const Arrivals arrivals = getArrivals();
+
+    vector<Result> results;
+
+    if ( arrivals.empty() )
+        return results;
+
+    for ( int delay = 0; delay <= settings.maxDelay; ++delay )
+        for ( int rollback = settings.minRollback; rollback <= settings.maxRollback; ++rollback )
+            results.push_back ( evaluate ( arrivals, delay, rollback ) );
+
+    return results;
+}
+
+vector<DelayRecommender::Result> DelayRecommender::getParetoFront ( const vector<Result>& results )
+{
+    const auto dominates = [] ( const Result& a, const Result& b )
+    {
+        if ( a.delay > b.delay || a.rollback > b.rollback
+                || a.rollbackCost > b.rollbackCost || a.stallFrames > b.stallFrames )
+        {
+            return false;
+        }
+
+        return ( a.delay < b.delay || a.rollback < b.rollback
+                 || a.rollbackCost < b.rollbackCost || a.stallFrames < b.stallFrames );
+    };
+
+    vector<Result> front;
+
+    for ( const Result& result : results )
+    {
+        bool isDominated = false;
+
+        for ( const Result& other : results )
+        {
+            if ( dominates ( other, result ) )
+            {
+                isDominated = true;
+                break;
+            }
+        }
+
+        if ( ! isDominated )
+            front.push_back ( result );
+    }
+
+    return front;
+}
+
+DelayRecommender::Result DelayRecommender::recommend() const
+{
+    // The weighted best is always on the Pareto front, so only the front needs to be compared
+    const vector<Result> front = getParetoFront ( evaluate() );
+
+    Result best;
+    best.delay = 0xFF;
+
+    for ( const Result& result : front )
+    {
+        if ( best.delay == 0xFF || result.score < best.score )
+            best = result;
+    }
+
+    return best;
+}
+
+bool DelayRecommender::shouldChange ( uint8_t delay, uint8_t rollback, Result& recommended ) const
+{
+    recommended = recommend();
+
+    if ( recommended.delay == 0xFF || ( recommended.delay == delay && recommended.rollback == rollback ) )
+        return false;
+
+    return ( evaluate ( delay, rollback ).score - recommended.score > settings.changeThreshold );
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Statistics.hpp"
+#include "Constants.hpp"
+
+#include <vector>
+#include <string>
+
+
+// Recommends the input delay and rollback from the measured one way latency distribution, packet loss, and frame time
+// jitter. Each (delay, rollback) pair is scored by modelling how many frames late each remote input arrives: inputs
+// late by at most rollback frames cause a rollback, anything later stalls the game. The recommendation is the best
+// pair on the Pareto front of delay, rollback cost, and stall cost, weighted by the settings below.
+// Live samples of how many frames in-game inputs took to arrive replace the ping distribution once there are enough.
+class DelayRecommender
+{
+public:
+
+    struct Settings
+    {
+        double frameMs = 1000.0 / 60;
+
+        // Range of settings to consider
+        uint8_t maxDelay = 10, minRollback = 0, maxRollback = MAX_ROLLBACK;
+
+        // Standard deviation in milliseconds of both sides' frame times combined,
+        // only added to the ping distribution, since live samples already include it.
+        double frameJitter = 2.0;
+
+        // Fraction of frames where the remote input changes, only these rollbacks are visible
+        double inputChangeRate = 0.15;
+
+        // Score for each frame of input delay, each squared frame of visible rollback, and each frame of stall,
+        // longer rollbacks are more jarring, so their cost grows with the square of their length.
+        double delayWeight = 1.0, rollbackWeight = 2.0, stallWeight = 30.0;
+
+        // Score for each frame of rollback allowed, so unused rollback frames aren't recommended
+        double rollbackCapacityWeight = 0.01;
+
+        // Minimum score improvement needed to recommend a change in-game
+        double changeThreshold = 0.5;
+
+        // Live samples are kept in two windows of this many samples, and used once there are minLiveSamples
+        size_t liveWindow = 600, minLiveSamples = 120;
+    };
+
+    // The modelled outcome of one (delay, rollback) pair
+    struct Result
+    {
+        uint8_t delay = 0, rollback = 0;
+
+        // Probability per frame of a rollback, and expected rollback frames per frame
+        double rollbackRate = 0, rollbackFrames = 0;
+
+        // Expected squared rollback frames per frame, only counting visible rollbacks
+        double rollbackCost = 0;
+
+        // Probability per frame of a stall, and expected stall frames per frame
+        double stallRate = 0, stallFrames = 0;
+
+        double score = 0;
+
+        std::string str() const;
+    };
+
+    Settings settings;
+
+    DelayRecommender() {}
+
+    DelayRecommender ( const Settings& settings ) : settings ( settings ) {}
+
+    // Set the one way latency in milliseconds measured before the game, ie from PingStats
+    void setLatency ( const LatencyHistogram& latency ) { _latency = latency; }
+
+    // Set the packet loss percentage
+    void setPacketLoss ( double packetLoss ) { _packetLoss = packetLoss; }
+
+    // Add how many whole frames after it was sent an input arrived in-game, ie the local frame minus the remote frame
+    void addLiveSample ( uint32_t frames );
+
+    // Reset the live samples, ie when the network changes
+    void resetLive();
+
+    size_t getNumLiveSamples() const { return _live.getNumSamples() + _previousLive.getNumSamples(); }
+
+    // The latency in milliseconds measured before the game
+    const LatencyHistogram& getLatency() const { return _latency; }
+
+    // The live samples in frames, these are used by the model once there are minLiveSamples
+    LatencyHistogram getLive() const;
+
+    // Model every (delay, rollback) pair in range
+    std::vector<Result> evaluate() const;
+
+    // Model a single (delay, rollback) pair
+    Result evaluate ( uint8_t delay, uint8_t rollback ) const;
+
+    // The results that are not dominated by any other result in delay, rollback cost, and stall frames
+    static std::vector<Result> getParetoFront ( const std::vector<Result>& results );
+
+    // The best result, or delay = 0xFF if there is no latency data
+    Result recommend() const;
+
+    // Check if the recommendation is enough of an improvement over the current delay and rollback
+    bool shouldChange ( uint8_t delay, uint8_t rollback, Result& recommended ) const;
+
+private:
+
+    // Latency measured before the game
+    LatencyHistogram _latency;
+
+    // Live samples in frames, the previous window is kept so there are always enough samples
+    LatencyHistogram _live, _previousLive;
+
+    double _packetLoss = 0;
+
+    // Distribution of the arrival time in frames, as pairs of frames and probability
+    typedef std::vector<std::pair<double, double>> Arrivals;
+
+    Arrivals getArrivals() const;
+
+    Result evaluate ( const Arrivals& arrivals, uint8_t delay, uint8_t rollback ) const;
+};
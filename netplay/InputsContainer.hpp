@@ -4,9 +4,22 @@
 #include "Logger.hpp"
 
 #include <vector>
+#include <memory>
 #include <algorithm>
 
 
+// Size in bytes of each chunk of inputs
+#define INPUTS_CHUNK_SIZE       ( 4096 )
+
+// Maximum number of unused chunks to keep for reuse
+#define INPUTS_MAX_FREE_CHUNKS  ( 16 )
+
+
+// Inputs stored by transition index and frame.
+//
+// The frames of each index are stored in fixed size chunks, so growing an index never copies the existing inputs,
+// and the chunks of erased indices are reused. Each index also caches the last known input up to that index, so
+// looking up the input before an index is O(1) instead of scanning back over empty indices.
 template<typename T>
 class InputsContainer
 {
@@ -15,34 +28,38 @@ public:
     // Get a single input for the given index:frame, returns 0 if none.
     T get ( uint32_t index, uint32_t frame ) const
     {
-        if ( index >= _inputs.size() || _inputs[index].empty() )
+        if ( index >= getEndIndex() || at ( index ).size == 0 )
             return lastInputBefore ( index );
 
-        if ( frame >= _inputs[index].size() )
-            return _inputs[index].back();
+        if ( frame >= at ( index ).size )
+            return at ( index ).last;
 
-        return _inputs[index][frame];
+        return input ( at ( index ), frame );
     }
 
     // Get n inputs starting from the given index:frame, ASSERTS if not enough.
     void get ( uint32_t index, uint32_t frame, T *t, size_t n ) const
     {
-        ASSERT ( index < _inputs.size() );
-        ASSERT ( frame + n <= _inputs[index].size() );
+        ASSERT ( index < getEndIndex() );
+        ASSERT ( frame + n <= at ( index ).size );
 
-        std::copy ( _inputs[index].begin() + frame,
-                    _inputs[index].begin() + frame + n, t );
+        forEachRange ( at ( index ), frame, n, [&] ( T *inputs, size_t len )
+        {
+            std::copy ( inputs, inputs + len, t );
+            t += len;
+        } );
     }
 
     // Set a single input for the given index:frame, CANNOT change existing inputs.
     void set ( uint32_t index, uint32_t frame, T t )
     {
-        if ( _inputs.size() > index && _inputs[index].size() > frame )
+        if ( getEndIndex() > index && at ( index ).size > frame )
             return;
 
         resize ( index, frame );
 
-        _inputs[index][frame] = t;
+        input ( at ( index ), frame ) = t;
+        setLast ( index, t );
     }
 
     // Assign a single input for the given index:frame, CAN change existing inputs
@@ -50,7 +67,10 @@ public:
     {
         resize ( index, frame );
 
-        _inputs[index][frame] = t;
+        input ( at ( index ), frame ) = t;
+
+        if ( frame + 1 == at ( index ).size )
+            setLast ( index, t );
     }
 
     // Fill n inputs with the same given value starting from the given index:frame, CAN change existing inputs.
@@ -58,8 +78,13 @@ public:
     {
         resize ( index, frame, n );
 
-        std::fill ( _inputs[index].begin() + frame,
-                    _inputs[index].begin() + frame + n, t );
+        forEachRange ( at ( index ), frame, n, [&] ( T *inputs, size_t len )
+        {
+            std::fill ( inputs, inputs + len, t );
+        } );
+
+        if ( n && frame + n == at ( index ).size )
+            setLast ( index, t );
     }
 
     // Set n inputs starting from the given index:frame, CAN change existing inputs.
@@ -67,23 +92,26 @@ public:
     {
         if ( index >= checkStartingFromIndex )
         {
-            IndexedFrame f;
-            size_t i;
+            const size_t i = findChanged ( index, frame, t, n );
 
-            for ( i = 0, f = {{ frame, index }}; i < n; ++i, ++f.parts.frame )
+            // Indicate changed if the input is different from the last known input
+            if ( i < n )
             {
-                if ( get ( f.parts.index, f.parts.frame ) == t[i] )
-                    continue;
-
-                // Indicate changed if the input is different from the last known input
+                const IndexedFrame f = {{ uint32_t ( frame + i ), index }};
                 _lastChangedFrame.value = std::min ( _lastChangedFrame.value, f.value );
-                break;
             }
         }
 
         resize ( index, frame, n );
 
-        std::copy ( t, t + n, &_inputs[index][frame] );
+        forEachRange ( at ( index ), frame, n, [&] ( T *inputs, size_t len )
+        {
+            std::copy ( t, t + len, inputs );
+            t += len;
+        } );
+
+        if ( n && frame + n == at ( index ).size )
+            setLast ( index, t[-1] );
     }
 
     // Resize the container so that it can contain inputs up to index:frame+n.
@@ -91,65 +119,104 @@ public:
     {
         T last = 0;
 
-        if ( index >= _inputs.size() )
+        if ( index >= getEndIndex() )
         {
-            last = lastInputBefore ( _inputs.size() );
-            _inputs.resize ( index + 1 );
+            last = lastInputBefore ( getEndIndex() );
+
+            // New indices start empty, carrying the last known input
+            while ( index >= getEndIndex() )
+            {
+                _indices.push_back ( Index() );
+                _indices.back().last = last;
+            }
         }
-        else if ( ! _inputs[index].empty() )
+        else if ( at ( index ).size > 0 )
         {
-            last = _inputs[index].back();
+            last = at ( index ).last;
         }
 
-        if ( frame + n > _inputs[index].size() )
-            _inputs[index].resize ( frame + n, last );
+        Index& idx = at ( index );
+
+        if ( frame + n <= idx.size )
+            return;
+
+        // The new frames are filled with the last input, so that only changes if the index was empty
+        const bool wasEmpty = ( idx.size == 0 );
+
+        grow ( idx, frame + n, last );
+
+        if ( wasEmpty )
+            setLast ( index, last );
     }
 
     void clear()
     {
-        _inputs.clear();
+        for ( size_t i = _front; i < _indices.size(); ++i )
+            release ( _indices[i] );
+
+        _indices.clear();
+        _front = 0;
     }
 
     bool empty() const
     {
-        return _inputs.empty();
+        return ( getEndIndex() == 0 );
     }
 
     bool empty ( size_t index ) const
     {
-        if ( index >= _inputs.size() )
+        if ( index >= getEndIndex() )
             return true;
 
-        return _inputs[index].empty();
+        return ( at ( index ).size == 0 );
     }
 
     uint32_t getEndIndex() const
     {
-        return _inputs.size();
+        return ( _indices.size() - _front );
     }
 
     uint32_t getEndFrame() const
     {
-        if ( _inputs.empty() )
+        if ( empty() )
             return 0;
 
-        return _inputs.back().size();
+        return _indices.back().size;
     }
 
     uint32_t getEndFrame ( size_t index ) const
     {
-        if ( index >= _inputs.size() )
+        if ( index >= getEndIndex() )
             return 0;
 
-        return _inputs[index].size();
+        return at ( index ).size;
     }
 
+    // Erase the inputs before the given index, the remaining indices are shifted down.
+    // Erased chunks are reused, and the remaining indices are NOT moved, except for an occasional compaction.
     void eraseIndexOlderThan ( size_t index )
     {
-        if ( index + 1 >= _inputs.size() )
-            _inputs.clear();
-        else
-            _inputs.erase ( _inputs.begin(), _inputs.begin() + index );
+        if ( index + 1 >= getEndIndex() )
+        {
+            clear();
+            return;
+        }
+
+        for ( size_t i = 0; i < index; ++i )
+            release ( at ( i ) );
+
+        _front += index;
+
+        // The last known input doesn't include the erased indices
+        for ( size_t i = 0; i < getEndIndex() && at ( i ).size == 0; ++i )
+            at ( i ).last = 0;
+
+        // Compact once the erased indices outnumber the remaining ones, so this is amortized O(1) per index
+        if ( _front > getEndIndex() )
+        {
+            _indices.erase ( _indices.begin(), _indices.begin() + _front );
+            _front = 0;
+        }
     }
 
     IndexedFrame getLastChangedFrame() const
@@ -162,31 +229,161 @@ public:
         _lastChangedFrame = MaxIndexedFrame;
     }
 
+    // Total bytes allocated for inputs, including unused chunks
+    size_t getAllocatedBytes() const
+    {
+        size_t chunks = _freeChunks.size();
+
+        for ( size_t i = _front; i < _indices.size(); ++i )
+            chunks += _indices[i].chunks.size();
+
+        return chunks * INPUTS_CHUNK_SIZE;
+    }
+
 private:
 
-    // Mapping: index -> frame -> input
-    std::vector<std::vector<T>> _inputs;
+    static const size_t FramesPerChunk = INPUTS_CHUNK_SIZE / sizeof ( T );
+
+    typedef std::unique_ptr<T[]> Chunk;
+
+    struct Index
+    {
+        // Inputs by frame, split into chunks of FramesPerChunk
+        std::vector<Chunk> chunks;
+
+        // Number of frames
+        uint32_t size = 0;
+
+        // Last known input up to and including this index, this is the last frame if there is one
+        T last = 0;
+    };
+
+    // Mapping: index -> frame -> input, the erased indices are before _front
+    std::vector<Index> _indices;
+
+    size_t _front = 0;
+
+    // Unused chunks
+    std::vector<Chunk> _freeChunks;
 
     // Last frame of input that changed
     IndexedFrame _lastChangedFrame = MaxIndexedFrame;
 
-    // Get the last known input BEFORE the given index. Defaults to 0 if unknown.
-    T lastInputBefore ( uint32_t index ) const
+    Index& at ( size_t index ) { return _indices[_front + index]; }
+
+    const Index& at ( size_t index ) const { return _indices[_front + index]; }
+
+    static T& input ( const Index& idx, uint32_t frame )
     {
-        if ( _inputs.empty() || index == 0 )
-            return 0;
+        return idx.chunks[frame / FramesPerChunk][frame % FramesPerChunk];
+    }
+
+    // Call func ( inputs, len ) for each continuous range of n inputs starting from the given frame
+    template<typename F>
+    static void forEachRange ( const Index& idx, uint32_t frame, size_t n, const F& func )
+    {
+        while ( n > 0 )
+        {
+            const size_t offset = frame % FramesPerChunk;
+            const size_t len = std::min ( n, FramesPerChunk - offset );
+
+            func ( &idx.chunks[frame / FramesPerChunk][offset], len );
+
+            frame += len;
+            n -= len;
+        }
+    }
+
+    // Find the first of n inputs that differs from the existing inputs starting from index:frame, returns n if none
+    size_t findChanged ( uint32_t index, uint32_t frame, const T *t, size_t n ) const
+    {
+        size_t i = 0;
+
+        // Compare the existing frames one chunk at a time
+        if ( index < getEndIndex() && frame < at ( index ).size )
+        {
+            const Index& idx = at ( index );
+            const size_t existing = std::min<size_t> ( n, idx.size - frame );
+
+            while ( i < existing )
+            {
+                const size_t offset = ( frame + i ) % FramesPerChunk;
+                const size_t len = std::min ( existing - i, FramesPerChunk - offset );
+                const T *inputs = &idx.chunks[( frame + i ) / FramesPerChunk][offset];
+                const size_t j = std::mismatch ( inputs, inputs + len, t + i ).first - inputs;
+
+                i += j;
+
+                if ( j < len )
+                    return i;
+            }
+        }
+
+        // The frames past the end are compared against the last known input
+        const T last = get ( index, frame + i );
+
+        while ( i < n && t[i] == last )
+            ++i;
+
+        return i;
+    }
+
+    // Grow an index to the given number of frames, filling the new frames with the given input
+    void grow ( Index& idx, uint32_t size, T fill )
+    {
+        const size_t numChunks = ( size + FramesPerChunk - 1 ) / FramesPerChunk;
+
+        while ( idx.chunks.size() < numChunks )
+        {
+            if ( _freeChunks.empty() )
+            {
+                idx.chunks.push_back ( Chunk ( new T[FramesPerChunk] ) );
+            }
+            else
+            {
+                idx.chunks.push_back ( std::move ( _freeChunks.back() ) );
+                _freeChunks.pop_back();
+            }
+        }
+
+        // Usually only a few frames are added at a time
+        for ( uint32_t frame = idx.size; frame < size; ++frame )
+            input ( idx, frame ) = fill;
 
-        if ( index > _inputs.size() )
-            index = _inputs.size();
+        idx.size = size;
+    }
 
-        do
+    // Return the chunks of an index to the free list
+    void release ( Index& idx )
+    {
+        for ( Chunk& chunk : idx.chunks )
         {
-            --index;
-            if ( ! _inputs[index].empty() )
-                return _inputs[index].back();
+            if ( _freeChunks.size() < INPUTS_MAX_FREE_CHUNKS )
+                _freeChunks.push_back ( std::move ( chunk ) );
         }
-        while ( index > 0 );
 
-        return 0;
+        idx.chunks.clear();
+        idx.size = 0;
+    }
+
+    // Set the last known input of an index after its last frame changed, then carry it over the empty indices after
+    void setLast ( uint32_t index, T last )
+    {
+        at ( index ).last = last;
+
+        for ( size_t i = index + 1; i < getEndIndex() && at ( i ).size == 0; ++i )
+            at ( i ).last = last;
+    }
+
+    // Get the last known input BEFORE the given index. Defaults to 0 if unknown.
+    T lastInputBefore ( uint32_t index ) const
+    {
+        if ( empty() || index == 0 )
+            return 0;
+
+        if ( index > getEndIndex() )
+            index = getEndIndex();
+
+        return at ( index - 1 ).last;
     }
 };
@@ -7,6 +7,7 @@
 #include "Version.hpp"
 #include "Compression.hpp"
 #include "CharacterSelect.hpp"
+#include "TimeSync.hpp"
 
 #include <cereal/types/array.hpp>
 #include <cereal/types/vector.hpp>
@@ -33,7 +34,14 @@ struct ClientMode : public SerializableSequence
 {
     ENUM_BOILERPLATE ( ClientMode, Host, Client, SpectateNetplay, SpectateBroadcast, Broadcast, Offline )
 
-    enum { Training = 0x01, GameStarted = 0x02, UdpTunnel = 0x04, IsWine = 0x08, VersusCPU = 0x10 };
+    enum
+    {
+        Training = 0x01, GameStarted = 0x02, UdpTunnel = 0x04, IsWine = 0x08, VersusCPU = 0x10,
+        PolicyWire = 0x20, CompactWire = 0x40, RelayTree = 0x80
+    };
+
+    // All the flags for the supported wire format versions
+    enum { WireFlags = ( PolicyWire | CompactWire ) };
 
     uint8_t flags = 0;
 
@@ -61,8 +69,20 @@ struct ClientMode : public SerializableSequence
     bool isGameStarted() const { return ( flags & GameStarted ); }
     bool isUdpTunnel() const { return ( flags & UdpTunnel ); }
     bool isWine() const { return ( flags & IsWine ); }
+    bool isPolicyWire() const { return ( flags & PolicyWire ); }
+    bool isCompactWire() const { return ( flags & CompactWire ); }
+    bool isRelayTree() const { return ( flags & RelayTree ); }
     bool isSinglePlayer() const { return ( isNetplay() || isVersusCPU() ); }
 
+    // Wire format version to use for sockets, the wire flags are only set once both ends support them
+    uint8_t getWireVersion() const
+    {
+        if ( isCompactWire() )
+            return WIRE_VERSION_COMPACT;
+
+        return ( isPolicyWire() ? WIRE_VERSION_POLICY : WIRE_VERSION_LEGACY );
+    }
+
     std::string flagString() const
     {
         std::string str;
@@ -82,6 +102,15 @@ struct ClientMode : public SerializableSequence
         if ( flags & VersusCPU )
             str += std::string ( str.empty() ? "" : ", " ) + "VersusCPU";
 
+        if ( flags & PolicyWire )
+            str += std::string ( str.empty() ? "" : ", " ) + "PolicyWire";
+
+        if ( flags & CompactWire )
+            str += std::string ( str.empty() ? "" : ", " ) + "CompactWire";
+
+        if ( flags & RelayTree )
+            str += std::string ( str.empty() ? "" : ", " ) + "RelayTree";
+
         return str;
     }
 
@@ -108,7 +137,26 @@ struct PingStats : public SerializableSequence
         packetLoss = 0;
     }
 
-    PROTOCOL_MESSAGE_BOILERPLATE ( PingStats, latency, packetLoss )
+    EMPTY_MESSAGE_BOILERPLATE ( PingStats )
+
+    // The latency histogram is only sent with WIRE_VERSION_COMPACT, older versions only see the mean and variance
+    void save ( cereal::BinaryOutputArchive& ar ) const override
+    {
+        ar ( latency, packetLoss );
+
+        if ( getWireVersion() >= WIRE_VERSION_COMPACT )
+            ar ( latency.getHistogram() );
+    }
+
+    void load ( cereal::BinaryInputArchive& ar ) override
+    {
+        ar ( latency, packetLoss );
+
+        if ( getWireVersion() >= WIRE_VERSION_COMPACT )
+            ar ( latency.getHistogram() );
+        else
+            latency.getHistogram().reset();
+    }
 };
 
 
@@ -263,6 +311,35 @@ struct SpectateConfig : public SerializableSequence
 };
 
 
+// RelayStatus::spareDepth when there is no room left in a subtree
+#define NO_SPARE_DEPTH ( 0xFF )
+
+// Sent by spectators to the client they are spectating, only if it has the RelayTree flag, see RelayTopology
+struct RelayStatus : public SerializableSequence
+{
+    // Number of spectators this node can relay to, based on its upload capacity
+    uint8_t capacity = 0;
+
+    // Number of spectators currently relayed to
+    uint8_t numChildren = 0;
+
+    // Number of nodes in this subtree, including this node
+    uint32_t subtreeSize = 1;
+
+    // Depth of the shallowest node in this subtree that can accept another spectator, relative to this node.
+    // NO_SPARE_DEPTH if the whole subtree is full.
+    uint8_t spareDepth = NO_SPARE_DEPTH;
+
+    std::string str() const override
+    {
+        return format ( "RelayStatus[%u/%u; subtreeSize=%u; spareDepth=%u]",
+                        numChildren, capacity, subtreeSize, spareDepth );
+    }
+
+    PROTOCOL_MESSAGE_BOILERPLATE ( RelayStatus, capacity, numChildren, subtreeSize, spareDepth )
+};
+
+
 struct ConfirmConfig : public SerializableSequence
 {
     EMPTY_MESSAGE_BOILERPLATE ( ConfirmConfig )
@@ -292,7 +369,7 @@ struct RngState : public SerializableSequence
 };
 
 
-struct SyncHash : public SerializableSequence
+struct SyncHash : public SerializableSequence // protocol: compress=0 integrity=CRC32C
 {
     IndexedFrame indexedFrame = {{ 0, 0 }};
 
@@ -360,19 +437,24 @@ struct SyncHash : public SerializableSequence
 
     std::string dump() const
     {
-        std::string str = format ( "[%s] %s; roundTimer=%u; realTimer=%u; camera={ %d, %d }",
-                                   indexedFrame, formatAsHex ( hash, sizeof ( hash ) ), roundTimer, realTimer,
-                                   cameraX, cameraY );
+        // This is logged every frame, so it is formatted into a single buffer
+        char buffer[1024];
 
-        for ( uint8_t i = 0; i < 2; ++i )
+        size_t len = FORMAT_TO ( buffer, sizeof ( buffer ), "[%s] %s; roundTimer=%u; realTimer=%u; camera={ %d, %d }",
+                                 indexedFrame, formatAsHex ( hash, sizeof ( hash ) ), roundTimer, realTimer,
+                                 cameraX, cameraY );
+
+        for ( uint8_t i = 0; i < 2 && len < sizeof ( buffer ); ++i )
         {
-            str += format ( "; P%u: C=%u; M=%u seq=%u; st=%u; hp=%u; rh=%u; gb=%.1f; gq=%.1f; mt=%u; ht=%u; x=%d; y=%d",
-                            i + 1, chara[i].chara, chara[i].moon, chara[i].seq, chara[i].seqState, chara[i].health,
-                            chara[i].redHealth, chara[i].guardBar, chara[i].guardQuality, chara[i].meter, chara[i].heat,
-                            chara[i].x, chara[i].y );
+            len += FORMAT_TO ( buffer + len, sizeof ( buffer ) - len,
+                               "; P%u: C=%u; M=%u seq=%u; st=%u; hp=%u; rh=%u; "
+                               "gb=%.1f; gq=%.1f; mt=%u; ht=%u; x=%d; y=%d",
+                               i + 1, chara[i].chara, chara[i].moon, chara[i].seq, chara[i].seqState, chara[i].health,
+                               chara[i].redHealth, chara[i].guardBar, chara[i].guardQuality, chara[i].meter,
+                               chara[i].heat, chara[i].x, chara[i].y );
         }
 
-        return str;
+        return std::string ( buffer, std::min ( len, sizeof ( buffer ) - 1 ) );
     }
 
     EMPTY_MESSAGE_BOILERPLATE ( SyncHash )
@@ -399,7 +481,7 @@ struct SyncHash : public SerializableSequence
 };
 
 
-struct MenuIndex : public SerializableSequence
+struct MenuIndex : public SerializableSequence // protocol: compress=0 integrity=CRC32C
 {
     uint32_t index = 0;
 
@@ -435,7 +517,7 @@ struct ChangeConfig : public SerializableSequence
 };
 
 
-struct TransitionIndex : public SerializableMessage
+struct TransitionIndex : public SerializableMessage // protocol: compress=0 integrity=CRC32C
 {
     uint32_t index = 0;
 
@@ -462,23 +544,103 @@ struct BaseInputs
     uint32_t getEndFrame() const { return indexedFrame.parts.frame + 1; }
 
     size_t size() const { return getEndFrame() - getStartFrame(); }
+
+protected:
+
+    // Compact encoding for WIRE_VERSION_COMPACT: varint index and frame, then for each array of inputs,
+    // runs of repeated inputs as a varint length and the 16 bit input. Only the inputs in range are encoded.
+    void saveIndexedFrame ( cereal::BinaryOutputArchive& ar ) const
+    {
+        saveVarint ( ar, indexedFrame.parts.index );
+        saveVarint ( ar, indexedFrame.parts.frame );
+    }
+
+    void loadIndexedFrame ( cereal::BinaryInputArchive& ar )
+    {
+        indexedFrame.parts.index = loadVarint ( ar );
+        indexedFrame.parts.frame = loadVarint ( ar );
+    }
+
+    void saveInputRuns ( cereal::BinaryOutputArchive& ar, const std::array<uint16_t, NUM_INPUTS>& inputs ) const
+    {
+        const size_t n = size();
+
+        for ( size_t i = 0, j; i < n; i = j )
+        {
+            for ( j = i + 1; j < n && inputs[j] == inputs[i]; ++j );
+
+            saveVarint ( ar, j - i );
+            ar ( inputs[i] );
+        }
+    }
+
+    void loadInputRuns ( cereal::BinaryInputArchive& ar, std::array<uint16_t, NUM_INPUTS>& inputs ) const
+    {
+        const size_t n = size();
+
+        for ( size_t i = 0; i < n; )
+        {
+            const uint32_t length = loadVarint ( ar );
+
+            if ( length == 0 || length > n - i )
+                throw cereal::Exception ( "Invalid inputs run length" );
+
+            uint16_t input;
+            ar ( input );
+
+            std::fill ( inputs.begin() + i, inputs.begin() + i + length, input );
+            i += length;
+        }
+
+        // Inputs out of range are not encoded
+        std::fill ( inputs.begin() + n, inputs.end(), 0 );
+    }
 };
 
 
-struct PlayerInputs : public SerializableMessage, public BaseInputs
+struct PlayerInputs : public SerializableMessage, public BaseInputs // protocol: compress=0 integrity=CRC32C
 {
     // Represents the input range [frame - NUM_INPUTS + 1, frame + 1)
     std::array<uint16_t, NUM_INPUTS> inputs;
 
+    // The sender's frame offset for TimeSync, only sent with WIRE_VERSION_COMPACT
+    int8_t frameOffset = FRAME_OFFSET_UNKNOWN;
+
     PlayerInputs ( IndexedFrame indexedFrame ) { this->indexedFrame = indexedFrame; }
 
     std::string str() const override { return format ( "PlayerInputs[%s]", indexedFrame ); }
 
-    PROTOCOL_MESSAGE_BOILERPLATE ( PlayerInputs, indexedFrame.value, inputs )
+    EMPTY_MESSAGE_BOILERPLATE ( PlayerInputs )
+
+    void save ( cereal::BinaryOutputArchive& ar ) const override
+    {
+        if ( getWireVersion() < WIRE_VERSION_COMPACT )
+        {
+            ar ( indexedFrame.value, inputs );
+            return;
+        }
+
+        saveIndexedFrame ( ar );
+        saveInputRuns ( ar, inputs );
+        ar ( frameOffset );
+    }
+
+    void load ( cereal::BinaryInputArchive& ar ) override
+    {
+        if ( getWireVersion() < WIRE_VERSION_COMPACT )
+        {
+            ar ( indexedFrame.value, inputs );
+            return;
+        }
+
+        loadIndexedFrame ( ar );
+        loadInputRuns ( ar, inputs );
+        ar ( frameOffset );
+    }
 };
 
 
-struct BothInputs : public SerializableSequence, public BaseInputs
+struct BothInputs : public SerializableSequence, public BaseInputs // protocol: compress=0 integrity=CRC32C
 {
     // Represents the input range [frame - NUM_INPUTS + 1, frame + 1)
     std::array<std::array<uint16_t, NUM_INPUTS>, 2> inputs;
@@ -487,5 +649,31 @@ struct BothInputs : public SerializableSequence, public BaseInputs
 
     std::string str() const override { return format ( "BothInputs[%s]", indexedFrame ); }
 
-    PROTOCOL_MESSAGE_BOILERPLATE ( BothInputs, indexedFrame.value, inputs )
+    EMPTY_MESSAGE_BOILERPLATE ( BothInputs )
+
+    void save ( cereal::BinaryOutputArchive& ar ) const override
+    {
+        if ( getWireVersion() < WIRE_VERSION_COMPACT )
+        {
+            ar ( indexedFrame.value, inputs );
+            return;
+        }
+
+        saveIndexedFrame ( ar );
+        saveInputRuns ( ar, inputs[0] );
+        saveInputRuns ( ar, inputs[1] );
+    }
+
+    void load ( cereal::BinaryInputArchive& ar ) override
+    {
+        if ( getWireVersion() < WIRE_VERSION_COMPACT )
+        {
+            ar ( indexedFrame.value, inputs );
+            return;
+        }
+
+        loadIndexedFrame ( ar );
+        loadInputRuns ( ar, inputs[0] );
+        loadInputRuns ( ar, inputs[1] );
+    }
 };
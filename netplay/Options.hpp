@@ -23,6 +23,7 @@ ENUM ( Options,
        MaxDelay,
        DefaultRollback,
        Fullscreen,
+       AutoDelay,
        // Debug options
        Tests,
        Stdout,
@@ -32,6 +33,8 @@ ENUM ( Options,
        PidLog,
        SyncTest,
        Replay,
+       NetworkProfile,
+       AsyncLog,
        // Special options
        NoFork,
        AppDir,
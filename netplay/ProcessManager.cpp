@@ -30,7 +30,7 @@ string ProcessManager::gameDir;
 string ProcessManager::appDir;
 
 
-ProcessManager::ProcessManager ( Owner *owner ) : owner ( owner ) {}
+ProcessManager::ProcessManager ( Owner *owner ) : owner ( owner ), _sharedIpc ( this ) {}
 
 ProcessManager::~ProcessManager()
 {
@@ -43,6 +43,8 @@ void ProcessManager::socketAccepted ( Socket *serverSocket )
     ASSERT ( serverSocket->isServer() == true );
 
     _ipcSocket = serverSocket->accept ( this );
+    _ipcSocket->setWireVersion ( WIRE_VERSION_LATEST );
+    _ipcSocket->setSendImpairment ( NetworkProfile() ); // Only emulate network conditions between peers
 
     LOG ( "ipcSocket=%08x", _ipcSocket.get() );
 
@@ -83,6 +85,9 @@ void ProcessManager::socketRead ( Socket *socket, const MsgPtr& msg, const IpAdd
         _connected = true;
         _gameStartTimer.reset();
 
+        // The other process only writes to the channel once it is connected, so start reading now
+        _sharedIpc.setReading ( true );
+
         if ( owner )
             owner->ipcConnected();
         return;
@@ -91,6 +96,14 @@ void ProcessManager::socketRead ( Socket *socket, const MsgPtr& msg, const IpAdd
     owner->ipcRead ( msg );
 }
 
+void ProcessManager::sharedMemoryRead ( SharedMemoryIpc *ipc, const MsgPtr& msg )
+{
+    ASSERT ( ipc == &_sharedIpc );
+
+    if ( owner )
+        owner->ipcRead ( msg );
+}
+
 void ProcessManager::timerExpired ( Timer *timer )
 {
     ASSERT ( timer == _gameStartTimer.get() );
@@ -204,6 +217,8 @@ void ProcessManager::openGame ( bool highPriority )
     LOG ( "ipcHost='%s'", ipcHost );
 
     _ipcSocket = TcpSocket::connect ( this, ipcHost );
+    _ipcSocket->setWireVersion ( WIRE_VERSION_LATEST );
+    _ipcSocket->setSendImpairment ( NetworkProfile() ); // Only emulate network conditions between peers
 
     LOG ( "ipcSocket=%08x", _ipcSocket.get() );
 
@@ -215,6 +230,10 @@ void ProcessManager::openGame ( bool highPriority )
 
     LOG ( "processId=%08x", _processId );
 
+    // The DLL created the channel before sending its process ID, if this fails the IPC socket is used instead
+    if ( ! _sharedIpc.open ( format ( SHARED_IPC_NAME, _processId ) ) )
+        LOG ( "Using IPC socket" );
+
     _gameStartTimer.reset ( new Timer ( this ) );
     _gameStartTimer->start ( GAME_START_INTERVAL );
     _gameStartCount = 0;
@@ -242,6 +261,7 @@ void ProcessManager::disconnectPipe()
 {
     _gameStartTimer.reset();
     _ipcSocket.reset();
+    _sharedIpc.close();
 
     if ( _pipe )
     {
@@ -446,6 +466,8 @@ bool ProcessManager::ipcSend ( const MsgPtr& msg )
 {
     if ( ! isConnected() )
         return false;
+    else if ( _sharedIpc.isPeerOpen() )
+        return _sharedIpc.send ( msg );
     else
         return _ipcSocket->send ( msg );
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Socket.hpp"
+#include "SharedMemoryIpc.hpp"
 #include "Timer.hpp"
 #include "Protocol.hpp"
 #include "Messages.hpp"
@@ -12,12 +13,16 @@
 
 #define INLINE_INPUT(INPUT)                 uint16_t ( ( INPUT ) & 0x000Fu ), uint16_t ( ( ( INPUT ) & 0xFFF0u ) >> 4 )
 
+// Name of the shared memory IPC channel, created by the DLL with its process ID
+#define SHARED_IPC_NAME                     "Local\\cccaster_ipc_%08x"
+
 
 struct IpcConnected : public SerializableSequence { EMPTY_MESSAGE_BOILERPLATE ( IpcConnected ) };
 
 
 class ProcessManager
     : private Socket::Owner
+    , private SharedMemoryIpc::Owner
     , private Timer::Owner
 {
 public:
@@ -74,7 +79,7 @@ public:
     // Indicates if the IPC pipe and socket are connected
     bool isConnected() const;
 
-    // Send a message over the IPC socket
+    // Send a message over the shared memory IPC channel, or the IPC socket if the channel couldn't be opened
     bool ipcSend ( Serializable& msg );
     bool ipcSend ( Serializable *msg );
     bool ipcSend ( const MsgPtr& msg );
@@ -108,9 +113,12 @@ private:
     // Process ID
     int _processId = 0;
 
-    // IPC socket
+    // IPC socket, this is also used to detect when the other process disconnects
     SocketPtr _ipcSocket;
 
+    // Shared memory IPC channel, messages are sent over this instead of the IPC socket when it is open
+    SharedMemoryIpc _sharedIpc;
+
     // Game start timer
     TimerPtr _gameStartTimer;
 
@@ -126,6 +134,9 @@ private:
     void socketDisconnected ( Socket *socket ) override;
     void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override;
 
+    // Shared memory IPC callback
+    void sharedMemoryRead ( SharedMemoryIpc *ipc, const MsgPtr& msg ) override;
+
     // IPC connect timer callback
     void timerExpired ( Timer *timer ) override;
 };
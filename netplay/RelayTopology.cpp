@@ -0,0 +1,143 @@
+#include "RelayTopology.hpp"
+
+using namespace std;
+
+
+void RelayTopology::initialize ( const ClientMode& clientMode )
+{
+    // The netplay clients are already uploading to each other
+    _capacity = ( clientMode.isSpectate() ? MAX_SPECTATORS : MAX_ROOT_SPECTATORS );
+
+    LOG ( "%s; capacity=%u", clientMode, _capacity );
+}
+
+void RelayTopology::addChild ( const IpAddrPort& serverAddr )
+{
+    LOG ( "serverAddr='%s'", serverAddr );
+
+    // Spectators that never report, ie older versions, are never redirected to unless every subtree is full
+    _children[serverAddr] = RelayStatus();
+}
+
+void RelayTopology::updateChild ( const IpAddrPort& serverAddr, const RelayStatus& status )
+{
+    auto it = _children.find ( serverAddr );
+
+    if ( it == _children.end() )
+        return;
+
+    it->second = status;
+}
+
+void RelayTopology::removeChild ( const IpAddrPort& serverAddr )
+{
+    LOG ( "serverAddr='%s'", serverAddr );
+
+    _children.erase ( serverAddr );
+}
+
+RelayTopology::ChildIterator RelayTopology::findBestChild() const
+{
+    auto best = _children.end();
+
+    for ( auto it = _children.begin(); it != _children.end(); ++it )
+    {
+        if ( best == _children.end() )
+        {
+            best = it;
+            continue;
+        }
+
+        const RelayStatus& a = it->second;
+        const RelayStatus& b = best->second;
+
+        // Prefer the shallowest free slot, then the smallest subtree, then the address so the choice is stable
+        if ( a.spareDepth != b.spareDepth )
+        {
+            if ( a.spareDepth < b.spareDepth )
+                best = it;
+        }
+        else if ( a.subtreeSize != b.subtreeSize )
+        {
+            if ( a.subtreeSize < b.subtreeSize )
+                best = it;
+        }
+        else if ( it->first < best->first )
+        {
+            best = it;
+        }
+    }
+
+    return best;
+}
+
+const IpAddrPort& RelayTopology::getAttachAddress() const
+{
+    if ( _children.size() < _capacity || _children.empty() )
+        return NullAddress;
+
+    // If every subtree is full, this spreads the new spectators over the smallest subtrees
+    return findBestChild()->first;
+}
+
+RelayStatus RelayTopology::getStatus() const
+{
+    RelayStatus status;
+    status.capacity = _capacity;
+    status.numChildren = min<size_t> ( _children.size(), 0xFF );
+
+    for ( const auto& kv : _children )
+        status.subtreeSize += kv.second.subtreeSize;
+
+    if ( _children.size() < _capacity )
+    {
+        status.spareDepth = 0;
+    }
+    else if ( ! _children.empty() )
+    {
+        const uint8_t spareDepth = findBestChild()->second.spareDepth;
+
+        if ( spareDepth + 1 < NO_SPARE_DEPTH )
+            status.spareDepth = spareDepth + 1;
+    }
+
+    return status;
+}
+
+
+void RelayRejoin::initialize ( const IpAddrPort& rootAddr, const string& sessionId )
+{
+    _rootAddr = rootAddr;
+    _sessionId = sessionId;
+    _isRejoining = false;
+}
+
+const IpAddrPort& RelayRejoin::parentLeft ( const IpAddrPort& parentAddr )
+{
+    LOG ( "parentAddr='%s'; rootAddr='%s'; isRejoining=%u", parentAddr, _rootAddr, _isRejoining );
+
+    if ( _isRejoining || _rootAddr.empty() || parentAddr == _rootAddr )
+    {
+        _isRejoining = false;
+        return NullAddress;
+    }
+
+    _isRejoining = true;
+    return _rootAddr;
+}
+
+bool RelayRejoin::gotSpectateConfig ( const SpectateConfig& spectateConfig )
+{
+    LOG ( "sessionId='%s'; expected='%s'", spectateConfig.sessionId, _sessionId );
+
+    _isRejoining = false;
+
+    return ( spectateConfig.sessionId == _sessionId );
+}
+
+bool RelayRejoin::canResume ( const InitialGameState& initial, uint32_t currentIndex )
+{
+    LOG ( "indexedFrame=[%s]; currentIndex=%u", initial.indexedFrame, currentIndex );
+
+    return ( initial.indexedFrame.parts.index <= currentIndex );
+}
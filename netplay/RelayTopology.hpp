@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Messages.hpp"
+#include "IpAddrPort.hpp"
+
+#include <unordered_map>
+#include <string>
+
+
+// The maximum number of spectators allowed for ClientMode::Spectate
+#define MAX_SPECTATORS              ( 15 )
+
+// The maximum number of spectators allowed for ClientMode::Host/Client
+#define MAX_ROOT_SPECTATORS         ( 1 )
+
+
+// Spectator relay tree, as seen from one node. Each spectator reports its RelayStatus to the node it is spectating,
+// so every node knows how deep the shallowest free slot is in each of its subtrees. New spectators are redirected one
+// level at a time towards that slot, which keeps the tree as shallow as the upload capacity of the nodes allows.
+// When a relay leaves, its slot is free again, and is filled by the next spectator that connects or reconnects.
+class RelayTopology
+{
+public:
+
+    // Set the capacity for the client mode, this must be done before reporting the status or accepting spectators
+    void initialize ( const ClientMode& clientMode );
+
+    // Number of spectators this node can relay to
+    void setCapacity ( uint8_t capacity ) { _capacity = capacity; }
+    uint8_t getCapacity() const { return _capacity; }
+
+    size_t numChildren() const { return _children.size(); }
+
+    bool hasChild ( const IpAddrPort& serverAddr ) const { return ( _children.find ( serverAddr ) != _children.end() ); }
+
+    // Add a spectator relayed to by this node, it is treated as a full subtree until it reports its status
+    void addChild ( const IpAddrPort& serverAddr );
+
+    void updateChild ( const IpAddrPort& serverAddr, const RelayStatus& status );
+
+    void removeChild ( const IpAddrPort& serverAddr );
+
+    // Get the server address a new spectator should be redirected to, or NullAddress to accept it here
+    const IpAddrPort& getAttachAddress() const;
+
+    // Get the status to report to the node this is spectating
+    RelayStatus getStatus() const;
+
+private:
+
+    typedef std::unordered_map<IpAddrPort, RelayStatus>::const_iterator ChildIterator;
+
+    uint8_t _capacity = 0;
+
+    // Last status reported by each child, keyed by their server address
+    std::unordered_map<IpAddrPort, RelayStatus> _children;
+
+    // Find the child with the shallowest spare slot, or the smallest subtree if none have spare slots
+    ChildIterator findBestChild() const;
+};
+
+
+// Rejoining the relay tree, as seen from a spectator. When the relay it is spectating leaves, the spectator reconnects
+// to the root, which redirects it to a free slot the same as a new spectator. The game keeps running and relaying to
+// its own spectators in the meantime, so the whole subtree moves with it.
+class RelayRejoin
+{
+public:
+
+    // Set the root address and session id of the game being spectated
+    void initialize ( const IpAddrPort& rootAddr, const std::string& sessionId );
+
+    bool isRejoining() const { return _isRejoining; }
+
+    // The relay being spectated left, returns the address to reconnect to, or NullAddress to stop spectating.
+    // There is nothing to rejoin if the root itself left, or if a rejoin is already in progress.
+    const IpAddrPort& parentLeft ( const IpAddrPort& parentAddr );
+
+    // The new parent sent its SpectateConfig, returns false if it isn't spectating the same game
+    bool gotSpectateConfig ( const SpectateConfig& spectateConfig );
+
+    // The new parent sends inputs from the index in its InitialGameState, returns false if that is past the
+    // current index, since the inputs in between would be missing.
+    static bool canResume ( const InitialGameState& initial, uint32_t currentIndex );
+
+private:
+
+    IpAddrPort _rootAddr;
+
+    std::string _sessionId;
+
+    bool _isRejoining = false;
+};
@@ -0,0 +1,560 @@
+#include "ReplayFile.hpp"
+#include "Exceptions.hpp"
+#include "Logger.hpp"
+#include "Messages.hpp"
+
+#include <sstream>
+#include <cstring>
+
+using namespace std;
+
+
+static void write16 ( string& bytes, uint16_t value )
+{
+    bytes.append ( ( const char * ) &value, sizeof ( value ) );
+}
+
+static void write32 ( string& bytes, uint32_t value )
+{
+    bytes.append ( ( const char * ) &value, sizeof ( value ) );
+}
+
+static void writeMsg ( string& bytes, const MsgPtr& msg )
+{
+    if ( ! msg )
+    {
+        write32 ( bytes, 0 );
+        return;
+    }
+
+    const string data = Protocol::encode ( msg, WIRE_VERSION_LATEST );
+
+    write32 ( bytes, data.size() );
+    bytes += data;
+}
+
+
+// Bounds checked reader over the replay data
+class ReplayReader
+{
+public:
+
+    ReplayReader ( const char *bytes, size_t len ) : _pos ( bytes ), _end ( bytes + len ) {}
+
+    const char *read ( size_t len )
+    {
+        if ( len > remaining() )
+            THROW_EXCEPTION ( "Truncated replay data, needed %u bytes, only %u left", "Invalid replay file!",
+                              len, remaining() );
+
+        const char *ptr = _pos;
+        _pos += len;
+        return ptr;
+    }
+
+    uint8_t read8() { return * ( const uint8_t * ) read ( 1 ); }
+
+    uint16_t read16()
+    {
+        uint16_t value;
+        memcpy ( &value, read ( sizeof ( value ) ), sizeof ( value ) );
+        return value;
+    }
+
+    uint32_t read32()
+    {
+        uint32_t value;
+        memcpy ( &value, read ( sizeof ( value ) ), sizeof ( value ) );
+        return value;
+    }
+
+    // Read a count of items that are at least minItemSize bytes each, this rejects counts that can't possibly fit
+    uint32_t readCount ( size_t minItemSize )
+    {
+        const uint32_t count = read32();
+
+        if ( count > remaining() / minItemSize )
+            THROW_EXCEPTION ( "Invalid replay count: %u", "Invalid replay file!", count );
+
+        return count;
+    }
+
+    MsgPtr readMsg ( MsgType type )
+    {
+        const uint32_t len = read32();
+
+        if ( len == 0 )
+            return NullMsg;
+
+        const char *bytes = read ( len );
+
+        size_t consumed;
+        MsgPtr msg = Protocol::decode ( bytes, len, consumed );
+
+        if ( ! msg || consumed != len || msg->getMsgType() != type )
+            THROW_EXCEPTION ( "Invalid replay message, expected %s", "Invalid replay file!", type );
+
+        return msg;
+    }
+
+    size_t remaining() const { return _end - _pos; }
+
+private:
+
+    const char *_pos, *_end;
+};
+
+
+void ReplayChunk::clear()
+{
+    index = gameMode = 0;
+    state.clear();
+    inputs.clear();
+    rollbacks.clear();
+    rngState.reset();
+}
+
+void ReplayChunk::save ( string& bytes ) const
+{
+    ASSERT ( state.size() <= 0xFF );
+
+    const size_t start = bytes.size();
+
+    // Size placeholder
+    write32 ( bytes, 0 );
+
+    write32 ( bytes, index );
+    write32 ( bytes, gameMode );
+    bytes += ( char ) state.size();
+    bytes += state;
+
+    write32 ( bytes, inputs.size() );
+
+    for ( const ReplayInputs& i : inputs )
+    {
+        write16 ( bytes, i.p1 );
+        write16 ( bytes, i.p2 );
+    }
+
+    write32 ( bytes, rollbacks.size() );
+
+    for ( const ReplayRollback& rollback : rollbacks )
+    {
+        write32 ( bytes, rollback.frame );
+        write32 ( bytes, rollback.target.parts.index );
+        write32 ( bytes, rollback.target.parts.frame );
+        write32 ( bytes, rollback.reinputs.size() );
+
+        for ( const ReplayInputs& i : rollback.reinputs )
+        {
+            write32 ( bytes, i.indexedFrame.parts.index );
+            write32 ( bytes, i.indexedFrame.parts.frame );
+            write16 ( bytes, i.p1 );
+            write16 ( bytes, i.p2 );
+        }
+    }
+
+    writeMsg ( bytes, rngState );
+
+    const uint32_t size = bytes.size() - start - sizeof ( uint32_t );
+    memcpy ( &bytes[start], &size, sizeof ( size ) );
+}
+
+void ReplayChunk::load ( const char *bytes, size_t len )
+{
+    clear();
+
+    ReplayReader reader ( bytes, len );
+
+    index = reader.read32();
+    gameMode = reader.read32();
+
+    const uint8_t stateLen = reader.read8();
+    state.assign ( reader.read ( stateLen ), stateLen );
+
+    inputs.resize ( reader.readCount ( 4 ) );
+
+    for ( size_t i = 0; i < inputs.size(); ++i )
+    {
+        inputs[i].indexedFrame.parts.index = index;
+        inputs[i].indexedFrame.parts.frame = i;
+        inputs[i].p1 = reader.read16();
+        inputs[i].p2 = reader.read16();
+    }
+
+    rollbacks.resize ( reader.readCount ( 16 ) );
+
+    for ( ReplayRollback& rollback : rollbacks )
+    {
+        rollback.frame = reader.read32();
+        rollback.target.parts.index = reader.read32();
+        rollback.target.parts.frame = reader.read32();
+        rollback.reinputs.resize ( reader.readCount ( 12 ) );
+
+        for ( ReplayInputs& i : rollback.reinputs )
+        {
+            i.indexedFrame.parts.index = reader.read32();
+            i.indexedFrame.parts.frame = reader.read32();
+            i.p1 = reader.read16();
+            i.p2 = reader.read16();
+        }
+    }
+
+    rngState = reader.readMsg ( MsgType::RngState );
+
+    if ( reader.remaining() )
+        THROW_EXCEPTION ( "%u unused bytes in replay chunk", "Invalid replay file!", reader.remaining() );
+}
+
+
+void ReplayIndex::load ( const char *bytes, size_t len )
+{
+    entries.clear();
+    initialStates.clear();
+
+    if ( len < REPLAY_HEADER_SIZE || memcmp ( bytes, REPLAY_MAGIC, 4 ) != 0 )
+        THROW_EXCEPTION ( "Not a binary replay", "Invalid replay file!" );
+
+    uint32_t version;
+    memcpy ( &version, bytes + 4, sizeof ( version ) );
+
+    if ( version != REPLAY_VERSION )
+        THROW_EXCEPTION ( "Unknown replay version: %u", "Invalid replay file!", version );
+
+    uint32_t footerOffset = 0;
+
+    if ( len >= REPLAY_HEADER_SIZE + 8 && memcmp ( bytes + len - 4, REPLAY_FOOTER_MAGIC, 4 ) == 0 )
+        memcpy ( &footerOffset, bytes + len - 8, sizeof ( footerOffset ) );
+
+    if ( footerOffset >= REPLAY_HEADER_SIZE && footerOffset <= len - 8 )
+    {
+        try
+        {
+            ReplayReader reader ( bytes + footerOffset, len - 8 - footerOffset );
+
+            initialStates.resize ( reader.readCount ( 4 ) );
+
+            for ( MsgPtr& msg : initialStates )
+            {
+                msg = reader.readMsg ( MsgType::InitialGameState );
+
+                if ( ! msg )
+                    THROW_EXCEPTION ( "Missing InitialGameState", "Invalid replay file!" );
+            }
+
+            entries.resize ( reader.readCount ( 16 ) );
+
+            for ( ReplayIndexEntry& entry : entries )
+            {
+                entry.index = reader.read32();
+                entry.gameMode = reader.read32();
+                entry.offset = reader.read32();
+                entry.numInputs = reader.read32();
+
+                if ( entry.offset < REPLAY_HEADER_SIZE || entry.offset > footerOffset - 4 )
+                    THROW_EXCEPTION ( "Invalid chunk offset: %u", "Invalid replay file!", entry.offset );
+            }
+
+            return;
+        }
+        catch ( const Exception& exc )
+        {
+            entries.clear();
+            initialStates.clear();
+        }
+    }
+
+    LOG ( "No valid replay footer, scanning chunks" );
+
+    // Scan the chunks in order, stopping at the first truncated chunk
+    for ( size_t offset = REPLAY_HEADER_SIZE; offset + 4 <= len; )
+    {
+        uint32_t size;
+        memcpy ( &size, bytes + offset, sizeof ( size ) );
+
+        if ( size > len - offset - 4 )
+            break;
+
+        try
+        {
+            ReplayReader reader ( bytes + offset + 4, size );
+
+            ReplayIndexEntry entry;
+            entry.offset = offset;
+            entry.index = reader.read32();
+            entry.gameMode = reader.read32();
+            reader.read ( reader.read8() );
+            entry.numInputs = reader.read32();
+
+            entries.push_back ( entry );
+        }
+        catch ( const Exception& exc )
+        {
+            break;
+        }
+
+        offset += 4 + size;
+    }
+
+    LOG ( "Found %u chunks", entries.size() );
+}
+
+
+bool ReplayWriter::open ( const string& filename )
+{
+    close();
+
+    _fout.open ( filename.c_str(), ofstream::binary | ofstream::trunc );
+
+    if ( ! _fout.good() )
+    {
+        LOG ( "Failed to open replay file: '%s'", filename );
+        _fout.close();
+        return false;
+    }
+
+    _buffer = REPLAY_MAGIC;
+    write32 ( _buffer, REPLAY_VERSION );
+
+    _fout.write ( &_buffer[0], _buffer.size() );
+    _offset = _buffer.size();
+
+    _chunk.clear();
+    _hasChunk = false;
+    _index.entries.clear();
+    _index.initialStates.clear();
+    return true;
+}
+
+void ReplayWriter::close()
+{
+    if ( ! isOpen() )
+        return;
+
+    flush();
+
+    _buffer.clear();
+    write32 ( _buffer, _index.initialStates.size() );
+
+    for ( const MsgPtr& msg : _index.initialStates )
+        writeMsg ( _buffer, msg );
+
+    write32 ( _buffer, _index.entries.size() );
+
+    for ( const ReplayIndexEntry& entry : _index.entries )
+    {
+        write32 ( _buffer, entry.index );
+        write32 ( _buffer, entry.gameMode );
+        write32 ( _buffer, entry.offset );
+        write32 ( _buffer, entry.numInputs );
+    }
+
+    write32 ( _buffer, _offset );
+    _buffer += REPLAY_FOOTER_MAGIC;
+
+    _fout.write ( &_buffer[0], _buffer.size() );
+    _fout.close();
+
+    _index.entries.clear();
+    _index.initialStates.clear();
+}
+
+void ReplayWriter::setIndex ( uint32_t index, uint32_t gameMode, const string& state )
+{
+    if ( ! isOpen() || ( _hasChunk && _chunk.index == index ) )
+        return;
+
+    flush();
+
+    _chunk.index = index;
+    _chunk.gameMode = gameMode;
+    _chunk.state = state;
+    _hasChunk = true;
+
+    // Each loading transition has an initial state that can be used to start playing the replay from there
+    if ( gameMode == CC_GAME_MODE_LOADING )
+        _index.initialStates.push_back ( MsgPtr ( new InitialGameState ( IndexedFrame {{ 0, index }} ) ) );
+}
+
+void ReplayWriter::addInputs ( uint32_t frame, uint16_t p1, uint16_t p2 )
+{
+    if ( ! _hasChunk )
+        return;
+
+    if ( frame >= _chunk.inputs.size() )
+        _chunk.inputs.resize ( frame + 1, { MaxIndexedFrame, 0, 0 } );
+
+    _chunk.inputs[frame].p1 = p1;
+    _chunk.inputs[frame].p2 = p2;
+}
+
+void ReplayWriter::addRollback ( uint32_t frame, IndexedFrame target )
+{
+    if ( ! _hasChunk )
+        return;
+
+    _chunk.rollbacks.push_back ( ReplayRollback() );
+    _chunk.rollbacks.back().frame = frame;
+    _chunk.rollbacks.back().target = target;
+}
+
+void ReplayWriter::addReinputs ( IndexedFrame indexedFrame, uint16_t p1, uint16_t p2 )
+{
+    if ( ! _hasChunk )
+        return;
+
+    if ( _chunk.rollbacks.empty() )
+    {
+        LOG ( "[%s] Ignoring reinputs without a rollback", indexedFrame );
+        return;
+    }
+
+    _chunk.rollbacks.back().reinputs.push_back ( { indexedFrame, p1, p2 } );
+}
+
+void ReplayWriter::setRngState ( const MsgPtr& rngState )
+{
+    if ( ! _hasChunk )
+        return;
+
+    ASSERT ( ! rngState || rngState->getMsgType() == MsgType::RngState );
+
+    _chunk.rngState = rngState;
+}
+
+void ReplayWriter::setCharacter ( uint8_t player, uint32_t chara, uint32_t moon, uint32_t color )
+{
+    ASSERT ( player == 1 || player == 2 );
+
+    if ( _index.initialStates.empty() )
+        return;
+
+    InitialGameState& initial = _index.initialStates.back()->getAs<InitialGameState>();
+
+    initial.chara[player - 1] = chara;
+    initial.moon[player - 1] = moon;
+    initial.color[player - 1] = color;
+    initial.invalidate();
+}
+
+void ReplayWriter::flush()
+{
+    if ( ! _hasChunk )
+        return;
+
+    _index.entries.push_back ( { _chunk.index, _chunk.gameMode, _offset, ( uint32_t ) _chunk.inputs.size() } );
+
+    _buffer.clear();
+    _chunk.save ( _buffer );
+
+    _fout.write ( &_buffer[0], _buffer.size() );
+    _offset += _buffer.size();
+
+    _chunk.clear();
+    _hasChunk = false;
+}
+
+
+// Parse a legacy RngState hex dump
+static MsgPtr parseLegacyRngState ( stringstream& ss )
+{
+    RngState *rngState = new RngState ( 0 );
+    MsgPtr msg ( rngState );
+
+    // The old hex dump size has 4 extra bytes before rngState3
+    const size_t extra = ( ss.str().size() == 707 ? 4 : 0 );
+
+    if ( ss.str().size() != 707 && ss.str().size() != 695 )
+        THROW_EXCEPTION ( "Unknown RngState size: %u", "Invalid replay file!", ss.str().size() );
+
+    char data [ sizeof ( uint32_t ) * 3 + 4 + CC_RNG_STATE3_SIZE ];
+
+    for ( size_t i = 0; i < sizeof ( uint32_t ) * 3 + extra + CC_RNG_STATE3_SIZE; ++i )
+    {
+        uint32_t v;
+        ss >> hex >> v;
+        data[i] = v;
+    }
+
+    memcpy ( &rngState->rngState0, &data[0], sizeof ( uint32_t ) );
+    memcpy ( &rngState->rngState1, &data[4], sizeof ( uint32_t ) );
+    memcpy ( &rngState->rngState2, &data[8], sizeof ( uint32_t ) );
+    copy ( &data[12 + extra], &data[12 + extra + CC_RNG_STATE3_SIZE], rngState->rngState3.begin() );
+
+    return msg;
+}
+
+bool convertLegacyReplay ( const string& legacyFile, const string& replayFile )
+{
+    ifstream fin ( legacyFile.c_str() );
+
+    if ( ! fin.good() )
+        return false;
+
+    ReplayWriter writer;
+
+    if ( ! writer.open ( replayFile ) )
+        return false;
+
+    uint32_t gameMode;
+    string netplayState;
+    uint32_t index, frame;
+    string tag;
+
+    while ( fin >> gameMode >> netplayState >> index >> frame >> tag )
+    {
+        string str;
+        stringstream ss;
+
+        getline ( fin, str );
+        ss << trimmed ( str );
+
+        // Lines are in chronological order, so the index only ever increases
+        if ( ! writer.hasIndex() || index > writer.getIndex() )
+            writer.setIndex ( index, gameMode, "NetplayState::" + netplayState );
+
+        if ( tag == "Inputs" )
+        {
+            uint16_t p1, p2;
+            ss >> hex >> p1 >> p2;
+
+            if ( index == writer.getIndex() )
+                writer.addInputs ( frame, p1, p2 );
+        }
+        else if ( tag == "RngState" )
+        {
+            writer.setRngState ( parseLegacyRngState ( ss ) );
+        }
+        else if ( tag == "Rollback" )
+        {
+            IndexedFrame target;
+            ss >> target.parts.index >> target.parts.frame;
+
+            writer.addRollback ( frame, target );
+        }
+        else if ( tag == "Reinputs" )
+        {
+            uint16_t p1, p2;
+            ss >> hex >> p1 >> p2;
+
+            writer.addReinputs ( {{ frame, index }}, p1, p2 );
+        }
+        else if ( tag == "P1" || tag == "P2" )
+        {
+            if ( gameMode != CC_GAME_MODE_IN_GAME )
+                continue;
+
+            uint32_t chara, moon, color;
+            ss >> chara >> moon >> color;
+
+            writer.setCharacter ( tag == "P1" ? 1 : 2, chara, moon, color );
+        }
+        else
+        {
+            THROW_EXCEPTION ( "Unhandled tag: '%s'", "Invalid replay file!", tag );
+        }
+    }
+
+    writer.close();
+    return true;
+}
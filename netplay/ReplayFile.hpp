@@ -0,0 +1,162 @@
+#pragma once
+
+#include "Constants.hpp"
+#include "Protocol.hpp"
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+
+// Binary replay file format, all integers are little endian:
+//
+//   Header:    "CCRP", uint32 version
+//
+//   Chunks:    One per transition index, in increasing index order:
+//              uint32 size of the rest of the chunk, uint32 index, uint32 gameMode, uint8 length + netplay state
+//              uint32 count + count * ( uint16 p1, uint16 p2 ), the inputs for each frame
+//              uint32 count + count * ( uint32 frame, uint32 target index, uint32 target frame,
+//                                       uint32 count + count * ( uint32 index, uint32 frame, uint16 p1, uint16 p2 ) )
+//              uint32 length + encoded RngState message, length is 0 if there is none
+//
+//   Footer:    uint32 count + count * ( uint32 length + encoded InitialGameState message )
+//              uint32 count + count * ( uint32 index, uint32 gameMode, uint32 chunk offset, uint32 number of inputs )
+//              uint32 footer offset, "CCRI"
+//
+// The footer is only written when the file is closed, so if it is missing the chunks can still be scanned in order.
+#define REPLAY_EXT              ".ccr"
+#define REPLAY_MAGIC            "CCRP"
+#define REPLAY_FOOTER_MAGIC     "CCRI"
+#define REPLAY_VERSION          ( 1 )
+#define REPLAY_HEADER_SIZE      ( 8 )
+
+
+struct ReplayInputs
+{
+    IndexedFrame indexedFrame;
+    uint16_t p1, p2;
+};
+
+
+struct ReplayRollback
+{
+    // Frame that was rolled back from
+    uint32_t frame = 0;
+
+    // Frame that was rolled back to
+    IndexedFrame target = MaxIndexedFrame;
+
+    // Inputs re-run after the rollback
+    std::vector<ReplayInputs> reinputs;
+};
+
+
+// All the data for a single transition index
+struct ReplayChunk
+{
+    uint32_t index = 0, gameMode = 0;
+
+    // Netplay state string, eg "NetplayState::InGame"
+    std::string state;
+
+    // Inputs indexed by frame
+    std::vector<ReplayInputs> inputs;
+
+    // Rollbacks in the order they happened
+    std::vector<ReplayRollback> rollbacks;
+
+    MsgPtr rngState;
+
+    void clear();
+
+    // Append the encoded chunk, including the size prefix
+    void save ( std::string& bytes ) const;
+
+    // Decode a chunk, excluding the size prefix. Throws Exception on invalid data.
+    void load ( const char *bytes, size_t len );
+};
+
+
+// Location of a chunk in the file, the game mode and number of inputs are duplicated here so they can be looked up
+// without decoding the chunk.
+struct ReplayIndexEntry
+{
+    uint32_t index, gameMode, offset, numInputs;
+};
+
+
+// Seekable index of a replay file
+struct ReplayIndex
+{
+    std::vector<ReplayIndexEntry> entries;
+
+    std::vector<MsgPtr> initialStates;
+
+    // Read the index from the footer, or by scanning the chunks if there is no valid footer.
+    // Throws Exception if the data isn't a binary replay file.
+    void load ( const char *bytes, size_t len );
+};
+
+
+// Writes a binary replay file during play. The current transition index is kept in memory and written out as a chunk
+// when the next index starts, so the file is written in small sequential appends. Nothing is recorded unless open.
+class ReplayWriter
+{
+public:
+
+    ~ReplayWriter() { close(); }
+
+    // Open a new replay file, returns false on failure
+    bool open ( const std::string& filename );
+
+    // Write the last chunk and the footer, then close the file
+    void close();
+
+    bool isOpen() const { return _fout.is_open(); }
+
+    // Get the current transition index, only valid if hasIndex()
+    uint32_t getIndex() const { return _chunk.index; }
+
+    bool hasIndex() const { return _hasChunk; }
+
+    // Start a new transition index, the previous index is written to the file
+    void setIndex ( uint32_t index, uint32_t gameMode, const std::string& state );
+
+    // Record the inputs for a frame of the current index
+    void addInputs ( uint32_t frame, uint16_t p1, uint16_t p2 );
+
+    // Record a rollback from a frame of the current index
+    void addRollback ( uint32_t frame, IndexedFrame target );
+
+    // Record the inputs re-run after the last rollback
+    void addReinputs ( IndexedFrame indexedFrame, uint16_t p1, uint16_t p2 );
+
+    // Record the RngState at the start of the current index
+    void setRngState ( const MsgPtr& rngState );
+
+    // Record the character selection for the last loading transition
+    void setCharacter ( uint8_t player, uint32_t chara, uint32_t moon, uint32_t color );
+
+private:
+
+    std::ofstream _fout;
+
+    uint32_t _offset = 0;
+
+    ReplayChunk _chunk;
+
+    bool _hasChunk = false;
+
+    ReplayIndex _index;
+
+    // Temporary buffer for encoding
+    std::string _buffer;
+
+    // Write the current chunk to the file
+    void flush();
+};
+
+
+// Convert a legacy text replay, made from sync.log with scripts/sync2replay, into a binary replay file.
+// Throws Exception if the text replay is invalid, returns false if the files can't be opened.
+bool convertLegacyReplay ( const std::string& legacyFile, const std::string& replayFile );
@@ -3,229 +3,169 @@
 #include "Logger.hpp"
 #include "Messages.hpp"
 
-#include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <cstring>
 
 using namespace std;
 
 
+static bool compareIndexEntries ( const ReplayIndexEntry& a, const ReplayIndexEntry& b )
+{
+    return ( a.index < b.index );
+}
+
 bool ReplayManager::load ( const string& replayFile, bool real )
 {
-    ifstream fin ( replayFile.c_str() );
-    bool good = fin.good();
+    _real = real;
+    _hasChunk = false;
+    _entries.clear();
+    _initialStates.clear();
+    _lastIndex = _lastFrame = 0;
+
+    if ( ! _file.open ( replayFile ) )
+        return false;
 
-    if ( good )
+    // Legacy text replays are converted once, then the binary replay is used
+    if ( _file.size() < 4 || memcmp ( _file.data(), REPLAY_MAGIC, 4 ) != 0 )
     {
-        uint32_t gameMode;
-        string netplayState;
-        uint32_t index, frame;
-        string tag;
+        const string converted = replayFile + REPLAY_EXT;
 
-        while ( fin >> gameMode >> netplayState >> index >> frame >> tag )
-        {
-            string str;
-            stringstream ss;
+        LOG ( "Converting legacy replay: '%s' -> '%s'", replayFile, converted );
+
+        _file.close();
+
+        if ( ! convertLegacyReplay ( replayFile, converted ) || ! _file.open ( converted ) )
+            return false;
+    }
+
+    ReplayIndex index;
+    index.load ( _file.data(), _file.size() );
+
+    _entries = index.entries;
+    _initialStates = index.initialStates;
+
+    stable_sort ( _entries.begin(), _entries.end(), compareIndexEntries );
+
+    for ( const ReplayIndexEntry& entry : _entries )
+    {
+        if ( entry.numInputs == 0 )
+            continue;
 
-            getline ( fin, str );
-            ss << trimmed ( str );
-
-            if ( index >= _modes.size() )
-            {
-                _modes.resize ( index + 1 );
-                _modes[index] = 0;
-            }
-
-            if ( ! _modes[index] )
-                _modes[index] = gameMode;
+        _lastIndex = entry.index;
+        _lastFrame = entry.numInputs - 1;
+    }
 
-            ASSERT ( _modes[index] == gameMode );
-
-            if ( index >= _states.size() )
-                _states.resize ( index + 1 );
-
-            if ( _states[index].empty() )
-                _states[index] = "NetplayState::" + netplayState;
+    LOG ( "Processed up to [%u:%u]", _lastIndex, _lastFrame );
+    return true;
+}
 
-            if ( gameMode == CC_GAME_MODE_LOADING )
-            {
-                if ( _initialStates.empty() )
-                    _initialStates.push_back ( MsgPtr ( new InitialGameState ( { 0, index } ) ) );
-
-                ASSERT ( _initialStates.back().get() != 0 );
-
-                if ( _initialStates.back()->getAs<InitialGameState>().indexedFrame.parts.index != index )
-                    _initialStates.push_back ( MsgPtr ( new InitialGameState ( { 0, index } ) ) );
-            }
+bool ReplayManager::seek ( uint32_t index )
+{
+    if ( _hasChunk && _chunk.index == index )
+        return true;
 
-            ASSERT ( _states[index] == "NetplayState::" + netplayState );
+    ReplayIndexEntry key;
+    key.index = index;
 
-            if ( tag == "Inputs" || ( real && tag == "Reinputs" ) )
-            {
-                if ( index >= _inputs.size() )
-                    _inputs.resize ( index + 1 );
+    auto it = lower_bound ( _entries.begin(), _entries.end(), key, compareIndexEntries );
 
-                ASSERT ( index + 1 == _inputs.size() );
+    if ( it == _entries.end() || it->index != index )
+        return false;
 
-                if ( frame >= _inputs[index].size() )
-                    _inputs[index].resize ( frame + 1 );
+    _hasChunk = false;
+    loadChunk ( *it, _chunk );
+    _hasChunk = true;
 
-                Inputs i;
-                i.indexedFrame.parts.index = index;
-                i.indexedFrame.parts.frame = frame;
-                ss >> hex >> i.p1 >> i.p2;
+    _rollbacks.clear();
+    _reinputs.clear();
 
-                _inputs[index][frame] = i;
-            }
-            else if ( tag == "RngState" )
-            {
-                if ( index >= _rngStates.size() )
-                    _rngStates.resize ( index + 1 );
+    if ( _real )
+    {
+        // Real inputs are the final inputs after all the rollbacks, so the reinputs are applied in the order they
+        // were recorded. The inputs of a frame are always recorded before any rollback that re-runs it.
+        for ( const ReplayRollback& rollback : _chunk.rollbacks )
+            applyRealInputs ( rollback.reinputs );
 
-                ASSERT ( _rngStates[index].get() == 0 );
-
-                RngState *rngState = 0;
-
-                if ( ss.str().size() == 707 ) // Old RngState hex dump size
-                {
-                    rngState = new RngState ( 0 );
+        // A rollback from a later index can re-run the end of this index, those reinputs are recorded in the later
+        // chunk. Rollbacks can't go back further than the saved states, so only the next few chunks are checked.
+        ReplayChunk later;
+        uint32_t skipped = 0;
 
-                    char data [ sizeof ( uint32_t ) * 3 + 4 + CC_RNG_STATE3_SIZE ];
-
-                    for ( char& c : data )
-                    {
-                        uint32_t v;
-                        ss >> hex >> v;
-                        c = v;
-                    }
-
-                    memcpy ( &rngState->rngState0, &data[0], sizeof ( uint32_t ) );
-                    memcpy ( &rngState->rngState1, &data[4], sizeof ( uint32_t ) );
-                    memcpy ( &rngState->rngState2, &data[8], sizeof ( uint32_t ) );
-                    copy ( &data[16], &data[16 + CC_RNG_STATE3_SIZE], rngState->rngState3.begin() );
-                }
-                else if ( ss.str().size() == 695 ) // New RngState hex dump size
-                {
-                    rngState = new RngState ( 0 );
-
-                    char data [ sizeof ( uint32_t ) * 3 + CC_RNG_STATE3_SIZE ];
-
-                    for ( char& c : data )
-                    {
-                        uint32_t v;
-                        ss >> hex >> v;
-                        c = v;
-                    }
-
-                    memcpy ( &rngState->rngState0, &data[0], sizeof ( uint32_t ) );
-                    memcpy ( &rngState->rngState1, &data[4], sizeof ( uint32_t ) );
-                    memcpy ( &rngState->rngState2, &data[8], sizeof ( uint32_t ) );
-                    copy ( &data[12], &data[12 + CC_RNG_STATE3_SIZE], rngState->rngState3.begin() );
-                }
-                else
-                {
-                    THROW_EXCEPTION ( "Unknown RngState size: %u", "Invalid replay file!", ss.str().size() );
-                }
-
-                _rngStates[index].reset ( rngState );
-            }
-            else if ( tag == "Rollback" )
-            {
-                if ( real )
-                    continue;
-
-                if ( index >= _rollbacks.size() )
-                    _rollbacks.resize ( index + 1 );
-
-                ASSERT ( index + 1 == _rollbacks.size() );
-
-                if ( frame >= _rollbacks[index].size() )
-                    _rollbacks[index].resize ( frame + 1, MaxIndexedFrame );
-
-                IndexedFrame i;
-                ss >> i.parts.index >> i.parts.frame;
-
-                _rollbacks[index][frame] = i;
-            }
-            else if ( tag == "Reinputs" )
-            {
-                if ( real )
-                    continue;
-
-                if ( _rollbacks.size() > _reinputs.size() )
-                    _reinputs.resize ( _rollbacks.size() );
-
-                ASSERT ( _rollbacks.size() == _reinputs.size() );
-
-                if ( _rollbacks.back().size() > _reinputs.back().size() )
-                    _reinputs.back().resize ( _rollbacks.back().size() );
-
-                ASSERT ( _rollbacks.back().size() == _reinputs.back().size() );
-
-                Inputs i;
-                i.indexedFrame.parts.index = index;
-                i.indexedFrame.parts.frame = frame;
-                ss >> hex >> i.p1 >> i.p2;
-
-                _reinputs.back().back().push_back ( i );
-            }
-            else if ( tag == "P1" )
-            {
-                if ( gameMode != CC_GAME_MODE_IN_GAME )
-                    continue;
-
-                ASSERT ( _initialStates.back().get() != 0 );
-
-                uint32_t chara, moon, color;
-                ss >> chara >> moon >> color;
-
-                _initialStates.back()->getAs<InitialGameState>().chara[0] = chara;
-                _initialStates.back()->getAs<InitialGameState>().moon[0] = moon;
-                _initialStates.back()->getAs<InitialGameState>().color[0] = color;
-            }
-            else if ( tag == "P2" )
-            {
-                if ( gameMode != CC_GAME_MODE_IN_GAME )
-                    continue;
-
-                ASSERT ( _initialStates.back().get() != 0 );
-
-                uint32_t chara, moon, color;
-                ss >> chara >> moon >> color;
-
-                _initialStates.back()->getAs<InitialGameState>().chara[1] = chara;
-                _initialStates.back()->getAs<InitialGameState>().moon[1] = moon;
-                _initialStates.back()->getAs<InitialGameState>().color[1] = color;
-            }
-            else
-            {
-                THROW_EXCEPTION ( "Unhandled tag: '%s'", "Invalid replay file!", tag );
-            }
+        for ( auto jt = it + 1; jt != _entries.end() && skipped < NUM_ROLLBACK_STATES; skipped += jt->numInputs, ++jt )
+        {
+            loadChunk ( *jt, later );
+
+            for ( const ReplayRollback& rollback : later.rollbacks )
+                applyRealInputs ( rollback.reinputs );
+        }
+
+        return true;
+    }
+
+    for ( const ReplayRollback& rollback : _chunk.rollbacks )
+    {
+
+        if ( rollback.frame >= _rollbacks.size() )
+        {
+            _rollbacks.resize ( rollback.frame + 1, MaxIndexedFrame );
+            _reinputs.resize ( rollback.frame + 1 );
         }
 
-        LOG ( "Processed up to [%u:%u]", _inputs.size() - 1, _inputs.back().size() - 1 );
+        _rollbacks[rollback.frame] = rollback.target;
+        _reinputs[rollback.frame].insert ( _reinputs[rollback.frame].end(),
+                                           rollback.reinputs.begin(), rollback.reinputs.end() );
     }
 
-    fin.close();
-    return good;
+    return true;
+}
+
+void ReplayManager::loadChunk ( const ReplayIndexEntry& entry, ReplayChunk& chunk ) const
+{
+    uint32_t size;
+    memcpy ( &size, _file.data() + entry.offset, sizeof ( size ) );
+
+    if ( size > _file.size() - entry.offset - sizeof ( size ) )
+        THROW_EXCEPTION ( "Truncated replay chunk [%u]", "Invalid replay file!", entry.index );
+
+    chunk.load ( _file.data() + entry.offset + sizeof ( size ), size );
+}
+
+void ReplayManager::applyRealInputs ( const vector<Inputs>& reinputs )
+{
+    for ( const Inputs& i : reinputs )
+    {
+        if ( i.indexedFrame.parts.index != _chunk.index )
+            continue;
+
+        while ( i.indexedFrame.parts.frame >= _chunk.inputs.size() )
+            _chunk.inputs.push_back ( { {{ ( uint32_t ) _chunk.inputs.size(), _chunk.index }}, 0, 0 } );
+
+        _chunk.inputs[i.indexedFrame.parts.frame] = i;
+    }
 }
 
 uint32_t ReplayManager::getGameMode ( IndexedFrame indexedFrame )
 {
-    if ( indexedFrame.parts.index >= _modes.size() )
+    ReplayIndexEntry key;
+    key.index = indexedFrame.parts.index;
+
+    auto it = lower_bound ( _entries.begin(), _entries.end(), key, compareIndexEntries );
+
+    if ( it == _entries.end() || it->index != indexedFrame.parts.index )
         return 0;
 
-    return _modes[indexedFrame.parts.index];
+    return it->gameMode;
 }
 
 const string& ReplayManager::getStateStr ( IndexedFrame indexedFrame )
 {
-    if ( indexedFrame.parts.index >= _states.size() )
+    if ( ! seek ( indexedFrame.parts.index ) )
     {
         static const string empty;
         return empty;
     }
 
-    return _states[indexedFrame.parts.index];
+    return _chunk.state;
 }
 
 const ReplayManager::Inputs& ReplayManager::getInputs ( IndexedFrame indexedFrame )
@@ -234,12 +174,17 @@ const ReplayManager::Inputs& ReplayManager::getInputs ( IndexedFrame indexedFram
     static const Inputs down = { MaxIndexedFrame, 2, 2 };
     static const Inputs empty = { MaxIndexedFrame, 0, 0 };
 
-    if ( _modes[indexedFrame.parts.index] == CC_GAME_MODE_LOADING )
+    const uint32_t gameMode = getGameMode ( indexedFrame );
+
+    if ( gameMode == CC_GAME_MODE_LOADING )
         return ( ( indexedFrame.parts.frame % 2 ) ? empty : confirm );
 
-    if ( _modes[indexedFrame.parts.index] == CC_GAME_MODE_RETRY )
+    if ( gameMode == CC_GAME_MODE_RETRY )
     {
-        if ( _modes[indexedFrame.parts.index + 1] == CC_GAME_MODE_LOADING )
+        IndexedFrame next = indexedFrame;
+        ++next.parts.index;
+
+        if ( getGameMode ( next ) == CC_GAME_MODE_LOADING )
             return ( ( indexedFrame.parts.frame % 2 ) ? empty : confirm );
 
         if ( indexedFrame.parts.frame == 30 )
@@ -254,63 +199,47 @@ const ReplayManager::Inputs& ReplayManager::getInputs ( IndexedFrame indexedFram
         return empty;
     }
 
-    if ( indexedFrame.parts.index >= _inputs.size()
-            || indexedFrame.parts.frame >= _inputs[indexedFrame.parts.index].size() )
-    {
+    if ( ! seek ( indexedFrame.parts.index ) || indexedFrame.parts.frame >= _chunk.inputs.size() )
         return empty;
-    }
 
-    return _inputs[indexedFrame.parts.index][indexedFrame.parts.frame];
+    return _chunk.inputs[indexedFrame.parts.frame];
 }
 
 IndexedFrame ReplayManager::getRollbackTarget ( IndexedFrame indexedFrame )
 {
-    if ( indexedFrame.parts.index >= _rollbacks.size()
-            || indexedFrame.parts.frame >= _rollbacks[indexedFrame.parts.index].size() )
-    {
+    if ( ! seek ( indexedFrame.parts.index ) || indexedFrame.parts.frame >= _rollbacks.size() )
         return MaxIndexedFrame;
-    }
 
-    return _rollbacks[indexedFrame.parts.index][indexedFrame.parts.frame];
+    return _rollbacks[indexedFrame.parts.frame];
 }
 
 const vector<ReplayManager::Inputs>& ReplayManager::getReinputs ( IndexedFrame indexedFrame )
 {
-    if ( indexedFrame.parts.index >= _reinputs.size()
-            || indexedFrame.parts.frame >= _reinputs[indexedFrame.parts.index].size() )
+    if ( ! seek ( indexedFrame.parts.index ) || indexedFrame.parts.frame >= _reinputs.size() )
     {
         static const vector<ReplayManager::Inputs> empty;
         return empty;
     }
 
-    return _reinputs[indexedFrame.parts.index][indexedFrame.parts.frame];
+    return _reinputs[indexedFrame.parts.frame];
 }
 
 MsgPtr ReplayManager::getRngState ( IndexedFrame indexedFrame )
 {
-    if ( indexedFrame.parts.index >= _rngStates.size() )
+    if ( ! seek ( indexedFrame.parts.index ) )
         return 0;
 
-    return _rngStates[indexedFrame.parts.index];
+    return _chunk.rngState;
 }
 
 uint32_t ReplayManager::getLastIndex() const
 {
-    if ( _inputs.empty() )
-        return 0;
-
-    return _inputs.size() - 1;
+    return _lastIndex;
 }
 
 uint32_t ReplayManager::getLastFrame() const
 {
-    if ( _inputs.empty() )
-        return 0;
-
-    if ( _inputs.back().empty() )
-        return 0;
-
-    return _inputs.back().size() - 1;
+    return _lastFrame;
 }
 
 MsgPtr ReplayManager::getInitialStateBefore ( uint32_t index ) const
@@ -2,21 +2,23 @@
 
 #include "Constants.hpp"
 #include "Protocol.hpp"
+#include "ReplayFile.hpp"
+#include "MappedFile.hpp"
 
 #include <string>
 #include <vector>
 
 
+// Plays back a binary replay file. The file is memory mapped, and only the chunk for the current transition index is
+// decoded, so the whole replay is never loaded into memory.
 class ReplayManager
 {
 public:
 
-    struct Inputs
-    {
-        IndexedFrame indexedFrame;
-        uint16_t p1, p2;
-    };
+    typedef ReplayInputs Inputs;
 
+    // Load a replay file, legacy text replays are converted to a binary replay file next to it first.
+    // If real is true, rollbacks are ignored and the reinputs replace the original inputs.
     bool load ( const std::string& replayFile, bool real );
 
     uint32_t getGameMode ( IndexedFrame indexedFrame );
@@ -39,17 +41,34 @@ public:
 
 private:
 
-    std::vector<uint32_t> _modes;
+    MappedFile _file;
 
-    std::vector<std::string> _states;
+    bool _real = false;
 
-    std::vector<std::vector<Inputs>> _inputs;
+    // Index entries by transition index, missing indices have a zero game mode
+    std::vector<ReplayIndexEntry> _entries;
 
-    std::vector<MsgPtr> _rngStates;
+    std::vector<MsgPtr> _initialStates;
 
-    std::vector<std::vector<IndexedFrame>> _rollbacks;
+    // Last transition index and frame with inputs
+    uint32_t _lastIndex = 0, _lastFrame = 0;
 
-    std::vector<std::vector<std::vector<Inputs>>> _reinputs;
+    // The currently decoded chunk
+    ReplayChunk _chunk;
 
-    std::vector<MsgPtr> _initialStates;
+    bool _hasChunk = false;
+
+    // Rollback targets and reinputs of the current chunk, indexed by frame
+    std::vector<IndexedFrame> _rollbacks;
+
+    std::vector<std::vector<Inputs>> _reinputs;
+
+    // Decode the chunk for the given transition index if it isn't already, returns false if there is no such chunk
+    bool seek ( uint32_t index );
+
+    // Decode the chunk at an index entry. Throws Exception on invalid data.
+    void loadChunk ( const ReplayIndexEntry& entry, ReplayChunk& chunk ) const;
+
+    // Replace the inputs of the current chunk with the reinputs for the same transition index
+    void applyRealInputs ( const std::vector<Inputs>& reinputs );
 };
@@ -3,6 +3,8 @@
 #include "Timer.hpp"
 #include "Socket.hpp"
 #include "Constants.hpp"
+#include "EncodedMsgCache.hpp"
+#include "RelayTopology.hpp"
 
 #include <unordered_map>
 #include <list>
@@ -61,7 +63,16 @@ public:
 
     void popSpectator ( Socket *socket );
 
-    const IpAddrPort& getRandomSpectatorAddress() const;
+
+    // Set the number of spectators this client can relay to, once the client mode is known
+    void initRelay ( const ClientMode& clientMode ) { _relay.initialize ( clientMode ); }
+
+    void updateRelayStatus ( Socket *socket, const RelayStatus& status );
+
+    RelayStatus getRelayStatus() const { return _relay.getStatus(); }
+
+    // Get the server address to redirect a new spectator to, or NullAddress to accept it
+    const IpAddrPort& getRelayAddress() const { return _relay.getAttachAddress(); }
 
 
     void newRngState ( const RngState& rngState );
@@ -82,10 +93,14 @@ private:
 
     std::list<Socket *>::iterator _spectatorListPos;
 
-    std::unordered_map<Socket *, Spectator>::const_iterator _spectatorMapPos;
-
     uint32_t _currentMinIndex = UINT_MAX;
 
+    // Relay tree of the spectators of this client
+    RelayTopology _relay;
+
+    // Messages sent to spectators, so spectators at the same position share the encoded bytes
+    EncodedMsgCache _msgCache;
+
     NetplayManager *_netManPtr = 0;
 
     const ProcessManager *_procManPtr = 0;
@@ -0,0 +1,121 @@
+#include "TimeSync.hpp"
+#include "StringUtils.hpp"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+
+void TimeSync::addSample ( double offset )
+{
+    _samples.push_back ( offset );
+
+    while ( _samples.size() > settings.window )
+        _samples.pop_front();
+
+    ++_numSamples;
+
+    update();
+}
+
+void TimeSync::update()
+{
+    if ( _samples.size() < settings.minSamples )
+    {
+        _hasLocalOffset = false;
+        return;
+    }
+
+    vector<double> sorted ( _samples.begin(), _samples.end() );
+    nth_element ( sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end() );
+
+    const double median = sorted[sorted.size() / 2];
+
+    double sum = 0;
+    size_t count = 0;
+
+    for ( double sample : _samples )
+    {
+        if ( fabs ( sample - median ) > settings.outlierFrames )
+            continue;
+
+        sum += sample;
+        ++count;
+    }
+
+    // The median itself is never an outlier, so count is at least 1
+    _localOffset = sum / count;
+    _hasLocalOffset = true;
+    _numOutliers = _samples.size() - count;
+}
+
+void TimeSync::setRemoteOffset ( int8_t offset )
+{
+    if ( offset == FRAME_OFFSET_UNKNOWN )
+    {
+        _hasRemoteOffset = false;
+        return;
+    }
+
+    _remoteOffset = double ( offset ) / FRAME_OFFSET_SCALE;
+    _hasRemoteOffset = true;
+}
+
+int8_t TimeSync::getEncodedOffset() const
+{
+    if ( ! _hasLocalOffset )
+        return FRAME_OFFSET_UNKNOWN;
+
+    return int8_t ( max ( -127.0, min ( 127.0, round ( _localOffset * FRAME_OFFSET_SCALE ) ) ) );
+}
+
+bool TimeSync::isReady() const
+{
+    return ( _hasLocalOffset && _hasRemoteOffset );
+}
+
+double TimeSync::getAdvantage() const
+{
+    if ( ! isReady() )
+        return 0;
+
+    return ( _localOffset - _remoteOffset ) / 2;
+}
+
+double TimeSync::getFps() const
+{
+    const double excess = getAdvantage() - settings.deadband;
+
+    if ( excess <= 0 )
+        return settings.fps;
+
+    return settings.fps * ( 1 - min ( excess / settings.correctionFrames, settings.maxSlowdown ) );
+}
+
+TimeSync::Metrics TimeSync::getMetrics() const
+{
+    Metrics metrics;
+    metrics.localOffset = _localOffset;
+    metrics.remoteOffset = _remoteOffset;
+    metrics.advantage = getAdvantage();
+    metrics.fps = getFps();
+    metrics.samples = _numSamples;
+    metrics.outliers = _numOutliers;
+    return metrics;
+}
+
+void TimeSync::reset()
+{
+    _samples.clear();
+    _hasLocalOffset = _hasRemoteOffset = false;
+    _numSamples = 0;
+    _numOutliers = 0;
+}
+
+string TimeSync::str() const
+{
+    return format ( "advantage=%.2f; fps=%.3f; localOffset=%.2f; remoteOffset=%.2f; samples=%llu; outliers=%llu",
+                    getAdvantage(), getFps(), _localOffset, _remoteOffset, _numSamples, _numOutliers );
+}
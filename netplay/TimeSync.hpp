@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+
+
+// The frame offset sent in PlayerInputs is in 1/FRAME_OFFSET_SCALE frames, FRAME_OFFSET_UNKNOWN if not measured yet
+#define FRAME_OFFSET_SCALE      ( 8 )
+#define FRAME_OFFSET_UNKNOWN    ( -128 )
+
+
+// Estimates how many frames the local game is ahead of the remote game, and the frame rate that converges both sides.
+//
+// When new remote inputs arrive, the local frame minus the frame the remote sent them on is the frame offset. This is
+// the frame advantage plus the latency in frames, and the remote measures the frame disadvantage plus the latency.
+// Both sides exchange their offsets, so half the difference is the advantage, without needing to know the latency.
+//
+// Only the side that is ahead slows down, by a fraction of a frame each frame, instead of stalling whole frames.
+class TimeSync
+{
+public:
+
+    struct Settings
+    {
+        // The normal frame rate
+        double fps = 60.0;
+
+        // Samples are kept in a rolling window, and the offset is only measured once there are minSamples
+        size_t window = 60, minSamples = 20;
+
+        // Samples further than this many frames from the median are outliers, ie inputs delayed by a lost packet
+        double outlierFrames = 1.5;
+
+        // An advantage within this many frames is considered in sync
+        double deadband = 0.5;
+
+        // The advantage is corrected over this many frames, but the frame rate is never slowed by more than
+        // this fraction, so the slowdown isn't noticeable.
+        double correctionFrames = 120.0, maxSlowdown = 0.02;
+    };
+
+    struct Metrics
+    {
+        // Local and remote frame offsets, including the latency
+        double localOffset = 0, remoteOffset = 0;
+
+        // Estimated frames the local game is ahead, and the frame rate to run at
+        double advantage = 0, fps = 0;
+
+        // Number of samples added, and number of samples in the window rejected as outliers
+        uint64_t samples = 0, outliers = 0;
+    };
+
+    Settings settings;
+
+    // Add the local frame minus the frame the remote was on when it sent new inputs
+    void addSample ( double offset );
+
+    // Set the encoded offset reported by the remote
+    void setRemoteOffset ( int8_t offset );
+
+    // The encoded offset to report to the remote
+    int8_t getEncodedOffset() const;
+
+    // True if both the local and remote offsets are measured
+    bool isReady() const;
+
+    // Estimated frames the local game is ahead, negative if behind, or 0 if not ready
+    double getAdvantage() const;
+
+    // The frame rate to run at, only slowed down if ahead
+    double getFps() const;
+
+    Metrics getMetrics() const;
+
+    void reset();
+
+    std::string str() const;
+
+private:
+
+    std::deque<double> _samples;
+
+    // Mean of the samples excluding outliers, only valid once there are enough samples
+    double _localOffset = 0;
+    bool _hasLocalOffset = false;
+
+    double _remoteOffset = 0;
+    bool _hasRemoteOffset = false;
+
+    uint64_t _numSamples = 0;
+    uint64_t _numOutliers = 0;
+
+    // Update the local offset from the samples
+    void update();
+};
@@ -19,10 +19,10 @@
 
 
 #define INLINE_DWORD(X)                                                         \
-    static_cast<unsigned char> ( unsigned ( X ) & 0xFF ),                       \
-    static_cast<unsigned char> ( ( unsigned ( X ) >> 8 ) & 0xFF ),              \
-    static_cast<unsigned char> ( ( unsigned ( X ) >> 16 ) & 0xFF ),             \
-    static_cast<unsigned char> ( ( unsigned ( X ) >> 24 ) & 0xFF )
+    static_cast<unsigned char> ( uintptr_t ( X ) & 0xFF ),                      \
+    static_cast<unsigned char> ( ( uintptr_t ( X ) >> 8 ) & 0xFF ),             \
+    static_cast<unsigned char> ( ( uintptr_t ( X ) >> 16 ) & 0xFF ),            \
+    static_cast<unsigned char> ( ( uintptr_t ( X ) >> 24 ) & 0xFF )
 
 #define INLINE_DWORD_FF { 0xFF, 0x00, 0x00, 0x00 }
 
@@ -1,15 +1,20 @@
 #include "DllFrameRate.hpp"
-#include "TimerManager.hpp"
 #include "Constants.hpp"
 #include "ProcessManager.hpp"
 #include "DllAsmHacks.hpp"
+#include "FramePacer.hpp"
 
 #include <d3dx9.h>
+#include <mmsystem.h>
 
 using namespace std;
 using namespace DllFrameRate;
 
 
+// The number of frames between each log of the frame timing
+#define FRAME_TIMING_LOG_INTERVAL ( 60 * 60 )
+
+
 namespace DllFrameRate
 {
 
@@ -19,6 +24,9 @@ double actualFps = 60.0;
 
 bool isEnabled = false;
 
+// Sleeps until shortly before each frame, then spins on the microsecond clock
+static FramePacer framePacer;
+
 
 void enable()
 {
@@ -29,6 +37,9 @@ void enable()
     WRITE_ASM_HACK ( AsmHacks::disableFpsLimit );
     WRITE_ASM_HACK ( AsmHacks::disableFpsCounter );
 
+    // Sleep is only accurate to the timer period, this is never ended since the game keeps running
+    timeBeginPeriod ( 1 );
+
     isEnabled = true;
 
     LOG ( "Enabling FPS control!" );
@@ -42,51 +53,22 @@ void PresentFrameEnd ( IDirect3DDevice9 *device )
     if ( !isEnabled || *CC_SKIP_FRAMES_ADDR )
         return;
 
-    static uint64_t last1f = 0, last5f = 0, last30f = 0, last60f = 0;
-    static uint8_t counter = 0;
+    framePacer.setFps ( desiredFps );
+    framePacer.waitNextFrame();
 
-    ++counter;
+    const uint64_t frames = framePacer.getCounters().frames;
 
-    uint64_t now = TimerManager::get().getNow ( true );
-
-    /**
-     * The best timer resolution is only in milliseconds, and we need to make
-     * sure the spacing between frames is as close to even as possible.
-     *
-     * What this code does is check every 30f, 5f, and 1f how many milliseconds have
-     * passed since the last check and make sure we are close to or under the desired FPS.
-     */
-    if ( counter % 30 == 0 )
-    {
-        while ( now - last30f < ( 30 * 1000 ) / desiredFps )
-            now = TimerManager::get().getNow ( true );
-
-        last30f = now;
-    }
-    else if ( counter % 5 == 0 )
+    if ( frames % 60 == 0 )
     {
-        while ( now - last5f < ( 5 * 1000 ) / desiredFps )
-            now = TimerManager::get().getNow ( true );
+        actualFps = framePacer.getActualFps();
 
-        last5f = now;
-    }
-    else
-    {
-        while ( now - last1f < 1000 / desiredFps )
-            now = TimerManager::get().getNow ( true );
+        *CC_FPS_COUNTER_ADDR = uint32_t ( actualFps + 0.5 );
     }
 
-    last1f = now;
-
-    if ( counter >= 60 )
+    if ( frames % FRAME_TIMING_LOG_INTERVAL == 0 )
     {
-        now = TimerManager::get().getNow ( true );
-
-        actualFps = 1000.0 / ( ( now - last60f ) / 60.0 );
-
-        *CC_FPS_COUNTER_ADDR = uint32_t ( actualFps + 0.5 );
+        LOG ( "%s", framePacer.str() );
 
-        counter = 0;
-        last60f = now;
+        framePacer.resetTiming();
     }
 }
@@ -0,0 +1,568 @@
+#include "DllFrameStepper.hpp"
+#include "DllAsmHacks.hpp"
+#include "ProcessManager.hpp"
+#include "Exceptions.hpp"
+#include "ErrorStringsExt.hpp"
+#include "Logger.hpp"
+
+using namespace std;
+
+
+// The extra number of frames to delay checking round over state during rollback
+#define ROLLBACK_ROUND_OVER_DELAY   ( 5 )
+
+// The number of frames between each automatic delay/rollback check
+#define AUTO_DELAY_INTERVAL         ( 300 )
+
+
+void DllFrameStepper::frameStep()
+{
+    // New frame
+    netMan.updateFrame();
+
+    // Check for changes to important variables for state transitions
+    checkChanges();
+
+    // Check for round over state during in-game
+    if ( netMan.isInGame() )
+        checkRoundOver();
+
+    // Need to manually set the intro state to 0 during rollback
+    if ( netMan.isInRollback() && netMan.getFrame() > CC_PRE_GAME_INTRO_FRAMES && *CC_INTRO_STATE_ADDR )
+        *CC_INTRO_STATE_ADDR = 0;
+
+    // Perform the frame step
+    if ( fastFwdStopFrame.value )
+        frameStepRerun();
+    else
+        frameStepNormal();
+
+    frameStepDone();
+}
+
+void DllFrameStepper::frameStepNormal()
+{
+    const ClientMode& clientMode = getClientMode();
+
+    switch ( netMan.getState().value )
+    {
+        case NetplayState::PreInitial:
+        case NetplayState::Initial:
+        case NetplayState::AutoCharaSelect:
+            // Skip rendering while loading character select
+            *CC_SKIP_FRAMES_ADDR = 1;
+            break;
+
+        case NetplayState::InGame:
+            if ( netMan.getRollback() )
+            {
+                // Only save rollback states in-game
+                saveRollbackState();
+
+                // Delayed round over check
+                if ( roundOverTimer > 0 )
+                    --roundOverTimer;
+            }
+
+        case NetplayState::CharaSelect:
+        case NetplayState::Loading:
+        case NetplayState::Skippable:
+        case NetplayState::RetryMenu:
+        {
+            if ( ! updateLocalInputs() )
+                break;
+
+            // Assign local player input
+            if ( ! clientMode.isSpectate() )
+            {
+#ifndef RELEASE
+                if ( netMan.isInRollback() )
+                    netMan.assignInput ( getLocalPlayer(), localInputs[0], netMan.getFrame() + netMan.getDelay() );
+                else
+#endif // NOT RELEASE
+                    netMan.setInput ( getLocalPlayer(), localInputs[0] );
+            }
+
+            Socket *dataSocket = getDataSocket();
+
+            if ( clientMode.isNetplay() )
+            {
+                // Special netplay retry menu behaviour, only select final option after both sides have selected
+                if ( netMan.getState() == NetplayState::RetryMenu )
+                {
+                    MsgPtr msgMenuIndex = netMan.getLocalRetryMenuIndex();
+
+                    // Lazy disconnect now once the retry menu option has been selected
+                    if ( msgMenuIndex && ( !dataSocket || !dataSocket->isConnected() ) )
+                    {
+                        if ( lazyDisconnect )
+                        {
+                            lazyDisconnect = false;
+                            delayedStop ( "Disconnected!" );
+                        }
+                        break;
+                    }
+
+                    // Only send retry menu index once
+                    if ( msgMenuIndex && !localRetryMenuIndexSent )
+                    {
+                        localRetryMenuIndexSent = true;
+                        dataSocket->send ( msgMenuIndex );
+                    }
+                    break;
+                }
+
+                dataSocket->send ( netMan.getInputs ( getLocalPlayer() ) );
+            }
+            else if ( clientMode.isLocal() )
+            {
+                netMan.setInput ( getRemotePlayer(), localInputs[1] );
+            }
+
+            if ( shouldSyncRngState && ( clientMode.isHost() || clientMode.isBroadcast() ) )
+            {
+                shouldSyncRngState = false;
+
+                MsgPtr msgRngState = getGameRngState ( netMan.getIndex() );
+
+                ASSERT ( msgRngState.get() != 0 );
+
+                netMan.setRngState ( msgRngState->getAs<RngState>() );
+
+                if ( clientMode.isHost() )
+                    dataSocket->send ( msgRngState );
+            }
+            break;
+        }
+
+        default:
+            ASSERT ( !"Unknown NetplayState!" );
+            break;
+    }
+
+    // A rollback was started while updating the inputs
+    if ( fastFwdStopFrame.value )
+        return;
+
+    // Clear the last changed frame before we get new inputs
+    if ( rollbackTimer == minRollbackSpacing )
+        netMan.clearLastChangedFrame();
+
+    if ( ! waitForInputs() )
+        return;
+
+    frameStepReady();
+}
+
+bool DllFrameStepper::isReady() const
+{
+    // Don't need to wait for anything in local modes
+    if ( getClientMode().isLocal() || lazyDisconnect )
+        return true;
+
+    return ( netMan.isRemoteInputReady() && netMan.isRngStateReady ( shouldSyncRngState ) );
+}
+
+bool DllFrameStepper::frameStepReady()
+{
+    if ( rollbackTimer < minRollbackSpacing )
+    {
+        --rollbackTimer;
+
+        if ( rollbackTimer < 0 )
+            rollbackTimer = minRollbackSpacing;
+    }
+
+    // Only rollback when necessary
+    if ( netMan.isInRollback()
+            && rollbackTimer == minRollbackSpacing
+            && netMan.getLastChangedFrame().value < netMan.getIndexedFrame().value )
+    {
+        if ( loadRollback ( netMan.getLastChangedFrame() ) )
+        {
+            netMan.clearLastChangedFrame();
+            --rollbackTimer;
+            return false;
+        }
+    }
+
+    // Update the RngState if necessary
+    if ( shouldSyncRngState )
+    {
+        shouldSyncRngState = false;
+
+        MsgPtr msgRngState = netMan.getRngState();
+
+        if ( msgRngState )
+            setGameRngState ( msgRngState->getAs<RngState>() );
+    }
+
+    updateDelayRollback();
+
+    if ( ! debugRollback() )
+        return false;
+
+    if ( checkSync )
+    {
+        // Check for desyncs by periodically sending hashes
+        if ( ( ( netMan.getFrame() % ( 5 * 60 ) == 0 ) || ( netMan.getFrame() % 150 == 149 ) )
+                && netMan.getState().value >= NetplayState::CharaSelect && netMan.getState() != NetplayState::Loading
+                && netMan.getState() != NetplayState::Skippable && netMan.getState() != NetplayState::RetryMenu
+                && ( !netMan.isInRollback()
+                     || ( netMan.getFrame() == 0 )
+                     || ( randomInputs && netMan.getFrame() % 150 == 149 ) ) )
+        {
+            if ( ! sendSyncHash ( MsgPtr ( new SyncHash ( netMan.getIndexedFrame() ) ) ) )
+                return false;
+        }
+
+        // Compare current lists of sync hashes
+        while ( !localSync.empty() && !remoteSync.empty() )
+        {
+
+#define L localSync.front()->getAs<SyncHash>()
+#define R remoteSync.front()->getAs<SyncHash>()
+
+            while ( !remoteSync.empty() && L.indexedFrame.value > R.indexedFrame.value )
+                remoteSync.pop_front();
+
+            if ( remoteSync.empty() )
+                break;
+
+            while ( !localSync.empty() && R.indexedFrame.value > L.indexedFrame.value )
+                localSync.pop_front();
+
+            if ( localSync.empty() )
+                break;
+
+            if ( L == R )
+            {
+                ++syncChecks;
+                localSync.pop_front();
+                remoteSync.pop_front();
+                continue;
+            }
+
+            desynced ( "Desync!", format ( "< %s\n> %s", L.dump(), R.dump() ) );
+
+#undef L
+#undef R
+
+            return false;
+        }
+    }
+
+    // Cleared last played and muted sound effects
+    memset ( AsmHacks::sfxFilterArray, 0, CC_SFX_ARRAY_LEN );
+    memset ( AsmHacks::sfxMuteArray, 0, CC_SFX_ARRAY_LEN );
+    return true;
+}
+
+bool DllFrameStepper::sendSyncHash ( const MsgPtr& msgSyncHash )
+{
+    Socket *dataSocket = getDataSocket();
+
+    if ( dataSocket && dataSocket->isConnected() )
+    {
+        dataSocket->send ( msgSyncHash );
+        localSync.push_back ( msgSyncHash );
+    }
+
+    return true;
+}
+
+void DllFrameStepper::updateDelayRollback()
+{
+    // Automatically change the delay, each side has its own delay.
+    // The rollback is not changed, both sides must use the same rollback since the round over timer depends on it.
+    if ( autoDelay && getClientMode().isNetplay() && netMan.isInGame()
+            && !shouldChangeDelayRollback && netMan.getFrame() % AUTO_DELAY_INTERVAL == 0 )
+    {
+        netMan.delayRecommender.settings.minRollback = netMan.getRollback();
+        netMan.delayRecommender.settings.maxRollback = netMan.getRollback();
+
+        DelayRecommender::Result result;
+
+        if ( netMan.delayRecommender.shouldChange ( netMan.getDelay(), netMan.getRollback(), result ) )
+        {
+            LOG ( "Recommended: %s", result.str() );
+
+            shouldChangeDelayRollback = true;
+
+            changeConfig.value = ChangeConfig::Delay;
+            changeConfig.indexedFrame = netMan.getIndexedFrame();
+            changeConfig.delay = result.delay;
+            changeConfig.rollback = result.rollback;
+            changeConfig.invalidate();
+
+            // The live samples depend on the delay, so start over
+            netMan.delayRecommender.resetLive();
+        }
+    }
+
+    // Update delay and/or rollback if necessary
+    if ( ! shouldChangeDelayRollback )
+        return;
+
+    shouldChangeDelayRollback = false;
+
+    if ( changeConfig.delay < 0xFF && changeConfig.delay != netMan.getDelay() )
+    {
+        LOG ( "Input delay was changed %u -> %u", netMan.getDelay(), changeConfig.delay );
+        netMan.setDelay ( changeConfig.delay );
+        delayRollbackChanged ( format ( "Input delay was changed to %u", changeConfig.delay ) );
+    }
+
+    if ( changeConfig.rollback <= MAX_ROLLBACK && changeConfig.rollback != netMan.getRollback() )
+    {
+        LOG ( "Rollback was changed %u -> %u", netMan.getRollback(), changeConfig.rollback );
+        netMan.setRollback ( changeConfig.rollback );
+        minRollbackSpacing = clamped<uint8_t> ( netMan.getRollback(), 2, 4 );
+        delayRollbackChanged ( format ( "Rollback was changed to %u", changeConfig.rollback ) );
+    }
+}
+
+bool DllFrameStepper::loadRollback ( IndexedFrame target )
+{
+    // Indicate we're re-running to the current frame
+    fastFwdStopFrame = netMan.getIndexedFrame();
+
+    // Reset the game state (this resets game state AND netMan state)
+    if ( rollMan.loadState ( target, netMan ) )
+    {
+        // Start fast-forwarding now
+        *CC_SKIP_FRAMES_ADDR = 1;
+        return true;
+    }
+
+    fastFwdStopFrame.value = 0;
+    return false;
+}
+
+void DllFrameStepper::frameStepRerun()
+{
+    // Here we don't save any game states while re-running because the inputs are faked
+
+    // Save sound state during rollback re-run
+    rollMan.saveRerunSounds ( netMan.getFrame() );
+
+    if ( netMan.getIndexedFrame().value >= fastFwdStopFrame.value )
+    {
+        // Stop fast-forwarding once we're reached the frame we want
+        fastFwdStopFrame.value = 0;
+
+        // Re-enable regular rendering once done
+        *CC_SKIP_FRAMES_ADDR = 0;
+
+        // Finalize rollback sound effects
+        rollMan.finishedRerunSounds();
+    }
+    else
+    {
+        // Skip rendering while fast-forwarding
+        *CC_SKIP_FRAMES_ADDR = 1;
+    }
+}
+
+void DllFrameStepper::frameStepDone()
+{
+    // Update spectators
+    frameStepSpectators();
+
+    // Write game inputs
+    writeGameInput ( getLocalPlayer(), netMan.getInput ( getLocalPlayer() ) );
+    writeGameInput ( getRemotePlayer(), netMan.getInput ( getRemotePlayer() ) );
+}
+
+void DllFrameStepper::randomizeLocalInputs()
+{
+    bool shouldRandomize = ( getRandom() % 2 );
+    if ( netMan.isInRollback() )
+        shouldRandomize &= ( netMan.getFrame() % 150 < 120 );
+
+    if ( ! shouldRandomize )
+        return;
+
+    uint16_t direction = ( getRandom() % 10 );
+
+    // Reduce the chances of moving the cursor at retry menu
+    if ( netMan.getState() == NetplayState::RetryMenu && ( getRandom() % 2 ) )
+        direction = 0;
+
+    uint16_t buttons = ( getRandom() % 0x1000 );
+
+    // Reduce the chances of hitting the D button
+    if ( getRandom() % 100 < 98 )
+        buttons &= ~ CC_BUTTON_D;
+
+    // Prevent hitting some non-essential buttons
+    buttons &= ~ ( CC_BUTTON_FN1 | CC_BUTTON_FN2 | CC_BUTTON_START );
+
+    // Prevent going back at character select
+    if ( netMan.getState() == NetplayState::CharaSelect )
+        buttons &= ~ ( CC_BUTTON_B | CC_BUTTON_CANCEL );
+
+    localInputs [ getClientMode().isLocal() ? 1 : 0 ] = COMBINE_INPUT ( direction, buttons );
+}
+
+void DllFrameStepper::netplayStateChanged ( NetplayState state )
+{
+    // Catch invalid transitions
+    if ( ! netMan.isValidNext ( state ) )
+    {
+        desynced ( ERROR_INTERNAL, format ( "Invalid transition: %s -> %s", netMan.getState(), state ) );
+        return;
+    }
+
+    netplayStateChanging ( state );
+
+    // Leaving Skippable
+    if ( netMan.getState() == NetplayState::Skippable )
+    {
+        // Reset state variables
+        roundOverTimer = -1;
+        lazyDisconnect = false;
+    }
+
+    // Leaving Loading
+    if ( netMan.getState() == NetplayState::Loading )
+    {
+        // Reset color loading state
+        AsmHacks::numLoadedColors = 0;
+    }
+
+    // Entering InGame
+    if ( state == NetplayState::InGame )
+    {
+        if ( netMan.getRollback() )
+            allocateRollbackStates();
+    }
+
+    // Leaving InGame
+    if ( netMan.getState() == NetplayState::InGame )
+    {
+        if ( netMan.getRollback() )
+            rollMan.deallocateStates();
+    }
+
+    // Entering CharaSelect OR entering InGame
+    if ( !getClientMode().isOffline() && ( state == NetplayState::CharaSelect || state == NetplayState::InGame ) )
+    {
+        // Indicate we should sync the RngState now
+        shouldSyncRngState = true;
+    }
+
+    Socket *dataSocket = getDataSocket();
+
+    // Entering RetryMenu
+    if ( state == NetplayState::RetryMenu )
+    {
+        // Lazy disconnect now during netplay
+        lazyDisconnect = getClientMode().isNetplay();
+
+        // Reset retry menu index flag
+        localRetryMenuIndexSent = false;
+    }
+    else if ( lazyDisconnect )
+    {
+        lazyDisconnect = false;
+
+        // If not entering RetryMenu and we're already disconnected...
+        if ( !dataSocket || !dataSocket->isConnected() )
+        {
+            delayedStop ( "Disconnected!" );
+            return;
+        }
+    }
+
+    // Update local state
+    netMan.setState ( state );
+
+    // Update remote index
+    if ( dataSocket && dataSocket->isConnected() )
+        dataSocket->send ( new TransitionIndex ( netMan.getIndex() ) );
+}
+
+void DllFrameStepper::gameModeChanged ( uint32_t previous, uint32_t current )
+{
+    if ( current == 0
+            || current == CC_GAME_MODE_STARTUP
+            || current == CC_GAME_MODE_OPENING
+            || current == CC_GAME_MODE_TITLE
+            || current == CC_GAME_MODE_MAIN
+            || current == CC_GAME_MODE_LOADING_DEMO
+            || ( previous == CC_GAME_MODE_LOADING_DEMO && current == CC_GAME_MODE_IN_GAME )
+            || current == CC_GAME_MODE_HIGH_SCORES )
+    {
+        ASSERT ( netMan.getState() == NetplayState::PreInitial || netMan.getState() == NetplayState::Initial );
+        return;
+    }
+
+    if ( netMan.getState() == NetplayState::Initial
+            && shouldAutoCharaSelect()
+            && netMan.initial.netplayState > NetplayState::CharaSelect )
+    {
+        // Spectate mode needs to auto select characters if starting after CharaSelect
+        netplayStateChanged ( NetplayState::AutoCharaSelect );
+        return;
+    }
+
+    if ( current == CC_GAME_MODE_CHARA_SELECT )
+    {
+        netplayStateChanged ( NetplayState::CharaSelect );
+        return;
+    }
+
+    if ( current == CC_GAME_MODE_LOADING )
+    {
+        netplayStateChanged ( NetplayState::Loading );
+        return;
+    }
+
+    if ( current == CC_GAME_MODE_IN_GAME )
+    {
+        // Versus mode in-game starts with character intros, which is a skippable state
+        if ( netMan.config.mode.isVersus() )
+            netplayStateChanged ( NetplayState::Skippable );
+        else
+            netplayStateChanged ( NetplayState::InGame );
+        return;
+    }
+
+    if ( current == CC_GAME_MODE_RETRY )
+    {
+        netplayStateChanged ( NetplayState::RetryMenu );
+        return;
+    }
+
+    THROW_EXCEPTION ( "gameModeChanged(%u, %u)", ERROR_INVALID_GAME_MODE, previous, current );
+}
+
+void DllFrameStepper::checkRoundOver()
+{
+    const bool isOver = ( ( *CC_P1_NO_INPUT_FLAG_ADDR ) && ( *CC_P2_NO_INPUT_FLAG_ADDR ) );
+
+    if ( netMan.getRollback() )
+    {
+        if ( isOver )
+        {
+            if ( roundOverTimer == 0 )
+            {
+                roundOverTimer = -1;
+                netplayStateChanged ( NetplayState::Skippable );
+            }
+            else if ( roundOverTimer < 0 )
+            {
+                roundOverTimer = netMan.getRollback() + ROLLBACK_ROUND_OVER_DELAY;
+            }
+        }
+        else
+        {
+            roundOverTimer = -1;
+        }
+    }
+    else if ( isOver )
+    {
+        netplayStateChanged ( NetplayState::Skippable );
+    }
+}
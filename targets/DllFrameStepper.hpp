@@ -0,0 +1,169 @@
+#pragma once
+
+#include "DllNetplayManager.hpp"
+#include "DllRollbackManager.hpp"
+#include "SpectatorManager.hpp"
+#include "Socket.hpp"
+
+#include <list>
+#include <array>
+#include <string>
+#include <cstdlib>
+
+
+// The number of milliseconds before resending inputs while waiting for more inputs
+#define RESEND_INPUTS_INTERVAL      ( 100 )
+
+// The maximum number of milliseconds to wait for inputs before timeout
+#define MAX_WAIT_INPUTS_INTERVAL    ( 10000 )
+
+
+// The netplay logic of each game frame, shared by DllMain and the simulator.
+// Reading local inputs, waiting for remote inputs, and accessing the game are left to the implementation.
+class DllFrameStepper : public SpectatorManager
+{
+public:
+
+    // NetplayManager instance
+    NetplayManager netMan;
+
+    // DllRollbackManager instance
+    DllRollbackManager rollMan;
+
+    // Indicates if we should sync the game RngState on this frame
+    bool shouldSyncRngState = false;
+
+    // Frame to stop on, when fast-forwarding the game.
+    // Used as a flag to indicate fast-forward mode, 0:0 means not fast-forwarding.
+    IndexedFrame fastFwdStopFrame = {{ 0, 0 }};
+
+    // Local player inputs
+    std::array<uint16_t, 2> localInputs = {{ 0, 0 }};
+
+    // If we have sent our local retry menu index
+    bool localRetryMenuIndexSent = false;
+
+    // If we should disconnect at the next NetplayState change
+    bool lazyDisconnect = false;
+
+    // Timer to delay checking round over state during rollback
+    int roundOverTimer = -1;
+
+    // We should only rollback if this timer is full
+    int rollbackTimer = 0;
+
+    // The minimum number of frames that must run normally, before we're allowed to do another rollback
+    uint8_t minRollbackSpacing = 2;
+
+    // If we should periodically send and compare SyncHashes to check for desyncs
+    bool checkSync = false;
+
+    // Local and remote SyncHashes, and the number of matching SyncHashes
+    std::list<MsgPtr> localSync, remoteSync;
+    uint64_t syncChecks = 0;
+
+    // If the local inputs are randomized for testing
+    bool randomInputs = false;
+
+    // If the delay/rollback should be changed automatically during netplay
+    bool autoDelay = false;
+
+    // If the delay and/or rollback should be changed
+    bool shouldChangeDelayRollback = false;
+
+    // Latest ChangeConfig for changing delay/rollback
+    ChangeConfig changeConfig;
+
+
+    DllFrameStepper ( const ProcessManager *procManPtr = 0 ) : SpectatorManager ( &netMan, procManPtr ) {}
+
+    virtual ~DllFrameStepper() {}
+
+    // Step a new game frame
+    void frameStep();
+
+    // Transition to a new NetplayState
+    void netplayStateChanged ( NetplayState state );
+
+    // Update the NetplayState for a change of CC_GAME_MODE_ADDR
+    void gameModeChanged ( uint32_t previous, uint32_t current );
+
+    // Check if we are ready to continue running, ie not waiting on remote input or RngState
+    bool isReady() const;
+
+    // Randomize the local inputs for testing
+    void randomizeLocalInputs();
+
+    // To be implemented
+    virtual const ClientMode& getClientMode() const = 0;
+    virtual Socket *getDataSocket() const = 0;
+    virtual uint8_t getLocalPlayer() const = 0;
+    virtual uint8_t getRemotePlayer() const = 0;
+
+protected:
+
+    // Frame step while not re-running
+    virtual void frameStepNormal();
+
+    // Frame step while re-running after a rollback
+    virtual void frameStepRerun();
+
+    // The rest of the normal frame step once isReady, returns false if it was cut short by a rollback or stop
+    virtual bool frameStepReady();
+
+    // The end of the frame step, this always runs after frameStepNormal or frameStepRerun
+    virtual void frameStepDone();
+
+    // Start re-running from the given frame, returns false if there is no saved state for it
+    virtual bool loadRollback ( IndexedFrame target );
+
+    // Save the current game state for rollback
+    virtual void saveRollbackState() { rollMan.saveState ( netMan ); }
+
+    // Allocate memory for saving game states
+    virtual void allocateRollbackStates() { rollMan.allocateStates(); }
+
+    // Send a SyncHash of the current frame to the remote.
+    // Overrides that check the hash themselves return false after reporting a desync, the default always returns true.
+    virtual bool sendSyncHash ( const MsgPtr& msgSyncHash );
+
+    // Called after validating a NetplayState transition, before the state is updated
+    virtual void netplayStateChanging ( NetplayState state ) {}
+
+    // If characters should be selected automatically when starting after CharaSelect
+    virtual bool shouldAutoCharaSelect() const { return netMan.config.mode.isSpectate(); }
+
+    // Called after the delay and/or rollback was changed to changeConfig
+    virtual void delayRollbackChanged ( const std::string& message ) {}
+
+    // Start a rollback for testing once isReady, returns false if one was started
+    virtual bool debugRollback() { return true; }
+
+    // Random number used by randomizeLocalInputs
+    virtual uint32_t getRandom() { return rand(); }
+
+    // To be implemented
+
+    // Check for changes to the game variables that cause NetplayState transitions
+    virtual void checkChanges() = 0;
+
+    // Update the local inputs for this frame, returns false if they should not be used
+    virtual bool updateLocalInputs() = 0;
+
+    // Wait until isReady, returns false if frameStepReady should be skipped, ie when stopping
+    virtual bool waitForInputs() = 0;
+
+    virtual MsgPtr getGameRngState ( uint32_t index ) const = 0;
+    virtual void setGameRngState ( const RngState& rngState ) = 0;
+    virtual void writeGameInput ( uint8_t player, uint16_t input ) = 0;
+
+    virtual void delayedStop ( const std::string& error ) = 0;
+    virtual void desynced ( const std::string& error, const std::string& details ) = 0;
+
+private:
+
+    void checkRoundOver();
+
+    // Automatically or manually change the delay/rollback
+    void updateDelayRollback();
+};
@@ -16,6 +16,7 @@
 #include "DllFrameRate.hpp"
 #include "ReplayManager.hpp"
 #include "DllRollbackManager.hpp"
+#include "DllFrameStepper.hpp"
 
 #include <windows.h>
 
@@ -32,31 +33,17 @@ using namespace std;
 // The number of milliseconds to poll for events each frame
 #define POLL_TIMEOUT                ( 3 )
 
-// The extra number of frames to delay checking round over state during rollback
-#define ROLLBACK_ROUND_OVER_DELAY   ( 5 )
-
 // The number of milliseconds to wait for the initial connect
 #define INITIAL_CONNECT_TIMEOUT     ( 60000 )
 
 // The number of milliseconds to wait to perform a delayed stop so that ErrorMessages are received before sockets die
 #define DELAYED_STOP                ( 100 )
 
-// The number of milliseconds before resending inputs while waiting for more inputs
-#define RESEND_INPUTS_INTERVAL      ( 100 )
-
-// The maximum number of milliseconds to wait for inputs before timeout
-#define MAX_WAIT_INPUTS_INTERVAL    ( 10000 )
-
-// The maximum number of spectators allowed for ClientMode::Spectate
-#define MAX_SPECTATORS              ( 15 )
-
-// The maximum number of spectators allowed for ClientMode::Host/Client
-#define MAX_ROOT_SPECTATORS         ( 1 )
+// The number of frames between each RelayStatus report to the client we are spectating
+#define RELAY_STATUS_INTERVAL       ( 60 )
 
-// Indicates if this client should redirect spectators
-#define SHOULD_REDIRECT_SPECTATORS  ( clientMode.isSpectate()                                                       \
-                                      ? numSpectators() >= MAX_SPECTATORS                                           \
-                                      : numSpectators() >= MAX_ROOT_SPECTATORS )
+// The number of frames between each log of the time sync metrics
+#define TIME_SYNC_LOG_INTERVAL      ( 600 )
 
 
 #define LOG_SYNC(FORMAT, ...)                                                                                       \
@@ -96,15 +83,9 @@ struct DllMain
         : public Main
         , public RefChangeMonitor<Variable, uint32_t>::Owner
         , public PtrToRefChangeMonitor<Variable, uint32_t>::Owner
-        , public SpectatorManager
+        , public DllFrameStepper
         , public DllControllerManager
 {
-    // NetplayManager instance
-    NetplayManager netMan;
-
-    // DllRollbackManager instance
-    DllRollbackManager rollMan;
-
     // If remote has loaded up to character select
     bool remoteCharaSelectLoaded = false;
 
@@ -117,55 +98,23 @@ struct DllMain
     // Timer for waiting for inputs
     int waitInputsTimer = -1;
 
-    // Indicates if we should sync the game RngState on this frame
-    bool shouldSyncRngState = false;
-
-    // Frame to stop on, when fast-forwarding the game.
-    // Used as a flag to indicate fast-forward mode, 0:0 means not fast-forwarding.
-    IndexedFrame fastFwdStopFrame = {{ 0, 0 }};
-
     // Initial connect timer
     TimerPtr initialTimer;
 
-    // Local player inputs
-    array<uint16_t, 2> localInputs = {{ 0, 0 }};
-
-    // If we have sent our local retry menu index
-    bool localRetryMenuIndexSent = false;
-
-    // If we should disconnect at the next NetplayState change
-    bool lazyDisconnect = false;
-
-    // If the delay and/or rollback should be changed
-    bool shouldChangeDelayRollback = false;
-
-    // Latest ChangeConfig for changing delay/rollback
-    ChangeConfig changeConfig;
-
     // Client serverCtrlSocket address
     IpAddrPort clientServerAddr;
 
     // Sockets that have been redirected to another client
     unordered_set<Socket *> redirectedSockets;
 
-    // Timer to delay checking round over state during rollback
-    int roundOverTimer = -1;
-
-    // We should only rollback if this timer is full
-    int rollbackTimer = 0;
-
     // If we should fast-forward when spectating
     bool spectateFastFwd = true;
 
-    // The minimum number of frames that must run normally, before we're allowed to do another rollback
-    uint8_t minRollbackSpacing = 2;
+    // Binary replay of this session, recorded alongside the sync log
+    ReplayWriter replayWriter;
 
 #ifndef RELEASE
-    // Local and remote SyncHashes
-    list<MsgPtr> localSync, remoteSync;
-
     // Debug testing flags
-    bool randomInputs = false;
     bool randomDelay = false;
     bool randomRollback = false;
     uint32_t rollUpTo = 10;
@@ -179,590 +128,211 @@ struct DllMain
     string replayCheckRngHexStr;
 #endif // NOT RELEASE
 
-    void frameStepNormal()
+    // Update the local inputs from the controllers, or replay the inputs
+    bool updateLocalInputs() override
     {
-        switch ( netMan.getState().value )
+        // Fast-forward if spectator
+        if ( spectateFastFwd && clientMode.isSpectate() && netMan.getState() != NetplayState::Loading )
         {
-            case NetplayState::PreInitial:
-            case NetplayState::Initial:
-            case NetplayState::AutoCharaSelect:
-                // Skip rendering while loading character select
-                *CC_SKIP_FRAMES_ADDR = 1;
-                break;
-
-            case NetplayState::InGame:
-                if ( netMan.getRollback() )
-                {
-                    // Only save rollback states in-game
-                    rollMan.saveState ( netMan );
+            static bool doneSkipping = true;
 
-                    // Delayed round over check
-                    if ( roundOverTimer > 0 )
-                        --roundOverTimer;
-                }
+            const IndexedFrame remoteIndexedFrame = netMan.getRemoteIndexedFrame();
 
-            case NetplayState::CharaSelect:
-            case NetplayState::Loading:
-            case NetplayState::Skippable:
-            case NetplayState::RetryMenu:
+            // Fast-forward implemented by skipping the rendering every other frame
+            if ( doneSkipping && remoteIndexedFrame.value > netMan.getIndexedFrame().value + 2 * NUM_INPUTS )
             {
-                // Fast-forward if spectator
-                if ( spectateFastFwd && clientMode.isSpectate() && netMan.getState() != NetplayState::Loading )
-                {
-                    static bool doneSkipping = true;
-
-                    const IndexedFrame remoteIndexedFrame = netMan.getRemoteIndexedFrame();
-
-                    // Fast-forward implemented by skipping the rendering every other frame
-                    if ( doneSkipping && remoteIndexedFrame.value > netMan.getIndexedFrame().value + 2 * NUM_INPUTS )
-                    {
-                        *CC_SKIP_FRAMES_ADDR = 1;
-                        doneSkipping = false;
-                    }
-                    else if ( !doneSkipping && *CC_SKIP_FRAMES_ADDR == 0 )
-                    {
-                        doneSkipping = true;
-                    }
-                }
+                *CC_SKIP_FRAMES_ADDR = 1;
+                doneSkipping = false;
+            }
+            else if ( !doneSkipping && *CC_SKIP_FRAMES_ADDR == 0 )
+            {
+                doneSkipping = true;
+            }
+        }
 
-                // Update controller state once per frame
-                KeyboardState::update();
-                updateControls ( &localInputs[0] );
+        // Update controller state once per frame
+        KeyboardState::update();
+        updateControls ( &localInputs[0] );
 
-                if ( DllOverlayUi::isEnabled() )                                            // Overlay UI controls
-                {
-                    localInputs[0] = localInputs[1] = 0;
-                }
-                else if ( clientMode.isNetplay() || clientMode.isLocal() )                  // Netplay + local controls
+        if ( DllOverlayUi::isEnabled() )                                            // Overlay UI controls
+        {
+            localInputs[0] = localInputs[1] = 0;
+        }
+        else if ( clientMode.isNetplay() || clientMode.isLocal() )                  // Netplay + local controls
+        {
+            if ( KeyboardState::isDown ( VK_CONTROL ) )
+            {
+                for ( uint8_t delay = 0; delay < 10; ++delay )
                 {
-                    if ( KeyboardState::isDown ( VK_CONTROL ) )
-                    {
-                        for ( uint8_t delay = 0; delay < 10; ++delay )
-                        {
-                            if ( delay == netMan.getDelay() )
-                                continue;
-
-                            if ( KeyboardState::isPressed ( '0' + delay )                   // Ctrl + Number
-                                    || KeyboardState::isPressed ( VK_NUMPAD0 + delay ) )    // Ctrl + Numpad Number
-                            {
-                                shouldChangeDelayRollback = true;
-
-                                changeConfig.value = ChangeConfig::Delay;
-                                changeConfig.indexedFrame = netMan.getIndexedFrame();
-                                changeConfig.delay = delay;
-                                changeConfig.rollback = netMan.getRollback();
-                                changeConfig.invalidate();
-                                break;
-                            }
-                        }
-                    }
+                    if ( delay == netMan.getDelay() )
+                        continue;
 
-                    if ( KeyboardState::isDown ( VK_MENU ) && netMan.getRollback() )        // Only if already rollback
-                    {
-                        for ( uint8_t rollback = 1; rollback < 10; ++rollback )             // Don't allow 0 rollback
-                        {
-                            if ( rollback == netMan.getRollback() )
-                                continue;
-
-                            if ( KeyboardState::isPressed ( '0' + rollback )                // Alt + Number
-                                    || KeyboardState::isPressed ( VK_NUMPAD0 + rollback ) ) // Alt + Numpad Number
-                            {
-                                shouldChangeDelayRollback = true;
-
-                                changeConfig.value = ChangeConfig::Rollback;
-                                changeConfig.indexedFrame = netMan.getIndexedFrame();
-                                changeConfig.delay = netMan.getDelay();
-                                changeConfig.rollback = rollback;
-                                changeConfig.invalidate();
-                                break;
-                            }
-                        }
-                    }
-
-#ifndef RELEASE
-                    // Test random delay setting
-                    if ( KeyboardState::isPressed ( VK_F11 ) )
-                    {
-                        randomDelay = !randomDelay;
-                        DllOverlayUi::showMessage ( randomDelay ? "Enabled random delay" : "Disabled random delay" );
-                    }
-
-                    if ( randomDelay && rand() % 30 == 0 )
+                    if ( KeyboardState::isPressed ( '0' + delay )                   // Ctrl + Number
+                            || KeyboardState::isPressed ( VK_NUMPAD0 + delay ) )    // Ctrl + Numpad Number
                     {
                         shouldChangeDelayRollback = true;
+
+                        changeConfig.value = ChangeConfig::Delay;
                         changeConfig.indexedFrame = netMan.getIndexedFrame();
-                        changeConfig.delay = rand() % 10;
+                        changeConfig.delay = delay;
+                        changeConfig.rollback = netMan.getRollback();
                         changeConfig.invalidate();
-                    }
-#endif // NOT RELEASE
-                }
-                else if ( clientMode.isSpectate() )                                         // Spectator controls
-                {
-                    if ( KeyboardState::isPressed ( VK_SPACE ) )
-                        spectateFastFwd = !spectateFastFwd;
-                }
-                else
-                {
-                    LOG ( "Unknown clientMode=%s; flags={ %s }", clientMode, clientMode.flagString() );
-                    break;
-                }
-
-#ifndef RELEASE
-                DllOverlayUi::debugText = format ( "%+d [%s]", netMan.getRemoteFrameDelta(), netMan.getIndexedFrame() );
-                DllOverlayUi::debugTextAlign = 1;
-
-                // Replay inputs and rollback
-                if ( replayInputs )
-                {
-                    if ( repMan.getGameMode ( netMan.getIndexedFrame() ) )
-                        ASSERT ( repMan.getGameMode ( netMan.getIndexedFrame() ) == *CC_GAME_MODE_ADDR );
-
-                    if ( ! repMan.getStateStr ( netMan.getIndexedFrame() ).empty() )
-                        ASSERT ( repMan.getStateStr ( netMan.getIndexedFrame() ) == netMan.getState().str() );
-
-                    // Inputs
-                    const auto& inputs = repMan.getInputs ( netMan.getIndexedFrame() );
-                    netMan.setInput ( 1, inputs.p1 );
-                    netMan.setInput ( 2, inputs.p2 );
-
-                    const IndexedFrame target = repMan.getRollbackTarget ( netMan.getIndexedFrame() );
-
-                    // Rollback
-                    if ( netMan.isInRollback() && target.value < netMan.getIndexedFrame().value )
-                    {
-                        // Reinputs
-                        const auto& reinputs = repMan.getReinputs ( netMan.getIndexedFrame() );
-                        for ( const auto& inputs : reinputs )
-                        {
-                            netMan.assignInput ( 1, inputs.p1, inputs.indexedFrame );
-                            netMan.assignInput ( 2, inputs.p2, inputs.indexedFrame );
-                        }
-
-                        const string before = format ( "%s [%u] %s [%s]",
-                                                       gameModeStr ( *CC_GAME_MODE_ADDR ), *CC_GAME_MODE_ADDR,
-                                                       netMan.getState(), netMan.getIndexedFrame() );
-
-                        // Indicate we're re-running to the current frame
-                        fastFwdStopFrame = netMan.getIndexedFrame();
-
-                        // Reset the game state (this resets game state AND netMan state)
-                        if ( rollMan.loadState ( target, netMan ) )
-                        {
-                            // Start fast-forwarding now
-                            *CC_SKIP_FRAMES_ADDR = 1;
-
-                            LOG_TO ( syncLog, "%s Rollback: target=[%s]; actual=[%s]",
-                                     before, target, netMan.getIndexedFrame() );
-
-                            LOG_SYNC ( "Reinputs: 0x%04x 0x%04x", netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
-                            return;
-                        }
-
-                        LOG_TO ( syncLog, "%s Rollback to target=[%s] failed!", before, target );
-
-                        ASSERT_IMPOSSIBLE;
-                    }
-
-                    // RngState
-                    if ( netMan.getFrame() == 0 && ( netMan.getState() == NetplayState::CharaSelect
-                                                     || netMan.getState() == NetplayState::InGame ) )
-                    {
-                        MsgPtr msgRngState = repMan.getRngState ( netMan.getIndexedFrame() );
-
-                        if ( msgRngState )
-                            procMan.setRngState ( msgRngState->getAs<RngState>() );
-                    }
-
-                    break;
-                }
-
-                // Test random input
-                if ( KeyboardState::isPressed ( VK_F12 ) )
-                {
-                    randomInputs = !randomInputs;
-                    localInputs [ clientMode.isLocal() ? 1 : 0 ] = 0;
-                    DllOverlayUi::showMessage ( randomInputs ? "Enabled random inputs" : "Disabled random inputs" );
-                }
-
-                if ( randomInputs )
-                {
-                    bool shouldRandomize = ( rand() % 2 );
-                    if ( netMan.isInRollback() )
-                        shouldRandomize &= ( netMan.getFrame() % 150 < 120 );
-
-                    if ( shouldRandomize )
-                    {
-                        uint16_t direction = ( rand() % 10 );
-
-                        // Reduce the chances of moving the cursor at retry menu
-                        if ( netMan.getState() == NetplayState::RetryMenu && ( rand() % 2 ) )
-                            direction = 0;
-
-                        uint16_t buttons = ( rand() % 0x1000 );
-
-                        // Reduce the chances of hitting the D button
-                        if ( rand() % 100 < 98 )
-                            buttons &= ~ CC_BUTTON_D;
-
-                        // Prevent hitting some non-essential buttons
-                        buttons &= ~ ( CC_BUTTON_FN1 | CC_BUTTON_FN2 | CC_BUTTON_START );
-
-                        // Prevent going back at character select
-                        if ( netMan.getState() == NetplayState::CharaSelect )
-                            buttons &= ~ ( CC_BUTTON_B | CC_BUTTON_CANCEL );
-
-                        localInputs [ clientMode.isLocal() ? 1 : 0 ] = COMBINE_INPUT ( direction, buttons );
+                        break;
                     }
                 }
-#endif // NOT RELEASE
+            }
 
-                // Assign local player input
-                if ( ! clientMode.isSpectate() )
+            if ( KeyboardState::isDown ( VK_MENU ) && netMan.getRollback() )        // Only if already rollback
+            {
+                for ( uint8_t rollback = 1; rollback < 10; ++rollback )             // Don't allow 0 rollback
                 {
-#ifndef RELEASE
-                    if ( netMan.isInRollback() )
-                        netMan.assignInput ( localPlayer, localInputs[0], netMan.getFrame() + netMan.getDelay() );
-                    else
-#endif // NOT RELEASE
-                        netMan.setInput ( localPlayer, localInputs[0] );
-                }
+                    if ( rollback == netMan.getRollback() )
+                        continue;
 
-                if ( clientMode.isNetplay() )
-                {
-                    // Special netplay retry menu behaviour, only select final option after both sides have selected
-                    if ( netMan.getState() == NetplayState::RetryMenu )
+                    if ( KeyboardState::isPressed ( '0' + rollback )                // Alt + Number
+                            || KeyboardState::isPressed ( VK_NUMPAD0 + rollback ) ) // Alt + Numpad Number
                     {
-                        MsgPtr msgMenuIndex = netMan.getLocalRetryMenuIndex();
-
-                        // Lazy disconnect now once the retry menu option has been selected
-                        if ( msgMenuIndex && ( !dataSocket || !dataSocket->isConnected() ) )
-                        {
-                            if ( lazyDisconnect )
-                            {
-                                lazyDisconnect = false;
-                                delayedStop ( "Disconnected!" );
-                            }
-                            break;
-                        }
+                        shouldChangeDelayRollback = true;
 
-                        // Only send retry menu index once
-                        if ( msgMenuIndex && !localRetryMenuIndexSent )
-                        {
-                            localRetryMenuIndexSent = true;
-                            dataSocket->send ( msgMenuIndex );
-                        }
+                        changeConfig.value = ChangeConfig::Rollback;
+                        changeConfig.indexedFrame = netMan.getIndexedFrame();
+                        changeConfig.delay = netMan.getDelay();
+                        changeConfig.rollback = rollback;
+                        changeConfig.invalidate();
                         break;
                     }
-
-                    dataSocket->send ( netMan.getInputs ( localPlayer ) );
-                }
-                else if ( clientMode.isLocal() )
-                {
-                    netMan.setInput ( remotePlayer, localInputs[1] );
-                }
-
-                if ( shouldSyncRngState && ( clientMode.isHost() || clientMode.isBroadcast() ) )
-                {
-                    shouldSyncRngState = false;
-
-                    MsgPtr msgRngState = procMan.getRngState ( netMan.getIndex() );
-
-                    ASSERT ( msgRngState.get() != 0 );
-
-                    netMan.setRngState ( msgRngState->getAs<RngState>() );
-
-                    if ( clientMode.isHost() )
-                        dataSocket->send ( msgRngState );
                 }
-                break;
             }
 
-            default:
-                ASSERT ( !"Unknown NetplayState!" );
-                break;
-        }
-
-        // Clear the last changed frame before we get new inputs
-        if ( rollbackTimer == minRollbackSpacing )
-            netMan.clearLastChangedFrame();
-
-        for ( ;; )
-        {
-            // Poll until we are ready to run
-            if ( ! EventManager::get().poll ( POLL_TIMEOUT ) )
+#ifndef RELEASE
+            // Test random delay setting
+            if ( KeyboardState::isPressed ( VK_F11 ) )
             {
-                appState = AppState::Stopping;
-                return;
+                randomDelay = !randomDelay;
+                DllOverlayUi::showMessage ( randomDelay ? "Enabled random delay" : "Disabled random delay" );
             }
 
-            // Don't need to wait for anything in local modes
-            if ( clientMode.isLocal() || lazyDisconnect )
-                break;
-
-            // Check if we are ready to continue running, ie not waiting on remote input or RngState
-            const bool ready = ( netMan.isRemoteInputReady() && netMan.isRngStateReady ( shouldSyncRngState ) );
-
-            // Don't resend inputs in spectator mode
-            if ( clientMode.isSpectate() )
+            if ( randomDelay && rand() % 30 == 0 )
             {
-                // Continue if ready
-                if ( ready )
-                    break;
-            }
-            else
-            {
-                // Stop resending inputs if we're ready
-                if ( ready )
-                {
-                    resendTimer.reset();
-                    waitInputsTimer = -1;
-                    break;
-                }
-
-                // Start resending inputs since we are waiting
-                if ( ! resendTimer )
-                {
-                    resendTimer.reset ( new Timer ( this ) );
-                    resendTimer->start ( RESEND_INPUTS_INTERVAL );
-                    waitInputsTimer = 0;
-                }
+                shouldChangeDelayRollback = true;
+                changeConfig.indexedFrame = netMan.getIndexedFrame();
+                changeConfig.delay = rand() % 10;
+                changeConfig.invalidate();
             }
+#endif // NOT RELEASE
         }
-
-        if ( rollbackTimer < minRollbackSpacing )
+        else if ( clientMode.isSpectate() )                                         // Spectator controls
         {
-            --rollbackTimer;
-
-            if ( rollbackTimer < 0 )
-                rollbackTimer = minRollbackSpacing;
+            if ( KeyboardState::isPressed ( VK_SPACE ) )
+                spectateFastFwd = !spectateFastFwd;
         }
-
-        // Only rollback when necessary
-        if ( netMan.isInRollback()
-                && rollbackTimer == minRollbackSpacing
-                && netMan.getLastChangedFrame().value < netMan.getIndexedFrame().value )
+        else
         {
-            const string before = format ( "%s [%u] %s [%s]",
-                                           gameModeStr ( *CC_GAME_MODE_ADDR ), *CC_GAME_MODE_ADDR,
-                                           netMan.getState(), netMan.getIndexedFrame() );
-
-            // Indicate we're re-running to the current frame
-            fastFwdStopFrame = netMan.getIndexedFrame();
-
-            // Reset the game state (this resets game state AND netMan state)
-            if ( rollMan.loadState ( netMan.getLastChangedFrame(), netMan ) )
-            {
-                // Start fast-forwarding now
-                *CC_SKIP_FRAMES_ADDR = 1;
-
-                LOG_TO ( syncLog, "%s Rollback: target=[%s]; actual=[%s]",
-                         before, netMan.getLastChangedFrame(), netMan.getIndexedFrame() );
-
-                LOG_SYNC ( "Reinputs: 0x%04x 0x%04x", netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
-
-                netMan.clearLastChangedFrame();
-                --rollbackTimer;
-                return;
-            }
-
-            LOG_TO ( syncLog, "%s Rollback to target=[%s] failed!", before, netMan.getLastChangedFrame() );
+            LOG ( "Unknown clientMode=%s; flags={ %s }", clientMode, clientMode.flagString() );
+            return false;
         }
 
-        // Update the RngState if necessary
-        if ( shouldSyncRngState )
-        {
-            shouldSyncRngState = false;
-
-            // LOG ( "Randomizing RngState" );
-
-            // RngState rngState;
-
-            // rngState.rngState0 = rand() % 1000000;
-            // rngState.rngState1 = rand() % 1000000;
-            // rngState.rngState2 = rand() % 1000000;
-
-            // for ( char& c : rngState.rngState3 )
-            //     c = rand() % 256;
-
-            // procMan.setRngState ( rngState );
-
-            MsgPtr msgRngState = netMan.getRngState();
-
-            if ( msgRngState )
-                procMan.setRngState ( msgRngState->getAs<RngState>() );
-        }
+#ifndef RELEASE
+        DllOverlayUi::debugText = format ( "%+d %+.2f [%s]", netMan.getRemoteFrameDelta(),
+                                           netMan.timeSync.getAdvantage(), netMan.getIndexedFrame() );
+        DllOverlayUi::debugTextAlign = 1;
 
-        // Update delay and/or rollback if necessary
-        if ( shouldChangeDelayRollback )
+        // Replay inputs and rollback
+        if ( replayInputs )
         {
-            shouldChangeDelayRollback = false;
+            if ( repMan.getGameMode ( netMan.getIndexedFrame() ) )
+                ASSERT ( repMan.getGameMode ( netMan.getIndexedFrame() ) == *CC_GAME_MODE_ADDR );
 
-            if ( changeConfig.delay < 0xFF && changeConfig.delay != netMan.getDelay() )
-            {
-                LOG ( "Input delay was changed %u -> %u", netMan.getDelay(), changeConfig.delay );
-                DllOverlayUi::showMessage ( format ( "Input delay was changed to %u", changeConfig.delay ) );
-                netMan.setDelay ( changeConfig.delay );
-                procMan.ipcSend ( changeConfig );
-            }
+            if ( ! repMan.getStateStr ( netMan.getIndexedFrame() ).empty() )
+                ASSERT ( repMan.getStateStr ( netMan.getIndexedFrame() ) == netMan.getState().str() );
 
-            if ( changeConfig.rollback <= MAX_ROLLBACK && changeConfig.rollback != netMan.getRollback() )
-            {
-                LOG ( "Rollback was changed %u -> %u", netMan.getRollback(), changeConfig.rollback );
-                DllOverlayUi::showMessage ( format ( "Rollback was changed to %u", changeConfig.rollback ) );
-                netMan.setRollback ( changeConfig.rollback );
-                minRollbackSpacing = clamped<uint8_t> ( netMan.getRollback(), 2, 4 );
-                procMan.ipcSend ( changeConfig );
-            }
-        }
+            // Inputs
+            const auto& inputs = repMan.getInputs ( netMan.getIndexedFrame() );
+            netMan.setInput ( 1, inputs.p1 );
+            netMan.setInput ( 2, inputs.p2 );
 
-        // LOG_SYNC ( "SFX 0x%X: CC_SFX_ARRAY=%u; sfxFilterArray=%u; sfxMuteArray=%u", SFX_NUM,
-        //            CC_SFX_ARRAY_ADDR[SFX_NUM], AsmHacks::sfxFilterArray[SFX_NUM], AsmHacks::sfxMuteArray[SFX_NUM] );
+            const IndexedFrame target = repMan.getRollbackTarget ( netMan.getIndexedFrame() );
 
-#ifndef RELEASE
-        if ( ! replayInputs )
-        {
-            // Test one time rollback
-            if ( KeyboardState::isPressed ( VK_F9 ) && netMan.isInGame() )
+            // Rollback
+            if ( netMan.isInRollback() && target.value < netMan.getIndexedFrame().value )
             {
-                IndexedFrame target = netMan.getIndexedFrame();
-
-                if ( target.parts.frame <= 30 )
-                    target.parts.frame = 0;
-                else
-                    target.parts.frame -= 30;
-
-                if ( KeyboardState::isDown ( VK_CONTROL ) )
+                // Reinputs
+                const auto& reinputs = repMan.getReinputs ( netMan.getIndexedFrame() );
+                for ( const auto& inputs : reinputs )
                 {
-                    const string before = format ( "%s [%u] %s [%s]",
-                                                   gameModeStr ( *CC_GAME_MODE_ADDR ), *CC_GAME_MODE_ADDR,
-                                                   netMan.getState(), netMan.getIndexedFrame() );
-
-                    // Indicate we're re-running to the current frame
-                    fastFwdStopFrame = netMan.getIndexedFrame();
-
-                    // Reset the game state (this resets game state AND netMan state)
-                    if ( rollMan.loadState ( target, netMan ) )
-                    {
-                        // Start fast-forwarding now
-                        *CC_SKIP_FRAMES_ADDR = 1;
-
-                        LOG_TO ( syncLog, "%s Rollback: target=[%s]; actual=[%s]",
-                                 before, netMan.getLastChangedFrame(), netMan.getIndexedFrame() );
-
-                        LOG_SYNC ( "Reinputs: 0x%04x 0x%04x", netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
-                        return;
-                    }
+                    netMan.assignInput ( 1, inputs.p1, inputs.indexedFrame );
+                    netMan.assignInput ( 2, inputs.p2, inputs.indexedFrame );
                 }
-                else
-                {
-                    rollMan.loadState ( target, netMan );
-                }
-            }
 
-            // Test random rollback
-            if ( KeyboardState::isPressed ( VK_F10 ) )
-            {
-                randomRollback = !randomRollback;
-                DllOverlayUi::showMessage ( randomRollback ? "Enabled random rollback" : "Disabled random rollback" );
+                if ( loadRollback ( target ) )
+                    return false;
+
+                ASSERT_IMPOSSIBLE;
             }
 
-            if ( randomRollback
-                    && rollbackTimer == minRollbackSpacing
-                    && netMan.isInGame()
-                    && ( netMan.getFrame() % 150 < 100 ) )
+            // RngState
+            if ( netMan.getFrame() == 0 && ( netMan.getState() == NetplayState::CharaSelect
+                                             || netMan.getState() == NetplayState::InGame ) )
             {
-                const uint32_t distance = 1 + ( rand() % rollUpTo );
+                MsgPtr msgRngState = repMan.getRngState ( netMan.getIndexedFrame() );
 
-                IndexedFrame target = netMan.getIndexedFrame();
-
-                if ( target.parts.frame <= distance )
-                    target.parts.frame = 0;
-                else
-                    target.parts.frame -= distance;
-
-                const string before = format ( "%s [%u] %s [%s]",
-                                               gameModeStr ( *CC_GAME_MODE_ADDR ), *CC_GAME_MODE_ADDR,
-                                               netMan.getState(), netMan.getIndexedFrame() );
-
-                // Indicate we're re-running to the current frame
-                fastFwdStopFrame = netMan.getIndexedFrame();
-
-                // Reset the game state (this resets game state AND netMan state)
-                if ( rollMan.loadState ( target, netMan ) )
-                {
-                    // Start fast-forwarding now
-                    *CC_SKIP_FRAMES_ADDR = 1;
-
-                    LOG_TO ( syncLog, "%s Rollback: target=[%s]; actual=[%s]",
-                             before, target, netMan.getIndexedFrame() );
-
-                    LOG_SYNC ( "Reinputs: 0x%04x 0x%04x", netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
-
-                    --rollbackTimer;
-                    return;
-                }
-
-                LOG_TO ( syncLog, "%s Rollback to target=[%s] failed!", before, target );
+                if ( msgRngState )
+                    procMan.setRngState ( msgRngState->getAs<RngState>() );
             }
-        }
 
-        if ( dataSocket && dataSocket->isConnected()
-                && ( ( netMan.getFrame() % ( 5 * 60 ) == 0 ) || ( netMan.getFrame() % 150 == 149 ) )
-                && netMan.getState().value >= NetplayState::CharaSelect && netMan.getState() != NetplayState::Loading
-                && netMan.getState() != NetplayState::Skippable && netMan.getState() != NetplayState::RetryMenu )
-        {
-            // Check for desyncs by periodically sending hashes
-            if ( !netMan.isInRollback()
-                    || ( netMan.getFrame() == 0 )
-                    || ( randomInputs && netMan.getFrame() % 150 == 149 ) )
-            {
-                MsgPtr msgSyncHash ( new SyncHash ( netMan.getIndexedFrame() ) );
-                dataSocket->send ( msgSyncHash );
-                localSync.push_back ( msgSyncHash );
-            }
+            return false;
         }
 
-        // Compare current lists of sync hashes
-        while ( !localSync.empty() && !remoteSync.empty() )
+        // Test random input
+        if ( KeyboardState::isPressed ( VK_F12 ) )
         {
+            randomInputs = !randomInputs;
+            localInputs [ clientMode.isLocal() ? 1 : 0 ] = 0;
+            DllOverlayUi::showMessage ( randomInputs ? "Enabled random inputs" : "Disabled random inputs" );
+        }
 
-#define L localSync.front()->getAs<SyncHash>()
-#define R remoteSync.front()->getAs<SyncHash>()
-
-            while ( !remoteSync.empty() && L.indexedFrame.value > R.indexedFrame.value )
-                remoteSync.pop_front();
-
-            if ( remoteSync.empty() )
-                break;
-
-            while ( !localSync.empty() && R.indexedFrame.value > L.indexedFrame.value )
-                localSync.pop_front();
+        if ( randomInputs )
+            randomizeLocalInputs();
+#endif // NOT RELEASE
 
-            if ( localSync.empty() )
-                break;
+        return true;
+    }
 
-            if ( L == R )
+    // Poll until we are ready to run
+    bool waitForInputs() override
+    {
+        for ( ;; )
+        {
+            if ( ! EventManager::get().poll ( POLL_TIMEOUT ) )
             {
-                localSync.pop_front();
-                remoteSync.pop_front();
-                continue;
+                appState = AppState::Stopping;
+                return false;
             }
 
-            LOG_TO ( syncLog, "Desync:" );
-            LOG_TO ( syncLog, "< %s", L.dump() );
-            LOG_TO ( syncLog, "> %s", R.dump() );
-
-#undef L
-#undef R
-
-            syncLog.deinitialize();
-            delayedStop ( "Desync!" );
+            // Stop resending inputs if we're ready
+            if ( isReady() )
+            {
+                resendTimer.reset();
+                waitInputsTimer = -1;
+                return true;
+            }
 
-            randomInputs = false;
-            localInputs [ clientMode.isLocal() ? 1 : 0 ] = 0;
-            return;
+            // Start resending inputs since we are waiting, but not in spectator mode
+            if ( ! clientMode.isSpectate() && ! resendTimer )
+            {
+                resendTimer.reset ( new Timer ( this ) );
+                resendTimer->start ( RESEND_INPUTS_INTERVAL );
+                waitInputsTimer = 0;
+            }
         }
+    }
+
+    bool frameStepReady() override
+    {
+        if ( ! DllFrameStepper::frameStepReady() )
+            return false;
 
+#ifndef RELEASE
         if ( replayInputs && netMan.getIndex() >= repMan.getLastIndex() && netMan.getFrame() >= repMan.getLastFrame() )
         {
             replayInputs = false;
@@ -786,12 +356,12 @@ struct DllMain
                 syncLog.deinitialize();
 
                 delayedStop ( ERROR_INTERNAL );
-                return;
+                return false;
             }
             else
             {
                 delayedStop ( ERROR_INTERNAL );
-                return;
+                return false;
             }
         }
 
@@ -816,10 +386,6 @@ struct DllMain
         // }
 #endif // NOT RELEASE
 
-        // Cleared last played and muted sound effects
-        memset ( AsmHacks::sfxFilterArray, 0, CC_SFX_ARRAY_LEN );
-        memset ( AsmHacks::sfxMuteArray, 0, CC_SFX_ARRAY_LEN );
-
 #ifndef DISABLE_LOGGING
         MsgPtr msgRngState = procMan.getRngState ( 0 );
         ASSERT ( msgRngState.get() != 0 );
@@ -828,6 +394,15 @@ struct DllMain
         LOG_SYNC ( "RngState: %s", msgRngState->getAs<RngState>().dump() );
         LOG_SYNC ( "Inputs: 0x%04x 0x%04x", netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
 
+        // Record the replay every frame, the RngState is only needed at the start of each transition
+        if ( ! replayWriter.hasIndex() || replayWriter.getIndex() != netMan.getIndex() )
+            replayWriter.setIndex ( netMan.getIndex(), *CC_GAME_MODE_ADDR, netMan.getState().str() );
+
+        if ( netMan.getFrame() == 0 )
+            replayWriter.setRngState ( msgRngState );
+
+        replayWriter.addInputs ( netMan.getFrame(), netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
+
         // Log extra state during chara select
         if ( netMan.getState() == NetplayState::CharaSelect )
         {
@@ -836,7 +411,7 @@ struct DllMain
                        *CC_P1_MOON_SELECTOR_ADDR, *CC_P1_COLOR_SELECTOR_ADDR,
                        *CC_P2_SELECTOR_MODE_ADDR, *CC_P2_CHARACTER_ADDR,
                        *CC_P2_MOON_SELECTOR_ADDR, *CC_P2_COLOR_SELECTOR_ADDR );
-            return;
+            return true;
         }
 
         // Log extra state while in-game
@@ -844,39 +419,128 @@ struct DllMain
         {
             LOG_SYNC_CHARACTER ( 1 );
             LOG_SYNC_CHARACTER ( 2 );
+
+            if ( netMan.getFrame() == 0 )
+            {
+                replayWriter.setCharacter ( 1, *CC_P1_CHARACTER_ADDR, *CC_P1_MOON_SELECTOR_ADDR,
+                                            *CC_P1_COLOR_SELECTOR_ADDR );
+                replayWriter.setCharacter ( 2, *CC_P2_CHARACTER_ADDR, *CC_P2_MOON_SELECTOR_ADDR,
+                                            *CC_P2_COLOR_SELECTOR_ADDR );
+            }
+
             LOG_SYNC ( "roundOverTimer=%d; introState=%u; roundTimer=%u; realTimer=%u; hitsparks=%u; camera={ %d, %d }",
                        roundOverTimer, *CC_INTRO_STATE_ADDR, *CC_ROUND_TIMER_ADDR, *CC_REAL_TIMER_ADDR,
                        *CC_HIT_SPARKS_ADDR, *CC_CAMERA_X_ADDR, *CC_CAMERA_Y_ADDR );
-            return;
+            return true;
         }
 #endif // NOT DISABLE_LOGGING
+
+        return true;
     }
 
-    void frameStepRerun()
+    void delayRollbackChanged ( const string& message ) override
     {
-        // Here we don't save any game states while re-running because the inputs are faked
+        DllOverlayUi::showMessage ( message );
+        procMan.ipcSend ( changeConfig );
+    }
 
-        // Save sound state during rollback re-run
-        rollMan.saveRerunSounds ( netMan.getFrame() );
+    // Test rollbacks
+    bool debugRollback() override
+    {
+        // LOG_SYNC ( "SFX 0x%X: CC_SFX_ARRAY=%u; sfxFilterArray=%u; sfxMuteArray=%u", SFX_NUM,
+        //            CC_SFX_ARRAY_ADDR[SFX_NUM], AsmHacks::sfxFilterArray[SFX_NUM], AsmHacks::sfxMuteArray[SFX_NUM] );
 
-        if ( netMan.getIndexedFrame().value >= fastFwdStopFrame.value )
+#ifndef RELEASE
+        if ( ! replayInputs )
         {
-            // Stop fast-forwarding once we're reached the frame we want
-            fastFwdStopFrame.value = 0;
+            // Test one time rollback
+            if ( KeyboardState::isPressed ( VK_F9 ) && netMan.isInGame() )
+            {
+                IndexedFrame target = netMan.getIndexedFrame();
+
+                if ( target.parts.frame <= 30 )
+                    target.parts.frame = 0;
+                else
+                    target.parts.frame -= 30;
+
+                if ( KeyboardState::isDown ( VK_CONTROL ) )
+                {
+                    if ( loadRollback ( target ) )
+                        return false;
+                }
+                else
+                {
+                    rollMan.loadState ( target, netMan );
+                }
+            }
+
+            // Test random rollback
+            if ( KeyboardState::isPressed ( VK_F10 ) )
+            {
+                randomRollback = !randomRollback;
+                DllOverlayUi::showMessage ( randomRollback ? "Enabled random rollback" : "Disabled random rollback" );
+            }
+
+            if ( randomRollback
+                    && rollbackTimer == minRollbackSpacing
+                    && netMan.isInGame()
+                    && ( netMan.getFrame() % 150 < 100 ) )
+            {
+                const uint32_t distance = 1 + ( rand() % rollUpTo );
 
-            // Re-enable regular rendering once done
-            *CC_SKIP_FRAMES_ADDR = 0;
+                IndexedFrame target = netMan.getIndexedFrame();
 
-            // Finalize rollback sound effects
-            rollMan.finishedRerunSounds();
+                if ( target.parts.frame <= distance )
+                    target.parts.frame = 0;
+                else
+                    target.parts.frame -= distance;
+
+                if ( loadRollback ( target ) )
+                {
+                    --rollbackTimer;
+                    return false;
+                }
+            }
         }
-        else
+#endif // NOT RELEASE
+
+        return true;
+    }
+
+    bool loadRollback ( IndexedFrame target ) override
+    {
+        const string before = format ( "%s [%u] %s [%s]",
+                                       gameModeStr ( *CC_GAME_MODE_ADDR ), *CC_GAME_MODE_ADDR,
+                                       netMan.getState(), netMan.getIndexedFrame() );
+
+        if ( DllFrameStepper::loadRollback ( target ) )
         {
-            // Skip rendering while fast-forwarding
-            *CC_SKIP_FRAMES_ADDR = 1;
+            LOG_TO ( syncLog, "%s Rollback: target=[%s]; actual=[%s]", before, target, netMan.getIndexedFrame() );
+
+            LOG_SYNC ( "Reinputs: 0x%04x 0x%04x", netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
+            recordRollback ( target );
+            return true;
         }
 
+        LOG_TO ( syncLog, "%s Rollback to target=[%s] failed!", before, target );
+        return false;
+    }
+
+    // Record a rollback that was just loaded, with the first re-run inputs
+    void recordRollback ( IndexedFrame target )
+    {
+        // fastFwdStopFrame is the frame that was rolled back from
+        replayWriter.addRollback ( fastFwdStopFrame.parts.frame, target );
+        replayWriter.addReinputs ( netMan.getIndexedFrame(), netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
+    }
+
+    void frameStepRerun() override
+    {
+        DllFrameStepper::frameStepRerun();
+
         LOG_SYNC ( "Reinputs: 0x%04x 0x%04x", netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
+        replayWriter.addReinputs ( netMan.getIndexedFrame(), netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
+
         LOG_SYNC ( "roundOverTimer=%d; introState=%u; roundTimer=%u; realTimer=%u; hitsparks=%u; camera={ %d, %d }",
                    roundOverTimer, *CC_INTRO_STATE_ADDR, *CC_ROUND_TIMER_ADDR, *CC_REAL_TIMER_ADDR,
                    *CC_HIT_SPARKS_ADDR, *CC_CAMERA_X_ADDR, *CC_CAMERA_Y_ADDR );
@@ -885,10 +549,8 @@ struct DllMain
         //            CC_SFX_ARRAY_ADDR[SFX_NUM], AsmHacks::sfxFilterArray[SFX_NUM], AsmHacks::sfxMuteArray[SFX_NUM] );
     }
 
-    void frameStep()
+    void checkChanges() override
     {
-        // New frame
-        netMan.updateFrame();
         procMan.clearInputs();
 
         // Check for changes to important variables for state transitions
@@ -897,27 +559,24 @@ struct DllMain
         // Check for controller changes normally on Wine
         if ( ProcessManager::isWine() )
             ControllerManager::get().check();
+    }
 
-        // Check for round over state during in-game
-        if ( netMan.isInGame() )
-            checkRoundOver();
+    void frameStepDone() override
+    {
+        DllFrameStepper::frameStepDone();
 
-        // Need to manually set the intro state to 0 during rollback
-        if ( netMan.isInRollback() && netMan.getFrame() > CC_PRE_GAME_INTRO_FRAMES && *CC_INTRO_STATE_ADDR )
-            *CC_INTRO_STATE_ADDR = 0;
+        // Report our relay status up the tree
+        if ( clientMode.isSpectate() && ( *CC_WORLD_TIMER_ADDR ) % RELAY_STATUS_INTERVAL == 0 )
+            procMan.ipcSend ( new RelayStatus ( getRelayStatus() ) );
 
-        // Perform the frame step
-        if ( fastFwdStopFrame.value )
-            frameStepRerun();
-        else
-            frameStepNormal();
-
-        // Update spectators
-        frameStepSpectators();
+        // Slow down by a fraction of a frame when ahead of the remote in-game, instead of stalling whole frames
+        if ( clientMode.isNetplay() )
+        {
+            DllFrameRate::desiredFps = ( netMan.isInGame() ? netMan.timeSync.getFps() : 60.0 );
 
-        // Write game inputs
-        procMan.writeGameInput ( localPlayer, netMan.getInput ( localPlayer ) );
-        procMan.writeGameInput ( remotePlayer, netMan.getInput ( remotePlayer ) );
+            if ( netMan.isInGame() && netMan.getFrame() % TIME_SYNC_LOG_INTERVAL == 0 )
+                LOG ( "timeSync: %s", netMan.timeSync.str() );
+        }
 
 #ifndef RELEASE
         if ( replayInputs && ( replaySpeed == 1 || KeyboardState::isDown ( VK_SPACE ) ) )
@@ -927,19 +586,8 @@ struct DllMain
 #endif
     }
 
-    void netplayStateChanged ( NetplayState state )
+    void netplayStateChanging ( NetplayState state ) override
     {
-        // Catch invalid transitions
-        if ( ! netMan.isValidNext ( state ) )
-        {
-            LOG_TO ( syncLog, "Desync!" );
-            LOG_TO ( syncLog, "Invalid transition: %s -> %s", netMan.getState(), state );
-            syncLog.deinitialize();
-
-            delayedStop ( ERROR_INTERNAL );
-            return;
-        }
-
         // Close the overlay if not mapping
         if ( ! DllOverlayUi::isShowingMessage() && isNotMapping() )
         {
@@ -961,132 +609,16 @@ struct DllMain
             // Initialize the overlay now
             DllOverlayUi::init();
         }
-
-        // Leaving Skippable
-        if ( netMan.getState() == NetplayState::Skippable )
-        {
-            // Reset state variables
-            roundOverTimer = -1;
-            lazyDisconnect = false;
-        }
-
-        // Leaving Loading
-        if ( netMan.getState() == NetplayState::Loading )
-        {
-            // Reset color loading state
-            AsmHacks::numLoadedColors = 0;
-        }
-
-        // Entering InGame
-        if ( state == NetplayState::InGame )
-        {
-            if ( netMan.getRollback() )
-                rollMan.allocateStates();
-        }
-
-        // Leaving InGame
-        if ( netMan.getState() == NetplayState::InGame )
-        {
-            if ( netMan.getRollback() )
-                rollMan.deallocateStates();
-        }
-
-        // Entering CharaSelect OR entering InGame
-        if ( !clientMode.isOffline() && ( state == NetplayState::CharaSelect || state == NetplayState::InGame ) )
-        {
-            // Indicate we should sync the RngState now
-            shouldSyncRngState = true;
-        }
-
-        // Entering RetryMenu
-        if ( state == NetplayState::RetryMenu )
-        {
-            // Lazy disconnect now during netplay
-            lazyDisconnect = clientMode.isNetplay();
-
-            // Reset retry menu index flag
-            localRetryMenuIndexSent = false;
-        }
-        else if ( lazyDisconnect )
-        {
-            lazyDisconnect = false;
-
-            // If not entering RetryMenu and we're already disconnected...
-            if ( !dataSocket || !dataSocket->isConnected() )
-            {
-                delayedStop ( "Disconnected!" );
-                return;
-            }
-        }
-
-        // Update local state
-        netMan.setState ( state );
-
-        // Update remote index
-        if ( dataSocket && dataSocket->isConnected() )
-            dataSocket->send ( new TransitionIndex ( netMan.getIndex() ) );
     }
 
-    void gameModeChanged ( uint32_t previous, uint32_t current )
+#ifndef RELEASE
+    bool shouldAutoCharaSelect() const override
     {
-        if ( current == 0
-                || current == CC_GAME_MODE_STARTUP
-                || current == CC_GAME_MODE_OPENING
-                || current == CC_GAME_MODE_TITLE
-                || current == CC_GAME_MODE_MAIN
-                || current == CC_GAME_MODE_LOADING_DEMO
-                || ( previous == CC_GAME_MODE_LOADING_DEMO && current == CC_GAME_MODE_IN_GAME )
-                || current == CC_GAME_MODE_HIGH_SCORES )
-        {
-            ASSERT ( netMan.getState() == NetplayState::PreInitial || netMan.getState() == NetplayState::Initial );
-            return;
-        }
-
-        if ( netMan.getState() == NetplayState::Initial
-#ifdef RELEASE
-                && netMan.config.mode.isSpectate()
-#else
-                && ( netMan.config.mode.isSpectate() || replayInputs )
-#endif // RELEASE
-                && netMan.initial.netplayState > NetplayState::CharaSelect )
-        {
-            // Spectate mode needs to auto select characters if starting after CharaSelect
-            netplayStateChanged ( NetplayState::AutoCharaSelect );
-            return;
-        }
-
-        if ( current == CC_GAME_MODE_CHARA_SELECT )
-        {
-            netplayStateChanged ( NetplayState::CharaSelect );
-            return;
-        }
-
-        if ( current == CC_GAME_MODE_LOADING )
-        {
-            netplayStateChanged ( NetplayState::Loading );
-            return;
-        }
-
-        if ( current == CC_GAME_MODE_IN_GAME )
-        {
-            // Versus mode in-game starts with character intros, which is a skippable state
-            if ( netMan.config.mode.isVersus() )
-                netplayStateChanged ( NetplayState::Skippable );
-            else
-                netplayStateChanged ( NetplayState::InGame );
-            return;
-        }
-
-        if ( current == CC_GAME_MODE_RETRY )
-        {
-            netplayStateChanged ( NetplayState::RetryMenu );
-            return;
-        }
-
-        THROW_EXCEPTION ( "gameModeChanged(%u, %u)", ERROR_INVALID_GAME_MODE, previous, current );
+        return ( DllFrameStepper::shouldAutoCharaSelect() || replayInputs );
     }
+#endif // NOT RELEASE
 
-    void delayedStop ( const string& error )
+    void delayedStop ( const string& error ) override
     {
         if ( ! error.empty() )
             procMan.ipcSend ( new ErrorMessage ( error ) );
@@ -1097,35 +629,28 @@ struct DllMain
         stopping = true;
     }
 
-    void checkRoundOver()
+    void desynced ( const string& error, const string& details ) override
     {
-        const bool isOver = ( ( *CC_P1_NO_INPUT_FLAG_ADDR ) && ( *CC_P2_NO_INPUT_FLAG_ADDR ) );
+        LOG_TO ( syncLog, "Desync!" );
+        LOG_TO ( syncLog, "%s", details );
+        syncLog.deinitialize();
 
-        if ( netMan.getRollback() )
-        {
-            if ( isOver )
-            {
-                if ( roundOverTimer == 0 )
-                {
-                    roundOverTimer = -1;
-                    netplayStateChanged ( NetplayState::Skippable );
-                }
-                else if ( roundOverTimer < 0 )
-                {
-                    roundOverTimer = netMan.getRollback() + ROLLBACK_ROUND_OVER_DELAY;
-                }
-            }
-            else
-            {
-                roundOverTimer = -1;
-            }
-        }
-        else if ( isOver )
-        {
-            netplayStateChanged ( NetplayState::Skippable );
-        }
+        delayedStop ( error );
+
+        randomInputs = false;
+        localInputs [ clientMode.isLocal() ? 1 : 0 ] = 0;
     }
 
+    // DllFrameStepper accessors
+    const ClientMode& getClientMode() const override { return clientMode; }
+    Socket *getDataSocket() const override { return dataSocket.get(); }
+    uint8_t getLocalPlayer() const override { return localPlayer; }
+    uint8_t getRemotePlayer() const override { return remotePlayer; }
+
+    MsgPtr getGameRngState ( uint32_t index ) const override { return procMan.getRngState ( index ); }
+    void setGameRngState ( const RngState& rngState ) override { procMan.setRngState ( rngState ); }
+    void writeGameInput ( uint8_t player, uint16_t input ) override { procMan.writeGameInput ( player, input ); }
+
     // ChangeMonitor callback
     void changedValue ( Variable var, uint32_t previous, uint32_t current ) override
     {
@@ -1168,14 +693,11 @@ struct DllMain
             ASSERT ( newSocket != 0 );
             ASSERT ( newSocket->isConnected() == true );
 
-            IpAddrPort redirectAddr;
-
-            if ( SHOULD_REDIRECT_SPECTATORS )
-                redirectAddr = getRandomRedirectAddress();
+            const IpAddrPort redirectAddr = getRedirectAddress();
 
             if ( redirectAddr.port == 0 )
             {
-                newSocket->send ( new VersionConfig ( clientMode ) );
+                newSocket->send ( new VersionConfig ( clientMode, ClientMode::WireFlags | ClientMode::RelayTree ) );
             }
             else
             {
@@ -1194,6 +716,9 @@ struct DllMain
             LOG ( "dataSocket=%08x", dataSocket.get() );
 
             ASSERT ( dataSocket != 0 );
+
+            dataSocket->setWireVersion ( clientMode.getWireVersion() );
+
             ASSERT ( dataSocket->isConnected() == true );
 
             netplayStateChanged ( NetplayState::Initial );
@@ -1231,6 +756,7 @@ struct DllMain
             if ( netMan.getState() == NetplayState::PreInitial )
             {
                 dataSocket = SmartSocket::connectUDP ( this, address );
+                dataSocket->setWireVersion ( clientMode.getWireVersion() );
                 LOG ( "dataSocket=%08x", dataSocket.get() );
                 return;
             }
@@ -1286,6 +812,9 @@ struct DllMain
                     return;
                 }
 
+                // Switch to the newest wire format the spectator supports
+                socket->setWireVersion ( msg->getAs<VersionConfig>().mode.getWireVersion() );
+
                 socket->send ( new SpectateConfig ( netMan.config, netMan.getState().value ) );
                 return;
             }
@@ -1301,6 +830,10 @@ struct DllMain
                 pushSpectator ( socket, { socket->address.addr, msg->getAs<IpAddrPort>().port } );
                 return;
 
+            case MsgType::RelayStatus:
+                updateRelayStatus ( socket, msg->getAs<RelayStatus>() );
+                return;
+
             case MsgType::RngState:
                 netMan.setRngState ( msg->getAs<RngState>() );
                 return;
@@ -1371,6 +904,15 @@ struct DllMain
                 switch ( msg->getMsgType() )
                 {
                     case MsgType::InitialGameState:
+                        // Only the first one starts the game, later ones are from a new parent after rejoining the
+                        // relay tree, which resends the inputs we already have from its spectate start index.
+                        if ( netMan.getState() != NetplayState::PreInitial )
+                        {
+                            if ( ! RelayRejoin::canResume ( msg->getAs<InitialGameState>(), netMan.getIndex() ) )
+                                delayedStop ( "Disconnected!" );
+                            return;
+                        }
+
                         netMan.initial = msg->getAs<InitialGameState>();
 
                         if ( netMan.initial.chara[0] == UNKNOWN_POSITION )
@@ -1446,20 +988,29 @@ struct DllMain
                 if ( options[Options::HeldStartDuration] )
                     netMan.heldStartDuration = lexical_cast<uint32_t> ( options.arg ( Options::HeldStartDuration ) );
 
+                autoDelay = options[Options::AutoDelay];
+
                 // This will log in the previous appDir folder it not the same
                 LOG ( "appDir='%s'", ProcessManager::appDir );
 
+                // Binary logs are decoded with logdecoder.exe
                 Logger::get().sessionId = options.arg ( Options::SessionId );
-                Logger::get().initialize ( ProcessManager::appDir + LOG_FILE );
+                Logger::get().initialize ( ProcessManager::appDir + LOG_FILE,
+                                           LOG_DEFAULT_OPTIONS | ( options[Options::AsyncLog] ? LOG_ASYNC : 0 ) );
                 Logger::get().logVersion();
 
                 LOG ( "gameDir='%s'", ProcessManager::gameDir );
                 LOG ( "appDir='%s'", ProcessManager::appDir );
 
                 syncLog.sessionId = options.arg ( Options::SessionId );
-                syncLog.initialize ( ProcessManager::appDir + SYNC_LOG_FILE, 0 );
+                syncLog.initialize ( ProcessManager::appDir + SYNC_LOG_FILE,
+                                     options[Options::AsyncLog] ? LOG_ASYNC : 0 );
                 syncLog.logVersion();
 
+#ifndef DISABLE_LOGGING
+                replayWriter.open ( ProcessManager::appDir + REPLAY_FILE );
+#endif // NOT DISABLE_LOGGING
+
                 // Manually hit Alt+Enter to enable fullscreen
                 if ( options[Options::Fullscreen] && DllHacks::windowHandle == GetForegroundWindow() )
                 {
@@ -1555,6 +1106,14 @@ struct DllMain
                 {
                     randomInputs = options[Options::SyncTest];
                 }
+
+                if ( options[Options::NetworkProfile] )
+                {
+                    NetworkProfile profile;
+
+                    if ( profile.load ( ProcessManager::appDir + options.arg ( Options::NetworkProfile ) ) )
+                        Socket::setDefaultImpairment ( profile );
+                }
 #endif // NOT RELEASE
                 break;
 
@@ -1579,6 +1138,9 @@ struct DllMain
 
                 isSinglePlayer = clientMode.isSinglePlayer();
 
+                // Spectators report their relay status as soon as they start, so this must be set first
+                initRelay ( clientMode );
+
                 LOG ( "%s: flags={ %s }", clientMode, clientMode.flagString() );
                 break;
 
@@ -1693,6 +1255,7 @@ struct DllMain
                         LOG ( "serverCtrlSocket=%08x", serverCtrlSocket.get() );
 
                         dataSocket = SmartSocket::connectUDP ( this, address, clientMode.isUdpTunnel() );
+                        dataSocket->setWireVersion ( clientMode.getWireVersion() );
                         LOG ( "dataSocket=%08x", dataSocket.get() );
                     }
 
@@ -1836,13 +1399,17 @@ struct DllMain
 
     // Constructor
     DllMain()
-        : SpectatorManager ( &netMan, &procMan )
+        : DllFrameStepper ( &procMan )
         , worldTimerMoniter ( this, Variable::WorldTime, *CC_WORLD_TIMER_ADDR )
     {
         // Timer and controller initialization is not done here because of threading issues
 
         procMan.connectPipe();
 
+#ifndef RELEASE
+        checkSync = true;
+#endif // NOT RELEASE
+
         netplayStateChanged ( NetplayState::PreInitial );
 
         ChangeMonitor::get().addRef ( this, Variable ( Variable::GameMode ), *CC_GAME_MODE_ADDR );
@@ -1866,6 +1433,8 @@ struct DllMain
 
         syncLog.deinitialize();
 
+        replayWriter.close();
+
         procMan.disconnectPipe();
 
         ControllerManager::get().owner = 0;
@@ -1890,14 +1459,21 @@ private:
         LOG ( "Failed to save: %s", file );
     }
 
-    const IpAddrPort& getRandomRedirectAddress() const
+    // Get the address to redirect a new spectator to, or NullAddress to accept it
+    const IpAddrPort& getRedirectAddress() const
     {
+        const IpAddrPort& relayAddr = getRelayAddress();
+
+        if ( relayAddr.port == 0 )
+            return relayAddr;
+
+        // Spread spectators over both roots of the relay tree
         size_t r = rand() % ( 1 + numSpectators() );
 
         if ( r == 0 && !clientServerAddr.empty() )
             return clientServerAddr;
         else
-            return getRandomSpectatorAddress();
+            return relayAddr;
     }
 };
 
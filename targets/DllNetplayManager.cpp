@@ -526,6 +526,10 @@ void NetplayManager::setState ( NetplayState state )
         if ( state == NetplayState::CharaSelect )
             _spectateStartIndex = getIndex();
 
+        // Entering InGame, the frame offsets from the previous game don't apply to this one
+        if ( state == NetplayState::InGame )
+            timeSync.reset();
+
         // Entering Loading
         if ( state == NetplayState::Loading )
         {
@@ -673,6 +677,8 @@ MsgPtr NetplayManager::getInputs ( uint8_t player ) const
     _inputs[player - 1].get ( playerInputs->getIndex() - _startIndex, playerInputs->getStartFrame(),
                               &playerInputs->inputs[0], playerInputs->size() );
 
+    playerInputs->frameOffset = timeSync.getEncodedOffset();
+
     return MsgPtr ( playerInputs );
 }
 
@@ -686,6 +692,22 @@ void NetplayManager::setInputs ( uint8_t player, const PlayerInputs& playerInput
     ASSERT ( getIndex() >= _startIndex );
     ASSERT ( playerInputs.getIndex() >= _startIndex );
 
+    if ( config.mode.isNetplay() && playerInputs.getIndex() == getIndex() )
+    {
+        // Sample the frame offset when new inputs for the current game arrive, ie the local frame minus the frame
+        // the remote sent them on. The remote set them delay frames ahead, and the delay is the same on both sides.
+        if ( isInGame() && playerInputs.getEndFrame() > _inputs[player - 1].getEndFrame ( getIndex() - _startIndex ) )
+        {
+            const int offset = int ( getFrame() + getDelay() ) - int ( playerInputs.getEndFrame() - 1 );
+
+            timeSync.addSample ( offset );
+            delayRecommender.addLiveSample ( max ( 0, offset ) );
+        }
+
+        // Only offsets measured in the current game are used
+        timeSync.setRemoteOffset ( playerInputs.frameOffset );
+    }
+
     const uint32_t checkStartingFromIndex = ( isInRollback() ? getIndex() - _startIndex : UINT_MAX );
 
     _inputs[player - 1].set ( playerInputs.getIndex() - _startIndex, playerInputs.getStartFrame(),
@@ -3,6 +3,8 @@
 #include "Messages.hpp"
 #include "InputsContainer.hpp"
 #include "NetplayStates.hpp"
+#include "TimeSync.hpp"
+#include "DelayRecommender.hpp"
 
 #include <vector>
 #include <climits>
@@ -25,6 +27,12 @@ public:
     // The number of frames it takes to register a held start button input
     uint32_t heldStartDuration = 0;
 
+    // Estimates the frame advantage from the remote inputs, the frame offset is sent with the local inputs
+    TimeSync timeSync;
+
+    // Recommends delay/rollback changes from the same frame offsets
+    DelayRecommender delayRecommender;
+
     // Indicate which player is the remote player
     void setRemotePlayer ( uint8_t player );
 
@@ -99,6 +99,10 @@ void ProcessManager::connectPipe()
 
     LOG ( "processId=%08x", _processId );
 
+    // Create the channel before sending the process ID, if this fails the IPC socket is used instead
+    if ( ! _sharedIpc.create ( format ( SHARED_IPC_NAME, _processId ) ) )
+        LOG ( "Using IPC socket" );
+
     if ( ! WriteFile ( _pipe, &_processId, sizeof ( _processId ), &bytes, 0 ) )
         THROW_WIN_EXCEPTION ( GetLastError(), "WriteFile failed", ERROR_PIPE_RW );
 
@@ -16,34 +16,6 @@ extern const unsigned char binary_res_rollback_bin_end;
 // Deserialized rollback memory data
 static MemDumpList allAddrs;
 
-template<typename T>
-static inline void deleteArray ( T *ptr ) { delete[] ptr; }
-
-
-void DllRollbackManager::GameState::save()
-{
-    ASSERT ( rawBytes != 0 );
-
-    char *dump = rawBytes;
-
-    for ( const MemDump& mem : allAddrs.addrs )
-        mem.saveDump ( dump );
-
-    ASSERT ( dump == rawBytes + allAddrs.totalSize );
-}
-
-void DllRollbackManager::GameState::load()
-{
-    ASSERT ( rawBytes != 0 );
-
-    const char *dump = rawBytes;
-
-    for ( const MemDump& mem : allAddrs.addrs )
-        mem.loadDump ( dump );
-
-    ASSERT ( dump == rawBytes + allAddrs.totalSize );
-}
-
 void DllRollbackManager::allocateStates()
 {
     if ( allAddrs.empty() )
@@ -55,11 +27,12 @@ void DllRollbackManager::allocateStates()
     if ( allAddrs.empty() )
         THROW_EXCEPTION ( "Failed to load rollback data!", ERROR_BAD_ROLLBACK_DATA );
 
-    if ( ! _memoryPool )
-        _memoryPool.reset ( new char[NUM_ROLLBACK_STATES * allAddrs.totalSize], deleteArray<char> );
+    allocateStates ( allAddrs );
+}
 
-    for ( size_t i = 0; i < NUM_ROLLBACK_STATES; ++i )
-        _freeStack.push ( i * allAddrs.totalSize );
+void DllRollbackManager::allocateStates ( const MemDumpList& addrs )
+{
+    _snapshots.allocate ( addrs, NUM_ROLLBACK_STATES );
 
     _statesList.clear();
 
@@ -69,17 +42,14 @@ void DllRollbackManager::allocateStates()
 
 void DllRollbackManager::deallocateStates()
 {
-    _memoryPool.reset();
-
-    while ( ! _freeStack.empty() )
-        _freeStack.pop();
+    _snapshots.deallocate();
 
     _statesList.clear();
 }
 
 void DllRollbackManager::saveState ( const NetplayManager& netMan )
 {
-    if ( _freeStack.empty() )
+    if ( _snapshots.full() )
     {
         ASSERT ( _statesList.empty() == false );
 
@@ -87,12 +57,12 @@ void DllRollbackManager::saveState ( const NetplayManager& netMan )
         {
             auto it = _statesList.begin();
             ++it;
-            _freeStack.push ( it->rawBytes - _memoryPool.get() );
+            _snapshots.erase ( it->snapshot );
             _statesList.erase ( it );
         }
         else
         {
-            _freeStack.push ( _statesList.front().rawBytes - _memoryPool.get() );
+            _snapshots.erase ( _statesList.front().snapshot );
             _statesList.pop_front();
         }
     }
@@ -102,11 +72,9 @@ void DllRollbackManager::saveState ( const NetplayManager& netMan )
         netMan._state,
         netMan._startWorldTime,
         netMan._indexedFrame,
-        _memoryPool.get() + _freeStack.top()
+        _snapshots.save()
     };
 
-    _freeStack.pop();
-    state.save();
     _statesList.push_back ( state );
 
     uint8_t *currentSfxArray = &_sfxHistory [ netMan.getFrame() % NUM_ROLLBACK_STATES ][0];
@@ -140,15 +108,12 @@ bool DllRollbackManager::loadState ( IndexedFrame indexedFrame, NetplayManager&
             netMan._state = it->netplayState;
             netMan._startWorldTime = it->startWorldTime;
             netMan._indexedFrame = it->indexedFrame;
-            it->load();
+
+            // This also erases all the newer snapshots
+            _snapshots.load ( it->snapshot );
 
             // Erase all other states after the current one.
             // Note: it.base() returns 1 after the position of it, but moving forward.
-            for ( auto jt = it.base(); jt != _statesList.end(); ++jt )
-            {
-                _freeStack.push ( jt->rawBytes - _memoryPool.get() );
-            }
-
             _statesList.erase ( it.base(), _statesList.end() );
 
             // Initialize the SFX filter by flagging all played SFX flags in the range (R,S),
@@ -1,10 +1,9 @@
 #pragma once
 
 #include "DllNetplayManager.hpp"
+#include "MemDumpSnapshots.hpp"
 #include "Constants.hpp"
 
-#include <memory>
-#include <stack>
 #include <list>
 #include <array>
 
@@ -17,6 +16,10 @@ public:
     void allocateStates();
     void deallocateStates();
 
+    // Allocate memory for saving game states of the given memory dumps, instead of the linked rollback data.
+    // The memory dumps must stay valid until deallocateStates is called.
+    void allocateStates ( const MemDumpList& addrs );
+
     // Save / load current game state
     void saveState ( const NetplayManager& netMan );
     bool loadState ( IndexedFrame indexedFrame, NetplayManager& netMan );
@@ -37,19 +40,12 @@ private:
         uint32_t startWorldTime;
         IndexedFrame indexedFrame;
 
-        // The pointer to the raw bytes in the state pool
-        char *rawBytes;
-
-        // Save / load the game state
-        void save();
-        void load();
+        // The snapshot id of the game memory
+        size_t snapshot;
     };
 
-    // Memory pool to allocate game states
-    std::shared_ptr<char> _memoryPool;
-
-    // Unused indices in the memory pool, each game state has the same size
-    std::stack<size_t> _freeStack;
+    // Incremental snapshots of the game memory
+    MemDumpSnapshots _snapshots;
 
     // List of saved game states in chronological order
     std::list<GameState> _statesList;
@@ -10,7 +10,6 @@ using namespace std;
 
 SpectatorManager::SpectatorManager ( NetplayManager *netManPtr, const ProcessManager *procManPtr )
     : _spectatorListPos ( _spectatorList.end() )
-    , _spectatorMapPos ( _spectatorMap.end() )
     , _netManPtr ( netManPtr )
     , _procManPtr ( procManPtr )
 {
@@ -59,8 +58,7 @@ void SpectatorManager::pushSpectator ( Socket *socketPtr, const IpAddrPort& serv
 
     _spectatorMap[socketPtr] = spectator;
 
-    if ( _spectatorMap.size() == 1 || _spectatorMapPos == _spectatorMap.cend() )
-        _spectatorMapPos = _spectatorMap.cbegin();
+    _relay.addChild ( serverAddr );
 
     _netManPtr->preserveStartIndex = min ( _netManPtr->preserveStartIndex, spectator.pos.parts.index );
 
@@ -98,8 +96,7 @@ void SpectatorManager::popSpectator ( Socket *socketPtr )
     if ( _spectatorListPos == it->second.it )
         ++_spectatorListPos;
 
-    if ( _spectatorMapPos == it )
-        ++_spectatorMapPos;
+    _relay.removeChild ( it->second.serverAddr );
 
     _spectatorList.erase ( it->second.it );
     _spectatorMap.erase ( socketPtr );
@@ -107,8 +104,12 @@ void SpectatorManager::popSpectator ( Socket *socketPtr )
 
 void SpectatorManager::newRngState ( const RngState& rngState )
 {
+    // Only encode once for all the spectators
+    EncodedMsgCache cache;
+    const MsgPtr msg ( const_cast<RngState *> ( &rngState ), ignoreMsgPtr );
+
     for ( Socket *socket : _spectatorList )
-        socket->send ( rngState );
+        cache.send ( socket, msg, rngState.index );
 }
 
 void SpectatorManager::frameStepSpectators()
@@ -116,22 +117,14 @@ void SpectatorManager::frameStepSpectators()
     if ( _spectatorMap.empty() )
     {
         _spectatorListPos = _spectatorList.end();
-        _spectatorMapPos = _spectatorMap.cend();
 
         // Reset the preserve index
         _netManPtr->preserveStartIndex = _currentMinIndex = UINT_MAX;
+
+        _msgCache.clear();
         return;
     }
 
-    if ( _spectatorMapPos == _spectatorMap.cend() )
-        _spectatorMapPos = _spectatorMap.cbegin();
-
-    if ( _spectatorMap.size() > 1 )
-        ++_spectatorMapPos;
-
-    if ( _spectatorMapPos == _spectatorMap.cend() )
-        _spectatorMapPos = _spectatorMap.cbegin();
-
     // Number of times to broadcast per frame
     const uint32_t multiplier = 1 + ( _spectatorList.size() * 2 ) / ( NUM_INPUTS + 1 );
 
@@ -154,6 +147,9 @@ void SpectatorManager::frameStepSpectators()
 
             // Reset the current min index
             _currentMinIndex = UINT_MAX;
+
+            // Forget messages that no spectator needed during the last round
+            _msgCache.evictUnused();
         }
 
         const auto it = _spectatorMap.find ( *_spectatorListPos );
@@ -169,9 +165,9 @@ void SpectatorManager::frameStepSpectators()
 
         MsgPtr msgBothInputs = _netManPtr->getBothInputs ( spectator.pos );
 
-        // Send inputs if available
+        // Send inputs if available, spectators at the same position get the same inputs
         if ( msgBothInputs )
-            socket->send ( msgBothInputs );
+            _msgCache.send ( socket, msgBothInputs, msgBothInputs->getAs<BothInputs>().indexedFrame.value );
 
         // Clear sent flags whenever the index changes
         if ( spectator.pos.parts.index > oldIndex )
@@ -185,7 +181,7 @@ void SpectatorManager::frameStepSpectators()
         // Send RngState ONCE if available
         if ( msgRngState && !spectator.sentRngState )
         {
-            socket->send ( msgRngState );
+            _msgCache.send ( socket, msgRngState, oldIndex );
             spectator.sentRngState = true;
         }
 
@@ -194,7 +190,7 @@ void SpectatorManager::frameStepSpectators()
         // Send retry menu index ONCE if available
         if ( msgMenuIndex && !spectator.sentRetryMenuIndex )
         {
-            socket->send ( msgMenuIndex );
+            _msgCache.send ( socket, msgMenuIndex, oldIndex );
             spectator.sentRetryMenuIndex = true;
         }
 
@@ -205,30 +201,14 @@ void SpectatorManager::frameStepSpectators()
     }
 }
 
-const IpAddrPort& SpectatorManager::getRandomSpectatorAddress() const
+void SpectatorManager::updateRelayStatus ( Socket *socketPtr, const RelayStatus& status )
 {
-    if ( _spectatorMap.empty() || _spectatorMapPos == _spectatorMap.cend() )
-    {
-        LOG ( "'%s'", NullAddress );
-        return NullAddress;
-    }
-
-    auto it = _spectatorMapPos;
+    const auto it = _spectatorMap.find ( socketPtr );
 
-#ifndef RELEASE
-    if ( it->second.serverAddr.port == 0 )
-    {
-        do
-        {
-            ++it;
+    if ( it == _spectatorMap.end() )
+        return;
 
-            if ( it == _spectatorMap.end() )
-                it = _spectatorMap.begin();
-        }
-        while ( it->second.serverAddr.port == 0 && it != _spectatorMapPos );
-    }
-#endif
+    LOG ( "socket=%08x; serverAddr='%s'; %s", socketPtr, it->second.serverAddr, status );
 
-    LOG ( "'%s'", it->second.serverAddr );
-    return it->second.serverAddr;
+    _relay.updateChild ( it->second.serverAddr, status );
 }
@@ -211,6 +211,12 @@ int main ( int argc, char *argv[] )
             "  --rollback, -r N     Set the default rollback to N.\n"
         },
 
+        {
+            Options::AutoDelay, 0, "", "auto-delay", Arg::None,
+            "  --auto-delay         Change the delay in-game,\n"
+            "                         from how late the remote inputs arrive.\n"
+        },
+
         {
             Options::Offline, 0, "o", "offline", Arg::OptionalNumeric,
             "  --offline, -o D      Force offline mode.\n"
@@ -257,10 +263,23 @@ int main ( int argc, char *argv[] )
             "  --replay, -R args    Replay the given file with options.\n"
             "                         TODO list possible arguments.\n"
         },
+
+        {
+            Options::NetworkProfile, 0, "", "network-profile", Arg::Required,
+            "  --network-profile F  Emulate the network conditions in profile file F.\n"
+            "                         Lines of key=value, see NetworkProfile for the keys.\n"
+        },
+
+        {
+            Options::AsyncLog, 0, "", "async-log", Arg::None,
+            "  --async-log          Write dll.log and sync.log as binary logs from a background thread.\n"
+            "                         Decode them with: logdecoder.exe <binary log> [output file]\n"
+        },
 #else
         { Options::Tunnel, 0, "", "tunnel", Arg::None, 0 },
         { Options::Dummy, 0, "", "dummy", Arg::None, 0 },
         { Options::PidLog, 0, "", "pidlog", Arg::None, 0 },
+        { Options::AsyncLog, 0, "", "async-log", Arg::None, 0 },
         { Options::StrictVersion, 0, "S", "", Arg::None, 0 },
 #endif
 
@@ -385,6 +404,15 @@ int main ( int argc, char *argv[] )
         system ( "@pause > nul" );
         return result;
     }
+
+    // Emulate network conditions on every socket
+    if ( opt[Options::NetworkProfile] )
+    {
+        NetworkProfile profile;
+
+        if ( profile.load ( ProcessManager::appDir + opt[Options::NetworkProfile].arg ) )
+            Socket::setDefaultImpairment ( profile );
+    }
 #endif // NOT RELEASE
 
     // Initialize config
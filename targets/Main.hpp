@@ -16,6 +16,9 @@
 // Log file that contains all the data needed to keep games in sync
 #define SYNC_LOG_FILE FOLDER "sync.log"
 
+// Binary replay file, recorded alongside the sync log
+#define REPLAY_FILE FOLDER "replay.ccr"
+
 // Controller mappings file extension
 #define MAPPINGS_EXT ".mappings"
 
@@ -119,6 +119,14 @@ struct MainApp
 
     bool rollbackChanged = false;
 
+    bool isRelayParent = false;
+
+    // Reconnects to the root of the relay tree if the client we are spectating leaves
+    RelayRejoin relayRejoin;
+
+    // The game's serverCtrlSocket address, sent again to the new parent after rejoining
+    IpAddrPort relayServerAddr;
+
     /* Connect protocol
 
         1 - Connect / accept ctrlSocket
@@ -302,6 +310,9 @@ struct MainApp
             return;
         }
 
+        // Switch to the newest wire format the remote supports
+        socket->setWireVersion ( versionConfig.mode.getWireVersion() );
+
         // Switch to spectate mode if the game is already started
         if ( clientMode.isClient() && versionConfig.mode.isGameStarted() )
             clientMode.value = ClientMode::SpectateNetplay;
@@ -315,6 +326,9 @@ struct MainApp
             if ( ! versionConfig.mode.isGameStarted() )
                 stop ( "Not in a game yet, cannot spectate!" );
 
+            // Only report our relay status if the client we are spectating understands it
+            isRelayParent = versionConfig.mode.isRelayTree();
+
             // Wait for SpectateConfig
             return;
         }
@@ -344,6 +358,10 @@ struct MainApp
             LOG ( "serverDataSocket=%08x", serverDataSocket.get() );
         }
 
+        // The dataSocket can only use the wire formats that both ends support
+        initialConfig.mode.flags &= ~ClientMode::WireFlags;
+        initialConfig.mode.flags |= ( versionConfig.mode.flags & ClientMode::WireFlags );
+
         initialConfig.invalidate();
         ctrlSocket->send ( initialConfig );
     }
@@ -381,6 +399,7 @@ struct MainApp
 
             dataSocket = SmartSocket::connectUDP ( this, { address.addr, this->initialConfig.dataPort },
                                                    ctrlSocket->getAsSmart().isTunnel() );
+            dataSocket->setWireVersion ( this->initialConfig.mode.getWireVersion() );
             LOG ( "dataSocket=%08x", dataSocket.get() );
 
             ui.display (
@@ -409,22 +428,24 @@ struct MainApp
         }
     }
 
-    void mergePingStats()
+    static void logPingStats ( const char *name, const Statistics& latency, uint8_t packetLoss )
     {
-        LOG ( "PingStats (local): latency=%.2f ms; worst=%.2f ms; stderr=%.2f ms; stddev=%.2f ms; packetLoss=%d%%",
-              pinger.getStats().getMean(), pinger.getStats().getWorst(),
-              pinger.getStats().getStdErr(), pinger.getStats().getStdDev(), pinger.getPacketLoss() );
+        LOG ( "PingStats (%s): latency=%.2f ms; worst=%.2f ms; stderr=%.2f ms; stddev=%.2f ms; packetLoss=%d%%; "
+              "p50=%.0f ms; p90=%.0f ms; p99=%.0f ms; p99.9=%.0f ms; histogram=%u samples",
+              name, latency.getMean(), latency.getWorst(), latency.getStdErr(), latency.getStdDev(), packetLoss,
+              latency.getPercentile ( 50 ), latency.getPercentile ( 90 ), latency.getPercentile ( 99 ),
+              latency.getPercentile ( 99.9 ), latency.getHistogram().getNumSamples() );
+    }
 
-        LOG ( "PingStats (remote): latency=%.2f ms; worst=%.2f ms; stderr=%.2f ms; stddev=%.2f ms; packetLoss=%d%%",
-              pingStats.latency.getMean(), pingStats.latency.getWorst(),
-              pingStats.latency.getStdErr(), pingStats.latency.getStdDev(), pingStats.packetLoss );
+    void mergePingStats()
+    {
+        logPingStats ( "local", pinger.getStats(), pinger.getPacketLoss() );
+        logPingStats ( "remote", pingStats.latency, pingStats.packetLoss );
 
         pingStats.latency.merge ( pinger.getStats() );
         pingStats.packetLoss = ( pingStats.packetLoss + pinger.getPacketLoss() ) / 2;
 
-        LOG ( "PingStats (merged): latency=%.2f ms; worst=%.2f ms; stderr=%.2f ms; stddev=%.2f ms; packetLoss=%d%%",
-              pingStats.latency.getMean(), pingStats.latency.getWorst(),
-              pingStats.latency.getStdErr(), pingStats.latency.getStdDev(), pingStats.packetLoss );
+        logPingStats ( "merged", pingStats.latency, pingStats.packetLoss );
     }
 
     void gotSpectateConfig ( const SpectateConfig& spectateConfig )
@@ -448,11 +469,52 @@ struct MainApp
 
         this->spectateConfig = spectateConfig;
 
+        relayRejoin.initialize ( originalAddress, spectateConfig.sessionId );
+
         ui.spectate ( spectateConfig );
 
         getUserConfirmation();
     }
 
+    // Messages from the new parent while rejoining the relay tree, the same handshake as spectating the first time
+    void gotRejoinMsg ( const MsgPtr& msg )
+    {
+        switch ( msg->getMsgType() )
+        {
+            case MsgType::VersionConfig:
+            {
+                const VersionConfig& versionConfig = msg->getAs<VersionConfig>();
+
+                if ( ! LocalVersion.isSimilar ( versionConfig.version, 1 + options[Options::StrictVersion] )
+                        || ! versionConfig.mode.isGameStarted() )
+                    break;
+
+                ctrlSocket->setWireVersion ( versionConfig.mode.getWireVersion() );
+                isRelayParent = versionConfig.mode.isRelayTree();
+                return;
+            }
+
+            case MsgType::SpectateConfig:
+                if ( ! relayRejoin.gotSpectateConfig ( msg->getAs<SpectateConfig>() ) )
+                    break;
+
+                // The new parent adds us once it has our server address, then sends the inputs from its start index
+                ctrlSocket->send ( new ConfirmConfig() );
+                ctrlSocket->send ( new IpAddrPort ( relayServerAddr ) );
+                return;
+
+            default:
+                break;
+        }
+
+        LOG ( "Failed to rejoin: '%s'", msg );
+
+        ctrlSocket.reset();
+
+        forwardMsgQueue();
+        procMan.ipcSend ( new ErrorMessage ( "Disconnected!" ) );
+    }
+
     void gotNetplayConfig ( const NetplayConfig& netplayConfig )
     {
         if ( ! clientMode.isClient() )
@@ -792,6 +854,7 @@ struct MainApp
             if ( clientMode.isClient() )
             {
                 dataSocket = SmartSocket::connectUDP ( this, address, ctrlSocket->getAsSmart().isTunnel() );
+                dataSocket->setWireVersion ( clientMode.getWireVersion() );
                 LOG ( "dataSocket=%08x", dataSocket.get() );
             }
 
@@ -859,7 +922,7 @@ struct MainApp
             ASSERT ( newSocket != 0 );
             ASSERT ( newSocket->isConnected() == true );
 
-            newSocket->send ( new VersionConfig ( clientMode ) );
+            newSocket->send ( new VersionConfig ( clientMode, ClientMode::WireFlags ) );
 
             pushPendingSocket ( this, newSocket );
         }
@@ -871,6 +934,8 @@ struct MainApp
             LOG ( "dataSocket=%08x", dataSocket.get() );
 
             ASSERT ( dataSocket != 0 );
+
+            dataSocket->setWireVersion ( initialConfig.mode.getWireVersion() );
             ASSERT ( dataSocket->isConnected() == true );
 
             pinger.start();
@@ -893,7 +958,7 @@ struct MainApp
             ASSERT ( ctrlSocket.get() != 0 );
             ASSERT ( ctrlSocket->isConnected() == true );
 
-            ctrlSocket->send ( new VersionConfig ( clientMode ) );
+            ctrlSocket->send ( new VersionConfig ( clientMode, ClientMode::WireFlags ) );
         }
         else if ( socket == dataSocket.get() )
         {
@@ -919,16 +984,28 @@ struct MainApp
             if ( isDummyReady && stopTimer )
             {
                 dataSocket = SmartSocket::connectUDP ( this, address );
+                dataSocket->setWireVersion ( clientMode.getWireVersion() );
                 LOG ( "dataSocket=%08x", dataSocket.get() );
                 return;
             }
 
             LOG ( "%s disconnected!", ( socket == ctrlSocket.get() ? "ctrlSocket" : "dataSocket" ) );
 
-            // TODO auto reconnect to original host address
-
             if ( socket == ctrlSocket.get() && clientMode.isSpectate() )
             {
+                // The game keeps running while we reconnect to the original host address
+                const IpAddrPort& rootAddr = ( procMan.isConnected() ? relayRejoin.parentLeft ( address )
+                                                                      : NullAddress );
+
+                if ( ! rootAddr.empty() )
+                {
+                    isRelayParent = false;
+                    address = rootAddr;
+                    ctrlSocket = SmartSocket::connectTCP ( this, address, options[Options::Tunnel] );
+                    LOG ( "Rejoining from '%s'; ctrlSocket=%08x", address, ctrlSocket.get() );
+                    return;
+                }
+
                 forwardMsgQueue();
                 procMan.ipcSend ( new ErrorMessage ( "Disconnected!" ) );
                 return;
@@ -980,6 +1057,11 @@ struct MainApp
             gotVersionConfig ( socket, msg->getAs<VersionConfig>() );
             return;
         }
+        else if ( relayRejoin.isRejoining() && socket == ctrlSocket.get() )
+        {
+            gotRejoinMsg ( msg );
+            return;
+        }
         else if ( isDummyReady )
         {
             gotDummyMsg ( msg );
@@ -1099,10 +1181,17 @@ struct MainApp
                 return;
 
             case MsgType::IpAddrPort:
+                relayServerAddr = msg->getAs<IpAddrPort>();
+
                 if ( ctrlSocket && ctrlSocket->isConnected() )
                     ctrlSocket->send ( msg );
                 return;
 
+            case MsgType::RelayStatus:
+                if ( ctrlSocket && ctrlSocket->isConnected() && isRelayParent )
+                    ctrlSocket->send ( msg );
+                return;
+
             case MsgType::ChangeConfig:
                 if ( msg->getAs<ChangeConfig>().value == ChangeConfig::Delay )
                     delayChanged = true;
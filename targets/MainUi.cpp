@@ -7,6 +7,7 @@
 #include "CharacterSelect.hpp"
 #include "StringUtils.hpp"
 #include "NetplayStates.hpp"
+#include "DelayRecommender.hpp"
 
 #include <mmsystem.h>
 #include <wininet.h>
@@ -1119,7 +1120,7 @@ bool MainUi::configure ( const PingStats& pingStats )
 
     ASSERT ( _ui.get() != 0 );
 
-    const int delay = computeDelay ( pingStats.latency.getMean() );
+    int delay = computeDelay ( pingStats.latency.getMean() );
     const int worst = computeDelay ( pingStats.latency.getWorst() );
     const int variance = computeDelay ( pingStats.latency.getVariance() );
 
@@ -1127,6 +1128,30 @@ bool MainUi::configure ( const PingStats& pingStats )
 
     _netplayConfig.delay = worst + 1;
 
+    // Recommend from the latency distribution if the remote sent one, otherwise use the mean and worst
+    DelayRecommender::Result recommended;
+    recommended.delay = 0xFF;
+
+    if ( pingStats.latency.getHistogram().getNumSamples() )
+    {
+        DelayRecommender recommender;
+        recommender.settings.maxRollback = clamped ( _config.getInteger ( "defaultRollback" ), 0, MAX_ROLLBACK );
+        recommender.setLatency ( pingStats.latency.getHistogram() );
+        recommender.setPacketLoss ( pingStats.packetLoss );
+
+        recommended = recommender.recommend();
+
+        recommender.settings.maxRollback = 0;
+
+        const DelayRecommender::Result withoutRollback = recommender.recommend();
+
+        LOG ( "Recommended: %s", recommended.str() );
+        LOG ( "Recommended without rollback: %s", withoutRollback.str() );
+
+        rollback = recommended.rollback;
+        delay = _netplayConfig.delay = withoutRollback.delay;
+    }
+
     // TODO maybe implement this as a slider or something
 
     _ui->pushBelow ( new ConsoleUi::Prompt ( ConsoleUi::Prompt::Integer, "Enter max frames of rollback:" ) );
@@ -1159,7 +1184,11 @@ bool MainUi::configure ( const PingStats& pingStats )
 
         _ui->top<ConsoleUi::Prompt>()->allowNegative = false;
         _ui->top<ConsoleUi::Prompt>()->maxDigits = 3;
-        _ui->top<ConsoleUi::Prompt>()->setInitial ( clamped ( delay - rollback, 0, delay ) );
+
+        if ( recommended.delay != 0xFF && rollback == recommended.rollback )
+            _ui->top<ConsoleUi::Prompt>()->setInitial ( recommended.delay );
+        else
+            _ui->top<ConsoleUi::Prompt>()->setInitial ( clamped ( delay - rollback, 0, delay ) );
 
         for ( ;; )
         {
@@ -1301,6 +1330,7 @@ string MainUi::formatStats ( const PingStats& pingStats )
                "\n%-" INDENT_STATS "s Worst: %.2f ms"
                "\n%-" INDENT_STATS "s StdErr: %.2f ms"
                "\n%-" INDENT_STATS "s StdDev: %.2f ms"
+               "\n%-" INDENT_STATS "s P99: %.0f ms"
                "\n%-" INDENT_STATS "s Packet Loss: %d%%"
 #endif
                , format ( "Network delay: %d", computeDelay ( pingStats.latency.getMean() ) )
@@ -1309,6 +1339,7 @@ string MainUi::formatStats ( const PingStats& pingStats )
                , "", pingStats.latency.getWorst()
                , "", pingStats.latency.getStdErr()
                , "", pingStats.latency.getStdDev()
+               , "", pingStats.latency.getPercentile ( 99 )
                , "", pingStats.packetLoss
 #endif
            );
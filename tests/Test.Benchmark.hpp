@@ -0,0 +1,32 @@
+#pragma once
+
+#ifndef RELEASE
+
+#include "StringUtils.hpp"
+
+#include <chrono>
+#include <string>
+
+
+// Run the function for the given number of iterations, returns the average nanoseconds per iteration
+template<typename F>
+inline double benchmark ( size_t iterations, const F& func )
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    for ( size_t i = 0; i < iterations; ++i )
+        func();
+
+    const auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano> ( end - start ).count() / ( iterations ? iterations : 1 );
+}
+
+// Print a line comparing two benchmark results
+inline void printBenchmark ( const std::string& name, double baselineNs, double optimizedNs )
+{
+    PRINT ( "[ BENCHMARK] %s: %.1f ns -> %.1f ns (%.2f times faster)",
+            name, baselineNs, optimizedNs, ( optimizedNs > 0 ? baselineNs / optimizedNs : 0.0 ) );
+}
+
+#endif // NOT RELEASE
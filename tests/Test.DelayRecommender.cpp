@@ -0,0 +1,217 @@
+#ifndef RELEASE
+
+#include "DelayRecommender.hpp"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <cmath>
+
+using namespace std;
+
+
+#define NUM_TRACE_SAMPLES ( 2000 )
+
+
+// Simulated one way latency trace: a base latency, uniform jitter, and a fraction of spikes
+static LatencyHistogram getTrace ( double base, double jitter, double spikeRate = 0, double spike = 0 )
+{
+    mt19937 random ( 12345 );
+    uniform_real_distribution<double> uniform ( 0, 1 );
+
+    LatencyHistogram trace;
+
+    for ( size_t i = 0; i < NUM_TRACE_SAMPLES; ++i )
+    {
+        double latency = base + ( 2 * uniform ( random ) - 1 ) * jitter;
+
+        if ( uniform ( random ) < spikeRate )
+            latency += spike * uniform ( random );
+
+        trace.addSample ( latency );
+    }
+
+    return trace;
+}
+
+
+TEST ( DelayRecommender, NoData )
+{
+    DelayRecommender recommender;
+
+    EXPECT_TRUE ( recommender.evaluate().empty() );
+    EXPECT_EQ ( 0xFF, recommender.recommend().delay );
+
+    DelayRecommender::Result result;
+    EXPECT_FALSE ( recommender.shouldChange ( 2, 0, result ) );
+}
+
+TEST ( DelayRecommender, LowLatency )
+{
+    DelayRecommender recommender;
+    recommender.setLatency ( getTrace ( 8, 3 ) );
+
+    const DelayRecommender::Result result = recommender.recommend();
+
+    EXPECT_LE ( result.delay, 1 );
+    EXPECT_LE ( result.rollback, 1 );
+    EXPECT_LT ( result.stallRate, 0.01 );
+}
+
+TEST ( DelayRecommender, CoversLatency )
+{
+    // 50 ms is 3 frames, so delay and rollback should cover at least that without stalling
+    DelayRecommender recommender;
+    recommender.setLatency ( getTrace ( 50, 5 ) );
+
+    const DelayRecommender::Result result = recommender.recommend();
+
+    EXPECT_GE ( result.delay + result.rollback, 3 );
+    EXPECT_LT ( result.stallRate, 0.01 );
+
+    // Without rollback, the delay alone must cover it
+    recommender.settings.maxRollback = 0;
+
+    const DelayRecommender::Result delayOnly = recommender.recommend();
+
+    EXPECT_EQ ( 0, delayOnly.rollback );
+    EXPECT_GE ( delayOnly.delay, 4 );
+    EXPECT_LT ( delayOnly.stallRate, 0.01 );
+}
+
+TEST ( DelayRecommender, Spikes )
+{
+    // Occasional spikes are cheaper to roll back than to cover with delay
+    DelayRecommender recommender;
+    recommender.setLatency ( getTrace ( 30, 5, 0.05, 80 ) );
+
+    const DelayRecommender::Result result = recommender.recommend();
+
+    EXPECT_GT ( result.rollback, 0 );
+    EXPECT_LT ( result.delay, ceil ( recommender.getLatency().getPercentile ( 99 ) / recommender.settings.frameMs ) );
+    EXPECT_LT ( result.stallRate, 0.02 );
+}
+
+TEST ( DelayRecommender, PacketLoss )
+{
+    DelayRecommender recommender;
+    recommender.setLatency ( getTrace ( 40, 5 ) );
+    recommender.settings.maxRollback = 0;
+
+    const DelayRecommender::Result noLoss = recommender.recommend();
+
+    recommender.setPacketLoss ( 10 );
+
+    const DelayRecommender::Result withLoss = recommender.recommend();
+
+    EXPECT_GE ( withLoss.delay, noLoss.delay );
+    EXPECT_GT ( recommender.evaluate ( noLoss.delay, 0 ).stallFrames, 0 );
+}
+
+TEST ( DelayRecommender, ParetoFront )
+{
+    DelayRecommender recommender;
+    recommender.setLatency ( getTrace ( 60, 15, 0.1, 50 ) );
+    recommender.setPacketLoss ( 2 );
+
+    const vector<DelayRecommender::Result> results = recommender.evaluate();
+    const vector<DelayRecommender::Result> front = DelayRecommender::getParetoFront ( results );
+
+    ASSERT_EQ ( ( 1u + recommender.settings.maxDelay ) * ( 1u + MAX_ROLLBACK ), results.size() );
+    ASSERT_FALSE ( front.empty() );
+    EXPECT_LT ( front.size(), results.size() );
+
+    const DelayRecommender::Result best = recommender.recommend();
+    bool isBestOnFront = false;
+
+    for ( const DelayRecommender::Result& result : front )
+    {
+        isBestOnFront |= ( result.delay == best.delay && result.rollback == best.rollback );
+
+        // Nothing on the front is dominated
+        for ( const DelayRecommender::Result& other : results )
+        {
+            EXPECT_FALSE ( other.delay <= result.delay && other.rollback <= result.rollback
+                           && other.rollbackCost <= result.rollbackCost && other.stallFrames <= result.stallFrames
+                           && ( other.delay < result.delay || other.rollback < result.rollback
+                                || other.rollbackCost < result.rollbackCost
+                                || other.stallFrames < result.stallFrames ) );
+        }
+    }
+
+    EXPECT_TRUE ( isBestOnFront );
+
+    for ( const DelayRecommender::Result& result : results )
+        EXPECT_LE ( best.score, result.score );
+}
+
+TEST ( DelayRecommender, LiveRefinement )
+{
+    DelayRecommender recommender;
+    recommender.setLatency ( getTrace ( 15, 3 ) );
+
+    const DelayRecommender::Result before = recommender.recommend();
+
+    DelayRecommender::Result result;
+    EXPECT_FALSE ( recommender.shouldChange ( before.delay, before.rollback, result ) );
+
+    // The network got worse in-game, live samples are only used once there are enough of them.
+    // Like DllMain, live samples are the whole frames between the remote sending an input and it arriving.
+    for ( size_t i = 0; i < recommender.settings.minLiveSamples - 1; ++i )
+        recommender.addLiveSample ( 6 );
+
+    EXPECT_FALSE ( recommender.shouldChange ( before.delay, before.rollback, result ) );
+
+    for ( size_t i = 0; i < NUM_TRACE_SAMPLES; ++i )
+        recommender.addLiveSample ( 5 + i % 3 );
+
+    // Older samples are dropped after two windows
+    EXPECT_LT ( recommender.getNumLiveSamples(), 2 * recommender.settings.liveWindow );
+
+    ASSERT_TRUE ( recommender.shouldChange ( before.delay, before.rollback, result ) );
+    EXPECT_GE ( result.delay + result.rollback, 7 );
+    EXPECT_EQ ( 0, result.stallRate );
+
+    // No change once the recommendation is applied
+    EXPECT_FALSE ( recommender.shouldChange ( result.delay, result.rollback, result ) );
+
+    recommender.resetLive();
+    EXPECT_EQ ( 0u, recommender.getNumLiveSamples() );
+    EXPECT_EQ ( before.delay, recommender.recommend().delay );
+}
+
+TEST ( DelayRecommender, LiveExactFrames )
+{
+    // Inputs that always arrive exactly on the frame they are needed are on time, so the current delay is kept
+    for ( uint8_t frames : { 1, 3, 4, 6 } )
+    {
+        DelayRecommender recommender;
+
+        for ( size_t i = 0; i < recommender.settings.liveWindow; ++i )
+            recommender.addLiveSample ( frames );
+
+        const DelayRecommender::Result current = recommender.evaluate ( frames, 0 );
+
+        EXPECT_EQ ( 0, current.stallFrames );
+        EXPECT_EQ ( 0, current.rollbackFrames );
+
+        DelayRecommender::Result result;
+
+        // Without rollback
+        recommender.settings.maxRollback = 0;
+
+        EXPECT_EQ ( frames, recommender.recommend().delay );
+        EXPECT_FALSE ( recommender.shouldChange ( frames, 0, result ) );
+
+        // With rollback, like DllMain when already using rollback, there are no rollbacks at the current delay,
+        // and the delay is never raised, though it may be lowered in exchange for some rollback.
+        recommender.settings.minRollback = 1;
+        recommender.settings.maxRollback = MAX_ROLLBACK;
+
+        EXPECT_EQ ( 0, recommender.evaluate ( frames, 2 ).rollbackFrames );
+        EXPECT_LE ( recommender.recommend().delay, frames );
+        EXPECT_TRUE ( ! recommender.shouldChange ( frames, 2, result ) || result.delay < frames );
+    }
+}
+
+#endif // NOT RELEASE
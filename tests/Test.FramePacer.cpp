@@ -0,0 +1,171 @@
+#ifndef RELEASE
+
+#include "FramePacer.hpp"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+using namespace std;
+
+
+#define NUM_FRAMES      ( 6000u )
+#define FRAME_US        ( 1000000.0 / 60 )
+
+
+// Sleeps overshoot by a random amount up to maxOvershoot microseconds, and each read of the clock takes 1 us
+struct MockClock : public FramePacer::Clock
+{
+    uint64_t now = 1000000;
+    uint32_t maxOvershoot = 0;
+    mt19937 random;
+
+    uint64_t getNow() override
+    {
+        return now++;
+    }
+
+    void sleep ( uint32_t milliseconds ) override
+    {
+        now += 1000 * uint64_t ( milliseconds );
+
+        if ( maxOvershoot )
+            now += uniform_int_distribution<uint32_t> ( 0, maxOvershoot ) ( random );
+    }
+
+    MockClock ( uint32_t maxOvershoot = 0 ) : maxOvershoot ( maxOvershoot ), random ( 12345 ) {}
+};
+
+
+// Run frames that each take work microseconds before waiting
+static void run ( FramePacer& pacer, MockClock& clock, size_t count, uint64_t work = 3000 )
+{
+    for ( size_t i = 0; i < count; ++i )
+    {
+        clock.now += work;
+        pacer.waitNextFrame();
+    }
+}
+
+
+TEST ( FramePacer, Steady )
+{
+    MockClock clock ( 1500 );
+    FramePacer pacer ( &clock );
+
+    run ( pacer, clock, NUM_FRAMES );
+
+    const FramePacer::Counters& counters = pacer.getCounters();
+
+    EXPECT_EQ ( NUM_FRAMES, counters.frames );
+    EXPECT_EQ ( 0u, counters.late );
+    EXPECT_EQ ( 0u, counters.resyncs );
+
+    // Every frame is within a few microseconds of its deadline
+    EXPECT_LE ( pacer.getLateness().getPercentile ( 100 ), 2u );
+    EXPECT_NEAR ( 60.0, pacer.getActualFps(), 0.01 );
+
+    // Most of the wait is spent sleeping
+    EXPECT_GT ( counters.sleepUs, 3 * counters.spinUs );
+    EXPECT_LE ( counters.spinUs / counters.frames, 2500u + 10 );
+}
+
+TEST ( FramePacer, NoDrift )
+{
+    MockClock clock;
+    FramePacer pacer ( &clock );
+
+    pacer.waitNextFrame();
+    const uint64_t start = clock.now;
+
+    // The interval is not a whole number of microseconds, but the deadlines don't drift from the ideal schedule
+    run ( pacer, clock, NUM_FRAMES, 1234 );
+
+    EXPECT_NEAR ( NUM_FRAMES * FRAME_US, double ( clock.now - start ), 5.0 );
+}
+
+TEST ( FramePacer, CalibratedSpin )
+{
+    // Sleeps that overshoot by up to 3 ms are missed at first, then the spin margin grows to cover them
+    MockClock clock ( 3000 );
+    FramePacer pacer ( &clock );
+
+    run ( pacer, clock, 60 );
+
+    EXPECT_GT ( pacer.getSpinUs(), 2500u );
+
+    pacer.resetTiming();
+    run ( pacer, clock, NUM_FRAMES );
+
+    EXPECT_EQ ( 0u, pacer.getCounters().late );
+    EXPECT_LE ( pacer.getLateness().getPercentile ( 99 ), 2u );
+
+    // The margin shrinks again once the sleeps are accurate, reading the clock still takes a microsecond
+    clock.maxOvershoot = 0;
+    run ( pacer, clock, 600 );
+
+    EXPECT_LE ( pacer.getSpinUs(), pacer.settings.minSpinUs + 1 );
+}
+
+TEST ( FramePacer, LateFrames )
+{
+    MockClock clock;
+    FramePacer pacer ( &clock );
+
+    run ( pacer, clock, 60 );
+
+    // One slow frame, the next frames are shortened to catch up to the schedule
+    const uint64_t start = clock.now;
+
+    clock.now += 20000;
+    pacer.waitNextFrame();
+    run ( pacer, clock, 59 );
+
+    EXPECT_EQ ( 0u, pacer.getCounters().resyncs );
+    EXPECT_GE ( pacer.getCounters().late, 1u );
+    EXPECT_NEAR ( 60 * FRAME_US, double ( clock.now - start ), 5.0 );
+
+    // A long stall restarts the schedule instead of running many frames back to back
+    clock.now += 500000;
+    pacer.waitNextFrame();
+
+    const uint64_t resumed = clock.now;
+    run ( pacer, clock, 1 );
+
+    EXPECT_EQ ( 1u, pacer.getCounters().resyncs );
+    EXPECT_NEAR ( FRAME_US, double ( clock.now - resumed ), 5.0 );
+}
+
+TEST ( FramePacer, ChangeFps )
+{
+    MockClock clock;
+    FramePacer pacer ( &clock );
+
+    run ( pacer, clock, 60 );
+
+    // Fractional changes take effect on the next frame without restarting the schedule
+    pacer.setFps ( 59.5 );
+
+    const uint64_t start = clock.now;
+    run ( pacer, clock, 595 );
+
+    EXPECT_NEAR ( 10000000.0, double ( clock.now - start ), 5.0 );
+    EXPECT_NEAR ( 59.5, pacer.getActualFps(), 0.01 );
+    EXPECT_EQ ( 0u, pacer.getCounters().resyncs );
+
+    // An unlimited frame rate never waits
+    pacer.setFps ( numeric_limits<double>::max() );
+    pacer.resetTiming();
+    run ( pacer, clock, 60, 100 );
+
+    EXPECT_EQ ( 0u, pacer.getCounters().sleeps );
+    EXPECT_EQ ( 0u, pacer.getCounters().spinUs );
+
+    pacer.setFps ( 60 );
+    pacer.resetTiming();
+    run ( pacer, clock, 60 );
+
+    EXPECT_EQ ( 0u, pacer.getCounters().late );
+}
+
+#endif // NOT RELEASE
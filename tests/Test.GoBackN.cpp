@@ -1,12 +1,15 @@
 #ifndef RELEASE
 
 #include "Test.Socket.hpp"
+#include "Test.Benchmark.hpp"
 #include "UdpSocket.hpp"
 #include "GoBackN.hpp"
+#include "NetworkImpairment.hpp"
 
 #include <gtest/gtest.h>
 
 #include <vector>
+#include <random>
 
 using namespace std;
 
@@ -15,6 +18,17 @@ using namespace std;
 #define CHECK_SUM_FAIL  50
 #define LONG_TIMEOUT    ( 120 * 1000 )
 
+// Large enough to be split into many messages, like the initial config or controller mappings
+#define BENCHMARK_BYTES         ( 16 * 1024 )
+#define BENCHMARK_PACKET_LOSS   ( 10 )
+
+// One way latency of the emulated link in milliseconds, and the number of seeds to average over
+#define BENCHMARK_LATENCY       ( 40 )
+#define BENCHMARK_SEEDS         ( 3 )
+
+// Datagrams larger than this are dropped, so only the 512 byte split size probe should get through
+#define PROBE_MAX_DATAGRAM      ( 700 )
+
 
 struct TestClass : public GoBackN::Owner, public Socket::Owner, public Timer::Owner
 {
@@ -411,4 +425,437 @@ TEST ( GoBackN, Timeout )
     TimerManager::get().deinitialize();
 }
 
+TEST ( GoBackN, SelectiveRepeat )
+{
+    struct TestSocket : public TestClass
+    {
+        SocketPtr socket;
+        IpAddrPort address;
+        GoBackN gbn;
+        Timer timer;
+        vector<MsgPtr> msgs;
+
+        void goBackNSendRaw ( GoBackN *gbn, const MsgPtr& msg ) override
+        {
+            socket->send ( msg, address );
+        }
+
+        void goBackNRecvMsg ( GoBackN *gbn, const MsgPtr& msg ) override
+        {
+            msgs.push_back ( msg );
+
+            if ( msgs.size() == 6 )
+            {
+                LOG ( "Stopping because all msgs have been received" );
+                EventManager::get().stop();
+            }
+        }
+
+        void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override
+        {
+            if ( this->address.empty() )
+                this->address = address;
+
+            gbn.recvFromSocket ( msg );
+        }
+
+        void timerExpired ( Timer *timer ) override
+        {
+            if ( socket->isClient() )
+            {
+                gbn.sendViaGoBackN ( new TestMessage ( "Message 1" ) );
+                gbn.sendViaGoBackN ( new TestMessage ( string ( 2000, 'x' ) ) );
+                gbn.sendViaGoBackN ( new TestMessage ( "Message 3" ) );
+                gbn.sendViaGoBackN ( new TestMessage ( "Message 4" ) );
+                gbn.sendViaGoBackN ( new TestMessage ( "Message 5" ) );
+                gbn.sendViaGoBackN ( new TestMessage ( "Message 6" ) );
+            }
+            else
+            {
+                LOG ( "Stopping because of timeout" );
+                EventManager::get().stop();
+            }
+        }
+
+        TestSocket ( uint16_t port )
+            : socket ( UdpSocket::bind ( this, port ) )
+            , gbn ( this ), timer ( this )
+        {
+            gbn.setSelectiveRepeat ( true );
+            socket->setPacketLoss ( PACKET_LOSS );
+            socket->setCheckSumFail ( CHECK_SUM_FAIL );
+            timer.start ( LONG_TIMEOUT );
+        }
+
+        TestSocket ( const string& address, uint16_t port )
+            : socket ( UdpSocket::bind ( this, IpAddrPort ( address, port ) ) )
+            , address ( address, port ), gbn ( this ), timer ( this )
+        {
+            gbn.setSelectiveRepeat ( true );
+            socket->setPacketLoss ( PACKET_LOSS );
+            socket->setCheckSumFail ( CHECK_SUM_FAIL );
+            timer.start ( 1000 );
+        }
+    };
+
+    TimerManager::get().initialize();
+    SocketManager::get().initialize();
+
+    TestSocket server ( 0 );
+    TestSocket client ( "127.0.0.1", server.socket->address.port );
+
+    EventManager::get().start();
+
+    // Messages are still received in order
+    EXPECT_EQ ( 6, server.msgs.size() );
+
+    for ( size_t i = 0; i < server.msgs.size(); ++i )
+    {
+        EXPECT_EQ ( MsgType::TestMessage, server.msgs[i]->getMsgType() );
+
+        if ( i == 1 )
+            EXPECT_EQ ( string ( 2000, 'x' ), server.msgs[i]->getAs<TestMessage>().str );
+        else
+            EXPECT_EQ ( format ( "Message %u", i + 1 ), server.msgs[i]->getAs<TestMessage>().str );
+    }
+
+    EXPECT_TRUE ( client.gbn.getAckCount() <= client.gbn.getSendCount() );
+
+    SocketManager::get().deinitialize();
+    TimerManager::get().deinitialize();
+}
+
+// Send one large message with packet loss in both directions, returns the nanoseconds until it was received
+static double transferUnderLoss ( bool selectiveRepeat )
+{
+    struct TestSocket : public TestClass
+    {
+        SocketPtr socket;
+        IpAddrPort address;
+        GoBackN gbn;
+        Timer timer;
+        MsgPtr msg;
+
+        void goBackNSendRaw ( GoBackN *gbn, const MsgPtr& msg ) override
+        {
+            if ( ! address.empty() )
+                socket->send ( msg, address );
+        }
+
+        void goBackNRecvMsg ( GoBackN *gbn, const MsgPtr& msg ) override
+        {
+            this->msg = msg;
+
+            LOG ( "Stopping because the msg was received" );
+            EventManager::get().stop();
+        }
+
+        void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override
+        {
+            if ( this->address.empty() )
+                this->address = address;
+
+            gbn.recvFromSocket ( msg );
+        }
+
+        void timerExpired ( Timer *timer ) override
+        {
+            LOG ( "Stopping because of timeout" );
+            EventManager::get().stop();
+        }
+
+        TestSocket ( uint16_t port, bool selectiveRepeat )
+            : socket ( UdpSocket::bind ( this, port ) )
+            , gbn ( this ), timer ( this )
+        {
+            gbn.setSelectiveRepeat ( selectiveRepeat );
+            socket->setPacketLoss ( BENCHMARK_PACKET_LOSS );
+            timer.start ( LONG_TIMEOUT );
+        }
+
+        TestSocket ( const string& address, uint16_t port, bool selectiveRepeat )
+            : socket ( UdpSocket::bind ( this, IpAddrPort ( address, port ) ) )
+            , address ( address, port ), gbn ( this ), timer ( this )
+        {
+            gbn.setSelectiveRepeat ( selectiveRepeat );
+            socket->setPacketLoss ( BENCHMARK_PACKET_LOSS );
+            timer.start ( LONG_TIMEOUT );
+        }
+    };
+
+    // Random bytes so the message isn't compressed
+    mt19937 rng ( 12345 );
+    string bytes ( BENCHMARK_BYTES, 0 );
+
+    for ( char& c : bytes )
+        c = rng();
+
+    TimerManager::get().initialize();
+    SocketManager::get().initialize();
+
+    TestSocket server ( 0, selectiveRepeat );
+    TestSocket client ( "127.0.0.1", server.socket->address.port, selectiveRepeat );
+
+    const double ns = benchmark ( 1, [&]()
+    {
+        client.gbn.sendViaGoBackN ( new TestMessage ( bytes ) );
+        EventManager::get().start();
+    } );
+
+    EXPECT_TRUE ( server.msg.get() );
+
+    if ( server.msg.get() )
+    {
+        EXPECT_EQ ( bytes, server.msg->getAs<TestMessage>().str );
+    }
+
+    SocketManager::get().deinitialize();
+    TimerManager::get().deinitialize();
+
+    return ns;
+}
+
+TEST ( GoBackN, ThroughputUnderLoss )
+{
+    const double goBackN = transferUnderLoss ( false );
+    const double selectiveRepeat = transferUnderLoss ( true );
+
+    printBenchmark ( format ( "GoBackN %u bytes with %u%% packet loss", BENCHMARK_BYTES, BENCHMARK_PACKET_LOSS ),
+                     goBackN, selectiveRepeat );
+
+    EXPECT_LT ( selectiveRepeat, goBackN );
+}
+
+// One end of a link that sends through a seeded NetworkImpairment, so the losses are the same every run
+struct ImpairedLink : public GoBackN::Owner, public NetworkImpairment::Owner
+{
+    GoBackN gbn;
+    NetworkImpairment impairment;
+    ImpairedLink *remote = 0;
+    MsgPtr msg;
+
+    void goBackNSendRaw ( GoBackN *gbn, const MsgPtr& msg ) override
+    {
+        const string bytes = ::Protocol::encode ( msg );
+        impairment.push ( &bytes[0], bytes.size(), NullAddress );
+    }
+
+    void goBackNRecvRaw ( GoBackN *gbn, const MsgPtr& msg ) override {}
+
+    void goBackNRecvMsg ( GoBackN *gbn, const MsgPtr& msg ) override
+    {
+        this->msg = msg;
+
+        LOG ( "Stopping because the msg was received" );
+        EventManager::get().stop();
+    }
+
+    void goBackNTimeout ( GoBackN *gbn ) override {}
+
+    bool impairmentReleased ( NetworkImpairment *impairment, const string& bytes, const IpAddrPort& address ) override
+    {
+        size_t consumed;
+        remote->gbn.recvFromSocket ( ::Protocol::decode ( &bytes[0], bytes.size(), consumed ) );
+        return true;
+    }
+
+    ImpairedLink ( const NetworkProfile& profile, uint32_t seed ) : gbn ( this ), impairment ( this, profile, false )
+    {
+        impairment.seed ( seed );
+    }
+};
+
+// Send one large message over an impaired link, returns the milliseconds until it was received
+static uint64_t transferOverLink ( bool selectiveRepeat, uint32_t sendWindow, uint32_t seed )
+{
+    NetworkProfile profile;
+    profile.latency = BENCHMARK_LATENCY;
+    profile.jitter = BENCHMARK_LATENCY / 10;
+    profile.loss = BENCHMARK_PACKET_LOSS;
+
+    mt19937 rng ( 12345 );
+    string bytes ( BENCHMARK_BYTES, 0 );
+
+    for ( char& c : bytes )
+        c = rng();
+
+    TimerManager::get().initialize();
+    SocketManager::get().initialize();
+
+    uint64_t elapsed = 0;
+    {
+        ImpairedLink client ( profile, 2 * seed ), server ( profile, 2 * seed + 1 );
+        client.remote = &server;
+        server.remote = &client;
+
+        for ( ImpairedLink *link : { &client, &server } )
+        {
+            link->gbn.setSelectiveRepeat ( selectiveRepeat );
+            link->gbn.setSendWindow ( sendWindow );
+        }
+
+        const uint64_t start = TimerManager::get().getNow ( true );
+
+        client.gbn.sendViaGoBackN ( new TestMessage ( bytes ) );
+        EventManager::get().start();
+
+        elapsed = TimerManager::get().getNow ( true ) - start;
+
+        EXPECT_TRUE ( server.msg.get() );
+
+        if ( server.msg.get() )
+        {
+            EXPECT_EQ ( bytes, server.msg->getAs<TestMessage>().str );
+        }
+
+        PRINT ( "[ BENCHMARK] selectiveRepeat=%u; sendWindow=%u; seed=%u: %llu ms; %llu packets; %llu lost",
+                selectiveRepeat, sendWindow, seed, elapsed,
+                client.impairment.getCounters().packets + server.impairment.getCounters().packets,
+                client.impairment.getCounters().lost + server.impairment.getCounters().lost );
+
+        client.gbn.reset();
+        server.gbn.reset();
+    }
+
+    SocketManager::get().deinitialize();
+    TimerManager::get().deinitialize();
+
+    return elapsed;
+}
+
+TEST ( GoBackN, ThroughputOverImpairedLink )
+{
+    uint64_t goBackN = 0, selectiveRepeat = 0, fullWindow = 0;
+
+    // The same seeds for each mode, timing still changes which packets are lost, so the results are averaged
+    for ( uint32_t seed = 1; seed <= BENCHMARK_SEEDS; ++seed )
+    {
+        goBackN += transferOverLink ( false, DEFAULT_SEND_WINDOW, seed );
+        selectiveRepeat += transferOverLink ( true, DEFAULT_SEND_WINDOW, seed );
+        fullWindow += transferOverLink ( true, SELECTIVE_ACK_WINDOW, seed );
+    }
+
+    const string name = format ( "GoBackN %u bytes with %ums latency and %u%% packet loss",
+                                 BENCHMARK_BYTES, BENCHMARK_LATENCY, BENCHMARK_PACKET_LOSS );
+
+    printBenchmark ( name, 1e6 * goBackN / BENCHMARK_SEEDS, 1e6 * selectiveRepeat / BENCHMARK_SEEDS );
+    printBenchmark ( name + " and a full send window", 1e6 * goBackN / BENCHMARK_SEEDS,
+                     1e6 * fullWindow / BENCHMARK_SEEDS );
+
+    // Only a few messages expire at once at this loss rate, so the window barely matters, but both should be
+    // several times faster than resending one message per interval.
+    EXPECT_LT ( 3 * selectiveRepeat, goBackN );
+    EXPECT_LT ( 3 * fullWindow, goBackN );
+}
+
+TEST ( GoBackN, SplitSizeProbe )
+{
+    struct TestSocket : public TestClass
+    {
+        SocketPtr socket;
+        IpAddrPort address;
+        GoBackN gbn;
+        Timer timer;
+        MsgPtr msg;
+
+        void goBackNSendRaw ( GoBackN *gbn, const MsgPtr& msg ) override
+        {
+            // Simulate a path that drops large datagrams
+            if ( msg && ::Protocol::encode ( msg ).size() > PROBE_MAX_DATAGRAM )
+                return;
+
+            if ( ! address.empty() )
+                socket->send ( msg, address );
+        }
+
+        void goBackNRecvMsg ( GoBackN *gbn, const MsgPtr& msg ) override
+        {
+            this->msg = msg;
+        }
+
+        void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override
+        {
+            if ( this->address.empty() )
+                this->address = address;
+
+            gbn.recvFromSocket ( msg );
+        }
+
+        void timerExpired ( Timer *timer ) override
+        {
+            LOG ( "Stopping after probing" );
+            EventManager::get().stop();
+        }
+
+        TestSocket ( uint16_t port )
+            : socket ( UdpSocket::bind ( this, port ) )
+            , gbn ( this, DEFAULT_SEND_INTERVAL, LONG_TIMEOUT ), timer ( this )
+        {
+            timer.start ( LONG_TIMEOUT );
+        }
+
+        TestSocket ( const string& address, uint16_t port )
+            : socket ( UdpSocket::bind ( this, IpAddrPort ( address, port ) ) )
+            , address ( address, port ), gbn ( this, DEFAULT_SEND_INTERVAL, LONG_TIMEOUT ), timer ( this )
+        {
+            timer.start ( 3000 );
+        }
+    };
+
+    TimerManager::get().initialize();
+    SocketManager::get().initialize();
+
+    TestSocket server ( 0 );
+    TestSocket client ( "127.0.0.1", server.socket->address.port );
+
+    EXPECT_EQ ( uint32_t ( MIN_SPLIT_SIZE ), client.gbn.getSplitSize() );
+
+    client.gbn.sendViaGoBackN ( new TestMessage ( "Hello server!" ) );
+
+    EventManager::get().start();
+
+    EXPECT_TRUE ( server.msg.get() );
+    EXPECT_EQ ( 512u, client.gbn.getSplitSize() );
+
+    // The max split size is also a limit on the current split size
+    client.gbn.setMaxSplitSize ( MIN_SPLIT_SIZE );
+
+    EXPECT_EQ ( uint32_t ( MIN_SPLIT_SIZE ), client.gbn.getSplitSize() );
+
+    SocketManager::get().deinitialize();
+    TimerManager::get().deinitialize();
+}
+
+TEST ( GoBackN, DatagramSizePerWireVersion )
+{
+    struct TestOwner : public TestClass
+    {
+        uint8_t wireVersion = WIRE_VERSION_LEGACY;
+
+        void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override {}
+
+        uint8_t goBackNWireVersion ( const GoBackN *gbn ) const override
+        {
+            return wireVersion;
+        }
+    };
+
+    TimerManager::get().initialize();
+
+    TestOwner owner;
+    GoBackN gbn ( &owner );
+
+    // The overhead follows the owner's wire version, since the encoding and the hash trailer can change with it
+    for ( uint8_t wireVersion = WIRE_VERSION_LEGACY; wireVersion <= WIRE_VERSION_LATEST; ++wireVersion )
+    {
+        owner.wireVersion = wireVersion;
+
+        const string empty = ::Protocol::encode ( SplitMessage ( MsgType::SplitMessage, "" ), wireVersion );
+
+        EXPECT_EQ ( MIN_SPLIT_SIZE + empty.size(), gbn.getDatagramSize() );
+    }
+
+    TimerManager::get().deinitialize();
+}
+
 #endif // NOT RELEASE
@@ -0,0 +1,404 @@
+#ifndef RELEASE
+
+#include "InputsContainer.hpp"
+#include "Test.Benchmark.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <cstdlib>
+
+using namespace std;
+
+
+// 30 minutes at 60 fps
+#define NUM_STREAM_FRAMES       ( 30 * 60 * 60 )
+
+// Frames per in-game index, 90 second rounds
+#define INGAME_FRAMES           ( 90 * 60 )
+
+// Frames per index between rounds, eg loading or retry menu
+#define OTHER_FRAMES            ( 300 )
+
+// Number of inputs sent in each PlayerInputs message
+#define INPUTS_PER_MESSAGE      ( 30 )
+
+#define NUM_BENCHMARK_RUNS      ( 10 )
+
+
+// The previous vector of vectors implementation, used as the reference for the expected semantics
+template<typename T>
+class VectorInputsContainer
+{
+public:
+
+    T get ( uint32_t index, uint32_t frame ) const
+    {
+        if ( index >= _inputs.size() || _inputs[index].empty() )
+            return lastInputBefore ( index );
+
+        if ( frame >= _inputs[index].size() )
+            return _inputs[index].back();
+
+        return _inputs[index][frame];
+    }
+
+    void get ( uint32_t index, uint32_t frame, T *t, size_t n ) const
+    {
+        std::copy ( _inputs[index].begin() + frame, _inputs[index].begin() + frame + n, t );
+    }
+
+    void set ( uint32_t index, uint32_t frame, T t )
+    {
+        if ( _inputs.size() > index && _inputs[index].size() > frame )
+            return;
+
+        resize ( index, frame );
+
+        _inputs[index][frame] = t;
+    }
+
+    void assign ( uint32_t index, uint32_t frame, T t )
+    {
+        resize ( index, frame );
+
+        _inputs[index][frame] = t;
+    }
+
+    void set ( uint32_t index, uint32_t frame, T t, size_t n )
+    {
+        resize ( index, frame, n );
+
+        std::fill ( _inputs[index].begin() + frame, _inputs[index].begin() + frame + n, t );
+    }
+
+    void set ( uint32_t index, uint32_t frame, const T *t, size_t n, uint32_t checkStartingFromIndex = UINT_MAX )
+    {
+        if ( index >= checkStartingFromIndex )
+        {
+            IndexedFrame f;
+            size_t i;
+
+            for ( i = 0, f = {{ frame, index }}; i < n; ++i, ++f.parts.frame )
+            {
+                if ( get ( f.parts.index, f.parts.frame ) == t[i] )
+                    continue;
+
+                _lastChangedFrame.value = std::min ( _lastChangedFrame.value, f.value );
+                break;
+            }
+        }
+
+        resize ( index, frame, n );
+
+        std::copy ( t, t + n, &_inputs[index][frame] );
+    }
+
+    void resize ( uint32_t index, uint32_t frame, size_t n = 1 )
+    {
+        T last = 0;
+
+        if ( index >= _inputs.size() )
+        {
+            last = lastInputBefore ( _inputs.size() );
+            _inputs.resize ( index + 1 );
+        }
+        else if ( ! _inputs[index].empty() )
+        {
+            last = _inputs[index].back();
+        }
+
+        if ( frame + n > _inputs[index].size() )
+            _inputs[index].resize ( frame + n, last );
+    }
+
+    void clear() { _inputs.clear(); }
+
+    bool empty() const { return _inputs.empty(); }
+
+    bool empty ( size_t index ) const { return ( index >= _inputs.size() || _inputs[index].empty() ); }
+
+    uint32_t getEndIndex() const { return _inputs.size(); }
+
+    uint32_t getEndFrame() const { return ( _inputs.empty() ? 0 : _inputs.back().size() ); }
+
+    uint32_t getEndFrame ( size_t index ) const { return ( index >= _inputs.size() ? 0 : _inputs[index].size() ); }
+
+    void eraseIndexOlderThan ( size_t index )
+    {
+        if ( index + 1 >= _inputs.size() )
+            _inputs.clear();
+        else
+            _inputs.erase ( _inputs.begin(), _inputs.begin() + index );
+    }
+
+    IndexedFrame getLastChangedFrame() const { return _lastChangedFrame; }
+
+    void clearLastChangedFrame() { _lastChangedFrame = MaxIndexedFrame; }
+
+    size_t getAllocatedBytes() const
+    {
+        size_t bytes = 0;
+
+        for ( const std::vector<T>& inputs : _inputs )
+            bytes += inputs.capacity() * sizeof ( T );
+
+        return bytes;
+    }
+
+private:
+
+    std::vector<std::vector<T>> _inputs;
+
+    IndexedFrame _lastChangedFrame = MaxIndexedFrame;
+
+    T lastInputBefore ( uint32_t index ) const
+    {
+        if ( _inputs.empty() || index == 0 )
+            return 0;
+
+        if ( index > _inputs.size() )
+            index = _inputs.size();
+
+        do
+        {
+            --index;
+            if ( ! _inputs[index].empty() )
+                return _inputs[index].back();
+        }
+        while ( index > 0 );
+
+        return 0;
+    }
+};
+
+
+// Check that every observable value matches the reference container
+template<typename A, typename B>
+static void expectSameInputs ( const A& a, const B& b )
+{
+    ASSERT_EQ ( a.getEndIndex(), b.getEndIndex() );
+    ASSERT_EQ ( a.getEndFrame(), b.getEndFrame() );
+    ASSERT_EQ ( a.empty(), b.empty() );
+    ASSERT_EQ ( a.getLastChangedFrame().value, b.getLastChangedFrame().value );
+
+    for ( uint32_t i = 0; i <= a.getEndIndex() + 1; ++i )
+    {
+        ASSERT_EQ ( a.empty ( i ), b.empty ( i ) ) << "index=" << i;
+        ASSERT_EQ ( a.getEndFrame ( i ), b.getEndFrame ( i ) ) << "index=" << i;
+
+        for ( uint32_t j = 0; j <= a.getEndFrame ( i ) + 1; ++j )
+            ASSERT_EQ ( a.get ( i, j ), b.get ( i, j ) ) << "index=" << i << " frame=" << j;
+    }
+}
+
+
+TEST ( InputsContainer, MatchesVectorContainer )
+{
+    InputsContainer<uint16_t> inputs;
+    VectorInputsContainer<uint16_t> expected;
+
+    srand ( 1234 );
+
+    // Small chunks of frames relative to the chunk size, so ranges cross chunk boundaries
+    const uint32_t maxFrame = 3 * INPUTS_CHUNK_SIZE / sizeof ( uint16_t );
+
+    uint16_t buffer[INPUTS_PER_MESSAGE];
+
+    for ( size_t i = 0; i < 5000; ++i )
+    {
+        const uint32_t index = rand() % 8;
+        const uint32_t frame = ( rand() % 4 == 0 ? rand() % maxFrame : rand() % 40 );
+        const uint16_t input = 1 + rand() % 4;
+        const size_t n = rand() % INPUTS_PER_MESSAGE;
+
+        switch ( rand() % 9 )
+        {
+            case 0:
+                inputs.set ( index, frame, input );
+                expected.set ( index, frame, input );
+                break;
+
+            case 1:
+                inputs.assign ( index, frame, input );
+                expected.assign ( index, frame, input );
+                break;
+
+            case 2:
+                inputs.set ( index, frame, input, n );
+                expected.set ( index, frame, input, n );
+                break;
+
+            case 3:
+            {
+                const uint32_t checkStartingFromIndex = rand() % 4;
+
+                for ( size_t j = 0; j < n; ++j )
+                    buffer[j] = ( rand() % 2 ? input : expected.get ( index, frame + j ) );
+
+                inputs.set ( index, frame, buffer, n, checkStartingFromIndex );
+                expected.set ( index, frame, buffer, n, checkStartingFromIndex );
+                break;
+            }
+
+            case 4:
+                inputs.resize ( index, frame, n );
+                expected.resize ( index, frame, n );
+                break;
+
+            case 5:
+                inputs.resize ( index, 0, 0 );
+                expected.resize ( index, 0, 0 );
+                break;
+
+            case 6:
+                if ( rand() % 8 == 0 )
+                {
+                    inputs.clear();
+                    expected.clear();
+                }
+                else
+                {
+                    const size_t older = rand() % 4;
+                    inputs.eraseIndexOlderThan ( older );
+                    expected.eraseIndexOlderThan ( older );
+                }
+                break;
+
+            case 7:
+                inputs.clearLastChangedFrame();
+                expected.clearLastChangedFrame();
+                break;
+
+            default:
+                if ( index < expected.getEndIndex() && expected.getEndFrame ( index ) > frame )
+                {
+                    const size_t count = min<size_t> ( n, expected.getEndFrame ( index ) - frame );
+                    uint16_t actual[INPUTS_PER_MESSAGE], reference[INPUTS_PER_MESSAGE];
+
+                    inputs.get ( index, frame, actual, count );
+                    expected.get ( index, frame, reference, count );
+
+                    ASSERT_TRUE ( equal ( actual, actual + count, reference ) );
+                }
+                break;
+        }
+
+        expectSameInputs ( inputs, expected );
+
+        if ( HasFatalFailure() )
+            return;
+    }
+}
+
+
+TEST ( InputsContainer, ReusesChunks )
+{
+    InputsContainer<uint16_t> inputs;
+
+    for ( size_t i = 0; i < 1000; ++i )
+    {
+        inputs.set ( inputs.getEndIndex(), INGAME_FRAMES, 1 );
+
+        if ( inputs.getEndIndex() > 2 )
+            inputs.eraseIndexOlderThan ( 1 );
+
+        ASSERT_LE ( inputs.getEndIndex(), 2u );
+    }
+
+    // Two live indices plus the free list, regardless of how many indices were played
+    const size_t chunksPerIndex = ( INGAME_FRAMES + INPUTS_CHUNK_SIZE / sizeof ( uint16_t ) )
+                                  / ( INPUTS_CHUNK_SIZE / sizeof ( uint16_t ) );
+
+    EXPECT_LE ( inputs.getAllocatedBytes(), ( 2 * chunksPerIndex + INPUTS_MAX_FREE_CHUNKS ) * INPUTS_CHUNK_SIZE );
+}
+
+
+// Replay a 30 minute input stream the way the netplay manager uses it: each frame the local input is set ahead by the
+// delay, the remote inputs arrive as overlapping batches, and both players' inputs are read back. Indices are relative
+// to a start index, and at every loading transition all but the last few indices are erased.
+template<typename C>
+static uint64_t replayStream ( C& local, C& remote, size_t& peakBytes )
+{
+    const uint32_t delay = 4;
+    const uint32_t preserve = 4;
+
+    uint64_t checksum = 0;
+    uint32_t startIndex = 0, index = 0, frame = 0;
+    uint32_t indexFrames = OTHER_FRAMES;
+
+    uint16_t batch[INPUTS_PER_MESSAGE];
+
+    peakBytes = 0;
+
+    for ( uint32_t i = 0; i < NUM_STREAM_FRAMES; ++i, ++frame )
+    {
+        if ( frame == indexFrames )
+        {
+            ++index;
+            frame = 0;
+            indexFrames = ( index % 2 ? INGAME_FRAMES : OTHER_FRAMES );
+
+            peakBytes = max ( peakBytes, local.getAllocatedBytes() + remote.getAllocatedBytes() );
+
+            if ( index % 4 == 0 && index - startIndex > preserve )
+            {
+                const uint32_t offset = index - preserve - startIndex;
+
+                local.eraseIndexOlderThan ( offset );
+                remote.eraseIndexOlderThan ( offset );
+                startIndex += offset;
+            }
+
+            remote.resize ( index - startIndex, 0, 0 );
+        }
+
+        const uint32_t relativeIndex = index - startIndex;
+        const uint16_t input = ( ( i / 7 ) * 2654435761u ) >> 20;
+
+        local.set ( relativeIndex, frame + delay, input );
+
+        if ( frame % 2 == 0 )
+        {
+            const uint32_t end = frame + delay + 1;
+            const uint32_t start = ( end > INPUTS_PER_MESSAGE ? end - INPUTS_PER_MESSAGE : 0 );
+            const size_t n = end - start;
+
+            for ( size_t j = 0; j < n; ++j )
+                batch[j] = ( ( ( i - frame + start + j ) / 11 ) * 40503u ) >> 4;
+
+            remote.set ( relativeIndex, start, batch, n, relativeIndex );
+        }
+
+        checksum = checksum * 31 + local.get ( relativeIndex, frame ) + remote.get ( relativeIndex, frame );
+    }
+
+    return checksum;
+}
+
+
+TEST ( InputsContainer, StreamBenchmark )
+{
+    uint64_t expected = 0, actual = 0;
+    size_t vectorBytes = 0, chunkedBytes = 0;
+
+    const double vectorNs = benchmark ( NUM_BENCHMARK_RUNS, [&]()
+    {
+        VectorInputsContainer<uint16_t> local, remote;
+        expected = replayStream ( local, remote, vectorBytes );
+    } );
+
+    const double chunkedNs = benchmark ( NUM_BENCHMARK_RUNS, [&]()
+    {
+        InputsContainer<uint16_t> local, remote;
+        actual = replayStream ( local, remote, chunkedBytes );
+    } );
+
+    printBenchmark ( "InputsContainer 30 minute stream", vectorNs / NUM_STREAM_FRAMES, chunkedNs / NUM_STREAM_FRAMES );
+
+    PRINT ( "[ BENCHMARK] InputsContainer peak memory: %u bytes -> %u bytes", vectorBytes, chunkedBytes );
+
+    EXPECT_EQ ( expected, actual );
+}
+
+#endif // NOT RELEASE
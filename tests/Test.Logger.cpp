@@ -0,0 +1,358 @@
+#if !defined(RELEASE) && !defined(DISABLE_LOGGING)
+
+#include "Logger.hpp"
+#include "MappedFile.hpp"
+#include "Test.Benchmark.hpp"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+
+using namespace std;
+
+
+#define TEST_SYNC_LOG_FILE      "test_sync.log"
+#define TEST_ASYNC_LOG_FILE     "test_async.log"
+
+#define NUM_LOG_THREADS         ( 4 )
+#define NUM_THREAD_LOGS         ( 1000 )
+#define NUM_BENCHMARK_LOGS      ( 2000 )
+
+
+// Type that is only printable with operator<<
+struct LoggedPoint
+{
+    int x, y;
+};
+
+static ostream& operator<< ( ostream& os, const LoggedPoint& a ) { return ( os << '{' << a.x << ", " << a.y << '}' ); }
+
+
+static string readFile ( const string& filename )
+{
+    ifstream fin ( filename.c_str(), ifstream::binary );
+    stringstream ss;
+    ss << fin.rdbuf();
+    return ss.str();
+}
+
+static string decodeLogFile ( const string& filename )
+{
+    MappedFile file;
+    string text;
+
+    EXPECT_TRUE ( file.open ( filename ) );
+    EXPECT_TRUE ( decodeLog ( file.data(), file.size(), text ) );
+
+    return text;
+}
+
+// Log the same messages from the same call sites, so the sync and async logs can be compared
+static void logTestMessages ( Logger& logger )
+{
+    const char str[] = "array";
+    const char *nullStr = 0;
+    const string escaped = "100%% done";
+    const int negative = -12345;
+    const uint8_t byte = 0xFE;
+    const int8_t signedByte = -2;
+    const uint16_t word = 0xBEEF;
+    const uint64_t big = 0x123456789ABCDEFULL;
+    const float f = 1.25f;
+    static const int pointed = 0;
+
+    LOG_TO ( logger, "No arguments 100%% literal" );
+    LOG_TO ( logger, "Integers: %d %u %02x %d %04X %llu %llx", negative, 42u, byte, signedByte, word, big, big );
+    LOG_TO ( logger, "Floats: %.1f %.3f %Lg", f, 3.14159, 2.5L );
+    LOG_TO ( logger, "Bools: %d %u", true, false );
+    LOG_TO ( logger, "Strings: %s '%s' %s %s %s", "literal", str, string ( "std::string" ), escaped, nullStr );
+    LOG_TO ( logger, "Pointers: %p %08x", ( const void * ) &pointed, &pointed );
+    LOG_TO ( logger, "Operator: %s; LOG_LIST style=[%s]", LoggedPoint { 1, -2 }, string ( " 1, 2, 3 " ) );
+    LOG_TO ( logger, "Missing argument: %u %u %s", 1u );
+    LOG_TO ( logger, "Extra argument: %u", 1u, 2u );
+    LOG_TO ( logger, "Width %10s|%-6d|%+d", "right", 7, 8 );
+    LOG_TO ( logger, "Trailing percent %u %", 5u );
+    LOG_TO ( logger, "Long string: %s", string ( 2 * LOG_MAX_RECORD_SIZE, 'x' ).substr ( 0, 1000 ) );
+}
+
+
+TEST ( Logger, AsyncMatchesSync )
+{
+    const uint32_t options = LOG_FILE_LINE | LOG_FUNC_NAME;
+
+    Logger syncLogger, asyncLogger;
+
+    syncLogger.initialize ( TEST_SYNC_LOG_FILE, options );
+    asyncLogger.initialize ( TEST_ASYNC_LOG_FILE, options | LOG_ASYNC );
+
+    for ( size_t i = 0; i < 10; ++i )
+    {
+        logTestMessages ( syncLogger );
+        logTestMessages ( asyncLogger );
+
+        // Text written directly is kept in order with the records
+        syncLogger.log ( "file", 1, "func()", "direct" );
+        asyncLogger.log ( "file", 1, "func()", "direct" );
+    }
+
+    syncLogger.deinitialize();
+    asyncLogger.deinitialize();
+
+    const string expected = readFile ( TEST_SYNC_LOG_FILE );
+    const string binary = readFile ( TEST_ASYNC_LOG_FILE );
+
+    EXPECT_FALSE ( expected.empty() );
+    EXPECT_EQ ( expected, decodeLogFile ( TEST_ASYNC_LOG_FILE ) );
+
+    // Each site is only stored once
+    EXPECT_LT ( binary.size(), expected.size() );
+
+    // A truncated file decodes up to the last complete entry
+    string text;
+    EXPECT_FALSE ( decodeLog ( binary.c_str(), binary.size() - 1, text ) );
+    EXPECT_FALSE ( text.empty() );
+    EXPECT_EQ ( 0u, expected.find ( text ) );
+
+    remove ( TEST_SYNC_LOG_FILE );
+    remove ( TEST_ASYNC_LOG_FILE );
+}
+
+
+TEST ( Logger, AsyncTimestamps )
+{
+    Logger logger;
+    logger.initialize ( TEST_ASYNC_LOG_FILE, LOG_DEFAULT_OPTIONS | LOG_ASYNC );
+
+    LOG_TO ( logger, "Timestamped %u", 1u );
+
+    logger.deinitialize();
+
+    const string text = decodeLogFile ( TEST_ASYNC_LOG_FILE );
+
+    // HH:MM:SS.mmm:file:line:function: message
+    ASSERT_GT ( text.size(), 13u );
+    EXPECT_EQ ( ':', text[2] );
+    EXPECT_EQ ( ':', text[5] );
+    EXPECT_EQ ( '.', text[8] );
+    EXPECT_EQ ( ':', text[12] );
+    EXPECT_NE ( string::npos, text.find ( "Test.Logger.cpp:" ) );
+    EXPECT_NE ( string::npos, text.find ( ": Timestamped 1\n" ) );
+
+    remove ( TEST_ASYNC_LOG_FILE );
+}
+
+
+// Logs numbered messages, each thread has its own ring buffer
+struct LoggingThread : public Thread
+{
+    Logger& logger;
+    uint32_t id;
+
+    LoggingThread ( Logger& logger, uint32_t id ) : logger ( logger ), id ( id ) {}
+
+    void run() override
+    {
+        for ( uint32_t i = 0; i < NUM_THREAD_LOGS; ++i )
+            LOG_TO ( logger, "thread=%u; i=%u", id, i );
+    }
+};
+
+
+TEST ( Logger, AsyncThreads )
+{
+    Logger logger;
+    logger.initialize ( TEST_ASYNC_LOG_FILE, LOG_ASYNC );
+
+    vector<unique_ptr<LoggingThread>> threads;
+
+    for ( uint32_t id = 0; id < NUM_LOG_THREADS; ++id )
+    {
+        threads.push_back ( unique_ptr<LoggingThread> ( new LoggingThread ( logger, id ) ) );
+        threads.back()->start();
+    }
+
+    for ( auto& thread : threads )
+        thread->join();
+
+    logger.deinitialize();
+
+    stringstream ss ( decodeLogFile ( TEST_ASYNC_LOG_FILE ) );
+    string line;
+    vector<uint32_t> next ( NUM_LOG_THREADS, 0 );
+    uint32_t dropped = 0;
+
+    while ( getline ( ss, line ) )
+    {
+        uint32_t id, i;
+
+        if ( sscanf ( line.c_str(), "Dropped %u", &i ) == 1 )
+        {
+            dropped += i;
+            continue;
+        }
+
+        ASSERT_EQ ( 2, sscanf ( line.c_str(), "thread=%u; i=%u", &id, &i ) );
+        ASSERT_LT ( id, ( uint32_t ) NUM_LOG_THREADS );
+
+        // Records from each thread stay in order
+        EXPECT_LE ( next[id], i );
+        next[id] = i + 1;
+    }
+
+    // Nothing should be dropped with these sizes, but a full ring is counted instead of blocking
+    EXPECT_EQ ( 0u, dropped );
+
+    for ( uint32_t count : next )
+        EXPECT_EQ ( ( uint32_t ) NUM_THREAD_LOGS, count );
+
+    remove ( TEST_ASYNC_LOG_FILE );
+}
+
+
+TEST ( Logger, AsyncManyLoggers )
+{
+    // More loggers than each thread caches a ring for
+    const size_t count = 8;
+
+    vector<unique_ptr<Logger>> loggers;
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        loggers.push_back ( unique_ptr<Logger> ( new Logger() ) );
+        loggers.back()->initialize ( format ( "test_async_%u.log", i ), LOG_ASYNC );
+    }
+
+    for ( uint32_t i = 0; i < 100; ++i )
+    {
+        for ( auto& it : loggers )
+        {
+            Logger& logger = *it;
+            LOG_TO ( logger, "i=%u", i );
+        }
+    }
+
+    // The evicted rings are found again instead of allocating a new ring on each miss
+    for ( auto& logger : loggers )
+        EXPECT_EQ ( 1u, logger->getNumRings() );
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        loggers[i]->deinitialize();
+
+        const string text = decodeLogFile ( format ( "test_async_%u.log", i ) );
+
+        EXPECT_EQ ( 100u, ( size_t ) count_if ( text.begin(), text.end(), [] ( char c ) { return c == '\n'; } ) );
+        EXPECT_EQ ( 0u, text.find ( "i=0\n" ) );
+
+        remove ( format ( "test_async_%u.log", i ).c_str() );
+    }
+}
+
+
+// Logs until stopped
+struct NonStopLoggingThread : public Thread
+{
+    Logger& logger;
+    volatile bool running = true;
+    uint32_t count = 0;
+
+    NonStopLoggingThread ( Logger& logger ) : logger ( logger ) {}
+
+    void run() override
+    {
+        while ( running )
+            LOG_TO ( logger, "count=%u", count++ );
+    }
+};
+
+
+TEST ( Logger, AsyncRestartWhileLogging )
+{
+    Logger logger;
+    logger.initialize ( TEST_SYNC_LOG_FILE, LOG_ASYNC );
+
+    vector<unique_ptr<NonStopLoggingThread>> threads;
+
+    for ( uint32_t id = 0; id < NUM_LOG_THREADS; ++id )
+    {
+        threads.push_back ( unique_ptr<NonStopLoggingThread> ( new NonStopLoggingThread ( logger ) ) );
+        threads.back()->start();
+    }
+
+    // Each restart frees the rings while the threads still have them cached
+    for ( size_t i = 0; i < 20; ++i )
+        logger.initialize ( ( i % 2 ) ? TEST_SYNC_LOG_FILE : TEST_ASYNC_LOG_FILE, LOG_ASYNC );
+
+    for ( auto& thread : threads )
+    {
+        thread->running = false;
+        thread->join();
+        EXPECT_GT ( thread->count, 0u );
+    }
+
+    // At most one ring per thread since the last restart
+    EXPECT_LE ( logger.getNumRings(), ( size_t ) NUM_LOG_THREADS );
+
+    logger.deinitialize();
+
+    // The file still decodes, records pushed after a ring was invalidated are just not written
+    decodeLogFile ( TEST_SYNC_LOG_FILE );
+
+    remove ( TEST_SYNC_LOG_FILE );
+    remove ( TEST_ASYNC_LOG_FILE );
+}
+
+
+TEST ( Logger, AsyncReopenTextLog )
+{
+    Logger logger;
+    logger.initialize ( TEST_ASYNC_LOG_FILE, 0 );
+    LOG_TO ( logger, "text=%u", 1u );
+
+    // Switching the same file to binary records starts it over, like the DLL does once it gets its options
+    logger.initialize ( TEST_ASYNC_LOG_FILE, LOG_ASYNC );
+    LOG_TO ( logger, "binary=%u", 2u );
+    logger.deinitialize();
+
+    const string text = decodeLogFile ( TEST_ASYNC_LOG_FILE );
+
+    EXPECT_EQ ( string::npos, text.find ( "text=1" ) );
+    EXPECT_NE ( string::npos, text.find ( "binary=2" ) );
+
+    remove ( TEST_ASYNC_LOG_FILE );
+}
+
+
+TEST ( Logger, Benchmark )
+{
+    Logger syncLogger, asyncLogger;
+
+    syncLogger.initialize ( TEST_SYNC_LOG_FILE, LOG_DEFAULT_OPTIONS );
+    asyncLogger.initialize ( TEST_ASYNC_LOG_FILE, LOG_DEFAULT_OPTIONS | LOG_ASYNC );
+
+    uint32_t frame = 0;
+
+    // Similar to the per frame LOG_SYNC_CHARACTER
+    auto logFrame = [&] ( Logger& logger )
+    {
+        ++frame;
+        LOG_TO ( logger, "%s [%u] %s [%u] P%u: C=%u; M=%u; seq=%u; hp=%u; gb=%.1f; x=%d; y=%d",
+                 "InGame", 1, "NetplayState::InGame", frame, 1, 12, 2, 40, 11400, 7000.0f, -1234, 0 );
+    };
+
+    const double syncNs = benchmark ( NUM_BENCHMARK_LOGS, [&]() { logFrame ( syncLogger ); } );
+    const double asyncNs = benchmark ( NUM_BENCHMARK_LOGS, [&]() { logFrame ( asyncLogger ); } );
+
+    syncLogger.deinitialize();
+    asyncLogger.deinitialize();
+
+    printBenchmark ( "Logger per frame sync log", syncNs, asyncNs );
+
+    remove ( TEST_SYNC_LOG_FILE );
+    remove ( TEST_ASYNC_LOG_FILE );
+}
+
+#endif // NOT RELEASE && NOT DISABLE_LOGGING
@@ -0,0 +1,201 @@
+#ifndef RELEASE
+
+#include "MemDump.hpp"
+#include "Test.Benchmark.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <memory>
+#include <cstdlib>
+
+using namespace std;
+
+
+#define NUM_BENCHMARK_FRAMES    ( 200 )
+
+#define NUM_EFFECTS             ( 1000 )
+#define EFFECT_SIZE             ( 0x33C )
+#define PLAYER_SIZE             ( 0xAFC )
+#define GRAPHICS_SIZE           ( 4000 * 0x60 )
+#define MISC_SIZE               ( 0x1000 )
+
+#define PTR_SIZE                ( sizeof ( char * ) )
+
+
+// Change random bytes in the given memory
+static void scribble ( char *bytes, size_t size )
+{
+    for ( size_t i = 0; i < size; i += 1 + rand() % 64 )
+        bytes[i] = rand();
+}
+
+
+// Synthetic game memory shaped like the list from tools/Generator.cpp: scattered scalars, a large graphics array,
+// ranges in 4 player structs, and an effects array where every effect has a chain of 3 pointers.
+struct GeneratorMemory
+{
+    char misc[MISC_SIZE];
+    char graphics[GRAPHICS_SIZE];
+    char players[4][PLAYER_SIZE];
+    char effects[NUM_EFFECTS][EFFECT_SIZE];
+
+    // Each chain is: effect + 0x320 -> node + 0x38 -> node -> value
+    struct Chain
+    {
+        char node1[0x38 + PTR_SIZE];
+        char *node2;
+        char value[PTR_SIZE];
+    };
+
+    Chain chains[NUM_EFFECTS];
+
+    MemDumpList addrs;
+
+    GeneratorMemory()
+    {
+        for ( size_t i = 0; i < NUM_EFFECTS; ++i )
+            link ( i, i );
+
+        // Scattered scalars and small ranges
+        for ( size_t i = 0; i < 64; ++i )
+            addrs.append ( MemDump ( misc + i * 0x40, 4 * ( 1 + i % 4 ) ) );
+
+        addrs.append ( MemDump ( graphics, sizeof ( graphics ) ) );
+
+        // Similar to playerAddrs: a few large continuous ranges, then some scalars
+        for ( size_t i = 0; i < 4; ++i )
+        {
+            addrs.append ( MemDump ( players[i], 0x154 ) );
+            addrs.append ( MemDump ( players[i] + 0x158, 0x44 ) );
+
+            for ( size_t j = 0; j < 8; ++j )
+                addrs.append ( MemDump ( players[i] + 0x200 + j * 0x80, 4 ) );
+        }
+
+        const MemDump firstEffect ( effects[0], EFFECT_SIZE, {
+            MemDumpPtr ( 0x320, 0x38, PTR_SIZE, {
+                MemDumpPtr ( 0, 0, PTR_SIZE, {
+                    MemDumpPtr ( 0, 0, PTR_SIZE )
+                } )
+            } )
+        } );
+
+        for ( size_t i = 0; i < NUM_EFFECTS; ++i )
+            addrs.append ( firstEffect, EFFECT_SIZE * i );
+
+        addrs.update();
+    }
+
+    // Point the effect at the given chain, or null if chain is out of range
+    void link ( size_t effect, size_t chain )
+    {
+        Chain *c = ( chain < NUM_EFFECTS ? &chains[chain] : 0 );
+
+        * ( char ** ) ( effects[effect] + 0x320 ) = ( c ? c->node1 : 0 );
+
+        if ( c )
+        {
+            * ( char ** ) ( c->node1 + 0x38 ) = ( char * ) &c->node2;
+            c->node2 = c->value;
+        }
+    }
+
+    // Randomize the data, but keep the pointers valid. Some effects become inactive with null pointers.
+    void randomize()
+    {
+        scribble ( misc, sizeof ( misc ) );
+        scribble ( graphics, sizeof ( graphics ) );
+        scribble ( players[0], sizeof ( players ) );
+        scribble ( effects[0], sizeof ( effects ) );
+
+        for ( size_t i = 0; i < NUM_EFFECTS; ++i )
+        {
+            link ( i, ( rand() % 4 == 0 ? NUM_EFFECTS : rand() % NUM_EFFECTS ) );
+            chains[i].value[0] = rand();
+        }
+    }
+
+    // Dump using the recursive MemDumpBase::saveDump
+    string dump() const
+    {
+        string bytes ( addrs.totalSize, ( char ) 0 );
+        char *dump = &bytes[0];
+
+        for ( const MemDump& mem : addrs.addrs )
+            mem.saveDump ( dump );
+
+        EXPECT_EQ ( &bytes[0] + bytes.size(), dump );
+        return bytes;
+    }
+};
+
+
+TEST ( MemDump, CompiledSaveLoad )
+{
+    unique_ptr<GeneratorMemory> memory ( new GeneratorMemory() );
+
+    srand ( 1234 );
+
+    for ( size_t i = 0; i < 10; ++i )
+    {
+        memory->randomize();
+
+        const string expected = memory->dump();
+
+        string bytes ( memory->addrs.totalSize, ( char ) 0 );
+        memory->addrs.saveDump ( &bytes[0] );
+
+        ASSERT_EQ ( expected, bytes );
+
+        // Loading must restore the pointers before following them
+        memory->randomize();
+        memory->addrs.loadDump ( &bytes[0] );
+
+        ASSERT_EQ ( expected, memory->dump() );
+    }
+}
+
+
+TEST ( MemDump, CompiledBenchmark )
+{
+    unique_ptr<GeneratorMemory> memory ( new GeneratorMemory() );
+
+    srand ( 1234 );
+    memory->randomize();
+
+    string bytes ( memory->addrs.totalSize, ( char ) 0 );
+
+    const double recursiveSaveNs = benchmark ( NUM_BENCHMARK_FRAMES, [&]()
+    {
+        char *dump = &bytes[0];
+
+        for ( const MemDump& mem : memory->addrs.addrs )
+            mem.saveDump ( dump );
+    } );
+
+    const double compiledSaveNs = benchmark ( NUM_BENCHMARK_FRAMES, [&]()
+    {
+        memory->addrs.saveDump ( &bytes[0] );
+    } );
+
+    const double recursiveLoadNs = benchmark ( NUM_BENCHMARK_FRAMES, [&]()
+    {
+        const char *dump = &bytes[0];
+
+        for ( const MemDump& mem : memory->addrs.addrs )
+            mem.loadDump ( dump );
+    } );
+
+    const double compiledLoadNs = benchmark ( NUM_BENCHMARK_FRAMES, [&]()
+    {
+        memory->addrs.loadDump ( &bytes[0] );
+    } );
+
+    printBenchmark ( "MemDumpList save", recursiveSaveNs, compiledSaveNs );
+    printBenchmark ( "MemDumpList load", recursiveLoadNs, compiledLoadNs );
+
+    EXPECT_EQ ( bytes, memory->dump() );
+}
+
+#endif // NOT RELEASE
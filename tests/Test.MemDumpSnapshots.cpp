@@ -0,0 +1,210 @@
+#ifndef RELEASE
+
+#include "MemDumpSnapshots.hpp"
+#include "Test.Benchmark.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <list>
+#include <memory>
+#include <cstdlib>
+
+using namespace std;
+
+
+#define MAX_SNAPSHOTS           ( 16 )
+#define NUM_TEST_FRAMES         ( 500 )
+#define NUM_BENCHMARK_FRAMES    ( 1000 )
+
+
+// Synthetic game memory: a large effects array, player structs, and a pointer to a separately allocated struct
+struct TestMemory
+{
+    char effects[1000 * 0x33C];
+    char players[4][0xAFC];
+
+    char *pointer;
+    char padding[60];
+
+    char pointed[2][0x200];
+
+    MemDumpList addrs;
+
+    TestMemory()
+    {
+        memset ( effects, 0, sizeof ( effects ) );
+        memset ( players, 0, sizeof ( players ) );
+        memset ( pointed, 0, sizeof ( pointed ) );
+
+        pointer = pointed[0];
+
+        addrs.append ( MemDump ( effects, sizeof ( effects ) ) );
+        addrs.append ( MemDump ( players, sizeof ( players ) ) );
+        addrs.append ( MemDump ( &pointer, sizeof ( pointer ) + sizeof ( padding ),
+                                 { MemDumpPtr ( 0, 0x10, 0x100 ) } ) );
+        addrs.update();
+    }
+
+    // Change a few bytes, similar to a frame of gameplay
+    void step ( size_t changes )
+    {
+        for ( size_t i = 0; i < changes; ++i )
+        {
+            effects[rand() % sizeof ( effects )] = rand();
+            players[rand() % 4][rand() % sizeof ( players[0] )] = rand();
+        }
+
+        // Sometimes change the pointer, including to null
+        switch ( rand() % 16 )
+        {
+            case 0:
+                pointer = pointed[rand() % 2];
+                break;
+
+            case 1:
+                pointer = 0;
+                break;
+
+            default:
+                if ( pointer )
+                    pointer[0x10 + rand() % 0x100] = rand();
+                break;
+        }
+    }
+
+    // Full copy of the memory described by addrs
+    string dump() const
+    {
+        string bytes ( addrs.totalSize, ( char ) 0 );
+        char *dump = &bytes[0];
+
+        for ( const MemDump& mem : addrs.addrs )
+            mem.saveDump ( dump );
+
+        return bytes;
+    }
+};
+
+
+TEST ( MemDumpSnapshots, SaveLoad )
+{
+    unique_ptr<TestMemory> memory ( new TestMemory() );
+
+    MemDumpSnapshots snapshots;
+    snapshots.allocate ( memory->addrs, MAX_SNAPSHOTS );
+
+    // Saved snapshot ids and the expected memory dumps, in chronological order
+    list<pair<size_t, string>> expected;
+
+    srand ( 1234 );
+
+    for ( size_t frame = 0; frame < NUM_TEST_FRAMES; ++frame )
+    {
+        // Erase the oldest or second oldest snapshot when full, like DllRollbackManager
+        if ( snapshots.full() )
+        {
+            auto it = expected.begin();
+
+            if ( rand() % 2 )
+                ++it;
+
+            snapshots.erase ( it->first );
+            expected.erase ( it );
+        }
+
+        memory->step ( 1 + rand() % 32 );
+
+        expected.push_back ( { snapshots.save(), memory->dump() } );
+
+        ASSERT_EQ ( expected.size(), snapshots.size() );
+
+        // Sometimes rollback to a random snapshot, then check the memory
+        if ( rand() % 8 == 0 )
+        {
+            auto it = expected.begin();
+            advance ( it, rand() % expected.size() );
+
+            memory->step ( 100 );
+
+            snapshots.load ( it->first );
+            expected.erase ( next ( it ), expected.end() );
+
+            ASSERT_EQ ( expected.size(), snapshots.size() );
+            ASSERT_EQ ( it->second, memory->dump() );
+        }
+
+        // Sometimes erase the newest snapshot
+        if ( rand() % 16 == 0 && expected.size() > 1 )
+        {
+            snapshots.erase ( expected.back().first );
+            expected.pop_back();
+        }
+    }
+
+    // Every remaining snapshot should still load correctly, from newest to oldest
+    while ( ! expected.empty() )
+    {
+        memory->step ( 100 );
+
+        snapshots.load ( expected.back().first );
+
+        ASSERT_EQ ( expected.back().second, memory->dump() );
+
+        snapshots.erase ( expected.back().first );
+        expected.pop_back();
+    }
+
+    EXPECT_TRUE ( snapshots.empty() );
+}
+
+
+TEST ( MemDumpSnapshots, SaveBenchmark )
+{
+    unique_ptr<TestMemory> memory ( new TestMemory() );
+
+    // The previous implementation copied the full memory into a pool of fixed size states
+    vector<char> pool ( MAX_SNAPSHOTS * memory->addrs.totalSize );
+    size_t poolIndex = 0;
+
+    srand ( 1234 );
+
+    const double fullNs = benchmark ( NUM_BENCHMARK_FRAMES, [&]()
+    {
+        memory->step ( 16 );
+
+        char *dump = &pool[ ( poolIndex++ % MAX_SNAPSHOTS ) * memory->addrs.totalSize];
+
+        for ( const MemDump& mem : memory->addrs.addrs )
+            mem.saveDump ( dump );
+    } );
+
+    MemDumpSnapshots snapshots;
+    snapshots.allocate ( memory->addrs, MAX_SNAPSHOTS );
+
+    list<size_t> ids;
+
+    srand ( 1234 );
+
+    const double incrementalNs = benchmark ( NUM_BENCHMARK_FRAMES, [&]()
+    {
+        memory->step ( 16 );
+
+        if ( snapshots.full() )
+        {
+            snapshots.erase ( ids.front() );
+            ids.pop_front();
+        }
+
+        ids.push_back ( snapshots.save() );
+    } );
+
+    printBenchmark ( "MemDumpSnapshots save", fullNs, incrementalNs );
+
+    PRINT ( "[   MEMORY ] %u snapshots: %u bytes -> %u bytes",
+            MAX_SNAPSHOTS, pool.size(), snapshots.getUsedBytes() );
+
+    EXPECT_LT ( snapshots.getUsedBytes(), pool.size() );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,264 @@
+#ifndef RELEASE
+
+#include "NetworkImpairment.hpp"
+#include "StringUtils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <string>
+#include <cstdio>
+
+using namespace std;
+
+
+#define NUM_PACKETS         ( 10000u )
+#define PACKET_INTERVAL     ( 5 )
+
+#define TEST_PROFILE_FILE   "test_network_profile.txt"
+
+
+// Collects released packets, packets are numbered so the tests can check their order
+struct TestImpairment : public NetworkImpairment::Owner
+{
+    NetworkImpairment impairment;
+    vector<uint32_t> released;
+    vector<uint64_t> times;
+    uint64_t now = 0;
+
+    bool impairmentReleased ( NetworkImpairment *impairment, const string& bytes, const IpAddrPort& address ) override
+    {
+        released.push_back ( * ( const uint32_t * ) &bytes[0] );
+        times.push_back ( now );
+        return true;
+    }
+
+    // Push numbered packets at a fixed interval, then release everything
+    void run ( size_t count, uint32_t size = sizeof ( uint32_t ), uint64_t interval = PACKET_INTERVAL )
+    {
+        string bytes ( max<uint32_t> ( size, sizeof ( uint32_t ) ), '\0' );
+
+        for ( uint32_t i = 0; i < count; ++i, now += interval )
+        {
+            impairment.release ( now );
+
+            * ( uint32_t * ) &bytes[0] = i;
+            impairment.push ( &bytes[0], bytes.size(), NullAddress, now );
+        }
+
+        while ( impairment.getQueued() )
+        {
+            now = impairment.getNextRelease();
+            impairment.release ( now );
+        }
+    }
+
+    TestImpairment ( const NetworkProfile& profile, bool isStream = false )
+        : impairment ( this, profile, isStream )
+    {
+        impairment.seed ( 12345 );
+    }
+};
+
+
+TEST ( NetworkImpairment, Disabled )
+{
+    NetworkProfile profile;
+    EXPECT_FALSE ( profile.isEnabled() );
+
+    // Only latency, so packets are released in order after exactly the latency
+    profile.latency = 50;
+    EXPECT_TRUE ( profile.isEnabled() );
+
+    TestImpairment test ( profile );
+    test.run ( 100 );
+
+    ASSERT_EQ ( 100u, test.released.size() );
+
+    for ( uint32_t i = 0; i < test.released.size(); ++i )
+    {
+        EXPECT_EQ ( i, test.released[i] );
+        EXPECT_EQ ( i * PACKET_INTERVAL + profile.latency, test.times[i] );
+    }
+}
+
+TEST ( NetworkImpairment, Jitter )
+{
+    NetworkProfile profile;
+    profile.latency = 50;
+    profile.jitter = 20;
+
+    TestImpairment test ( profile );
+    test.run ( NUM_PACKETS );
+
+    ASSERT_EQ ( NUM_PACKETS, test.released.size() );
+
+    size_t reordered = 0;
+
+    for ( size_t i = 0; i < test.released.size(); ++i )
+    {
+        const uint64_t sent = test.released[i] * PACKET_INTERVAL;
+
+        EXPECT_GE ( test.times[i], sent + profile.latency - profile.jitter );
+        EXPECT_LE ( test.times[i], sent + profile.latency + profile.jitter );
+
+        reordered += ( i > 0 && test.released[i] < test.released[i - 1] );
+    }
+
+    // Jitter larger than the packet interval reorders datagrams
+    EXPECT_GT ( reordered, 0u );
+}
+
+TEST ( NetworkImpairment, Loss )
+{
+    NetworkProfile profile;
+    profile.loss = 20;
+
+    TestImpairment test ( profile );
+    test.run ( NUM_PACKETS );
+
+    const NetworkImpairment::Counters& counters = test.impairment.getCounters();
+
+    EXPECT_EQ ( NUM_PACKETS, counters.packets );
+    EXPECT_EQ ( NUM_PACKETS, counters.lost + test.released.size() );
+    EXPECT_NEAR ( 0.2, counters.lost / double ( NUM_PACKETS ), 0.02 );
+}
+
+TEST ( NetworkImpairment, BurstLoss )
+{
+    NetworkProfile profile;
+    profile.burstEnter = 2;
+    profile.burstExit = 25;
+
+    TestImpairment test ( profile );
+    test.run ( NUM_PACKETS );
+
+    // Count the runs of consecutive lost packets
+    size_t lost = 0, bursts = 0;
+    uint32_t expected = 0;
+
+    for ( uint32_t i : test.released )
+    {
+        if ( i > expected )
+        {
+            lost += i - expected;
+            ++bursts;
+        }
+
+        expected = i + 1;
+    }
+
+    if ( expected < NUM_PACKETS )
+    {
+        lost += NUM_PACKETS - expected;
+        ++bursts;
+    }
+
+    EXPECT_EQ ( test.impairment.getCounters().lost, lost );
+    ASSERT_GT ( bursts, 0u );
+
+    // The mean burst length is 100 / burstExit
+    EXPECT_NEAR ( 100 / profile.burstExit, lost / double ( bursts ), 1.0 );
+}
+
+TEST ( NetworkImpairment, Bandwidth )
+{
+    NetworkProfile profile;
+    profile.bandwidth = 80;     // 10 bytes per ms
+    profile.queueLimit = 500;
+
+    // All sent at once, so each packet waits 10 ms for the link, until 500 bytes are waiting
+    TestImpairment test ( profile );
+    test.run ( 10, 100, 0 );
+
+    ASSERT_EQ ( 6u, test.released.size() );
+    EXPECT_EQ ( 4u, test.impairment.getCounters().dropped );
+
+    for ( uint32_t i = 0; i < test.released.size(); ++i )
+    {
+        EXPECT_EQ ( i, test.released[i] );
+        EXPECT_EQ ( 10 * ( i + 1 ), test.times[i] );
+    }
+}
+
+TEST ( NetworkImpairment, Stream )
+{
+    NetworkProfile profile;
+    profile.latency = 50;
+    profile.jitter = 40;
+    profile.loss = 10;
+    profile.reorder = 10;
+    profile.reorderDelay = 100;
+    profile.duplicate = 10;
+
+    // Streams are never reordered or duplicated, and lost packets are only delayed
+    TestImpairment test ( profile, true );
+    test.run ( NUM_PACKETS );
+
+    ASSERT_EQ ( NUM_PACKETS, test.released.size() );
+
+    for ( uint32_t i = 0; i < test.released.size(); ++i )
+        EXPECT_EQ ( i, test.released[i] );
+
+    EXPECT_GT ( test.impairment.getCounters().lost, 0u );
+    EXPECT_EQ ( 0u, test.impairment.getCounters().reordered );
+    EXPECT_EQ ( 0u, test.impairment.getCounters().duplicated );
+}
+
+TEST ( NetworkImpairment, ReorderDuplicate )
+{
+    NetworkProfile profile;
+    profile.latency = 20;
+    profile.reorder = 10;
+    profile.reorderDelay = 50;
+    profile.duplicate = 10;
+
+    TestImpairment test ( profile );
+    test.run ( NUM_PACKETS );
+
+    const NetworkImpairment::Counters& counters = test.impairment.getCounters();
+
+    EXPECT_NEAR ( 0.1, counters.reordered / double ( NUM_PACKETS ), 0.02 );
+    EXPECT_NEAR ( 0.1, counters.duplicated / double ( NUM_PACKETS ), 0.02 );
+    EXPECT_EQ ( NUM_PACKETS + counters.duplicated, test.released.size() );
+    EXPECT_EQ ( test.released.size(), counters.released );
+
+    size_t reordered = 0;
+
+    for ( size_t i = 1; i < test.released.size(); ++i )
+        reordered += ( test.released[i] < test.released[i - 1] );
+
+    EXPECT_GT ( reordered, 0u );
+}
+
+TEST ( NetworkImpairment, ProfileFile )
+{
+    NetworkProfile profile;
+    profile.latency = 80;
+    profile.jitter = 15;
+    profile.normalJitter = true;
+    profile.loss = 1.5;
+    profile.burstEnter = 0.5;
+    profile.burstExit = 30;
+    profile.burstLoss = 75;
+    profile.reorder = 2;
+    profile.reorderDelay = 10;
+    profile.duplicate = 0.5;
+    profile.bandwidth = 1000;
+    profile.queueLimit = 32 * 1024;
+
+    ASSERT_TRUE ( profile.save ( TEST_PROFILE_FILE ) );
+
+    NetworkProfile loaded;
+    ASSERT_TRUE ( loaded.load ( TEST_PROFILE_FILE ) );
+
+    EXPECT_EQ ( profile.str(), loaded.str() );
+
+    remove ( TEST_PROFILE_FILE );
+
+    // Missing files leave the profile unchanged
+    EXPECT_FALSE ( loaded.load ( TEST_PROFILE_FILE ) );
+    EXPECT_EQ ( profile.str(), loaded.str() );
+}
+
+#endif // NOT RELEASE
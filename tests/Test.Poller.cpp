@@ -0,0 +1,266 @@
+#ifndef RELEASE
+
+#include "Poller.hpp"
+#include "SocketManager.hpp"
+#include "TimerManager.hpp"
+#include "Thread.hpp"
+#include "Test.Benchmark.hpp"
+
+#include <gtest/gtest.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+
+using namespace std;
+
+
+#define NUM_IDLE_SOCKETS        ( 500 )
+#define NUM_BENCHMARK_WAITS     ( 2000 )
+
+
+// Raw loopback UDP socket, bound to any available port
+struct LoopbackUdpSocket
+{
+    int fd = 0;
+    sockaddr_in addr;
+
+    LoopbackUdpSocket()
+    {
+        fd = ::socket ( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+
+        memset ( &addr, 0, sizeof ( addr ) );
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+
+#ifdef _WIN32
+        int len = sizeof ( addr );
+#else
+        socklen_t len = sizeof ( addr );
+#endif
+
+        ::bind ( fd, ( sockaddr * ) &addr, sizeof ( addr ) );
+        getsockname ( fd, ( sockaddr * ) &addr, &len );
+    }
+
+    ~LoopbackUdpSocket()
+    {
+#ifdef _WIN32
+        closesocket ( fd );
+#else
+        ::close ( fd );
+#endif
+    }
+
+    void sendTo ( const LoopbackUdpSocket& other )
+    {
+        const char byte = 1;
+        ::sendto ( fd, &byte, 1, 0, ( const sockaddr * ) &other.addr, sizeof ( other.addr ) );
+    }
+
+    void recv()
+    {
+        char byte;
+        ::recv ( fd, &byte, 1, 0 );
+    }
+};
+
+
+// Wakes the poller after a delay
+struct PollerWakeThread : public Thread
+{
+    Poller& poller;
+    long delay;
+
+    PollerWakeThread ( Poller& poller, long delay ) : poller ( poller ), delay ( delay ) {}
+
+    void run() override
+    {
+        Mutex mutex;
+        CondVar cond;
+
+        LOCK ( mutex );
+        cond.wait ( mutex, delay );
+
+        poller.wake();
+    }
+};
+
+
+// Run the test function with each poller backend available on this platform
+template<typename F>
+static void forEachPoller ( const F& func )
+{
+    // Initializes WinSock
+    TimerManager::get().initialize();
+    SocketManager::get().initialize();
+
+    {
+        SelectPoller poller;
+        SCOPED_TRACE ( poller.getName() );
+        func ( poller );
+    }
+
+#ifdef __linux__
+    {
+        EpollPoller poller;
+        SCOPED_TRACE ( poller.getName() );
+        func ( poller );
+    }
+#endif
+
+    SocketManager::get().deinitialize();
+    TimerManager::get().deinitialize();
+}
+
+
+TEST ( Poller, ReadEvents )
+{
+    forEachPoller ( [] ( Poller& poller )
+    {
+        LoopbackUdpSocket a, b, c;
+        vector<Poller::Event> events;
+
+        poller.set ( a.fd, POLL_READ, &a );
+        poller.set ( b.fd, POLL_READ, &b );
+
+        poller.wait ( 10, events );
+        EXPECT_TRUE ( events.empty() );
+
+        c.sendTo ( b );
+
+        poller.wait ( 1000, events );
+        ASSERT_EQ ( 1u, events.size() );
+        EXPECT_EQ ( &b, events[0].data );
+        EXPECT_EQ ( POLL_READ, events[0].events );
+
+        // Level triggered, so the event repeats until read
+        poller.wait ( 1000, events );
+        EXPECT_EQ ( 1u, events.size() );
+
+        b.recv();
+
+        poller.wait ( 10, events );
+        EXPECT_TRUE ( events.empty() );
+
+        // Removed sockets don't return events
+        poller.remove ( b.fd );
+        c.sendTo ( b );
+        c.sendTo ( a );
+
+        poller.wait ( 1000, events );
+        ASSERT_EQ ( 1u, events.size() );
+        EXPECT_EQ ( &a, events[0].data );
+    } );
+}
+
+
+TEST ( Poller, WriteEvents )
+{
+    forEachPoller ( [] ( Poller& poller )
+    {
+        LoopbackUdpSocket a;
+        vector<Poller::Event> events;
+
+        // UDP sockets are always writable
+        poller.set ( a.fd, POLL_WRITE, &a );
+
+        poller.wait ( 1000, events );
+        ASSERT_EQ ( 1u, events.size() );
+        EXPECT_EQ ( POLL_WRITE, events[0].events );
+
+        // Changing the events replaces the old ones
+        poller.set ( a.fd, POLL_READ, &a );
+
+        poller.wait ( 10, events );
+        EXPECT_TRUE ( events.empty() );
+    } );
+}
+
+
+TEST ( Poller, Wake )
+{
+    forEachPoller ( [] ( Poller& poller )
+    {
+        vector<Poller::Event> events;
+
+        const auto start = chrono::steady_clock::now();
+
+        PollerWakeThread waker ( poller, 50 );
+        waker.start();
+
+        poller.wait ( 10000, events );
+        waker.join();
+
+        EXPECT_TRUE ( events.empty() );
+        EXPECT_LT ( chrono::steady_clock::now() - start, chrono::seconds ( 5 ) );
+
+        // A wake before the wait still interrupts it
+        poller.wake();
+        poller.wait ( 10000, events );
+
+        EXPECT_LT ( chrono::steady_clock::now() - start, chrono::seconds ( 5 ) );
+    } );
+}
+
+
+#ifdef __linux__
+
+TEST ( Poller, Benchmark )
+{
+    TimerManager::get().initialize();
+    SocketManager::get().initialize();
+
+    vector<unique_ptr<LoopbackUdpSocket>> sockets ( NUM_IDLE_SOCKETS );
+
+    for ( auto& socket : sockets )
+        socket.reset ( new LoopbackUdpSocket() );
+
+    LoopbackUdpSocket active, sender;
+
+    // One socket always has data, like a busy connection among many idle ones
+    sender.sendTo ( active );
+
+    auto measure = [&] ( Poller& poller )
+    {
+        for ( auto& socket : sockets )
+            poller.set ( socket->fd, POLL_READ, socket.get() );
+
+        poller.set ( active.fd, POLL_READ, &active );
+
+        vector<Poller::Event> events;
+
+        const double ns = benchmark ( NUM_BENCHMARK_WAITS, [&]()
+        {
+            poller.wait ( 1000, events );
+        } );
+
+        EXPECT_EQ ( 1u, events.size() );
+        return ns;
+    };
+
+    SelectPoller selectPoller;
+    EpollPoller epollPoller;
+
+    const double selectNs = measure ( selectPoller );
+    const double epollNs = measure ( epollPoller );
+
+    printBenchmark ( format ( "Poller wait with %u idle sockets", NUM_IDLE_SOCKETS ), selectNs, epollNs );
+
+    sockets.clear();
+
+    SocketManager::get().deinitialize();
+    TimerManager::get().deinitialize();
+}
+
+#endif // __linux__
+
+#endif // NOT RELEASE
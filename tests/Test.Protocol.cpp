@@ -0,0 +1,478 @@
+#ifndef RELEASE
+
+#include "Test.Socket.hpp"
+#include "Test.Benchmark.hpp"
+#include "Messages.hpp"
+#include "Compression.hpp"
+#include "EncodedMsgCache.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+
+#define NUM_RECORDED_FRAMES     ( 600 )
+#define NUM_BENCHMARK_PASSES    ( 20 )
+#define NUM_BENCHMARK_MESSAGES  ( 10000 )
+
+// Spectators spread over a few positions, like after a broadcast round
+#define NUM_BENCHMARK_SPECTATORS    ( 16 )
+#define NUM_SPECTATOR_POSITIONS     ( 4 )
+
+
+// Build a stream of encoded messages, similar to what is received during netplay
+static string recordedStream ( vector<MsgPtr>& messages )
+{
+    string stream;
+
+    for ( uint32_t frame = 0; frame < NUM_RECORDED_FRAMES; ++frame )
+    {
+        IndexedFrame indexedFrame = {{ frame, 1 }};
+
+        PlayerInputs *playerInputs = new PlayerInputs ( indexedFrame );
+        for ( size_t i = 0; i < playerInputs->inputs.size(); ++i )
+            playerInputs->inputs[i] = ( ( frame + i ) / 8 ) % 0x10;
+        messages.push_back ( MsgPtr ( playerInputs ) );
+
+        BothInputs *bothInputs = new BothInputs ( indexedFrame );
+        bothInputs->inputs[0] = bothInputs->inputs[1] = playerInputs->inputs;
+        bothInputs->setSequence ( frame );
+        messages.push_back ( MsgPtr ( bothInputs ) );
+
+        if ( frame % 60 == 0 )
+        {
+            SyncHash *syncHash = new SyncHash();
+            syncHash->indexedFrame = indexedFrame;
+            memset ( syncHash->hash, frame, sizeof ( syncHash->hash ) );
+            syncHash->roundTimer = syncHash->realTimer = frame;
+            memset ( &syncHash->chara[0], 0, sizeof ( syncHash->chara ) );
+            messages.push_back ( MsgPtr ( syncHash ) );
+        }
+    }
+
+    for ( const MsgPtr& msg : messages )
+        stream += Protocol::encode ( msg );
+
+    return stream;
+}
+
+
+TEST ( Protocol, EncodeDecode )
+{
+    vector<MsgPtr> messages;
+    const string stream = recordedStream ( messages );
+
+    size_t pos = 0;
+
+    for ( const MsgPtr& expected : messages )
+    {
+        size_t consumed = 0;
+        MsgPtr msg = Protocol::decode ( &stream[pos], stream.size() - pos, consumed );
+
+        ASSERT_TRUE ( msg.get() );
+        EXPECT_EQ ( expected->getMsgType(), msg->getMsgType() );
+        EXPECT_EQ ( Protocol::encode ( expected ), Protocol::encode ( msg ) );
+        EXPECT_GT ( consumed, 0u );
+
+        pos += consumed;
+    }
+
+    EXPECT_EQ ( stream.size(), pos );
+}
+
+
+TEST ( Protocol, EncodeDecodeCompressed )
+{
+    TestMessage expected ( string ( 4096, 'x' ) );
+    const string bytes = Protocol::encode ( expected );
+
+    // Make sure the message was actually compressed
+    ASSERT_NE ( 0, expected.compressionLevel );
+    ASSERT_LT ( bytes.size(), expected.str.size() );
+
+    size_t consumed = 0;
+    MsgPtr msg = Protocol::decode ( &bytes[0], bytes.size(), consumed );
+
+    ASSERT_TRUE ( msg.get() );
+    EXPECT_EQ ( MsgType::TestMessage, msg->getMsgType() );
+    EXPECT_EQ ( expected.str, msg->getAs<TestMessage>().str );
+    EXPECT_EQ ( bytes.size(), consumed );
+}
+
+
+TEST ( Protocol, DecodePartial )
+{
+    TestMessage compressed ( string ( 4096, 'x' ) );
+    TestMessage uncompressed ( "hello" );
+    uncompressed.compressionLevel = 0;
+
+    for ( const string& bytes : { Protocol::encode ( compressed ), Protocol::encode ( uncompressed ) } )
+    {
+        // Any truncated message should fail to decode without consuming anything
+        for ( size_t len = 0; len < bytes.size(); ++len )
+        {
+            size_t consumed = 12345;
+            MsgPtr msg = Protocol::decode ( &bytes[0], len, consumed );
+
+            EXPECT_FALSE ( msg.get() );
+            EXPECT_EQ ( 0u, consumed );
+        }
+    }
+}
+
+
+TEST ( Protocol, DecodeCorrupted )
+{
+    TestMessage expected ( "hello" );
+    expected.compressionLevel = 0;
+    string bytes = Protocol::encode ( expected );
+
+    // Flip a bit in the message data, the hash check should fail
+    bytes[bytes.size() / 2] ^= 0x01;
+
+    size_t consumed = 0;
+    MsgPtr msg = Protocol::decode ( &bytes[0], bytes.size(), consumed );
+
+    EXPECT_FALSE ( msg.get() );
+}
+
+
+TEST ( Protocol, PolicyAnnotations )
+{
+    const MsgPolicy policy = Protocol::getPolicy ( MsgType::PlayerInputs );
+
+    EXPECT_EQ ( 0, policy.compressionLevel );
+    EXPECT_EQ ( Integrity::CRC32C, policy.integrity.value );
+
+    // Message types without an annotation use the default policy
+    EXPECT_EQ ( Integrity::MD5, Protocol::getPolicy ( MsgType::TestMessage ).integrity.value );
+
+    // The legacy wire format always uses MD5
+    EXPECT_EQ ( Integrity::MD5, Protocol::getIntegrity ( MsgType::PlayerInputs, WIRE_VERSION_LEGACY ).value );
+    EXPECT_EQ ( Integrity::CRC32C, Protocol::getIntegrity ( MsgType::PlayerInputs, WIRE_VERSION_POLICY ).value );
+}
+
+
+TEST ( Protocol, EncodeDecodeWireVersions )
+{
+    vector<MsgPtr> messages;
+    recordedStream ( messages );
+
+    const uint8_t versions[] = { WIRE_VERSION_LEGACY, WIRE_VERSION_POLICY, WIRE_VERSION_COMPACT };
+
+    size_t sizes[3] = { 0, 0, 0 };
+
+    for ( const MsgPtr& expected : messages )
+    {
+        const string compact = Protocol::encode ( expected, WIRE_VERSION_COMPACT );
+
+        // Every wire format must always be decodable
+        for ( size_t i = 0; i < 3; ++i )
+        {
+            const string bytes = Protocol::encode ( expected, versions[i] );
+            sizes[i] += bytes.size();
+
+            size_t consumed = 0;
+            MsgPtr msg = Protocol::decode ( &bytes[0], bytes.size(), consumed );
+
+            ASSERT_TRUE ( msg.get() );
+            EXPECT_EQ ( bytes.size(), consumed );
+            EXPECT_EQ ( bytes, Protocol::encode ( msg, versions[i] ) );
+            EXPECT_EQ ( compact, Protocol::encode ( msg, WIRE_VERSION_COMPACT ) );
+        }
+    }
+
+    // The CRC32C is 12 bytes smaller than the MD5, and the inputs are mostly repeated
+    EXPECT_LT ( sizes[1], sizes[0] );
+    EXPECT_LT ( sizes[2], sizes[1] );
+
+    PRINT ( "[    SIZES ] legacy=%u bytes; policy=%u bytes; compact=%u bytes", sizes[0], sizes[1], sizes[2] );
+}
+
+
+TEST ( Protocol, CompactInputs )
+{
+    BothInputs expected ( IndexedFrame {{ 10, 2 }} );
+    expected.inputs[0].fill ( 0 );
+    expected.inputs[1].fill ( 0 );
+
+    for ( size_t i = 0; i < expected.size(); ++i )
+    {
+        expected.inputs[0][i] = ( i < 4 ? 0 : 0x0016 );
+        expected.inputs[1][i] = ( i % 3 ? 0x0600 : 0x0000 );
+    }
+
+    const string bytes = Protocol::encode ( expected, WIRE_VERSION_COMPACT );
+
+    size_t consumed = 0;
+    MsgPtr msg = Protocol::decode ( &bytes[0], bytes.size(), consumed );
+
+    ASSERT_TRUE ( msg.get() );
+    EXPECT_EQ ( expected.indexedFrame.value, msg->getAs<BothInputs>().indexedFrame.value );
+    EXPECT_EQ ( expected.inputs, msg->getAs<BothInputs>().inputs );
+
+    // Only frames [0, 11) are in range, so this should be much smaller than the full arrays
+    EXPECT_LT ( bytes.size(), Protocol::encode ( expected, WIRE_VERSION_POLICY ).size() / 2 );
+}
+
+
+TEST ( Protocol, DecodeInvalidInputRuns )
+{
+    // Runs that overflow the inputs range should fail to decode, even if the hash is correct
+    struct : public PlayerInputs
+    {
+        using PlayerInputs::PlayerInputs;
+
+        void save ( cereal::BinaryOutputArchive& ar ) const override
+        {
+            saveIndexedFrame ( ar );
+            saveVarint ( ar, size() + 1 );
+            ar ( uint16_t ( 0 ) );
+        }
+    } invalid ( IndexedFrame {{ 100, 1 }} );
+
+    const string bytes = Protocol::encode ( invalid, WIRE_VERSION_COMPACT );
+
+    size_t consumed = 0;
+    MsgPtr msg = Protocol::decode ( &bytes[0], bytes.size(), consumed );
+
+    EXPECT_FALSE ( msg.get() );
+}
+
+
+TEST ( Protocol, DecodeCorruptedPolicy )
+{
+    PlayerInputs expected ( IndexedFrame {{ 123, 1 }} );
+    expected.inputs.fill ( 0x10 );
+    string bytes = Protocol::encode ( expected, WIRE_VERSION_POLICY );
+
+    // Flip a bit in the message data, the CRC32C check should fail
+    bytes[bytes.size() / 2] ^= 0x01;
+
+    size_t consumed = 0;
+    MsgPtr msg = Protocol::decode ( &bytes[0], bytes.size(), consumed );
+
+    EXPECT_FALSE ( msg.get() );
+}
+
+
+static MsgPtr spectatorInputs ( uint32_t frame )
+{
+    BothInputs *bothInputs = new BothInputs ( IndexedFrame {{ frame, 2 }} );
+
+    for ( size_t i = 0; i < bothInputs->inputs[0].size(); ++i )
+        bothInputs->inputs[0][i] = bothInputs->inputs[1][i] = ( ( frame + i ) / 8 ) % 0x10;
+
+    return MsgPtr ( bothInputs );
+}
+
+static MsgPtr spectatorRngState ( uint32_t index )
+{
+    RngState *rngState = new RngState ( index );
+    rngState->rngState0 = index;
+
+    for ( size_t i = 0; i < rngState->rngState3.size(); ++i )
+        rngState->rngState3[i] = char ( i * 7 + index );
+
+    return MsgPtr ( rngState );
+}
+
+
+TEST ( Protocol, EncodedMsgCache )
+{
+    EncodedMsgCache cache;
+
+    const MsgPtr first = spectatorInputs ( 100 );
+    const MsgPtr second = spectatorInputs ( 100 );
+
+    // Messages with the same type and key are shared
+    EXPECT_EQ ( first, cache.get ( first, 100 ) );
+    EXPECT_EQ ( first, cache.get ( second, 100 ) );
+
+    const uint8_t versions[] = { WIRE_VERSION_LEGACY, WIRE_VERSION_POLICY, WIRE_VERSION_COMPACT };
+
+    for ( uint8_t version : versions )
+    {
+        const string& bytes = cache.encode ( second, 100, version );
+
+        EXPECT_EQ ( Protocol::encode ( spectatorInputs ( 100 ), version ), bytes );
+
+        // Only encoded once
+        EXPECT_EQ ( &bytes, &cache.encode ( spectatorInputs ( 100 ), 100, version ) );
+    }
+
+    // Other message types have separate keys
+    cache.encode ( spectatorRngState ( 100 ), 100, WIRE_VERSION_COMPACT );
+
+    EXPECT_EQ ( 2u, cache.size() );
+
+    size_t consumed = 0;
+    const string& bytes = cache.encode ( spectatorRngState ( 1 ), 100, WIRE_VERSION_COMPACT );
+    MsgPtr msg = Protocol::decode ( &bytes[0], bytes.size(), consumed );
+
+    ASSERT_TRUE ( msg.get() );
+    EXPECT_EQ ( MsgType::RngState, msg->getMsgType() );
+    EXPECT_EQ ( 100u, msg->getAs<RngState>().index );
+
+    // Messages are evicted once they aren't used for a whole round
+    cache.evictUnused();
+
+    EXPECT_EQ ( 2u, cache.size() );
+
+    cache.get ( spectatorInputs ( 100 ), 100 );
+    cache.evictUnused();
+
+    EXPECT_EQ ( 1u, cache.size() );
+    EXPECT_EQ ( first, cache.get ( spectatorInputs ( 100 ), 100 ) );
+}
+
+
+TEST ( Protocol, EncodedMsgCacheBenchmark )
+{
+    EncodedMsgCache cache;
+    uint32_t frame = 0;
+    size_t sent = 0;
+
+    // Each spectator gets the inputs and RngState for its position, spectators are spread over a few positions
+    auto broadcast = [&] ( bool cached )
+    {
+        frame += NUM_INPUTS;
+
+        for ( uint32_t i = 0; i < NUM_BENCHMARK_SPECTATORS; ++i )
+        {
+            const uint32_t pos = frame + ( i % NUM_SPECTATOR_POSITIONS ) * NUM_INPUTS;
+
+            const MsgPtr inputs = spectatorInputs ( pos );
+            const MsgPtr rngState = spectatorRngState ( pos );
+
+            if ( cached )
+            {
+                sent += cache.encode ( inputs, pos, WIRE_VERSION_COMPACT ).size();
+                sent += cache.encode ( rngState, pos, WIRE_VERSION_COMPACT ).size();
+            }
+            else
+            {
+                sent += Protocol::encode ( inputs, WIRE_VERSION_COMPACT ).size();
+                sent += Protocol::encode ( rngState, WIRE_VERSION_COMPACT ).size();
+            }
+        }
+
+        if ( cached )
+            cache.evictUnused();
+    };
+
+    const double encodeNs = benchmark ( NUM_BENCHMARK_PASSES, [&]() { broadcast ( false ); } );
+    const double cachedNs = benchmark ( NUM_BENCHMARK_PASSES, [&]() { broadcast ( true ); } );
+
+    EXPECT_GT ( sent, 0u );
+    EXPECT_LE ( cache.size(), 4u * NUM_SPECTATOR_POSITIONS );
+
+    printBenchmark ( format ( "Spectator broadcast to %u spectators", NUM_BENCHMARK_SPECTATORS ), encodeNs, cachedNs );
+}
+
+
+TEST ( Protocol, CRC32C )
+{
+    // Standard check value for CRC-32C
+    EXPECT_EQ ( 0xE3069283u, getCRC32C ( "123456789", 9 ) );
+    EXPECT_EQ ( 0u, getCRC32C ( "", 0 ) );
+    EXPECT_EQ ( 0xE3069283u, getCRC32CPortable ( "123456789", 9 ) );
+}
+
+
+TEST ( Protocol, CRC32CHardware )
+{
+    if ( ! hasCRC32CHardware() )
+        return;
+
+    string bytes;
+
+    // Check every alignment and tail length against the portable implementation
+    for ( size_t len = 0; len < 256; ++len )
+    {
+        bytes.push_back ( char ( len * 37 + 11 ) );
+
+        for ( size_t offset = 0; offset < 4 && offset <= bytes.size(); ++offset )
+        {
+            EXPECT_EQ ( getCRC32CPortable ( &bytes[offset], bytes.size() - offset ),
+                        getCRC32CHardware ( &bytes[offset], bytes.size() - offset ) );
+        }
+    }
+}
+
+
+TEST ( Protocol, IntegrityBenchmark )
+{
+    PlayerInputs playerInputs ( IndexedFrame {{ 123, 1 }} );
+    for ( size_t i = 0; i < playerInputs.inputs.size(); ++i )
+        playerInputs.inputs[i] = ( i / 8 ) % 0x10;
+
+    size_t decoded = 0;
+
+    // Encode and decode a PlayerInputs, the hash is recalculated for each encode like during netplay
+    auto encodeDecode = [&] ( uint8_t wireVersion )
+    {
+        playerInputs.invalidate();
+        const string bytes = Protocol::encode ( playerInputs, wireVersion );
+
+        size_t consumed = 0;
+        if ( Protocol::decode ( &bytes[0], bytes.size(), consumed ) )
+            ++decoded;
+    };
+
+    const double md5Ns = benchmark ( NUM_BENCHMARK_MESSAGES, [&]() { encodeDecode ( WIRE_VERSION_LEGACY ); } );
+    const double crcNs = benchmark ( NUM_BENCHMARK_MESSAGES, [&]() { encodeDecode ( WIRE_VERSION_POLICY ); } );
+
+    EXPECT_EQ ( size_t ( 2 * NUM_BENCHMARK_MESSAGES ), decoded );
+
+    printBenchmark ( format ( "PlayerInputs encode+decode MD5 vs CRC32C (%s)",
+                              hasCRC32CHardware() ? "SSE4.2" : "portable" ), md5Ns, crcNs );
+}
+
+
+TEST ( Protocol, DecodeBenchmark )
+{
+    vector<MsgPtr> messages;
+    const string stream = recordedStream ( messages );
+
+    size_t decoded = 0;
+
+    // Decode the whole stream from the front of the buffer, like Socket::socketRead does
+    auto decodeStream = [&] ( bool copyPending )
+    {
+        for ( size_t pos = 0; pos < stream.size(); )
+        {
+            size_t consumed = 0;
+            MsgPtr msg;
+
+            if ( copyPending )
+            {
+                // The previous implementation copied all the pending bytes before parsing each message
+                const string pending ( &stream[pos], stream.size() - pos );
+                msg = Protocol::decode ( &pending[0], pending.size(), consumed );
+            }
+            else
+            {
+                msg = Protocol::decode ( &stream[pos], stream.size() - pos, consumed );
+            }
+
+            if ( ! msg || ! consumed )
+                break;
+
+            pos += consumed;
+            ++decoded;
+        }
+    };
+
+    const double copyNs = benchmark ( NUM_BENCHMARK_PASSES, [&]() { decodeStream ( true ); } );
+    const double zeroCopyNs = benchmark ( NUM_BENCHMARK_PASSES, [&]() { decodeStream ( false ); } );
+
+    EXPECT_EQ ( 2 * NUM_BENCHMARK_PASSES * messages.size(), decoded );
+
+    printBenchmark ( format ( "Protocol::decode x %u messages", messages.size() ), copyNs, zeroCopyNs );
+}
+
+#endif // NOT RELEASE
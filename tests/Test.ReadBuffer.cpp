@@ -0,0 +1,127 @@
+#ifndef RELEASE
+
+#include "ReadBuffer.hpp"
+#include "Test.Benchmark.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace std;
+
+
+#define NUM_BENCHMARK_MESSAGES  ( 1000 )
+#define BENCHMARK_MESSAGE_SIZE  ( 100 )
+
+
+static void append ( ReadBuffer& buffer, const string& bytes )
+{
+    buffer.reserve ( bytes.size() );
+    memcpy ( buffer.writePtr(), &bytes[0], bytes.size() );
+    buffer.commit ( bytes.size() );
+}
+
+
+TEST ( ReadBuffer, StartsEmpty )
+{
+    ReadBuffer buffer;
+
+    EXPECT_TRUE ( buffer.empty() );
+    EXPECT_EQ ( 0u, buffer.size() );
+    EXPECT_EQ ( 0u, buffer.capacity() );
+
+    buffer.reserve ( 1 );
+
+    EXPECT_EQ ( size_t ( READ_BUFFER_MIN_CAPACITY ), buffer.capacity() );
+}
+
+
+TEST ( ReadBuffer, CommitAndConsume )
+{
+    ReadBuffer buffer;
+
+    append ( buffer, "hello" );
+    append ( buffer, "world" );
+
+    EXPECT_EQ ( "helloworld", string ( buffer.data(), buffer.size() ) );
+
+    buffer.consume ( 5 );
+    EXPECT_EQ ( "world", string ( buffer.data(), buffer.size() ) );
+
+    // Consuming everything rewinds to the front
+    buffer.consume ( 5 );
+    EXPECT_TRUE ( buffer.empty() );
+    EXPECT_EQ ( buffer.capacity(), buffer.writable() );
+}
+
+
+TEST ( ReadBuffer, CompactsBeforeGrowing )
+{
+    ReadBuffer buffer;
+
+    append ( buffer, string ( READ_BUFFER_MIN_CAPACITY - 10, 'x' ) );
+    buffer.consume ( READ_BUFFER_MIN_CAPACITY - 20 );
+
+    // There are only 10 unread bytes, so this should move them to the front instead of growing
+    append ( buffer, string ( 100, 'y' ) );
+
+    EXPECT_EQ ( size_t ( READ_BUFFER_MIN_CAPACITY ), buffer.capacity() );
+    EXPECT_EQ ( string ( 10, 'x' ) + string ( 100, 'y' ), string ( buffer.data(), buffer.size() ) );
+}
+
+
+TEST ( ReadBuffer, GrowsForLargeMessages )
+{
+    ReadBuffer buffer;
+
+    const string large ( 5 * READ_BUFFER_MIN_CAPACITY + 1, 'z' );
+
+    append ( buffer, "abc" );
+    append ( buffer, large );
+
+    EXPECT_GE ( buffer.capacity(), large.size() + 3 );
+    EXPECT_EQ ( "abc" + large, string ( buffer.data(), buffer.size() ) );
+
+    buffer.free();
+
+    EXPECT_TRUE ( buffer.empty() );
+    EXPECT_EQ ( 0u, buffer.capacity() );
+}
+
+
+TEST ( ReadBuffer, ConsumeBenchmark )
+{
+    const string message ( BENCHMARK_MESSAGE_SIZE, 'm' );
+
+    // The previous implementation erased from the front of a 4 MiB string, then resized it back
+    string legacy;
+    size_t legacyPos = 0;
+
+    const double legacyNs = benchmark ( NUM_BENCHMARK_MESSAGES, [&]()
+    {
+        if ( legacy.empty() )
+            legacy.resize ( 1024 * 4096, ( char ) 0 );
+
+        memcpy ( &legacy[legacyPos], &message[0], message.size() );
+        legacyPos += message.size();
+
+        legacy.erase ( 0, message.size() );
+        legacy.resize ( 1024 * 4096, ( char ) 0 );
+        legacyPos -= message.size();
+    } );
+
+    ReadBuffer buffer;
+
+    const double bufferNs = benchmark ( NUM_BENCHMARK_MESSAGES, [&]()
+    {
+        append ( buffer, message );
+        buffer.consume ( message.size() );
+    } );
+
+    EXPECT_TRUE ( buffer.empty() );
+    EXPECT_EQ ( size_t ( READ_BUFFER_MIN_CAPACITY ), buffer.capacity() );
+
+    printBenchmark ( "ReadBuffer consume", legacyNs, bufferNs );
+}
+
+#endif // NOT RELEASE
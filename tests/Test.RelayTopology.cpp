@@ -0,0 +1,366 @@
+#ifndef RELEASE
+
+#include "RelayTopology.hpp"
+#include "Logger.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <random>
+
+using namespace std;
+
+
+#define NUM_SIMULATED_SPECTATORS    ( 300 )
+#define NUM_SIMULATED_LEAVES        ( 60 )
+#define SIMULATED_BASE_PORT         ( 3939 )
+#define SIMULATED_SESSION_ID        "session"
+
+
+// A population of spectators on localhost, connected only through the messages that the real clients send each other
+struct SimulatedTree
+{
+    struct Node
+    {
+        IpAddrPort addr;
+        RelayTopology relay;
+        RelayRejoin rejoin;
+        int parent = -1;
+        bool active = true;
+
+        // Initialized the same as DllMain once it gets the ClientMode
+        Node ( uint16_t port, ClientMode::Enum mode ) : addr ( "127.0.0.1", port ) { relay.initialize ( mode ); }
+    };
+
+    vector<Node> nodes;
+
+    unordered_map<IpAddrPort, int> byAddr;
+
+    SimulatedTree() { addNode ( ClientMode::Host ); }
+
+    int addNode ( ClientMode::Enum mode = ClientMode::SpectateNetplay )
+    {
+        nodes.push_back ( Node ( SIMULATED_BASE_PORT + nodes.size(), mode ) );
+        byAddr[nodes.back().addr] = nodes.size() - 1;
+
+        // MainApp sets the root once it gets the SpectateConfig
+        nodes.back().rejoin.initialize ( nodes[0].addr, SIMULATED_SESSION_ID );
+        return nodes.size() - 1;
+    }
+
+    // Report the relay status of each node up to the root, like the periodic RelayStatus messages
+    void reportStatus ( int i )
+    {
+        for ( ; nodes[i].parent >= 0; i = nodes[i].parent )
+            nodes[nodes[i].parent].relay.updateChild ( nodes[i].addr, nodes[i].relay.getStatus() );
+    }
+
+    // Connect to an address and follow the redirects, returns the node that accepted the spectator
+    int attach ( int i, const IpAddrPort& addr )
+    {
+        int current = byAddr[addr];
+
+        for ( ;; )
+        {
+            const IpAddrPort& redirectAddr = nodes[current].relay.getAttachAddress();
+
+            if ( redirectAddr.port == 0 )
+                break;
+
+            current = byAddr[redirectAddr];
+        }
+
+        nodes[i].parent = current;
+        nodes[current].relay.addChild ( nodes[i].addr );
+        reportStatus ( i );
+        return current;
+    }
+
+    int attach ( int i ) { return attach ( i, nodes[0].addr ); }
+
+    // A relay leaves, then the spectators it was relaying to rejoin the same as MainApp, keeping their own subtrees
+    void leave ( int i )
+    {
+        const int parent = nodes[i].parent;
+
+        nodes[i].active = false;
+        nodes[parent].relay.removeChild ( nodes[i].addr );
+        reportStatus ( parent );
+
+        vector<int> orphans;
+
+        for ( size_t j = 0; j < nodes.size(); ++j )
+            if ( nodes[j].active && nodes[j].parent == i )
+                orphans.push_back ( j );
+
+        // Bigger subtrees reconnect first, so they get the shallower slots
+        sort ( orphans.begin(), orphans.end(), [this] ( int a, int b )
+        {
+            return nodes[a].relay.getStatus().subtreeSize > nodes[b].relay.getStatus().subtreeSize;
+        } );
+
+        for ( int j : orphans )
+        {
+            const IpAddrPort& rootAddr = nodes[j].rejoin.parentLeft ( nodes[i].addr );
+
+            ASSERT_EQ ( nodes[0].addr, rootAddr );
+            ASSERT_TRUE ( nodes[j].rejoin.isRejoining() );
+
+            attach ( j, rootAddr );
+
+            // The new parent sends its SpectateConfig
+            SpectateConfig spectateConfig;
+            spectateConfig.sessionId = SIMULATED_SESSION_ID;
+
+            EXPECT_TRUE ( nodes[j].rejoin.gotSpectateConfig ( spectateConfig ) );
+            EXPECT_FALSE ( nodes[j].rejoin.isRejoining() );
+        }
+    }
+
+    int depth ( int i ) const
+    {
+        int d = 0;
+
+        for ( ; nodes[i].parent >= 0; i = nodes[i].parent )
+            ++d;
+
+        return d;
+    }
+
+    int maxDepth() const
+    {
+        int d = 0;
+
+        for ( size_t i = 0; i < nodes.size(); ++i )
+            if ( nodes[i].active )
+                d = max ( d, depth ( i ) );
+
+        return d;
+    }
+
+    // Depth of the shallowest node that can accept another spectator
+    int shallowestSpareDepth() const
+    {
+        int d = INT_MAX;
+
+        for ( size_t i = 0; i < nodes.size(); ++i )
+            if ( nodes[i].active && nodes[i].relay.numChildren() < nodes[i].relay.getCapacity() )
+                d = min ( d, depth ( i ) );
+
+        return d;
+    }
+
+    void checkInvariants() const
+    {
+        size_t numActive = 0;
+
+        for ( size_t i = 0; i < nodes.size(); ++i )
+        {
+            if ( ! nodes[i].active )
+                continue;
+
+            ++numActive;
+
+            EXPECT_LE ( nodes[i].relay.numChildren(), nodes[i].relay.getCapacity() );
+
+            if ( i == 0 )
+                continue;
+
+            ASSERT_GE ( nodes[i].parent, 0 );
+            EXPECT_TRUE ( nodes[nodes[i].parent].active );
+            EXPECT_TRUE ( nodes[nodes[i].parent].relay.hasChild ( nodes[i].addr ) );
+        }
+
+        EXPECT_EQ ( numActive, nodes[0].relay.getStatus().subtreeSize );
+    }
+};
+
+
+// The old behaviour: a full client redirects to its spectators in turn, without knowing how full their subtrees are
+static int roundRobinMaxDepth ( size_t count )
+{
+    vector<vector<int>> children ( count );
+    vector<size_t> nextChild ( count, 0 );
+    vector<int> depth ( count, 0 );
+    int maxDepth = 0;
+
+    for ( size_t i = 1; i < count; ++i )
+    {
+        int current = 0;
+
+        while ( children[current].size() >= ( current == 0 ? MAX_ROOT_SPECTATORS : MAX_SPECTATORS ) )
+            current = children[current][nextChild[current]++ % children[current].size()];
+
+        children[current].push_back ( i );
+        depth[i] = depth[current] + 1;
+        maxDepth = max ( maxDepth, depth[i] );
+    }
+
+    return maxDepth;
+}
+
+
+TEST ( RelayTopology, Initialize )
+{
+    // A spectator that just started has room for spectators, even before it accepts one
+    RelayTopology relay;
+    relay.initialize ( ClientMode::SpectateNetplay );
+
+    EXPECT_EQ ( MAX_SPECTATORS, relay.getCapacity() );
+    EXPECT_EQ ( 0, relay.getStatus().spareDepth );
+    EXPECT_EQ ( 1u, relay.getStatus().subtreeSize );
+
+    // So new spectators are spread over the spectators of a full node, instead of all going to the same one
+    RelayTopology root;
+    root.initialize ( ClientMode::Host );
+
+    EXPECT_EQ ( MAX_ROOT_SPECTATORS, root.getCapacity() );
+
+    const IpAddrPort a ( "127.0.0.1", 1 );
+
+    root.addChild ( a );
+    root.updateChild ( a, relay.getStatus() );
+
+    EXPECT_EQ ( a, root.getAttachAddress() );
+    EXPECT_EQ ( 1, root.getStatus().spareDepth );
+}
+
+TEST ( RelayTopology, Rejoin )
+{
+    const IpAddrPort root ( "127.0.0.1", 1 ), relay ( "127.0.0.1", 2 );
+
+    SpectateConfig spectateConfig;
+    spectateConfig.sessionId = SIMULATED_SESSION_ID;
+
+    // Nothing to rejoin if the root leaves
+    RelayRejoin rejoin;
+    rejoin.initialize ( root, SIMULATED_SESSION_ID );
+
+    EXPECT_EQ ( NullAddress, rejoin.parentLeft ( root ) );
+    EXPECT_FALSE ( rejoin.isRejoining() );
+
+    // A relay leaving reconnects to the root, but only once until the new parent is found
+    EXPECT_EQ ( root, rejoin.parentLeft ( relay ) );
+    EXPECT_TRUE ( rejoin.isRejoining() );
+    EXPECT_EQ ( NullAddress, rejoin.parentLeft ( relay ) );
+    EXPECT_FALSE ( rejoin.isRejoining() );
+
+    EXPECT_EQ ( root, rejoin.parentLeft ( relay ) );
+    EXPECT_TRUE ( rejoin.gotSpectateConfig ( spectateConfig ) );
+    EXPECT_FALSE ( rejoin.isRejoining() );
+
+    // The root is already in a different game
+    EXPECT_EQ ( root, rejoin.parentLeft ( relay ) );
+    spectateConfig.sessionId = "other";
+    EXPECT_FALSE ( rejoin.gotSpectateConfig ( spectateConfig ) );
+
+    // The new parent's inputs must start at or before the current index
+    InitialGameState initial ( IndexedFrame {{ 0, 5 }} );
+
+    EXPECT_TRUE ( RelayRejoin::canResume ( initial, 5 ) );
+    EXPECT_TRUE ( RelayRejoin::canResume ( initial, 7 ) );
+    EXPECT_FALSE ( RelayRejoin::canResume ( initial, 4 ) );
+}
+
+TEST ( RelayTopology, AttachShallowest )
+{
+    RelayTopology relay;
+    relay.setCapacity ( 2 );
+
+    EXPECT_EQ ( NullAddress, relay.getAttachAddress() );
+    EXPECT_EQ ( 0, relay.getStatus().spareDepth );
+
+    const IpAddrPort a ( "127.0.0.1", 1 ), b ( "127.0.0.1", 2 );
+
+    relay.addChild ( a );
+    relay.addChild ( b );
+
+    // Children that haven't reported yet are treated as full
+    EXPECT_EQ ( NO_SPARE_DEPTH, relay.getStatus().spareDepth );
+    EXPECT_EQ ( 3u, relay.getStatus().subtreeSize );
+
+    RelayStatus full;
+    full.capacity = 1;
+    full.numChildren = 1;
+    full.subtreeSize = 5;
+    full.spareDepth = 2;
+
+    RelayStatus spare;
+    spare.capacity = 2;
+    spare.numChildren = 1;
+    spare.subtreeSize = 9;
+    spare.spareDepth = 0;
+
+    relay.updateChild ( a, full );
+    relay.updateChild ( b, spare );
+
+    // The bigger subtree still has the shallower free slot
+    EXPECT_EQ ( b, relay.getAttachAddress() );
+    EXPECT_EQ ( 1, relay.getStatus().spareDepth );
+    EXPECT_EQ ( 15u, relay.getStatus().subtreeSize );
+
+    // A relay leaving frees its slot on this node
+    relay.removeChild ( b );
+
+    EXPECT_EQ ( NullAddress, relay.getAttachAddress() );
+    EXPECT_EQ ( 0, relay.getStatus().spareDepth );
+    EXPECT_EQ ( 6u, relay.getStatus().subtreeSize );
+
+    // Reports from spectators that already left are ignored
+    relay.updateChild ( b, spare );
+
+    EXPECT_FALSE ( relay.hasChild ( b ) );
+    EXPECT_EQ ( 1u, relay.numChildren() );
+}
+
+TEST ( RelayTopology, SimulatedPopulation )
+{
+    mt19937 rng ( 12345 );
+
+    SimulatedTree tree;
+
+    for ( size_t i = 0; i < NUM_SIMULATED_SPECTATORS; ++i )
+    {
+        const int expectedDepth = tree.shallowestSpareDepth() + 1;
+        const int node = tree.addNode();
+
+        tree.attach ( node );
+
+        // Every spectator is placed in the shallowest free slot
+        EXPECT_EQ ( expectedDepth, tree.depth ( node ) );
+    }
+
+    tree.checkInvariants();
+
+    const int relayDepth = tree.maxDepth();
+    const int roundRobinDepth = roundRobinMaxDepth ( 1 + NUM_SIMULATED_SPECTATORS );
+
+    PRINT ( "[ RELAYTREE] %u spectators: max depth %d with round robin redirects, %d with relay status",
+            NUM_SIMULATED_SPECTATORS, roundRobinDepth, relayDepth );
+
+    EXPECT_LE ( relayDepth, roundRobinDepth );
+
+    // Relays leave, the tree should stay connected and shallow
+    for ( size_t i = 0; i < NUM_SIMULATED_LEAVES; ++i )
+    {
+        int node;
+
+        do
+        {
+            node = 1 + rng() % NUM_SIMULATED_SPECTATORS;
+        }
+        while ( ! tree.nodes[node].active );
+
+        tree.leave ( node );
+    }
+
+    tree.checkInvariants();
+
+    PRINT ( "[ RELAYTREE] %u relays left: max depth %d", NUM_SIMULATED_LEAVES, tree.maxDepth() );
+
+    EXPECT_LE ( tree.maxDepth(), relayDepth + 1 );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,366 @@
+#ifndef RELEASE
+
+#include "ReplayManager.hpp"
+#include "Messages.hpp"
+#include "Test.Benchmark.hpp"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+using namespace std;
+
+
+#define TEST_REPLAY_FILE        "test_replay" REPLAY_EXT
+#define TEST_LEGACY_FILE        "test_replay.txt"
+
+#define NUM_BENCHMARK_INDICES   ( 20 )
+#define NUM_BENCHMARK_FRAMES    ( 3000 )
+
+
+static MsgPtr makeRngState ( uint32_t seed )
+{
+    RngState *rngState = new RngState ( 0 );
+    rngState->rngState0 = seed;
+    rngState->rngState1 = seed * 3;
+    rngState->rngState2 = seed * 7;
+
+    for ( size_t i = 0; i < rngState->rngState3.size(); ++i )
+        rngState->rngState3[i] = ( char ) ( seed + i );
+
+    return MsgPtr ( rngState );
+}
+
+static size_t getFileSize ( const string& filename )
+{
+    ifstream fin ( filename.c_str(), ifstream::binary | ifstream::ate );
+    return ( fin.good() ? ( size_t ) fin.tellg() : 0 );
+}
+
+// Write a short session: chara select, loading, then in-game with a rollback
+static void writeTestReplay ( ReplayWriter& writer )
+{
+    writer.setIndex ( 1, CC_GAME_MODE_CHARA_SELECT, "NetplayState::CharaSelect" );
+    writer.setRngState ( makeRngState ( 1 ) );
+
+    for ( uint32_t frame = 0; frame < 10; ++frame )
+        writer.addInputs ( frame, frame, 0 );
+
+    writer.setIndex ( 2, CC_GAME_MODE_LOADING, "NetplayState::Loading" );
+    writer.addInputs ( 0, 0, 0 );
+
+    writer.setIndex ( 3, CC_GAME_MODE_IN_GAME, "NetplayState::InGame" );
+    writer.setRngState ( makeRngState ( 3 ) );
+    writer.setCharacter ( 1, 12, 1, 3 );
+    writer.setCharacter ( 2, 34, 2, 5 );
+
+    for ( uint32_t frame = 0; frame < 100; ++frame )
+        writer.addInputs ( frame, 0x100 + frame, 0x200 + frame );
+
+    // Rollback from frame 100 to 95, then re-run 95 to 100 with different inputs
+    writer.addRollback ( 100, {{ 95, 3 }} );
+
+    for ( uint32_t frame = 95; frame <= 100; ++frame )
+        writer.addReinputs ( {{ frame, 3 }}, 0x300 + frame, 0x400 + frame );
+
+    writer.addInputs ( 100, 0x300 + 100, 0x400 + 100 );
+}
+
+static void checkTestReplay ( ReplayManager& repMan )
+{
+    EXPECT_EQ ( 3u, repMan.getLastIndex() );
+    EXPECT_EQ ( 100u, repMan.getLastFrame() );
+
+    EXPECT_EQ ( uint32_t ( CC_GAME_MODE_CHARA_SELECT ), repMan.getGameMode ( {{ 5, 1 }} ) );
+    EXPECT_EQ ( uint32_t ( CC_GAME_MODE_IN_GAME ), repMan.getGameMode ( {{ 0, 3 }} ) );
+    EXPECT_EQ ( 0u, repMan.getGameMode ( {{ 0, 4 }} ) );
+
+    EXPECT_EQ ( "NetplayState::CharaSelect", repMan.getStateStr ( {{ 0, 1 }} ) );
+    EXPECT_EQ ( "NetplayState::InGame", repMan.getStateStr ( {{ 0, 3 }} ) );
+    EXPECT_EQ ( "", repMan.getStateStr ( {{ 0, 7 }} ) );
+
+    EXPECT_EQ ( 7u, repMan.getInputs ( {{ 7, 1 }} ).p1 );
+    EXPECT_EQ ( 0x100u + 50, repMan.getInputs ( {{ 50, 3 }} ).p1 );
+    EXPECT_EQ ( 0x200u + 96, repMan.getInputs ( {{ 96, 3 }} ).p2 );
+    EXPECT_EQ ( 0u, repMan.getInputs ( {{ 1000, 3 }} ).p1 );
+
+    EXPECT_EQ ( IndexedFrame ( {{ 95, 3 }} ).value, repMan.getRollbackTarget ( {{ 100, 3 }} ).value );
+    EXPECT_EQ ( MaxIndexedFrame.value, repMan.getRollbackTarget ( {{ 99, 3 }} ).value );
+
+    ASSERT_EQ ( 6u, repMan.getReinputs ( {{ 100, 3 }} ).size() );
+    EXPECT_EQ ( IndexedFrame ( {{ 97, 3 }} ).value, repMan.getReinputs ( {{ 100, 3 }} )[2].indexedFrame.value );
+    EXPECT_EQ ( 0x400u + 97, repMan.getReinputs ( {{ 100, 3 }} )[2].p2 );
+
+    ASSERT_TRUE ( repMan.getRngState ( {{ 0, 3 }} ).get() != 0 );
+    EXPECT_EQ ( makeRngState ( 3 )->getAs<RngState>().dump(),
+                repMan.getRngState ( {{ 0, 3 }} )->getAs<RngState>().dump() );
+    EXPECT_TRUE ( repMan.getRngState ( {{ 0, 2 }} ).get() == 0 );
+}
+
+
+TEST ( Replay, WriteLoad )
+{
+    {
+        ReplayWriter writer;
+        ASSERT_TRUE ( writer.open ( TEST_REPLAY_FILE ) );
+        writeTestReplay ( writer );
+    }
+
+    // Scoped so the file is unmapped before removing it
+    {
+        ReplayManager repMan;
+        ASSERT_TRUE ( repMan.load ( TEST_REPLAY_FILE, false ) );
+
+        checkTestReplay ( repMan );
+
+        // The loading transition has an initial state with the characters from the next transition
+        MsgPtr initial = repMan.getInitialStateBefore ( 3 );
+
+        ASSERT_TRUE ( initial.get() != 0 );
+        EXPECT_EQ ( 2u, initial->getAs<InitialGameState>().indexedFrame.parts.index );
+        EXPECT_EQ ( 12u, initial->getAs<InitialGameState>().chara[0] );
+        EXPECT_EQ ( 2u, initial->getAs<InitialGameState>().moon[1] );
+        EXPECT_EQ ( 5u, initial->getAs<InitialGameState>().color[1] );
+
+        EXPECT_TRUE ( repMan.getInitialStateBefore ( 2 ).get() == 0 );
+
+        // Real inputs replace the original inputs with the reinputs, and ignore rollbacks
+        ASSERT_TRUE ( repMan.load ( TEST_REPLAY_FILE, true ) );
+
+        EXPECT_EQ ( 0x300u + 96, repMan.getInputs ( {{ 96, 3 }} ).p1 );
+        EXPECT_EQ ( 0x100u + 94, repMan.getInputs ( {{ 94, 3 }} ).p1 );
+        EXPECT_EQ ( MaxIndexedFrame.value, repMan.getRollbackTarget ( {{ 100, 3 }} ).value );
+    }
+
+    remove ( TEST_REPLAY_FILE );
+}
+
+
+TEST ( Replay, RealInputsAcrossIndices )
+{
+    {
+        ReplayWriter writer;
+        ASSERT_TRUE ( writer.open ( TEST_REPLAY_FILE ) );
+
+        writer.setIndex ( 3, CC_GAME_MODE_IN_GAME, "NetplayState::InGame" );
+
+        for ( uint32_t frame = 0; frame < 100; ++frame )
+            writer.addInputs ( frame, 0x100 + frame, 0x200 + frame );
+
+        writer.setIndex ( 4, CC_GAME_MODE_IN_GAME, "NetplayState::InGame" );
+
+        for ( uint32_t frame = 0; frame < 10; ++frame )
+            writer.addInputs ( frame, 0x500 + frame, 0x600 + frame );
+
+        // Rollback from [4:10] back into the previous index, then re-run [3:95] to [4:10]
+        writer.addRollback ( 10, {{ 95, 3 }} );
+
+        for ( uint32_t frame = 95; frame < 100; ++frame )
+            writer.addReinputs ( {{ frame, 3 }}, 0x300 + frame, 0x400 + frame );
+
+        for ( uint32_t frame = 0; frame <= 10; ++frame )
+            writer.addReinputs ( {{ frame, 4 }}, 0x700 + frame, 0x800 + frame );
+
+        for ( uint32_t frame = 11; frame < 15; ++frame )
+            writer.addInputs ( frame, 0x500 + frame, 0x600 + frame );
+
+        // A second rollback that overlaps the frames re-run by the first one
+        writer.addRollback ( 15, {{ 8, 4 }} );
+
+        for ( uint32_t frame = 8; frame <= 15; ++frame )
+            writer.addReinputs ( {{ frame, 4 }}, 0x900 + frame, 0xA00 + frame );
+
+        for ( uint32_t frame = 16; frame < 20; ++frame )
+            writer.addInputs ( frame, 0x500 + frame, 0x600 + frame );
+    }
+
+    {
+        ReplayManager repMan;
+        ASSERT_TRUE ( repMan.load ( TEST_REPLAY_FILE, false ) );
+
+        EXPECT_EQ ( IndexedFrame ( {{ 95, 3 }} ).value, repMan.getRollbackTarget ( {{ 10, 4 }} ).value );
+        EXPECT_EQ ( 16u, repMan.getReinputs ( {{ 10, 4 }} ).size() );
+        EXPECT_EQ ( 0x100u + 97, repMan.getInputs ( {{ 97, 3 }} ).p1 );
+
+        // The later index is decoded first, like seeking back during playback
+        ASSERT_TRUE ( repMan.load ( TEST_REPLAY_FILE, true ) );
+
+        EXPECT_EQ ( 0x700u + 5, repMan.getInputs ( {{ 5, 4 }} ).p1 );
+        EXPECT_EQ ( 0x900u + 9, repMan.getInputs ( {{ 9, 4 }} ).p1 );
+        EXPECT_EQ ( 0xA00u + 15, repMan.getInputs ( {{ 15, 4 }} ).p2 );
+        EXPECT_EQ ( 0x500u + 16, repMan.getInputs ( {{ 16, 4 }} ).p1 );
+        EXPECT_EQ ( MaxIndexedFrame.value, repMan.getRollbackTarget ( {{ 10, 4 }} ).value );
+
+        EXPECT_EQ ( 0x100u + 94, repMan.getInputs ( {{ 94, 3 }} ).p1 );
+        EXPECT_EQ ( 0x300u + 95, repMan.getInputs ( {{ 95, 3 }} ).p1 );
+        EXPECT_EQ ( 0x400u + 99, repMan.getInputs ( {{ 99, 3 }} ).p2 );
+    }
+
+    remove ( TEST_REPLAY_FILE );
+}
+
+
+TEST ( Replay, MissingFooter )
+{
+    ReplayWriter writer;
+    ASSERT_TRUE ( writer.open ( TEST_REPLAY_FILE ) );
+    writeTestReplay ( writer );
+    writer.setIndex ( 4, CC_GAME_MODE_RETRY, "NetplayState::RetryMenu" );
+    writer.close();
+
+    // Cut off the footer and part of the last chunk, like a crash during play
+    string data;
+    {
+        ifstream fin ( TEST_REPLAY_FILE, ifstream::binary );
+        data.assign ( istreambuf_iterator<char> ( fin ), istreambuf_iterator<char>() );
+    }
+    {
+        uint32_t footerOffset;
+        memcpy ( &footerOffset, &data[data.size() - 8], sizeof ( footerOffset ) );
+
+        ofstream fout ( TEST_REPLAY_FILE, ofstream::binary | ofstream::trunc );
+        fout.write ( &data[0], footerOffset - 4 );
+    }
+
+    {
+        ReplayManager repMan;
+        ASSERT_TRUE ( repMan.load ( TEST_REPLAY_FILE, false ) );
+
+        checkTestReplay ( repMan );
+
+        EXPECT_EQ ( 0u, repMan.getGameMode ( {{ 0, 4 }} ) );
+    }
+
+    remove ( TEST_REPLAY_FILE );
+}
+
+
+// Write a legacy text replay line, the same format as scripts/sync2replay
+static void writeLegacyLine ( ostream& os, uint32_t gameMode, const string& state, IndexedFrame indexedFrame,
+                              const string& tag, const string& rest )
+{
+    os << gameMode << ' ' << state << ' ' << indexedFrame.parts.index << ' ' << indexedFrame.parts.frame
+       << ' ' << tag << ' ' << rest << '\n';
+}
+
+static void writeLegacyReplay ( ostream& os, uint32_t numIndices, uint32_t numFrames )
+{
+    for ( uint32_t index = 1; index <= numIndices; ++index )
+    {
+        const uint32_t gameMode = ( index % 2 ? CC_GAME_MODE_LOADING : CC_GAME_MODE_IN_GAME );
+        const string state = ( index % 2 ? "Loading" : "InGame" );
+
+        writeLegacyLine ( os, gameMode, state, {{ 0, index }}, "RngState",
+                          makeRngState ( index )->getAs<RngState>().dump() );
+
+        if ( gameMode == CC_GAME_MODE_IN_GAME )
+        {
+            writeLegacyLine ( os, gameMode, state, {{ 0, index }}, "P1", "12 1 3" );
+            writeLegacyLine ( os, gameMode, state, {{ 0, index }}, "P2", "34 2 5" );
+        }
+
+        for ( uint32_t frame = 0; frame < numFrames; ++frame )
+        {
+            writeLegacyLine ( os, gameMode, state, {{ frame, index }}, "Inputs",
+                              format ( "0x%04x 0x%04x", frame & 0xFFFF, index ) );
+
+            if ( frame % 100 != 99 )
+                continue;
+
+            writeLegacyLine ( os, gameMode, state, {{ frame, index }}, "Rollback",
+                              format ( "%u %u", index, frame - 3 ) );
+
+            for ( uint32_t i = frame - 3; i <= frame; ++i )
+                writeLegacyLine ( os, gameMode, state, {{ i, index }}, "Reinputs", "0x0001 0x0002" );
+        }
+    }
+}
+
+
+TEST ( Replay, ConvertLegacy )
+{
+    {
+        ofstream fout ( TEST_LEGACY_FILE );
+        writeLegacyReplay ( fout, 4, 200 );
+    }
+
+    ReplayManager repMan;
+    ASSERT_TRUE ( repMan.load ( TEST_LEGACY_FILE, false ) );
+
+    EXPECT_EQ ( 4u, repMan.getLastIndex() );
+    EXPECT_EQ ( 199u, repMan.getLastFrame() );
+
+    EXPECT_EQ ( uint32_t ( CC_GAME_MODE_IN_GAME ), repMan.getGameMode ( {{ 0, 2 }} ) );
+    EXPECT_EQ ( "NetplayState::InGame", repMan.getStateStr ( {{ 0, 2 }} ) );
+
+    EXPECT_EQ ( 150u, repMan.getInputs ( {{ 150, 2 }} ).p1 );
+    EXPECT_EQ ( 2u, repMan.getInputs ( {{ 150, 2 }} ).p2 );
+
+    EXPECT_EQ ( IndexedFrame ( {{ 96, 2 }} ).value, repMan.getRollbackTarget ( {{ 99, 2 }} ).value );
+    EXPECT_EQ ( 4u, repMan.getReinputs ( {{ 99, 2 }} ).size() );
+
+    ASSERT_TRUE ( repMan.getRngState ( {{ 0, 3 }} ).get() != 0 );
+    EXPECT_EQ ( makeRngState ( 3 )->getAs<RngState>().dump(),
+                repMan.getRngState ( {{ 0, 3 }} )->getAs<RngState>().dump() );
+
+    MsgPtr initial = repMan.getInitialStateBefore ( 2 );
+
+    ASSERT_TRUE ( initial.get() != 0 );
+    EXPECT_EQ ( 1u, initial->getAs<InitialGameState>().indexedFrame.parts.index );
+    EXPECT_EQ ( 34u, initial->getAs<InitialGameState>().chara[1] );
+
+    remove ( TEST_LEGACY_FILE );
+    remove ( TEST_LEGACY_FILE REPLAY_EXT );
+}
+
+
+TEST ( Replay, LoadBenchmark )
+{
+    {
+        ofstream fout ( TEST_LEGACY_FILE );
+        writeLegacyReplay ( fout, NUM_BENCHMARK_INDICES, NUM_BENCHMARK_FRAMES );
+    }
+
+    // Read every input in the replay, like playing it back
+    auto playback = [] ( ReplayManager& repMan )
+    {
+        uint32_t sum = 0;
+
+        for ( uint32_t index = 1; index <= repMan.getLastIndex(); ++index )
+            for ( uint32_t frame = 0; frame < NUM_BENCHMARK_FRAMES; ++frame )
+                sum += repMan.getInputs ( {{ frame, index }} ).p1;
+
+        return sum;
+    };
+
+    // Parsing the text replay is the same work the previous loader did
+    const double legacyNs = benchmark ( 1, [&]()
+    {
+        ASSERT_TRUE ( convertLegacyReplay ( TEST_LEGACY_FILE, TEST_REPLAY_FILE ) );
+    } );
+
+    uint32_t sum = 0;
+
+    const double binaryNs = benchmark ( 1, [&]()
+    {
+        ReplayManager repMan;
+        ASSERT_TRUE ( repMan.load ( TEST_REPLAY_FILE, false ) );
+        sum = playback ( repMan );
+    } );
+
+    EXPECT_GT ( sum, 0u );
+
+    printBenchmark ( "Replay load", legacyNs, binaryNs );
+
+    PRINT ( "[   MEMORY ] Replay file: %u bytes -> %u bytes",
+            getFileSize ( TEST_LEGACY_FILE ), getFileSize ( TEST_REPLAY_FILE ) );
+
+    EXPECT_LT ( getFileSize ( TEST_REPLAY_FILE ), getFileSize ( TEST_LEGACY_FILE ) );
+
+    remove ( TEST_LEGACY_FILE );
+    remove ( TEST_REPLAY_FILE );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,202 @@
+#ifndef RELEASE
+
+#include "Test.Benchmark.hpp"
+#include "SharedMemoryIpc.hpp"
+#include "Messages.hpp"
+#include "TimerManager.hpp"
+#include "SocketManager.hpp"
+#include "Timer.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#define getpid GetCurrentProcessId
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+// Small enough that the messages wrap around the end of the ring many times
+#define SMALL_RING_CAPACITY     ( 256 )
+
+#define NUM_RING_MESSAGES       ( 1000 )
+#define NUM_IPC_MESSAGES        ( 200u )
+#define NUM_BENCHMARK_MESSAGES  ( 100000 )
+
+#define IPC_TEST_TIMEOUT        ( 5000 )
+
+
+static string getTestName ( const string& name )
+{
+    return format ( "cccaster_test_%s_%u", name, getpid() );
+}
+
+static string getTestError ( size_t i )
+{
+    return format ( "Error %u", i ) + string ( i % 97, 'x' );
+}
+
+
+TEST ( IpcRing, WrapAround )
+{
+    SharedMemory memory;
+    ASSERT_TRUE ( memory.create ( getTestName ( "ring" ), IpcRing::getMemorySize ( SMALL_RING_CAPACITY ) ) );
+
+    IpcRing writer, reader;
+    ASSERT_TRUE ( writer.init ( memory.data(), SMALL_RING_CAPACITY, getTestName ( "ring_event" ) ) );
+    ASSERT_TRUE ( reader.attach ( memory.data(), memory.size(), getTestName ( "ring_event" ) ) );
+
+    EXPECT_TRUE ( reader.isEmpty() );
+    EXPECT_FALSE ( reader.read().get() );
+
+    for ( size_t i = 0; i < NUM_RING_MESSAGES; ++i )
+    {
+        const uint32_t position = reader.getWritePosition();
+
+        ASSERT_TRUE ( writer.write ( ErrorMessage ( getTestError ( i ) ) ) );
+        EXPECT_NE ( position, reader.getWritePosition() );
+
+        MsgPtr msg = reader.read();
+
+        ASSERT_TRUE ( msg.get() );
+        ASSERT_EQ ( MsgType::ErrorMessage, msg->getMsgType() );
+        EXPECT_EQ ( getTestError ( i ), msg->getAs<ErrorMessage>().error );
+        EXPECT_TRUE ( reader.isEmpty() );
+    }
+
+    // Fill the ring, then everything written should be read back in order
+    size_t count = 0;
+
+    while ( writer.write ( ErrorMessage ( getTestError ( count ) ) ) )
+        ++count;
+
+    EXPECT_GT ( count, 1u );
+
+    // A message larger than the ring never fits
+    EXPECT_FALSE ( writer.write ( ErrorMessage ( string ( SMALL_RING_CAPACITY, 'x' ) ) ) );
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        MsgPtr msg = reader.read();
+
+        ASSERT_TRUE ( msg.get() );
+        EXPECT_EQ ( getTestError ( i ), msg->getAs<ErrorMessage>().error );
+    }
+
+    EXPECT_TRUE ( reader.isEmpty() );
+
+    // Nothing is written, so this times out
+    EXPECT_FALSE ( reader.waitForWrite ( reader.getWritePosition(), 1 ) );
+}
+
+TEST ( SharedMemoryIpc, SendRecv )
+{
+    struct TestIpc : public SharedMemoryIpc::Owner, public Timer::Owner
+    {
+        SharedMemoryIpc ipc;
+        Timer timer;
+        vector<string> received;
+        bool echo = false;
+
+        void sharedMemoryRead ( SharedMemoryIpc *ipc, const MsgPtr& msg ) override
+        {
+            received.push_back ( msg->getAs<ErrorMessage>().error );
+
+            if ( echo )
+                ipc->send ( msg );
+            else if ( received.size() >= NUM_IPC_MESSAGES )
+                EventManager::get().stop();
+        }
+
+        void timerExpired ( Timer *timer ) override
+        {
+            LOG ( "Stopping because of timeout" );
+            EventManager::get().stop();
+        }
+
+        TestIpc() : ipc ( this ), timer ( this ) {}
+    };
+
+    TimerManager::get().initialize();
+    SocketManager::get().initialize();
+
+    TestIpc creator, opener;
+
+    ASSERT_TRUE ( creator.ipc.create ( getTestName ( "ipc" ), SMALL_RING_CAPACITY ) );
+    EXPECT_FALSE ( creator.ipc.isPeerOpen() );
+
+    // Messages are kept until the other side opens the channel and starts reading, even if they don't fit in the ring
+    for ( size_t i = 0; i < NUM_IPC_MESSAGES; ++i )
+        EXPECT_TRUE ( creator.ipc.send ( ErrorMessage ( getTestError ( i ) ) ) );
+
+    ASSERT_TRUE ( opener.ipc.open ( getTestName ( "ipc" ) ) );
+    EXPECT_TRUE ( creator.ipc.isPeerOpen() );
+
+    // The other side echoes everything back
+    opener.echo = true;
+    creator.ipc.setReading ( true );
+    opener.ipc.setReading ( true );
+
+    creator.timer.start ( IPC_TEST_TIMEOUT );
+
+    EventManager::get().start();
+
+    ASSERT_EQ ( NUM_IPC_MESSAGES, opener.received.size() );
+    ASSERT_EQ ( NUM_IPC_MESSAGES, creator.received.size() );
+
+    for ( size_t i = 0; i < NUM_IPC_MESSAGES; ++i )
+    {
+        EXPECT_EQ ( getTestError ( i ), opener.received[i] );
+        EXPECT_EQ ( getTestError ( i ), creator.received[i] );
+    }
+
+    opener.ipc.close();
+    creator.ipc.close();
+
+    SocketManager::get().deinitialize();
+    TimerManager::get().deinitialize();
+}
+
+TEST ( SharedMemoryIpc, Benchmark )
+{
+    SharedMemory memory;
+    ASSERT_TRUE ( memory.create ( getTestName ( "benchmark" ), IpcRing::getMemorySize ( DEFAULT_IPC_RING_CAPACITY ) ) );
+
+    IpcRing ring;
+    ASSERT_TRUE ( ring.init ( memory.data(), DEFAULT_IPC_RING_CAPACITY, getTestName ( "benchmark_event" ) ) );
+
+    // Spectator inputs are the most frequent message forwarded between the processes
+    BothInputs bothInputs ( IndexedFrame { { 123, 4 } } );
+
+    for ( size_t i = 0; i < bothInputs.inputs[0].size(); ++i )
+        bothInputs.inputs[0][i] = bothInputs.inputs[1][i] = ( i / 8 ) % 0x10;
+
+    size_t failed = 0;
+
+    const double encodeNs = benchmark ( NUM_BENCHMARK_MESSAGES, [&]()
+    {
+        bothInputs.invalidate();
+        const string bytes = Protocol::encode ( bothInputs, WIRE_VERSION_LATEST );
+        size_t consumed;
+        failed += ! Protocol::decode ( &bytes[0], bytes.size(), consumed ).get();
+    } );
+
+    const double ringNs = benchmark ( NUM_BENCHMARK_MESSAGES, [&]()
+    {
+        ring.write ( bothInputs );
+        failed += ! ring.read().get();
+    } );
+
+    EXPECT_EQ ( 0u, failed );
+
+    // This doesn't include the loopback socket round trip that the ring also avoids
+    printBenchmark ( "BothInputs Protocol encode+decode vs IpcRing write+read", encodeNs, ringNs );
+}
+
+#endif // NOT RELEASE
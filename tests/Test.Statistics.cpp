@@ -0,0 +1,175 @@
+#ifndef RELEASE
+
+#include "Statistics.hpp"
+#include "Messages.hpp"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+TEST ( LatencyHistogram, Buckets )
+{
+    // Small values are exact
+    for ( uint32_t i = 0; i < 2 * LATENCY_HISTOGRAM_SUB_COUNT; ++i )
+    {
+        EXPECT_EQ ( i, LatencyHistogram::getBucketIndex ( i ) );
+        EXPECT_EQ ( i, LatencyHistogram::getBucketMax ( i ) );
+    }
+
+    // Every value is in a bucket with a max that is at least the value, and within 1/16 of it
+    size_t lastIndex = 0;
+
+    for ( uint64_t value = 1; value <= numeric_limits<uint32_t>::max(); value += 1 + value / 7 )
+    {
+        const size_t index = LatencyHistogram::getBucketIndex ( value );
+        const uint32_t max = LatencyHistogram::getBucketMax ( index );
+
+        EXPECT_GE ( index, lastIndex );
+        EXPECT_GE ( max, value );
+        EXPECT_LE ( max - value, value / LATENCY_HISTOGRAM_SUB_COUNT );
+
+        if ( index > 0 )
+        {
+            EXPECT_LT ( LatencyHistogram::getBucketMax ( index - 1 ), value );
+        }
+
+        lastIndex = index;
+    }
+
+    EXPECT_EQ ( numeric_limits<uint32_t>::max(),
+                LatencyHistogram::getBucketMax ( LatencyHistogram::getBucketIndex ( numeric_limits<uint32_t>::max() ) ) );
+}
+
+TEST ( LatencyHistogram, Percentiles )
+{
+    Statistics stats;
+
+    EXPECT_EQ ( 0, stats.getPercentile ( 50 ) );
+
+    for ( uint32_t i = 1; i <= 1000; ++i )
+        stats.addSample ( i );
+
+    EXPECT_EQ ( 1000u, stats.getHistogram().getNumSamples() );
+
+    EXPECT_NEAR ( 500, stats.getPercentile ( 50 ), 500 / LATENCY_HISTOGRAM_SUB_COUNT );
+    EXPECT_NEAR ( 900, stats.getPercentile ( 90 ), 900 / LATENCY_HISTOGRAM_SUB_COUNT );
+    EXPECT_NEAR ( 990, stats.getPercentile ( 99 ), 990 / LATENCY_HISTOGRAM_SUB_COUNT );
+    EXPECT_NEAR ( 999, stats.getPercentile ( 99.9 ), 999 / LATENCY_HISTOGRAM_SUB_COUNT );
+
+    EXPECT_GE ( stats.getPercentile ( 50 ), 500 );
+    EXPECT_LE ( stats.getPercentile ( 50 ), stats.getPercentile ( 90 ) );
+    EXPECT_LE ( stats.getPercentile ( 90 ), stats.getPercentile ( 99 ) );
+    EXPECT_LE ( stats.getPercentile ( 99 ), stats.getPercentile ( 99.9 ) );
+
+    // A tail that barely moves the mean still shows up in the high percentiles
+    Statistics tail;
+
+    for ( uint32_t i = 0; i < 990; ++i )
+        tail.addSample ( 20 );
+
+    for ( uint32_t i = 0; i < 10; ++i )
+        tail.addSample ( 200 );
+
+    EXPECT_EQ ( 20, tail.getPercentile ( 50 ) );
+    EXPECT_EQ ( 20, tail.getPercentile ( 99 ) );
+    EXPECT_NEAR ( 200, tail.getPercentile ( 99.9 ), 200 / LATENCY_HISTOGRAM_SUB_COUNT );
+
+    stats.reset();
+    EXPECT_EQ ( 0u, stats.getHistogram().getNumSamples() );
+}
+
+TEST ( LatencyHistogram, Merge )
+{
+    Statistics a, b, both;
+
+    for ( uint32_t i = 0; i < 100; ++i )
+    {
+        a.addSample ( 10 + i % 7 );
+        b.addSample ( 100 + i );
+        both.addSample ( 10 + i % 7 );
+        both.addSample ( 100 + i );
+    }
+
+    a.merge ( b );
+
+    EXPECT_EQ ( both.getNumSamples(), a.getNumSamples() );
+    EXPECT_EQ ( both.getHistogram().getNumSamples(), a.getHistogram().getNumSamples() );
+
+    for ( double percentile : { 10.0, 50.0, 75.0, 90.0, 99.0, 99.9 } )
+        EXPECT_EQ ( both.getPercentile ( percentile ), a.getPercentile ( percentile ) );
+}
+
+TEST ( LatencyHistogram, InvalidLoad )
+{
+    auto load = [] ( const vector<uint32_t>& varints )
+    {
+        ostringstream ss ( stringstream::binary );
+        {
+            cereal::BinaryOutputArchive ar ( ss );
+
+            for ( uint32_t value : varints )
+                saveVarint ( ar, value );
+        }
+
+        istringstream in ( ss.str(), stringstream::binary );
+        cereal::BinaryInputArchive ar ( in );
+
+        LatencyHistogram histogram;
+        histogram.load ( ar );
+    };
+
+    const uint32_t maxIndex = LatencyHistogram::getBucketIndex ( numeric_limits<uint32_t>::max() );
+
+    EXPECT_NO_THROW ( load ( { 2, 5, 1, maxIndex - 5, 1 } ) );
+
+    // More buckets than there are bucket indices
+    EXPECT_THROW ( load ( { maxIndex + 2, 0, 1 } ), cereal::Exception );
+
+    // The second delta would wrap around to index 4 as a 32 bit sum
+    EXPECT_THROW ( load ( { 2, 5, 1, numeric_limits<uint32_t>::max(), 1 } ), cereal::Exception );
+}
+
+TEST ( LatencyHistogram, PingStats )
+{
+    Statistics latency;
+
+    for ( uint32_t i = 0; i < 100; ++i )
+        latency.addSample ( 30 + ( i * i ) % 50 );
+
+    // The histogram is only sent with the compact wire version
+    for ( uint8_t wireVersion = WIRE_VERSION_LEGACY; wireVersion <= WIRE_VERSION_LATEST; ++wireVersion )
+    {
+        const string bytes = Protocol::encode ( PingStats ( latency, 5 ), wireVersion );
+
+        size_t consumed = 0;
+        MsgPtr msg = Protocol::decode ( &bytes[0], bytes.size(), consumed );
+
+        ASSERT_TRUE ( msg.get() );
+        ASSERT_EQ ( MsgType::PingStats, msg->getMsgType() );
+        EXPECT_EQ ( bytes.size(), consumed );
+
+        const PingStats& pingStats = msg->getAs<PingStats>();
+
+        EXPECT_EQ ( 5, pingStats.packetLoss );
+        EXPECT_EQ ( latency.getNumSamples(), pingStats.latency.getNumSamples() );
+        EXPECT_DOUBLE_EQ ( latency.getMean(), pingStats.latency.getMean() );
+
+        if ( wireVersion < WIRE_VERSION_COMPACT )
+        {
+            EXPECT_EQ ( 0u, pingStats.latency.getHistogram().getNumSamples() );
+            continue;
+        }
+
+        EXPECT_EQ ( latency.getHistogram().getNumSamples(), pingStats.latency.getHistogram().getNumSamples() );
+
+        for ( double percentile : { 50.0, 90.0, 99.0, 99.9 } )
+            EXPECT_EQ ( latency.getPercentile ( percentile ), pingStats.latency.getPercentile ( percentile ) );
+    }
+}
+
+#endif // NOT RELEASE
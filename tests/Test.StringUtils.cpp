@@ -0,0 +1,114 @@
+#ifndef RELEASE
+
+#include "StringUtils.hpp"
+#include "Test.Benchmark.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace std;
+
+
+#define NUM_BENCHMARK_FORMATS   ( 20000 )
+
+
+// Type that is only printable with operator<<
+struct FormattedPoint
+{
+    int x, y;
+};
+
+static ostream& operator<< ( ostream& os, const FormattedPoint& a ) { return ( os << '{' << a.x << ", " << a.y << '}' ); }
+
+
+// Check that FormatString gives the same output as format, including when the buffer is too small
+template<typename ... V>
+static void expectSameFormat ( const char *fmt, const V& ... vals )
+{
+    const string expected = format ( fmt, vals... );
+    const FormatString formatString ( fmt );
+
+    EXPECT_EQ ( expected, formatString.str ( vals... ) ) << "fmt=" << fmt;
+
+    char buffer[8];
+    const size_t len = formatString.print ( buffer, sizeof ( buffer ), vals... );
+
+    EXPECT_EQ ( expected.size(), len ) << "fmt=" << fmt;
+    EXPECT_EQ ( expected.substr ( 0, sizeof ( buffer ) - 1 ), buffer ) << "fmt=" << fmt;
+}
+
+
+TEST ( StringUtils, FormatString )
+{
+    const char str[] = "array";
+    const char *nullStr = 0;
+    const int negative = -12345;
+    const uint8_t byte = 0xFE;
+    const int8_t signedByte = -2;
+
+    expectSameFormat ( "No arguments 100%% literal" );
+    expectSameFormat ( "" );
+    expectSameFormat ( "%d", 0 );
+    expectSameFormat ( "Integers: %d %i %u %x %X", negative, INT_MIN, UINT_MAX, 0xABCDEFu, 0xABCDEFu );
+    expectSameFormat ( "Promoted: %d %u %x %d %u", byte, byte, byte, signedByte, signedByte );
+    expectSameFormat ( "Widths: %02x %04X %-6d| %+d %10s|", byte, 0xBEEF, 7, 8, "right" );
+    expectSameFormat ( "64 bit: %llu %llx %lld", 0x123456789ABCDEFULL, 0x123456789ABCDEFULL, -1LL );
+    expectSameFormat ( "Floats: %.1f %.3f %Lg %f", 1.25f, 3.14159, 2.5L, -0.5 );
+    expectSameFormat ( "Bools: %d %u", true, false );
+    expectSameFormat ( "Strings: %s '%s' %s %s %s", "literal", str, string ( "std::string" ), nullStr, ( char * ) 0 );
+    expectSameFormat ( "Escaped: %s %s", string ( "100%% done" ), string ( "50%" ) );
+    expectSameFormat ( "Operator: %s, %s", FormattedPoint { 1, -2 }, FormattedPoint { 3, 4 } );
+    expectSameFormat ( "Escaped 100%% %u%%", 5u );
+    expectSameFormat ( "Missing argument: %u %u %s 100%%", 1u );
+    expectSameFormat ( "Extra argument: %u", 1u, 2u, "three" );
+    expectSameFormat ( "Trailing percent %u %", 5u );
+    expectSameFormat ( "Trailing percent %u %%%", 5u );
+    expectSameFormat ( "%u%u%u", 1u, 2u, 3u );
+    expectSameFormat ( "No conversions 100%%", 1u );
+    expectSameFormat ( "Long: %s", string ( 2000, 'x' ) );
+}
+
+
+TEST ( StringUtils, FormatTo )
+{
+    char buffer[64];
+
+    EXPECT_EQ ( 10u, FORMAT_TO ( buffer, sizeof ( buffer ), "%s=%03d;", "value", 42 ) );
+    EXPECT_EQ ( string ( "value=042;" ), buffer );
+
+    // Truncated like snprintf
+    EXPECT_EQ ( 9u, FORMAT_TO ( buffer, 4, "%s=%u;", "value", 42u ) );
+    EXPECT_EQ ( string ( "val" ), buffer );
+
+    EXPECT_EQ ( "00 7f 80 ff", formatAsHex ( string ( "\x00\x7f\x80\xff", 4 ) ) );
+}
+
+
+TEST ( StringUtils, Benchmark )
+{
+    uint32_t frame = 0;
+    char buffer[256];
+    size_t len = 0;
+
+    // Similar to the per frame LOG_SYNC_CHARACTER
+#define FORMAT_FRAME "%s [%u] %s [%u] P%u: C=%u; M=%u; seq=%u; hp=%u; gb=%.1f; x=%d; y=%d"
+#define FRAME_ARGS "InGame", 1, "NetplayState::InGame", ++frame, 1, 12, 2, 40, 11400, 7000.0f, -1234, 0
+
+    const double formatNs = benchmark ( NUM_BENCHMARK_FORMATS, [&]()
+    {
+        len += format ( FORMAT_FRAME, FRAME_ARGS ).size();
+    } );
+
+    const double formatToNs = benchmark ( NUM_BENCHMARK_FORMATS, [&]()
+    {
+        len += FORMAT_TO ( buffer, sizeof ( buffer ), FORMAT_FRAME, FRAME_ARGS );
+    } );
+
+#undef FORMAT_FRAME
+#undef FRAME_ARGS
+
+    EXPECT_GT ( len, 0u );
+
+    printBenchmark ( "format vs FORMAT_TO per frame sync log", formatNs, formatToNs );
+}
+
+#endif // NOT RELEASE
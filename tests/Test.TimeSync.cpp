@@ -0,0 +1,246 @@
+#ifndef RELEASE
+
+#include "TimeSync.hpp"
+#include "Messages.hpp"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <queue>
+
+using namespace std;
+
+
+#define FRAME_US        ( 1000000.0 / 60 )
+#define TIME_STEP_US    ( 100 )
+
+// A peer stalls if it is this many frames ahead of the last remote inputs, like delay + rollback
+#define MAX_AHEAD       ( 8 )
+
+
+struct TimeSyncPeer
+{
+    struct Packet
+    {
+        double arrival;
+        uint32_t frame;
+        int8_t frameOffset;
+
+        bool operator< ( const Packet& other ) const { return arrival > other.arrival; }
+    };
+
+    TimeSync timeSync;
+
+    // Frame interval multiplier, ie 1.005 for a clock that runs 0.5% slow
+    double skew = 1.0;
+
+    uint32_t frame = 0, remoteFrame = 0;
+
+    double nextFrameTime = 0, minFps = 1e9;
+
+    uint64_t stalls = 0;
+
+    // Packets to this peer
+    priority_queue<Packet> incoming;
+
+    // Run a frame if it is time for one, inputs are only read once per frame like DllMain
+    void step ( double now, TimeSyncPeer& remote, double latency, double jitter, mt19937& random )
+    {
+        if ( now < nextFrameTime )
+            return;
+
+        while ( ! incoming.empty() && incoming.top().arrival <= now )
+        {
+            const Packet& packet = incoming.top();
+
+            if ( packet.frame > remoteFrame )
+            {
+                timeSync.addSample ( double ( frame ) - packet.frame );
+                remoteFrame = packet.frame;
+            }
+
+            timeSync.setRemoteOffset ( packet.frameOffset );
+            incoming.pop();
+        }
+
+        if ( frame >= remoteFrame + MAX_AHEAD )
+        {
+            ++stalls;
+            nextFrameTime = now + TIME_STEP_US;
+            return;
+        }
+
+        ++frame;
+
+        const double delay = latency + uniform_real_distribution<double> ( -jitter, jitter ) ( random );
+        remote.incoming.push ( { now + delay, frame, timeSync.getEncodedOffset() } );
+
+        const double fps = timeSync.getFps();
+        minFps = min ( minFps, fps );
+
+        nextFrameTime = max ( nextFrameTime + skew * 1000000.0 / fps, now );
+    }
+};
+
+
+// Run two peers for the given number of seconds, and return the mean frames a is ahead of b in the last 10 seconds
+static double run ( TimeSyncPeer& a, TimeSyncPeer& b, double seconds, double latency = 30000, double jitter = 3000 )
+{
+    mt19937 random ( 12345 );
+
+    const double end = seconds * 1000000;
+    const double measureStart = end - 10000000;
+
+    double sum = 0;
+    size_t count = 0;
+
+    for ( double now = 0; now < end; now += TIME_STEP_US )
+    {
+        a.step ( now, b, latency, jitter, random );
+        b.step ( now, a, latency, jitter, random );
+
+        if ( now >= measureStart )
+        {
+            sum += double ( a.frame ) - b.frame;
+            ++count;
+        }
+    }
+
+    return sum / count;
+}
+
+
+TEST ( TimeSync, NotReady )
+{
+    TimeSync timeSync;
+
+    EXPECT_FALSE ( timeSync.isReady() );
+    EXPECT_EQ ( FRAME_OFFSET_UNKNOWN, timeSync.getEncodedOffset() );
+
+    // Enough local samples, but the remote offset is unknown, so there is no adjustment
+    for ( size_t i = 0; i < timeSync.settings.minSamples; ++i )
+        timeSync.addSample ( 10 );
+
+    EXPECT_EQ ( 10 * FRAME_OFFSET_SCALE, timeSync.getEncodedOffset() );
+    EXPECT_FALSE ( timeSync.isReady() );
+    EXPECT_EQ ( 0, timeSync.getAdvantage() );
+    EXPECT_EQ ( timeSync.settings.fps, timeSync.getFps() );
+
+    // Behind, so only the remote slows down
+    timeSync.setRemoteOffset ( 14 * FRAME_OFFSET_SCALE );
+
+    EXPECT_TRUE ( timeSync.isReady() );
+    EXPECT_DOUBLE_EQ ( -2, timeSync.getAdvantage() );
+    EXPECT_EQ ( timeSync.settings.fps, timeSync.getFps() );
+
+    // Ahead, the slowdown is limited
+    timeSync.setRemoteOffset ( -10 * FRAME_OFFSET_SCALE );
+
+    EXPECT_DOUBLE_EQ ( 10, timeSync.getAdvantage() );
+    EXPECT_DOUBLE_EQ ( timeSync.settings.fps * ( 1 - timeSync.settings.maxSlowdown ), timeSync.getFps() );
+
+    timeSync.setRemoteOffset ( FRAME_OFFSET_UNKNOWN );
+    EXPECT_FALSE ( timeSync.isReady() );
+}
+
+TEST ( TimeSync, Outliers )
+{
+    TimeSync timeSync;
+
+    for ( size_t i = 0; i < timeSync.settings.window; ++i )
+        timeSync.addSample ( ( i % 10 == 0 ) ? 12 : 3 + 0.1 * ( i % 3 ) );
+
+    const TimeSync::Metrics metrics = timeSync.getMetrics();
+
+    EXPECT_NEAR ( 3.1, metrics.localOffset, 0.01 );
+    EXPECT_EQ ( timeSync.settings.window / 10, metrics.outliers );
+    EXPECT_EQ ( timeSync.settings.window, metrics.samples );
+
+    // Only the last window of samples is kept
+    for ( size_t i = 0; i < timeSync.settings.window; ++i )
+        timeSync.addSample ( -1 );
+
+    EXPECT_DOUBLE_EQ ( -1, timeSync.getMetrics().localOffset );
+    EXPECT_EQ ( 0u, timeSync.getMetrics().outliers );
+}
+
+TEST ( TimeSync, PlayerInputs )
+{
+    PlayerInputs playerInputs ( IndexedFrame {{ 123, 1 }} );
+    playerInputs.frameOffset = -3 * FRAME_OFFSET_SCALE;
+
+    // The frame offset is only sent with the compact wire version
+    for ( uint8_t wireVersion = WIRE_VERSION_LEGACY; wireVersion <= WIRE_VERSION_LATEST; ++wireVersion )
+    {
+        const string bytes = Protocol::encode ( playerInputs, wireVersion );
+
+        size_t consumed = 0;
+        MsgPtr msg = Protocol::decode ( &bytes[0], bytes.size(), consumed );
+
+        ASSERT_TRUE ( msg.get() );
+        ASSERT_EQ ( MsgType::PlayerInputs, msg->getMsgType() );
+
+        if ( wireVersion < WIRE_VERSION_COMPACT )
+            EXPECT_EQ ( FRAME_OFFSET_UNKNOWN, msg->getAs<PlayerInputs>().frameOffset );
+        else
+            EXPECT_EQ ( playerInputs.frameOffset, msg->getAs<PlayerInputs>().frameOffset );
+    }
+}
+
+TEST ( TimeSync, Converge )
+{
+    // The host started 4 frames earlier
+    TimeSyncPeer host, client;
+    client.nextFrameTime = 4 * FRAME_US;
+
+    const double advantage = run ( host, client, 60 );
+
+    EXPECT_LT ( fabs ( advantage ), host.timeSync.settings.deadband + 0.5 );
+    EXPECT_GT ( host.timeSync.getMetrics().samples, 3000u );
+
+    // Only the host slowed down, and only by a fraction of a frame per frame
+    EXPECT_LT ( host.minFps, host.timeSync.settings.fps );
+    EXPECT_GE ( host.minFps, host.timeSync.settings.fps * ( 1 - host.timeSync.settings.maxSlowdown ) );
+    EXPECT_EQ ( client.timeSync.settings.fps, client.minFps );
+
+    EXPECT_EQ ( 0u, host.stalls );
+    EXPECT_EQ ( 0u, client.stalls );
+}
+
+TEST ( TimeSync, ClockSkew )
+{
+    // The client's clock runs 0.5% slow, so the host keeps getting ahead and stalls without time sync
+    TimeSyncPeer host, client;
+    client.skew = 1.005;
+    host.timeSync.settings.maxSlowdown = client.timeSync.settings.maxSlowdown = 0;
+
+    run ( host, client, 60 );
+
+    EXPECT_GT ( host.stalls, 0u );
+
+    // With time sync, the host runs slightly slower to match, instead of stalling
+    TimeSyncPeer syncedHost, syncedClient;
+    syncedClient.skew = 1.005;
+
+    const double advantage = run ( syncedHost, syncedClient, 60 );
+
+    EXPECT_EQ ( 0u, syncedHost.stalls );
+    EXPECT_EQ ( 0u, syncedClient.stalls );
+    EXPECT_LT ( fabs ( advantage ), 2.0 );
+    EXPECT_NEAR ( syncedHost.timeSync.settings.fps / 1.005, syncedHost.timeSync.getFps(), 0.1 );
+}
+
+TEST ( TimeSync, AsymmetricStart )
+{
+    // Same as Converge but the client is ahead, with more latency and jitter
+    TimeSyncPeer host, client;
+    host.nextFrameTime = 3 * FRAME_US;
+
+    const double advantage = run ( host, client, 60, 60000, 10000 );
+
+    EXPECT_LT ( fabs ( advantage ), client.timeSync.settings.deadband + 0.5 );
+    EXPECT_EQ ( host.timeSync.settings.fps, host.minFps );
+    EXPECT_LT ( client.minFps, client.timeSync.settings.fps );
+}
+
+#endif // NOT RELEASE
@@ -4,11 +4,14 @@
 #include "SocketManager.hpp"
 #include "TimerManager.hpp"
 #include "Timer.hpp"
+#include "Test.Benchmark.hpp"
 
 #include <gtest/gtest.h>
 
 #include <cstdlib>
 #include <vector>
+#include <memory>
+#include <unordered_set>
 
 using namespace std;
 
@@ -17,6 +20,12 @@ using namespace std;
 #define NUM_ITERATIONS          ( 10 )
 #define MAX_DELAY_MILLISECONDS  ( 2000 )
 
+#define NUM_BENCHMARK_TIMERS    ( 10000 )
+#define NUM_BENCHMARK_CHECKS    ( 1000 )
+
+// Number of timers restarted before each check, like the GoBackN send timers
+#define NUM_RESTARTS_PER_CHECK  ( 100 )
+
 
 TEST ( Timer, RepeatRandom )
 {
@@ -71,4 +80,158 @@ TEST ( Timer, RepeatRandom )
     TimerManager::get().deinitialize();
 }
 
+
+TEST ( Timer, ExpiryOrder )
+{
+    struct OrderedTimers : public Timer::Owner
+    {
+        vector<unique_ptr<Timer>> timers;
+        vector<size_t> expired;
+
+        void timerExpired ( Timer *timer ) override
+        {
+            size_t i = 0;
+            while ( timers[i].get() != timer )
+                ++i;
+
+            expired.push_back ( i );
+
+            // The first timer to expire stops one timer and deletes another, neither should expire after this
+            if ( expired.size() == 1 )
+            {
+                timers[3]->stop();
+                timers[4].reset ( new Timer ( this ) );
+            }
+
+            // Restarting from the callback schedules it relative to the current check
+            if ( expired.size() == 1 )
+                timer->start ( 15 );
+        }
+    };
+
+    TimerManager::get().initialize();
+
+    OrderedTimers test;
+    const uint64_t delays[] = { 40, 20, 10, 30, 30, 60 };
+
+    for ( uint64_t delay : delays )
+    {
+        test.timers.push_back ( unique_ptr<Timer> ( new Timer ( &test ) ) );
+        test.timers.back()->start ( delay );
+    }
+
+    // Restarting replaces the previous delay
+    test.timers[5]->start ( 50 );
+
+    const uint64_t end = TimerManager::get().getNow ( true ) + 100;
+
+    while ( TimerManager::get().getNow() < end )
+        TimerManager::get().check();
+
+    const vector<size_t> expected = { 2, 1, 2, 0, 5 };
+
+    EXPECT_EQ ( expected, test.expired );
+    EXPECT_EQ ( UINT64_MAX, TimerManager::get().getNextExpiry() );
+
+    for ( const auto& timer : test.timers )
+        EXPECT_FALSE ( timer->isStarted() );
+
+    test.timers.clear();
+
+    TimerManager::get().deinitialize();
+}
+
+
+// The previous TimerManager::check, which scanned every timer on every check
+struct ScannedTimer
+{
+    uint64_t delay = 0, expiry = 0;
+};
+
+static uint64_t checkScannedTimers ( const unordered_set<ScannedTimer *>& activeTimers,
+                                     const unordered_set<ScannedTimer *>& allocatedTimers, uint64_t now )
+{
+    uint64_t nextExpiry = UINT64_MAX;
+
+    for ( ScannedTimer *timer : activeTimers )
+    {
+        if ( allocatedTimers.find ( timer ) == allocatedTimers.end() )
+            continue;
+
+        if ( timer->expiry > 0 && now >= timer->expiry )
+            timer->delay = timer->expiry = 0;
+
+        if ( timer->delay > 0 )
+        {
+            timer->expiry = now + timer->delay;
+            timer->delay = 0;
+        }
+
+        if ( timer->expiry > 0 && timer->expiry < nextExpiry )
+            nextExpiry = timer->expiry;
+    }
+
+    return nextExpiry;
+}
+
+
+TEST ( Timer, Benchmark )
+{
+    struct IdleOwner : public Timer::Owner
+    {
+        void timerExpired ( Timer *timer ) override {}
+    };
+
+    TimerManager::get().initialize();
+
+    IdleOwner owner;
+    vector<unique_ptr<Timer>> timers;
+    vector<ScannedTimer> scannedTimers ( NUM_BENCHMARK_TIMERS );
+    unordered_set<ScannedTimer *> activeTimers, allocatedTimers;
+
+    srand ( 1234 );
+
+    // Long delays so none of the timers expire during the benchmark
+    for ( size_t i = 0; i < NUM_BENCHMARK_TIMERS; ++i )
+    {
+        const uint64_t delay = 60 * 1000 + rand() % ( 60 * 1000 );
+
+        timers.push_back ( unique_ptr<Timer> ( new Timer ( &owner ) ) );
+        timers.back()->start ( delay );
+
+        scannedTimers[i].delay = delay;
+        activeTimers.insert ( &scannedTimers[i] );
+        allocatedTimers.insert ( &scannedTimers[i] );
+    }
+
+    size_t next = 0;
+    uint64_t nextExpiry = 0;
+
+    const double scanNs = benchmark ( NUM_BENCHMARK_CHECKS, [&]()
+    {
+        for ( size_t i = 0; i < NUM_RESTARTS_PER_CHECK; ++i, next = ( next + 1 ) % NUM_BENCHMARK_TIMERS )
+            scannedTimers[next].delay = 60 * 1000;
+
+        nextExpiry = checkScannedTimers ( activeTimers, allocatedTimers, TimerManager::get().getNow ( true ) );
+    } );
+
+    EXPECT_NE ( UINT64_MAX, nextExpiry );
+
+    const double heapNs = benchmark ( NUM_BENCHMARK_CHECKS, [&]()
+    {
+        for ( size_t i = 0; i < NUM_RESTARTS_PER_CHECK; ++i, next = ( next + 1 ) % NUM_BENCHMARK_TIMERS )
+            timers[next]->start ( 60 * 1000 );
+
+        TimerManager::get().check();
+    } );
+
+    EXPECT_NE ( UINT64_MAX, TimerManager::get().getNextExpiry() );
+
+    printBenchmark ( format ( "TimerManager check with %u timers", NUM_BENCHMARK_TIMERS ), scanNs, heapNs );
+
+    timers.clear();
+
+    TimerManager::get().deinitialize();
+}
+
 #endif // NOT RELEASE
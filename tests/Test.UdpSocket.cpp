@@ -13,6 +13,9 @@ using namespace std;
 #define CHECK_SUM_FAIL  50
 #define LONG_TIMEOUT    ( 120 * 1000 )
 
+#define NUM_COALESCED_MESSAGES  ( 50u )
+#define NUM_IMPAIRED_MESSAGES   ( 200u )
+
 
 TEST_CONNECT                ( UdpSocket, PACKET_LOSS, CHECK_SUM_FAIL, LONG_TIMEOUT, LONG_TIMEOUT )
 
@@ -272,4 +275,192 @@ TEST ( UdpSocket, BindThenConnect )
     TimerManager::get().deinitialize();
 }
 
+
+// Messages sent in one event loop tick are coalesced, they should still all arrive in order despite packet loss
+static void testCoalescing ( uint64_t window )
+{
+    struct TestSocket : public BaseTestSocket<UdpSocket, 0, LONG_TIMEOUT>
+    {
+        uint64_t window = 0;
+        vector<string> received;
+
+        void socketAccepted ( Socket *serverSocket ) override
+        {
+            accepted = serverSocket->accept ( this );
+        }
+
+        void socketConnected ( Socket *socket ) override
+        {
+            socket->getAsUDP().setCoalescing ( true, window );
+
+            for ( size_t i = 0; i < NUM_COALESCED_MESSAGES; ++i )
+                socket->send ( new TestMessage ( format ( "Coalesced message %u", i ) ) );
+        }
+
+        void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override
+        {
+            if ( msg.get() && msg->getMsgType() == MsgType::TestMessage )
+                received.push_back ( msg->getAs<TestMessage>().str );
+
+            if ( received.size() >= NUM_COALESCED_MESSAGES )
+            {
+                LOG ( "Stopping because all messages were received" );
+                EventManager::get().stop();
+            }
+        }
+
+        void timerExpired ( Timer *timer ) override
+        {
+            LOG ( "Stopping because of timeout" );
+            EventManager::get().stop();
+        }
+
+        TestSocket ( uint16_t port ) : BaseTestSocket ( port )
+        {
+            socket->setPacketLoss ( PACKET_LOSS );
+        }
+
+        TestSocket ( const string& address, uint16_t port, uint64_t window )
+            : BaseTestSocket ( address, port ), window ( window )
+        {
+            socket->setPacketLoss ( PACKET_LOSS );
+        }
+    };
+
+    TimerManager::get().initialize();
+    SocketManager::get().initialize();
+
+    TestSocket server ( 0 );
+    TestSocket client ( "127.0.0.1", server.socket->address.port, window );
+
+    EventManager::get().start();
+
+    EXPECT_TRUE ( server.accepted.get() );
+    EXPECT_TRUE ( client.socket->isConnected() );
+
+    ASSERT_EQ ( NUM_COALESCED_MESSAGES, server.received.size() );
+
+    for ( size_t i = 0; i < NUM_COALESCED_MESSAGES; ++i )
+        EXPECT_EQ ( format ( "Coalesced message %u", i ), server.received[i] );
+
+    SocketManager::get().deinitialize();
+    TimerManager::get().deinitialize();
+}
+
+TEST ( UdpSocket, Coalescing )
+{
+    testCoalescing ( 0 );
+}
+
+TEST ( UdpSocket, CoalescingWindow )
+{
+    testCoalescing ( 5 );
+}
+
+// Messages over an emulated bad connection should still all arrive in order, exactly once
+static void testImpairment ( uint8_t wireVersion )
+{
+    struct TestSocket : public BaseTestSocket<UdpSocket, 0, LONG_TIMEOUT>
+    {
+        uint8_t wireVersion = WIRE_VERSION_LEGACY;
+        vector<string> received;
+
+        void socketAccepted ( Socket *serverSocket ) override
+        {
+            accepted = serverSocket->accept ( this );
+            accepted->setWireVersion ( wireVersion );
+        }
+
+        void socketConnected ( Socket *socket ) override
+        {
+            socket->setWireVersion ( wireVersion );
+
+            for ( size_t i = 0; i < NUM_IMPAIRED_MESSAGES; ++i )
+                socket->send ( new TestMessage ( format ( "Impaired message %u", i ) ) );
+        }
+
+        void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override
+        {
+            if ( msg.get() && msg->getMsgType() == MsgType::TestMessage )
+                received.push_back ( msg->getAs<TestMessage>().str );
+
+            if ( received.size() >= NUM_IMPAIRED_MESSAGES )
+            {
+                LOG ( "Stopping because all messages were received" );
+                EventManager::get().stop();
+            }
+        }
+
+        void timerExpired ( Timer *timer ) override
+        {
+            LOG ( "Stopping because of timeout" );
+            EventManager::get().stop();
+        }
+
+        TestSocket ( uint16_t port, uint8_t wireVersion )
+            : BaseTestSocket ( port ), wireVersion ( wireVersion ) {}
+
+        TestSocket ( const string& address, uint16_t port, uint8_t wireVersion )
+            : BaseTestSocket ( address, port ), wireVersion ( wireVersion ) {}
+    };
+
+    NetworkProfile profile;
+    profile.latency = 20;
+    profile.jitter = 10;
+    profile.normalJitter = true;
+    profile.loss = 5;
+    profile.burstEnter = 2;
+    profile.burstExit = 50;
+    profile.reorder = 5;
+    profile.reorderDelay = 30;
+    profile.duplicate = 5;
+    profile.bandwidth = 1000;
+
+    TimerManager::get().initialize();
+    SocketManager::get().initialize();
+
+    // Every socket sends through the impairment, and the client also receives through one
+    Socket::setDefaultImpairment ( profile );
+
+    TestSocket server ( 0, wireVersion );
+    TestSocket client ( "127.0.0.1", server.socket->address.port, wireVersion );
+    client.socket->setRecvImpairment ( profile );
+
+    Socket::setDefaultImpairment ( NetworkProfile() );
+
+    EventManager::get().start();
+
+    EXPECT_TRUE ( server.accepted.get() );
+    EXPECT_TRUE ( client.socket->isConnected() );
+
+    ASSERT_TRUE ( client.socket->getSendImpairment() );
+    EXPECT_GT ( client.socket->getSendImpairment()->getCounters().packets, 0u );
+
+    // Selective repeat is negotiated by the wire version
+    const bool selectiveRepeat = ( wireVersion >= WIRE_VERSION_COMPACT );
+
+    EXPECT_EQ ( selectiveRepeat, client.socket->getAsUDP().isSelectiveRepeat() );
+
+    if ( server.accepted.get() )
+        EXPECT_EQ ( selectiveRepeat, server.accepted->getAsUDP().isSelectiveRepeat() );
+
+    ASSERT_EQ ( NUM_IMPAIRED_MESSAGES, server.received.size() );
+
+    for ( size_t i = 0; i < NUM_IMPAIRED_MESSAGES; ++i )
+        EXPECT_EQ ( format ( "Impaired message %u", i ), server.received[i] );
+
+    SocketManager::get().deinitialize();
+    TimerManager::get().deinitialize();
+}
+
+TEST ( UdpSocket, Impairment )
+{
+    testImpairment ( WIRE_VERSION_LEGACY );
+}
+
+TEST ( UdpSocket, ImpairmentSelectiveRepeat )
+{
+    testImpairment ( WIRE_VERSION_COMPACT );
+}
+
 #endif // NOT RELEASE
@@ -19,10 +19,6 @@ using namespace std;
 
 #define CC_METER_ANIMATION_ADDR     ( ( uint32_t * ) 0x7717D8 )
 
-#define CC_EFFECTS_ARRAY_ADDR       ( ( char * )     0x67BDE8 )
-#define CC_EFFECTS_ARRAY_COUNT      ( 1000 )
-#define CC_EFFECT_ELEMENT_SIZE      ( 0x33C )
-
 #define CC_SUPER_FLASH_PAUSE_ADDR   ( ( uint32_t * ) 0x5595B4 )
 #define CC_SUPER_FLASH_TIMER_ADDR   ( ( uint32_t * ) 0x562A48 )
 
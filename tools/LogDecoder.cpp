@@ -0,0 +1,51 @@
+#include "LogRecord.hpp"
+#include "MappedFile.hpp"
+#include "StringUtils.hpp"
+
+#include <cstdio>
+
+using namespace std;
+
+
+// Decodes a binary log written with LOG_ASYNC back to the same text that would have been logged without it
+int main ( int argc, char *argv[] )
+{
+    if ( argc < 2 )
+    {
+        PRINT ( "Usage: %s <binary log> [output file]", argv[0] );
+        return -1;
+    }
+
+    MappedFile file;
+
+    if ( ! file.open ( argv[1] ) )
+    {
+        PRINT ( "Failed to open '%s'", argv[1] );
+        return -1;
+    }
+
+    string text;
+    const bool valid = decodeLog ( file.data(), file.size(), text );
+
+    FILE *out = ( argc > 2 ? fopen ( argv[2], "w" ) : stdout );
+
+    if ( ! out )
+    {
+        PRINT ( "Failed to open '%s'", argv[2] );
+        return -1;
+    }
+
+    fwrite ( text.c_str(), 1, text.size(), out );
+
+    if ( out != stdout )
+        fclose ( out );
+
+    // Logs are usually truncated by a crash, so everything before that is still output
+    if ( ! valid )
+    {
+        fprintf ( stderr, "Invalid or truncated log data\n" );
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,1736 @@
+#include "DllFrameStepper.hpp"
+#include "DllAsmHacks.hpp"
+#include "ProcessManager.hpp"
+#include "CharacterSelect.hpp"
+#include "ChangeMonitor.hpp"
+#include "MemDump.hpp"
+#include "SocketManager.hpp"
+#include "Statistics.hpp"
+#include "Algorithms.hpp"
+#include "Exceptions.hpp"
+#include "ErrorStringsExt.hpp"
+#include "Enum.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Older headers don't define this, and older kernels treat it as a hint, so the mapped address is still checked
+#if !defined ( _WIN32 ) && !defined ( MAP_FIXED_NOREPLACE )
+#define MAP_FIXED_NOREPLACE         ( 0x100000 )
+#endif
+
+#include <random>
+#include <chrono>
+#include <queue>
+#include <map>
+#include <list>
+#include <memory>
+
+using namespace std;
+
+
+#define LOG_FILE                    "simulator.log"
+
+// Range of MBAA's memory that is mapped for the fake game, this covers all the addresses in Constants.hpp.
+// Windows builds must be linked with an image base above this range, other builds must be position independent.
+#define GAME_MEMORY_START           ( 0x540000 )
+#define GAME_MEMORY_END             ( 0x7C0000 )
+
+// Unused game memory for the state of the fake game that isn't part of MBAA's memory layout
+#define FAKE_GAME_ADDR              ( ( FakeGame * ) 0x7BF000 )
+
+// Simulated time step in microseconds, and the frame interval of the game in microseconds
+#define TIME_STEP                   ( 1000 )
+#define FRAME_INTERVAL              ( 1000000.0 / 60 )
+
+// Fake game timings in frames
+#define SELECT_DONE_FRAMES          ( 30 )
+#define LOADING_FRAMES              ( 120 )
+#define CHARA_INTRO_FRAMES          ( 180 )
+#define PRE_GAME_FRAMES             ( 60 )
+#define ROUND_OVER_FRAMES           ( 90 )
+#define HIT_STUN_FRAMES             ( 15 )
+#define ATTACK_ACTIVE_FRAME         ( 6 )
+#define EFFECT_FRAMES               ( 30 )
+
+// Fake game rules
+#define SELECT_DONE                 ( CC_SELECT_COLOR + 1 )
+#define NUM_COLORS                  ( 36 )
+#define ROUND_TIME                  ( 4752 )
+#define MAX_HEALTH                  ( 11400 )
+#define MAX_METER                   ( 30000 )
+#define MAX_GUARD_BAR               ( 7000.0f )
+#define STAGE_EDGE                  ( 65536 )
+#define START_POSITION              ( 16384 )
+#define MIN_DISTANCE                ( 8192 )
+#define WALK_SPEED                  ( 512 )
+#define JUMP_SPEED                  ( 3072 )
+#define GRAVITY                     ( 192 )
+#define ATTACK_RANGE                ( 24576 )
+
+// Fake game sound effects, hits are SFX_HIT + attack
+#define SFX_HIT                     ( 10 )
+#define SFX_GUARD                   ( 20 )
+#define SFX_KO                      ( 30 )
+
+#define CONFIRM_BUTTONS             ( CC_BUTTON_A | CC_BUTTON_CONFIRM )
+#define CANCEL_BUTTONS              ( CC_BUTTON_B | CC_BUTTON_CANCEL )
+
+
+// The simulator is linked with the DLL netplay code instead of DllAsmHacks.cpp, so it provides these
+namespace AsmHacks
+{
+
+uint32_t currentMenuIndex = 0;
+
+uint32_t menuConfirmState = 0;
+
+uint32_t roundStartCounter = 0;
+
+uint32_t *autoReplaySaveStatePtr = 0;
+
+uint8_t enableEscapeToExit = true;
+
+uint8_t sfxFilterArray[CC_SFX_ARRAY_LEN] = { 0 };
+
+uint8_t sfxMuteArray[CC_SFX_ARRAY_LEN] = { 0 };
+
+uint32_t numLoadedColors = 0;
+
+extern "C" void callback() {}
+
+extern "C" void charaSelectColorCb() {}
+
+extern "C" void loadingStateColorCb() {}
+
+} // namespace AsmHacks
+
+
+struct SimOptions
+{
+    // Number of frames each netplay instance runs
+    uint32_t frames = 36000;
+
+    uint32_t delay = 4, rollback = 4, rollbackDelay = 0;
+
+    // One way latency and jitter in milliseconds
+    uint32_t latency = 30, jitter = 4;
+
+    // Packet loss percentage
+    uint32_t loss = 0;
+
+    uint32_t spectators = 1;
+
+    // Number of game effects that are animated every frame
+    uint32_t effects = 64;
+
+    uint32_t seed = 1;
+
+    // Percentage the client's frame rate is slower than the host's
+    int32_t skew = 0;
+
+    // Slow down the peer that is ahead in-game, like DllMain, 0 to only stall
+    uint32_t timeSync = 1;
+
+    // Change the delay from the DelayRecommender, like DllMain's auto delay option
+    uint32_t autoDelay = 0;
+
+    // Send the packets over real UDP sockets on the loopback interface, instead of in process
+    uint32_t loopback = 0;
+};
+
+static SimOptions options;
+
+
+/* Fake game */
+
+// State of the fake game that isn't part of MBAA's memory layout, this is also saved for rollback
+struct FakeGame
+{
+    // Inputs for the next frame, written by the frame step
+    uint16_t inputs[2];
+
+    // Inputs of the previous frame, to detect presses
+    uint16_t prevInputs[2];
+
+    // Frames since the last transition of the current game mode
+    uint32_t timer;
+
+    // Per player state
+    uint32_t attack[2], attackTimer[2], hitStun[2];
+    int32_t ySpeed[2];
+};
+
+// State of an effect, stored at the start of each element of the game's effects array
+struct FakeEffect
+{
+    uint32_t timer, type;
+    int32_t x, y;
+};
+
+static uint32_t *const selectorModeAddrs[2] = { CC_P1_SELECTOR_MODE_ADDR, CC_P2_SELECTOR_MODE_ADDR };
+static uint32_t *const charaSelectorAddrs[2] = { CC_P1_CHARA_SELECTOR_ADDR, CC_P2_CHARA_SELECTOR_ADDR };
+static uint32_t *const characterAddrs[2] = { CC_P1_CHARACTER_ADDR, CC_P2_CHARACTER_ADDR };
+static uint32_t *const moonSelectorAddrs[2] = { CC_P1_MOON_SELECTOR_ADDR, CC_P2_MOON_SELECTOR_ADDR };
+static uint32_t *const colorSelectorAddrs[2] = { CC_P1_COLOR_SELECTOR_ADDR, CC_P2_COLOR_SELECTOR_ADDR };
+static uint32_t *const winsAddrs[2] = { CC_P1_WINS_ADDR, CC_P2_WINS_ADDR };
+
+// Get a field of the player struct, given the P1 address of the field and the player index (0 or 1)
+template<typename T>
+static T& plr ( T *p1Addr, uint8_t i )
+{
+    return * ( T * ) ( ( ( char * ) p1Addr ) + i * CC_PLR_STRUCT_SIZE );
+}
+
+static FakeEffect& getEffect ( size_t i )
+{
+    return * ( FakeEffect * ) ( CC_EFFECTS_ARRAY_ADDR + i * CC_EFFECT_ELEMENT_SIZE );
+}
+
+static uint32_t nextRandom()
+{
+    // The game's RNG state is the only source of randomness, so the game only stays in sync if the RngState is synced
+    *CC_RNG_STATE0_ADDR = ( *CC_RNG_STATE0_ADDR ) * 1103515245 + 12345;
+    ++ ( *CC_RNG_STATE1_ADDR );
+
+    const uint32_t value = ( ( *CC_RNG_STATE0_ADDR ) >> 16 );
+    CC_RNG_STATE3_ADDR[value % CC_RNG_STATE3_SIZE] ^= ( char ) value;
+    return value;
+}
+
+static void playSfx ( uint32_t sfx )
+{
+    // Same as the sound effect hack, muted sounds are played silently, otherwise only play sounds not played yet
+    if ( AsmHacks::sfxMuteArray[sfx] == 0 )
+    {
+        ++AsmHacks::sfxFilterArray[sfx];
+
+        if ( AsmHacks::sfxFilterArray[sfx] > 1 )
+            return;
+    }
+
+    CC_SFX_ARRAY_ADDR[sfx] = 1;
+}
+
+static uint16_t getPressedButtons ( uint8_t i )
+{
+    const FakeGame& game = *FAKE_GAME_ADDR;
+
+    return ( ( game.inputs[i] >> 4 ) & ~ ( game.prevInputs[i] >> 4 ) );
+}
+
+// Returns 0 if the direction didn't change
+static uint16_t getPressedDirection ( uint8_t i )
+{
+    const FakeGame& game = *FAKE_GAME_ADDR;
+
+    const uint16_t direction = ( game.inputs[i] & 0xF );
+
+    return ( direction == ( game.prevInputs[i] & 0xF ) ? 0 : direction );
+}
+
+static uint8_t nextCharaSelector ( uint8_t selector, int step )
+{
+    do
+    {
+        selector = ( selector + RANDOM_CHARA_SELECTOR + step ) % RANDOM_CHARA_SELECTOR;
+    }
+    while ( selectorToChara ( selector ) == UNKNOWN_POSITION );
+
+    return selector;
+}
+
+static void startRound ( bool intros )
+{
+    FakeGame& game = *FAKE_GAME_ADDR;
+
+    game.timer = 0;
+
+    *CC_INTRO_STATE_ADDR = ( intros ? 2 : 1 );
+    *CC_ROUND_TIMER_ADDR = ROUND_TIME;
+    *CC_REAL_TIMER_ADDR = 0;
+    *CC_CAMERA_X_ADDR = *CC_CAMERA_Y_ADDR = 0;
+
+    for ( uint8_t i = 0; i < 2; ++i )
+    {
+        plr ( CC_P1_SEQUENCE_ADDR, i ) = plr ( CC_P1_SEQ_STATE_ADDR, i ) = 0;
+        plr ( CC_P1_HEALTH_ADDR, i ) = plr ( CC_P1_RED_HEALTH_ADDR, i ) = MAX_HEALTH;
+        plr ( CC_P1_GUARD_BAR_ADDR, i ) = MAX_GUARD_BAR;
+        plr ( CC_P1_GUARD_QUALITY_ADDR, i ) = 1.0f;
+        plr ( CC_P1_HEAT_ADDR, i ) = 0;
+        plr ( CC_P1_NO_INPUT_FLAG_ADDR, i ) = 0;
+        plr ( CC_P1_X_POSITION_ADDR, i ) = ( i ? START_POSITION : -START_POSITION );
+        plr ( CC_P1_Y_POSITION_ADDR, i ) = 0;
+        plr ( CC_P1_FACING_FLAG_ADDR, i ) = ( i ? 0 : 1 );
+
+        game.attack[i] = game.attackTimer[i] = game.hitStun[i] = 0;
+        game.ySpeed[i] = 0;
+    }
+
+    for ( size_t i = 0; i < options.effects; ++i )
+        getEffect ( i ).timer = 0;
+}
+
+static void changeGameMode ( uint32_t mode )
+{
+    FakeGame& game = *FAKE_GAME_ADDR;
+
+    game.timer = 0;
+
+    *CC_GAME_MODE_ADDR = mode;
+
+    switch ( mode )
+    {
+        case CC_GAME_MODE_CHARA_SELECT:
+            for ( uint8_t i = 0; i < 2; ++i )
+            {
+                *selectorModeAddrs[i] = CC_SELECT_CHARA;
+                *charaSelectorAddrs[i] = nextCharaSelector ( 0, 1 );
+                *characterAddrs[i] = selectorToChara ( *charaSelectorAddrs[i] );
+                *moonSelectorAddrs[i] = *colorSelectorAddrs[i] = 0;
+            }
+            break;
+
+        case CC_GAME_MODE_IN_GAME:
+            for ( uint8_t i = 0; i < 2; ++i )
+            {
+                *winsAddrs[i] = 0;
+                plr ( CC_P1_METER_ADDR, i ) = 0;
+            }
+
+            startRound ( true );
+            break;
+
+        case CC_GAME_MODE_RETRY:
+            AsmHacks::currentMenuIndex = 0;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void stepMenuConfirm ( uint32_t selectedMode )
+{
+    // Same as the menu confirm hack, menu confirms only go through if allowed by the netplay code
+    if ( ! ( ( getPressedButtons ( 0 ) | getPressedButtons ( 1 ) ) & CONFIRM_BUTTONS ) )
+        return;
+
+    if ( AsmHacks::menuConfirmState > 1 )
+        changeGameMode ( selectedMode );
+    else
+        AsmHacks::menuConfirmState = 1;
+}
+
+static void stepCharaSelect()
+{
+    FakeGame& game = *FAKE_GAME_ADDR;
+
+    for ( uint8_t i = 0; i < 2; ++i )
+    {
+        uint32_t& mode = *selectorModeAddrs[i];
+        const uint16_t buttons = getPressedButtons ( i );
+        const uint16_t direction = getPressedDirection ( i );
+
+        if ( buttons & CANCEL_BUTTONS )
+        {
+            if ( mode > CC_SELECT_CHARA )
+                --mode;
+            continue;
+        }
+
+        if ( buttons & CONFIRM_BUTTONS )
+        {
+            if ( mode < SELECT_DONE )
+                ++mode;
+            continue;
+        }
+
+        if ( direction != 4 && direction != 6 )
+            continue;
+
+        const int step = ( direction == 6 ? 1 : -1 );
+
+        switch ( mode )
+        {
+            case CC_SELECT_CHARA:
+                *charaSelectorAddrs[i] = nextCharaSelector ( *charaSelectorAddrs[i], step );
+                *characterAddrs[i] = selectorToChara ( *charaSelectorAddrs[i] );
+                break;
+
+            case CC_SELECT_MOON:
+                *moonSelectorAddrs[i] = ( *moonSelectorAddrs[i] + 3 + step ) % 3;
+                break;
+
+            case CC_SELECT_COLOR:
+                *colorSelectorAddrs[i] = ( *colorSelectorAddrs[i] + NUM_COLORS + step ) % NUM_COLORS;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    // Start loading a short time after both players are done selecting
+    if ( *selectorModeAddrs[0] < SELECT_DONE || *selectorModeAddrs[1] < SELECT_DONE )
+        game.timer = 0;
+    else if ( ++game.timer >= SELECT_DONE_FRAMES )
+        changeGameMode ( CC_GAME_MODE_LOADING );
+}
+
+static bool isHoldingBack ( uint8_t i )
+{
+    const uint16_t direction = ( FAKE_GAME_ADDR->inputs[i] & 0xF );
+
+    if ( plr ( CC_P1_FACING_FLAG_ADDR, i ) )
+        return ( direction == 1 || direction == 4 || direction == 7 );
+
+    return ( direction == 3 || direction == 6 || direction == 9 );
+}
+
+static void stepPlayer ( uint8_t i )
+{
+    FakeGame& game = *FAKE_GAME_ADDR;
+
+    const uint16_t direction = ( game.inputs[i] & 0xF );
+    const uint16_t buttons = getPressedButtons ( i );
+
+    int32_t& x = plr ( CC_P1_X_POSITION_ADDR, i );
+    int32_t& y = plr ( CC_P1_Y_POSITION_ADDR, i );
+
+    if ( game.hitStun[i] )
+    {
+        if ( --game.hitStun[i] == 0 )
+            plr ( CC_P1_SEQUENCE_ADDR, i ) = 0;
+        else
+            ++plr ( CC_P1_SEQ_STATE_ADDR, i );
+    }
+    else if ( game.attackTimer[i] )
+    {
+        ++plr ( CC_P1_SEQ_STATE_ADDR, i );
+
+        if ( --game.attackTimer[i] == 0 )
+            plr ( CC_P1_SEQUENCE_ADDR, i ) = 0;
+    }
+    else if ( buttons & ( CC_BUTTON_A | CC_BUTTON_B | CC_BUTTON_C ) )
+    {
+        game.attack[i] = ( ( buttons & CC_BUTTON_C ) ? 2 : ( ( buttons & CC_BUTTON_B ) ? 1 : 0 ) );
+        game.attackTimer[i] = 12 + 6 * game.attack[i];
+
+        plr ( CC_P1_SEQUENCE_ADDR, i ) = 10 + game.attack[i];
+        plr ( CC_P1_SEQ_STATE_ADDR, i ) = 0;
+    }
+    else if ( y == 0 )
+    {
+        if ( direction == 3 || direction == 6 || direction == 9 )
+            x += WALK_SPEED;
+        else if ( direction == 1 || direction == 4 || direction == 7 )
+            x -= WALK_SPEED;
+
+        if ( direction >= 7 )
+            game.ySpeed[i] = JUMP_SPEED;
+    }
+
+    y += game.ySpeed[i];
+
+    if ( y > 0 )
+    {
+        game.ySpeed[i] -= GRAVITY;
+    }
+    else
+    {
+        y = 0;
+        game.ySpeed[i] = 0;
+    }
+
+    x = clamped ( x, -STAGE_EDGE, STAGE_EDGE );
+}
+
+static void stepAttack ( uint8_t i )
+{
+    FakeGame& game = *FAKE_GAME_ADDR;
+
+    const uint8_t j = 1 - i;
+
+    if ( game.attackTimer[i] == 0 || plr ( CC_P1_SEQ_STATE_ADDR, i ) != ATTACK_ACTIVE_FRAME || game.hitStun[j] )
+        return;
+
+    if ( abs ( plr ( CC_P1_X_POSITION_ADDR, i ) - plr ( CC_P1_X_POSITION_ADDR, j ) ) > ATTACK_RANGE
+            || abs ( plr ( CC_P1_Y_POSITION_ADDR, i ) - plr ( CC_P1_Y_POSITION_ADDR, j ) ) > ATTACK_RANGE )
+    {
+        return;
+    }
+
+    const uint32_t damage = 300 + 250 * game.attack[i] + nextRandom() % 256;
+
+    float& guardBar = plr ( CC_P1_GUARD_BAR_ADDR, j );
+
+    // Guard if holding back, until the guard bar breaks
+    if ( game.attackTimer[j] == 0 && plr ( CC_P1_Y_POSITION_ADDR, j ) == 0 && isHoldingBack ( j ) )
+    {
+        guardBar -= 0.25f * damage;
+
+        if ( guardBar > 0 )
+        {
+            plr ( CC_P1_GUARD_QUALITY_ADDR, j ) = guardBar / MAX_GUARD_BAR;
+            playSfx ( SFX_GUARD );
+            return;
+        }
+
+        guardBar = MAX_GUARD_BAR;
+    }
+
+    uint32_t& health = plr ( CC_P1_HEALTH_ADDR, j );
+
+    health = ( health > damage ? health - damage : 0 );
+
+    plr ( CC_P1_RED_HEALTH_ADDR, j ) = min<uint32_t> ( MAX_HEALTH, health + damage / 2 );
+    plr ( CC_P1_METER_ADDR, i ) = min<uint32_t> ( MAX_METER, plr ( CC_P1_METER_ADDR, i ) + damage );
+    plr ( CC_P1_METER_ADDR, j ) = min<uint32_t> ( MAX_METER, plr ( CC_P1_METER_ADDR, j ) + damage / 2 );
+    plr ( CC_P1_SEQUENCE_ADDR, j ) = 2;
+    plr ( CC_P1_SEQ_STATE_ADDR, j ) = 0;
+
+    game.attackTimer[j] = 0;
+    game.hitStun[j] = HIT_STUN_FRAMES;
+
+    if ( options.effects )
+    {
+        FakeEffect& effect = getEffect ( ( *CC_HIT_SPARKS_ADDR ) % options.effects );
+        effect.timer = EFFECT_FRAMES;
+        effect.type = game.attack[i];
+        effect.x = plr ( CC_P1_X_POSITION_ADDR, j );
+        effect.y = plr ( CC_P1_Y_POSITION_ADDR, j ) + 4096;
+    }
+
+    ++ ( *CC_HIT_SPARKS_ADDR );
+
+    playSfx ( SFX_HIT + game.attack[i] );
+}
+
+static void stepEffects()
+{
+    for ( size_t i = 0; i < options.effects; ++i )
+    {
+        FakeEffect& effect = getEffect ( i );
+
+        if ( ! effect.timer )
+            continue;
+
+        --effect.timer;
+        effect.y += 64 * ( 1 + effect.type );
+    }
+}
+
+static void stepInGame()
+{
+    FakeGame& game = *FAKE_GAME_ADDR;
+
+    // Character intros, which can be skipped
+    if ( *CC_INTRO_STATE_ADDR == 2 )
+    {
+        if ( ++game.timer >= CHARA_INTRO_FRAMES || ( ( getPressedButtons ( 0 ) | getPressedButtons ( 1 ) )
+                & CONFIRM_BUTTONS ) )
+        {
+            game.timer = 0;
+            *CC_INTRO_STATE_ADDR = 1;
+        }
+        return;
+    }
+
+    // Pre-game, players can start moving after this
+    if ( *CC_INTRO_STATE_ADDR == 1 )
+    {
+        if ( ++game.timer >= PRE_GAME_FRAMES )
+        {
+            game.timer = 0;
+            *CC_INTRO_STATE_ADDR = 0;
+            ++AsmHacks::roundStartCounter;
+        }
+        return;
+    }
+
+    // Round over, effects keep animating
+    if ( ( *CC_P1_NO_INPUT_FLAG_ADDR ) && ( *CC_P2_NO_INPUT_FLAG_ADDR ) )
+    {
+        stepEffects();
+
+        if ( ++game.timer < ROUND_OVER_FRAMES )
+            return;
+
+        if ( max ( *winsAddrs[0], *winsAddrs[1] ) >= *CC_WIN_COUNT_VS_ADDR )
+            changeGameMode ( CC_GAME_MODE_RETRY );
+        else
+            startRound ( false );
+        return;
+    }
+
+    ++ ( *CC_REAL_TIMER_ADDR );
+    -- ( *CC_ROUND_TIMER_ADDR );
+
+    stepPlayer ( 0 );
+    stepPlayer ( 1 );
+
+    stepAttack ( 0 );
+    stepAttack ( 1 );
+
+    int32_t& x1 = *CC_P1_X_POSITION_ADDR;
+    int32_t& x2 = *CC_P2_X_POSITION_ADDR;
+
+    // Push players apart on the ground
+    if ( abs ( x1 - x2 ) < MIN_DISTANCE && *CC_P1_Y_POSITION_ADDR == 0 && *CC_P2_Y_POSITION_ADDR == 0 )
+    {
+        const int32_t push = ( MIN_DISTANCE - abs ( x1 - x2 ) ) / 2;
+
+        if ( x1 <= x2 )
+        {
+            x1 -= push;
+            x2 += push;
+        }
+        else
+        {
+            x1 += push;
+            x2 -= push;
+        }
+    }
+
+    *CC_P1_FACING_FLAG_ADDR = ( x1 <= x2 ? 1 : 0 );
+    *CC_P2_FACING_FLAG_ADDR = 1 - *CC_P1_FACING_FLAG_ADDR;
+
+    *CC_CAMERA_X_ADDR = ( x1 + x2 ) / 2;
+    *CC_CAMERA_Y_ADDR = max ( *CC_P1_Y_POSITION_ADDR, *CC_P2_Y_POSITION_ADDR ) / 2;
+
+    stepEffects();
+
+    if ( *CC_P1_HEALTH_ADDR && *CC_P2_HEALTH_ADDR && *CC_ROUND_TIMER_ADDR )
+        return;
+
+    // KO or time over, no wins if both players have the same health
+    if ( *CC_P1_HEALTH_ADDR > *CC_P2_HEALTH_ADDR )
+        ++ ( *CC_P1_WINS_ADDR );
+    else if ( *CC_P2_HEALTH_ADDR > *CC_P1_HEALTH_ADDR )
+        ++ ( *CC_P2_WINS_ADDR );
+
+    *CC_P1_NO_INPUT_FLAG_ADDR = *CC_P2_NO_INPUT_FLAG_ADDR = 1;
+    game.timer = 0;
+
+    playSfx ( SFX_KO );
+}
+
+static void stepRetryMenu()
+{
+    for ( uint8_t i = 0; i < 2; ++i )
+    {
+        const uint16_t direction = getPressedDirection ( i );
+
+        if ( direction == 8 )
+            AsmHacks::currentMenuIndex = ( AsmHacks::currentMenuIndex + 3 ) % 4;
+        else if ( direction == 2 )
+            AsmHacks::currentMenuIndex = ( AsmHacks::currentMenuIndex + 1 ) % 4;
+    }
+
+    // Only once again and chara select are implemented
+    if ( AsmHacks::currentMenuIndex <= 1 )
+        stepMenuConfirm ( AsmHacks::currentMenuIndex == 0 ? CC_GAME_MODE_LOADING : CC_GAME_MODE_CHARA_SELECT );
+}
+
+// Run one frame of the fake game with the inputs written by the last frame step
+static void stepGame()
+{
+    FakeGame& game = *FAKE_GAME_ADDR;
+
+    // Inputs before the round starts aren't synced, so they can't be used to detect presses in-game
+    const bool isIntro = ( *CC_GAME_MODE_ADDR == CC_GAME_MODE_IN_GAME && *CC_INTRO_STATE_ADDR );
+
+    memset ( CC_SFX_ARRAY_ADDR, 0, CC_SFX_ARRAY_LEN );
+
+    switch ( *CC_GAME_MODE_ADDR )
+    {
+        case CC_GAME_MODE_TITLE:
+            if ( ( getPressedButtons ( 0 ) | getPressedButtons ( 1 ) ) & CONFIRM_BUTTONS )
+                changeGameMode ( CC_GAME_MODE_MAIN );
+            break;
+
+        case CC_GAME_MODE_MAIN:
+            stepMenuConfirm ( CC_GAME_MODE_CHARA_SELECT );
+            break;
+
+        case CC_GAME_MODE_CHARA_SELECT:
+            stepCharaSelect();
+            break;
+
+        case CC_GAME_MODE_LOADING:
+            if ( ++game.timer >= LOADING_FRAMES )
+                changeGameMode ( CC_GAME_MODE_IN_GAME );
+            break;
+
+        case CC_GAME_MODE_IN_GAME:
+            stepInGame();
+            break;
+
+        case CC_GAME_MODE_RETRY:
+            stepRetryMenu();
+            break;
+
+        default:
+            break;
+    }
+
+    game.prevInputs[0] = ( isIntro ? 0 : game.inputs[0] );
+    game.prevInputs[1] = ( isIntro ? 0 : game.inputs[1] );
+
+    ++ ( *CC_WORLD_TIMER_ADDR );
+}
+
+
+/* Game memory */
+
+// Memory ranges of the game that are swapped between game instances
+static vector<pair<char *, size_t>> imageRanges;
+
+// Rollback memory data, the linked rollback data plus the fake game state
+static MemDumpList rollbackAddrs;
+
+// Linked rollback memory data (binary message format)
+extern const unsigned char binary_res_rollback_bin_start;
+extern const unsigned char binary_res_rollback_bin_end;
+
+#define IMAGE_RANGE(ADDR) { ( char * ) ( ADDR ), sizeof ( * ( ADDR ) ) }
+
+static void initGameMemory()
+{
+    const size_t size = GAME_MEMORY_END - GAME_MEMORY_START;
+
+#ifdef _WIN32
+    void *memory = VirtualAlloc ( ( void * ) GAME_MEMORY_START, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+#else
+    void *memory = mmap ( ( void * ) GAME_MEMORY_START, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0 );
+
+    if ( memory == MAP_FAILED )
+        memory = 0;
+#endif
+
+    if ( memory != ( void * ) GAME_MEMORY_START )
+        THROW_EXCEPTION ( "memory=%08x", "Failed to map the game memory!", memory );
+
+    imageRanges =
+    {
+        IMAGE_RANGE ( CC_WORLD_TIMER_ADDR ),
+        IMAGE_RANGE ( CC_GAME_MODE_ADDR ),
+        IMAGE_RANGE ( CC_SKIP_FRAMES_ADDR ),
+        IMAGE_RANGE ( CC_PAUSE_FLAG_ADDR ),
+        IMAGE_RANGE ( CC_WIN_COUNT_VS_ADDR ),
+        IMAGE_RANGE ( CC_AUTO_REPLAY_SAVE_ADDR ),
+        IMAGE_RANGE ( CC_MENU_STATE_COUNTER_ADDR ),
+        IMAGE_RANGE ( CC_STAGE_SELECTOR_ADDR ),
+        IMAGE_RANGE ( CC_INTRO_STATE_ADDR ),
+        IMAGE_RANGE ( CC_ROUND_TIMER_ADDR ),
+        IMAGE_RANGE ( CC_REAL_TIMER_ADDR ),
+        IMAGE_RANGE ( CC_CAMERA_X_ADDR ),
+        IMAGE_RANGE ( CC_CAMERA_Y_ADDR ),
+        IMAGE_RANGE ( CC_HIT_SPARKS_ADDR ),
+        IMAGE_RANGE ( CC_P1_WINS_ADDR ),
+        IMAGE_RANGE ( CC_P2_WINS_ADDR ),
+        IMAGE_RANGE ( CC_RNG_STATE0_ADDR ),
+        IMAGE_RANGE ( CC_RNG_STATE1_ADDR ),
+        IMAGE_RANGE ( CC_RNG_STATE2_ADDR ),
+        { CC_RNG_STATE3_ADDR, CC_RNG_STATE3_SIZE },
+        { ( char * ) CC_P1_SEQUENCE_ADDR, 2 * CC_PLR_STRUCT_SIZE },
+        { ( char * ) CC_P1_SELECTOR_MODE_ADDR, ( char * ) ( CC_P2_COLOR_SELECTOR_ADDR + 1 )
+          - ( char * ) CC_P1_SELECTOR_MODE_ADDR },
+        { CC_EFFECTS_ARRAY_ADDR, options.effects * CC_EFFECT_ELEMENT_SIZE },
+        { ( char * ) CC_SFX_ARRAY_ADDR, CC_SFX_ARRAY_LEN },
+        IMAGE_RANGE ( FAKE_GAME_ADDR ),
+        IMAGE_RANGE ( &AsmHacks::currentMenuIndex ),
+        IMAGE_RANGE ( &AsmHacks::menuConfirmState ),
+        IMAGE_RANGE ( &AsmHacks::roundStartCounter ),
+        IMAGE_RANGE ( &AsmHacks::numLoadedColors ),
+        { ( char * ) AsmHacks::sfxFilterArray, CC_SFX_ARRAY_LEN },
+        { ( char * ) AsmHacks::sfxMuteArray, CC_SFX_ARRAY_LEN },
+    };
+
+    const size_t rollbackSize = ( ( char * ) &binary_res_rollback_bin_end ) - ( char * ) &binary_res_rollback_bin_start;
+
+    if ( ! rollbackAddrs.load ( ( char * ) &binary_res_rollback_bin_start, rollbackSize ) )
+        THROW_EXCEPTION ( "Failed to load rollback data!", ERROR_BAD_ROLLBACK_DATA );
+
+    rollbackAddrs.append ( MemDump ( FAKE_GAME_ADDR, sizeof ( FakeGame ) ) );
+    rollbackAddrs.update();
+
+    LOG ( "rollbackAddrs.totalSize=%u", rollbackAddrs.totalSize );
+}
+
+#undef IMAGE_RANGE
+
+// Copy of the game memory of one game instance. The netplay code only works with the game's fixed addresses,
+// so the active image is kept at those addresses, and the others are swapped out.
+class GameImage
+{
+public:
+
+    GameImage()
+    {
+        size_t size = 0;
+
+        for ( const auto& range : imageRanges )
+            size += range.first ? range.second : 0;
+
+        _saved.resize ( size );
+
+        if ( _active )
+            _active->save();
+
+        // Start from zeroed memory
+        for ( const auto& range : imageRanges )
+            memset ( range.first, 0, range.second );
+
+        _active = this;
+    }
+
+    virtual ~GameImage()
+    {
+        if ( _active == this )
+            _active = 0;
+    }
+
+    // Swap this image into the game memory
+    void activate()
+    {
+        if ( _active == this )
+            return;
+
+        if ( _active )
+            _active->save();
+
+        size_t offset = 0;
+
+        for ( const auto& range : imageRanges )
+        {
+            memcpy ( range.first, &_saved[offset], range.second );
+            offset += range.second;
+        }
+
+        _active = this;
+    }
+
+private:
+
+    vector<char> _saved;
+
+    static GameImage *_active;
+
+    void save()
+    {
+        size_t offset = 0;
+
+        for ( const auto& range : imageRanges )
+        {
+            memcpy ( &_saved[offset], range.first, range.second );
+            offset += range.second;
+        }
+    }
+};
+
+GameImage *GameImage::_active = 0;
+
+
+/* Network */
+
+// Virtual time in microseconds
+static uint64_t now = 0;
+
+class SimSocket;
+
+struct SimPacket
+{
+    uint64_t due, order;
+
+    SimSocket *socket;
+
+    string bytes;
+
+    // Reversed for priority_queue, so the earliest packet is on top
+    bool operator< ( const SimPacket& other ) const
+    {
+        return ( due == other.due ? order > other.order : due > other.due );
+    }
+};
+
+static priority_queue<SimPacket> packets;
+
+static uint64_t packetOrder = 0;
+
+static mt19937 networkRandom;
+
+static uint64_t numPackets = 0, numBytes = 0, numLost = 0;
+
+// UDP socket for one end of a simulated link. Messages are encoded like real sockets, and delivered
+// after the link latency. Plain messages can be lost or reordered, sequences are retransmitted in order.
+// Delivered messages are only read when the owner polls, like the event loop polled by the frame step.
+// In loopback mode each end also has a real UDP socket, and delivered packets are sent through the kernel.
+class SimSocket : public Socket
+{
+public:
+
+    // Socket on the other end of the link
+    SimSocket *peer = 0;
+
+    SimSocket ( Owner *owner, uint16_t port )
+        : Socket ( owner, IpAddrPort ( "127.0.0.1", options.loopback ? 0 : port ), Protocol::UDP, false )
+    {
+        // Bind to any available local port, the address is updated with the bound port
+        if ( options.loopback )
+            init();
+
+        _state = State::Connected;
+    }
+
+    ~SimSocket() override
+    {
+        _state = State::Disconnected;
+    }
+
+    void disconnect() override
+    {
+        _state = State::Disconnected;
+    }
+
+    SocketPtr accept ( Owner *owner ) override { return 0; }
+
+    bool send ( SerializableMessage *message, const IpAddrPort& address = NullAddress ) override
+    {
+        return send ( MsgPtr ( message ), address );
+    }
+
+    bool send ( SerializableSequence *message, const IpAddrPort& address = NullAddress ) override
+    {
+        return send ( MsgPtr ( message ), address );
+    }
+
+    bool send ( const MsgPtr& message, const IpAddrPort& address = NullAddress ) override
+    {
+        if ( ! message )
+            return false;
+
+        return sendEncoded ( message, ::Protocol::encode ( message, _wireVersion ) );
+    }
+
+    bool canSendEncoded() const override { return true; }
+
+    bool sendEncoded ( const MsgPtr& message, const string& bytes ) override
+    {
+        if ( ! isConnected() || ! peer )
+            return false;
+
+        uniform_int_distribution<uint32_t> percent ( 0, 99 );
+        uniform_int_distribution<uint32_t> jitter ( 0, 1000 * options.jitter );
+
+        uint64_t due = now + 1000 * options.latency + jitter ( networkRandom );
+
+        ++numPackets;
+        numBytes += bytes.size();
+
+        if ( message->getBaseType() == BaseType::SerializableSequence )
+        {
+            // Each lost packet is retransmitted after a round trip, sequences are always delivered in order
+            while ( percent ( networkRandom ) < options.loss )
+            {
+                due += 2000 * options.latency;
+                ++numLost;
+            }
+
+            due = _lastSequenceDue = max ( due, _lastSequenceDue );
+        }
+        else if ( percent ( networkRandom ) < options.loss )
+        {
+            ++numLost;
+            return true;
+        }
+
+        packets.push ( { due, packetOrder++, peer, bytes } );
+        return true;
+    }
+
+    void deliver ( const string& bytes )
+    {
+        // The peer sends the packet now, it is read from the real socket when polled
+        if ( options.loopback )
+        {
+            if ( peer->isConnected() && ! peer->sendImmediately ( &bytes[0], bytes.size() ) )
+                THROW_EXCEPTION ( "Failed to send [ %u bytes ]", ERROR_INTERNAL, bytes.size() );
+            return;
+        }
+
+        size_t consumed;
+        MsgPtr msg = ::Protocol::decode ( &bytes[0], bytes.size(), consumed );
+
+        if ( ! msg )
+            THROW_EXCEPTION ( "Failed to decode [ %u bytes ]", ERROR_INTERNAL, bytes.size() );
+
+        _received.push_back ( msg );
+    }
+
+    // Read all the delivered messages
+    void poll()
+    {
+        // Read datagrams until there are no more, ie the read didn't produce a message
+        for ( uint64_t numRead = UINT64_MAX; options.loopback && _numRead != numRead && isConnected(); )
+        {
+            numRead = _numRead;
+            Socket::socketRead();
+        }
+
+        while ( ! _received.empty() && isConnected() )
+        {
+            const MsgPtr msg = _received.front();
+            _received.pop_front();
+
+            socketRead ( msg, address );
+        }
+    }
+
+protected:
+
+    void socketRead ( const MsgPtr& msg, const IpAddrPort& address ) override
+    {
+        ++_numRead;
+
+        if ( owner )
+            owner->socketRead ( this, msg, address );
+    }
+
+private:
+
+    uint64_t _lastSequenceDue = 0;
+
+    list<MsgPtr> _received;
+
+    uint64_t _numRead = 0;
+};
+
+// Deliver all the packets that are due
+static void deliverPackets()
+{
+    while ( ! packets.empty() && packets.top().due <= now )
+    {
+        const SimPacket packet = packets.top();
+        packets.pop();
+
+        if ( packet.socket->isConnected() )
+            packet.socket->deliver ( packet.bytes );
+    }
+}
+
+// Connect a pair of sockets
+static void connectSockets ( SimSocket *a, SimSocket *b, uint8_t wireVersion )
+{
+    a->peer = b;
+    b->peer = a;
+
+    // Each real socket sends to the port the other one is bound to
+    if ( options.loopback )
+        swap ( a->address, b->address );
+
+    a->setWireVersion ( wireVersion );
+    b->setWireVersion ( wireVersion );
+}
+
+
+/* Game instance */
+
+static uint64_t getWallMicroseconds()
+{
+    return chrono::duration_cast<chrono::microseconds> ( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+ENUM ( Variable, GameMode, RoundStart );
+
+// Sync hashes of the host, for checking spectators
+static map<uint64_t, MsgPtr> hostSyncHashes;
+
+// One simulated game with the same netplay logic as DllMain
+class SimInstance
+    : public GameImage
+    , public Socket::Owner
+    , public Timer::Owner
+    , public RefChangeMonitor<Variable, uint32_t>::Owner
+    , public DllFrameStepper
+{
+public:
+
+    const string name;
+
+    const ClientMode clientMode;
+
+    // Host <-> client socket
+    SocketPtr dataSocket;
+
+    // Spectator -> host socket
+    SocketPtr ctrlSocket;
+
+    uint8_t localPlayer = 1, remotePlayer = 2;
+
+    // Reason this instance stopped, empty if still running
+    string error;
+
+    uint64_t frames = 0, rerunFrames = 0, rollbacks = 0, stalls = 0, stallTime = 0;
+
+    // Rollback distance in frames, and wall time in microseconds
+    Statistics rollbackDistance, rerunTime, saveStateTime;
+
+    SimInstance ( const string& name, ClientMode clientMode, uint32_t seed, double frameInterval )
+        : name ( name )
+        , clientMode ( clientMode )
+        , _gameModeMonitor ( this, Variable::GameMode, *CC_GAME_MODE_ADDR )
+        , _roundStartMonitor ( this, Variable::RoundStart, AsmHacks::roundStartCounter )
+        , _random ( seed )
+        , _frameInterval ( frameInterval )
+    {
+        // Inputs are always random, and every instance checks for desyncs
+        randomInputs = true;
+        checkSync = true;
+        autoDelay = options.autoDelay;
+
+        // Boot to the title screen with a different RngState for each game
+        changeGameMode ( CC_GAME_MODE_TITLE );
+
+        *CC_RNG_STATE0_ADDR = _random();
+        *CC_WORLD_TIMER_ADDR = _random() % 1000;
+        *CC_WIN_COUNT_VS_ADDR = 2;
+
+        netplayStateChanged ( NetplayState::PreInitial );
+
+        initRelay ( clientMode );
+
+        if ( clientMode.isSpectate() )
+            return;
+
+        netMan.config.mode = clientMode;
+        netMan.config.delay = options.delay;
+        netMan.config.rollback = options.rollback;
+        netMan.config.rollbackDelay = options.rollbackDelay;
+        netMan.config.winCount = 2;
+        netMan.config.hostPlayer = 1;
+
+        if ( clientMode.isHost() )
+        {
+            localPlayer = netMan.config.hostPlayer;
+            remotePlayer = ( 3 - netMan.config.hostPlayer );
+        }
+        else
+        {
+            remotePlayer = netMan.config.hostPlayer;
+            localPlayer = ( 3 - netMan.config.hostPlayer );
+        }
+
+        netMan.setRemotePlayer ( remotePlayer );
+
+        minRollbackSpacing = clamped<uint8_t> ( netMan.config.rollback, 2, 4 );
+        rollbackTimer = minRollbackSpacing;
+    }
+
+    ~SimInstance() override
+    {
+        rollMan.deallocateStates();
+    }
+
+    // Connected to the other side, the game leaves the main menu after this
+    void connected ( const SocketPtr& socket )
+    {
+        activate();
+
+        dataSocket = socket;
+        _sockets.push_back ( socket );
+
+        netplayStateChanged ( NetplayState::Initial );
+    }
+
+    // Spectator connecting to a host, the game leaves the main menu after the InitialGameState is received
+    void spectate ( const SocketPtr& socket )
+    {
+        ctrlSocket = socket;
+        _sockets.push_back ( socket );
+    }
+
+    // Spectator connected to this host, this can only happen during the first CharaSelect
+    void spectatorConnected ( const SocketPtr& socket, SimInstance& spectator )
+    {
+        activate();
+
+        spectator.netMan.config = netMan.config;
+        spectator.netMan.config.mode = ClientMode ( ClientMode::SpectateNetplay, clientMode.flags );
+
+        _sockets.push_back ( socket );
+
+        pushPendingSocket ( this, socket );
+        pushSpectator ( socket.get(), socket->address );
+    }
+
+    bool isDone() const { return ( ! error.empty() || frames >= options.frames ); }
+
+    // Step the virtual time, this runs a game frame when it is time for one
+    void step()
+    {
+        if ( ! error.empty() )
+            return;
+
+        if ( _waitStart != UINT64_MAX )
+        {
+            activate();
+            poll();
+
+            if ( ! checkReady() )
+                return;
+
+            frameStepReady();
+            frameStepDone();
+        }
+        else if ( now >= _nextFrameTime )
+        {
+            _nextFrameTime = max ( _nextFrameTime + getFrameInterval(), double ( now ) );
+
+            activate();
+
+            stepGame();
+            frameStep();
+
+            if ( _waitStart != UINT64_MAX )
+                return;
+        }
+        else
+        {
+            return;
+        }
+
+        if ( ! fastFwdStopFrame.value )
+            return;
+
+        // Re-run all the frames since the rollback at once, like the game does when skipping rendering
+        while ( fastFwdStopFrame.value && error.empty() )
+        {
+            stepGame();
+            frameStep();
+        }
+
+        rerunTime.addSample ( getWallMicroseconds() - _rollbackStartTime );
+    }
+
+    // Socket callbacks
+    void socketAccepted ( Socket *serverSocket ) override {}
+
+    void socketConnected ( Socket *socket ) override {}
+
+    void socketDisconnected ( Socket *socket ) override {}
+
+    void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override
+    {
+        if ( ! msg.get() || ! error.empty() )
+            return;
+
+        switch ( msg->getMsgType() )
+        {
+            case MsgType::RngState:
+                netMan.setRngState ( msg->getAs<RngState>() );
+                return;
+
+            case MsgType::SyncHash:
+                remoteSync.push_back ( msg );
+                return;
+
+            default:
+                break;
+        }
+
+        switch ( clientMode.value )
+        {
+            case ClientMode::Host:
+            case ClientMode::Client:
+                switch ( msg->getMsgType() )
+                {
+                    case MsgType::PlayerInputs:
+                        netMan.setInputs ( remotePlayer, msg->getAs<PlayerInputs>() );
+                        return;
+
+                    case MsgType::MenuIndex:
+                        netMan.setRemoteRetryMenuIndex ( msg->getAs<MenuIndex>().menuIndex );
+                        return;
+
+                    case MsgType::TransitionIndex:
+                        netMan.setRemoteIndex ( msg->getAs<TransitionIndex>().index );
+                        return;
+
+                    default:
+                        break;
+                }
+                break;
+
+            case ClientMode::SpectateNetplay:
+                switch ( msg->getMsgType() )
+                {
+                    case MsgType::InitialGameState:
+                        netMan.initial = msg->getAs<InitialGameState>();
+                        netplayStateChanged ( NetplayState::Initial );
+                        return;
+
+                    case MsgType::BothInputs:
+                        netMan.setBothInputs ( msg->getAs<BothInputs>() );
+                        return;
+
+                    case MsgType::MenuIndex:
+                        netMan.setRetryMenuIndex ( msg->getAs<MenuIndex>().index, msg->getAs<MenuIndex>().menuIndex );
+                        return;
+
+                    default:
+                        break;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        LOG ( "[%s] Unexpected '%s'", name, msg );
+    }
+
+    // Timer callback
+    void timerExpired ( Timer *timer ) override
+    {
+        SpectatorManager::timerExpired ( timer );
+    }
+
+    // DllFrameStepper accessors
+    const ClientMode& getClientMode() const override { return clientMode; }
+    Socket *getDataSocket() const override { return dataSocket.get(); }
+    uint8_t getLocalPlayer() const override { return localPlayer; }
+    uint8_t getRemotePlayer() const override { return remotePlayer; }
+
+private:
+
+    RefChangeMonitor<Variable, uint32_t> _gameModeMonitor, _roundStartMonitor;
+
+    mt19937 _random;
+
+    const double _frameInterval;
+
+    double _nextFrameTime = 0;
+
+    // Virtual time the current frame started waiting, UINT64_MAX if not waiting
+    uint64_t _waitStart = UINT64_MAX;
+
+    uint64_t _nextResendTime = 0;
+
+    uint64_t _rollbackStartTime = 0;
+
+    // All the sockets of this instance, only polled where DllMain polls the event loop
+    vector<SocketPtr> _sockets;
+
+    // Same as DllMain, the frame rate is only adjusted in-game
+    double getFrameInterval() const
+    {
+        if ( ! options.timeSync || ! clientMode.isNetplay() || ! netMan.isInGame() )
+            return _frameInterval;
+
+        return _frameInterval * netMan.timeSync.settings.fps / netMan.timeSync.getFps();
+    }
+
+    void poll()
+    {
+        for ( const SocketPtr& socket : _sockets )
+            static_cast<SimSocket *> ( socket.get() )->poll();
+    }
+
+    void delayedStop ( const string& error ) override
+    {
+        LOG ( "[%s] [%s] %s", name, netMan.getIndexedFrame(), error );
+
+        if ( this->error.empty() )
+            this->error = error;
+    }
+
+    void desynced ( const string& error, const string& details ) override
+    {
+        LOG ( "[%s] Desync:\n%s", name, details );
+        delayedStop ( error );
+    }
+
+    void checkChanges() override
+    {
+        _gameModeMonitor.check();
+        _roundStartMonitor.check();
+    }
+
+    void frameStepNormal() override
+    {
+        ++frames;
+        DllFrameStepper::frameStepNormal();
+    }
+
+    void frameStepRerun() override
+    {
+        ++rerunFrames;
+        DllFrameStepper::frameStepRerun();
+    }
+
+    // The end of the frame step is deferred until the simulation loop resumes it, see waitForInputs
+    void frameStepDone() override
+    {
+        if ( _waitStart == UINT64_MAX )
+            DllFrameStepper::frameStepDone();
+    }
+
+    void saveRollbackState() override
+    {
+        const uint64_t start = getWallMicroseconds();
+        rollMan.saveState ( netMan );
+        saveStateTime.addSample ( getWallMicroseconds() - start );
+    }
+
+    void allocateRollbackStates() override
+    {
+        rollMan.allocateStates ( rollbackAddrs );
+    }
+
+    bool loadRollback ( IndexedFrame target ) override
+    {
+        _rollbackStartTime = getWallMicroseconds();
+
+        if ( ! DllFrameStepper::loadRollback ( target ) )
+        {
+            LOG ( "[%s] Rollback to target=[%s] failed!", name, target );
+            return false;
+        }
+
+        ++rollbacks;
+        rollbackDistance.addSample ( fastFwdStopFrame.parts.frame - netMan.getFrame() );
+        return true;
+    }
+
+    // Spectators check against the host's hashes, since they don't send any
+    bool sendSyncHash ( const MsgPtr& msgSyncHash ) override
+    {
+        if ( clientMode.isHost() )
+            hostSyncHashes[netMan.getIndexedFrame().value] = msgSyncHash;
+
+        if ( ! clientMode.isSpectate() )
+            return DllFrameStepper::sendSyncHash ( msgSyncHash );
+
+        const auto it = hostSyncHashes.find ( netMan.getIndexedFrame().value );
+
+        if ( it == hostSyncHashes.end() )
+            return true;
+
+        ++syncChecks;
+
+        if ( it->second->getAs<SyncHash>() == msgSyncHash->getAs<SyncHash>() )
+            return true;
+
+        desynced ( "Desync!", format ( "< %s\n> %s", it->second->getAs<SyncHash>().dump(),
+                                       msgSyncHash->getAs<SyncHash>().dump() ) );
+        return false;
+    }
+
+    // Inputs are random instead of from the controllers
+    bool updateLocalInputs() override
+    {
+        randomizeLocalInputs();
+        return true;
+    }
+
+    uint32_t getRandom() override { return _random(); }
+
+    // Waiting for inputs returns to the simulation loop, which calls frameStepReady and frameStepDone once ready
+    bool waitForInputs() override
+    {
+        poll();
+        return checkReady();
+    }
+
+    // Check if we are ready to continue running, and resend inputs while waiting
+    bool checkReady()
+    {
+        if ( isReady() )
+        {
+            if ( _waitStart != UINT64_MAX )
+            {
+                stallTime += ( now - _waitStart );
+                _waitStart = UINT64_MAX;
+            }
+            return true;
+        }
+
+        if ( _waitStart == UINT64_MAX )
+        {
+            ++stalls;
+            _waitStart = now;
+            _nextResendTime = now + 1000 * RESEND_INPUTS_INTERVAL;
+            return false;
+        }
+
+        // Don't resend inputs in spectator mode
+        if ( clientMode.isSpectate() || now < _nextResendTime )
+            return false;
+
+        dataSocket->send ( netMan.getInputs ( localPlayer ) );
+        _nextResendTime = now + 1000 * RESEND_INPUTS_INTERVAL;
+
+        if ( now - _waitStart > 1000 * MAX_WAIT_INPUTS_INTERVAL )
+            delayedStop ( "Timed out!" );
+
+        return false;
+    }
+
+    // ChangeMonitor callback
+    void changedValue ( Variable var, uint32_t previous, uint32_t current ) override
+    {
+        LOG ( "[%s] [%s] %s: previous=%u; current=%u", name, netMan.getIndexedFrame(), var, previous, current );
+
+        switch ( var.value )
+        {
+            case Variable::GameMode:
+                gameModeChanged ( previous, current );
+                break;
+
+            case Variable::RoundStart:
+                // In-game happens after round start, when players can start moving
+                netplayStateChanged ( NetplayState::InGame );
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    // Same as ProcessManager
+    void writeGameInput ( uint8_t player, uint16_t input ) override
+    {
+        uint16_t direction = ( input & 0xF );
+
+        if ( direction == 5 || direction > 9 )
+            direction = 0;
+
+        FAKE_GAME_ADDR->inputs[player - 1] = COMBINE_INPUT ( direction, input >> 4 );
+    }
+
+    MsgPtr getGameRngState ( uint32_t index ) const override
+    {
+        RngState *rngState = new RngState ( index );
+
+        rngState->rngState0 = *CC_RNG_STATE0_ADDR;
+        rngState->rngState1 = *CC_RNG_STATE1_ADDR;
+        rngState->rngState2 = *CC_RNG_STATE2_ADDR;
+        copy ( CC_RNG_STATE3_ADDR, CC_RNG_STATE3_ADDR + CC_RNG_STATE3_SIZE, rngState->rngState3.begin() );
+
+        return MsgPtr ( rngState );
+    }
+
+    void setGameRngState ( const RngState& rngState ) override
+    {
+        *CC_RNG_STATE0_ADDR = rngState.rngState0;
+        *CC_RNG_STATE1_ADDR = rngState.rngState1;
+        *CC_RNG_STATE2_ADDR = rngState.rngState2;
+
+        copy ( rngState.rngState3.begin(), rngState.rngState3.end(), CC_RNG_STATE3_ADDR );
+    }
+};
+
+
+/* Simulation */
+
+static bool parseOption ( const string& arg )
+{
+    static const map<string, uint32_t *> unsignedOptions =
+    {
+        { "frames", &options.frames },
+        { "delay", &options.delay },
+        { "rollback", &options.rollback },
+        { "rollback-delay", &options.rollbackDelay },
+        { "latency", &options.latency },
+        { "jitter", &options.jitter },
+        { "loss", &options.loss },
+        { "spectators", &options.spectators },
+        { "effects", &options.effects },
+        { "seed", &options.seed },
+        { "time-sync", &options.timeSync },
+        { "auto-delay", &options.autoDelay },
+        { "loopback", &options.loopback },
+    };
+
+    const size_t split = arg.find ( '=' );
+
+    if ( arg.compare ( 0, 2, "--" ) != 0 || split == string::npos )
+        return false;
+
+    const string name = arg.substr ( 2, split - 2 );
+    const string value = arg.substr ( split + 1 );
+
+    if ( name == "skew" )
+    {
+        options.skew = lexical_cast<int32_t> ( value );
+        return true;
+    }
+
+    const auto it = unsignedOptions.find ( name );
+
+    if ( it == unsignedOptions.end() )
+        return false;
+
+    *it->second = lexical_cast<uint32_t> ( value );
+    return true;
+}
+
+static void printStats ( const SimInstance& instance )
+{
+    PRINT ( "%s: frames=%llu; stalls=%llu (%llu ms); syncChecks=%llu%s",
+            instance.name, instance.frames, instance.stalls, instance.stallTime / 1000, instance.syncChecks,
+            instance.error.empty() ? "" : ( "; error=" + instance.error ) );
+
+    if ( instance.clientMode.isNetplay() && instance.netMan.timeSync.getMetrics().samples )
+        PRINT ( "%s: timeSync: %s", instance.name, instance.netMan.timeSync.str() );
+
+    if ( instance.clientMode.isNetplay() && options.autoDelay )
+        PRINT ( "%s: delay=%u; rollback=%u", instance.name, instance.netMan.getDelay(), instance.netMan.getRollback() );
+
+    if ( ! instance.rollbacks )
+        return;
+
+    PRINT ( "%s: rollbacks=%llu; rerunFrames=%llu; distance=%.2f (p99 %.0f, worst %.0f); "
+            "rerun=%.1f us (p99 %.0f us, worst %.0f us); saveState=%.1f us (p99 %.0f us, worst %.0f us)",
+            instance.name, instance.rollbacks, instance.rerunFrames,
+            instance.rollbackDistance.getMean(), instance.rollbackDistance.getPercentile ( 99 ),
+            instance.rollbackDistance.getWorst(),
+            instance.rerunTime.getMean(), instance.rerunTime.getPercentile ( 99 ), instance.rerunTime.getWorst(),
+            instance.saveStateTime.getMean(), instance.saveStateTime.getPercentile ( 99 ),
+            instance.saveStateTime.getWorst() );
+}
+
+static bool runSimulation()
+{
+    networkRandom.seed ( options.seed );
+
+    const uint8_t wireVersion = ClientMode ( ClientMode::Host, ClientMode::WireFlags ).getWireVersion();
+
+    vector<shared_ptr<SimInstance>> instances;
+
+    instances.push_back ( make_shared<SimInstance> ( "Host", ClientMode ( ClientMode::Host, ClientMode::WireFlags ),
+                          options.seed, FRAME_INTERVAL ) );
+
+    instances.push_back ( make_shared<SimInstance> ( "Client", ClientMode ( ClientMode::Client, ClientMode::WireFlags ),
+                          options.seed + 1, FRAME_INTERVAL * ( 100 + options.skew ) / 100 ) );
+
+    for ( uint32_t i = 0; i < options.spectators; ++i )
+    {
+        instances.push_back ( make_shared<SimInstance> (
+                                  format ( "Spectator%u", i + 1 ), ClientMode ( ClientMode::SpectateNetplay, 0 ),
+                                  options.seed + 2 + i, FRAME_INTERVAL ) );
+    }
+
+    SimInstance& host = *instances[0];
+    SimInstance& client = *instances[1];
+
+    SocketPtr hostSocket ( new SimSocket ( &host, 1 ) );
+    SocketPtr clientSocket ( new SimSocket ( &client, 2 ) );
+
+    connectSockets ( ( SimSocket * ) hostSocket.get(), ( SimSocket * ) clientSocket.get(), wireVersion );
+
+    host.connected ( hostSocket );
+    client.connected ( clientSocket );
+
+    size_t numConnectedSpectators = 0;
+
+    const uint64_t start = getWallMicroseconds();
+
+    for ( now = 0; ! host.isDone() || ! client.isDone(); now += TIME_STEP )
+    {
+        deliverPackets();
+
+        for ( const auto& instance : instances )
+            instance->step();
+
+        // Spectators connect during the first CharaSelect
+        if ( numConnectedSpectators < options.spectators && host.netMan.getState() == NetplayState::CharaSelect
+                && host.netMan.getIndex() == 1 )
+        {
+            SimInstance& spectator = *instances[2 + numConnectedSpectators];
+
+            SocketPtr hostSide ( new SimSocket ( &host, 3 + 2 * numConnectedSpectators ) );
+            SocketPtr spectatorSide ( new SimSocket ( &spectator, 4 + 2 * numConnectedSpectators ) );
+
+            connectSockets ( ( SimSocket * ) hostSide.get(), ( SimSocket * ) spectatorSide.get(), wireVersion );
+
+            spectator.spectate ( spectatorSide );
+            host.spectatorConnected ( hostSide, spectator );
+
+            ++numConnectedSpectators;
+        }
+
+        if ( ! host.error.empty() || ! client.error.empty() )
+            break;
+    }
+
+    const double seconds = ( getWallMicroseconds() - start ) / 1000000.0;
+
+    uint64_t totalFrames = 0;
+    bool success = true;
+
+    for ( const auto& instance : instances )
+    {
+        printStats ( *instance );
+
+        totalFrames += instance->frames + instance->rerunFrames;
+        success = success && instance->error.empty();
+    }
+
+    PRINT ( "Network: packets=%llu; bytes=%llu; lost=%llu", numPackets, numBytes, numLost );
+
+    PRINT ( "Simulated %.1f s in %.2f s, %.0f frames per second", now / 1000000.0, seconds,
+            totalFrames / max ( seconds, 1e-6 ) );
+
+    // Sockets must be destroyed before the instances that own them
+    while ( ! packets.empty() )
+        packets.pop();
+
+    return success;
+}
+
+int main ( int argc, char *argv[] )
+{
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( parseOption ( argv[i] ) )
+            continue;
+
+        PRINT ( "Usage: %s [--frames=N] [--delay=N] [--rollback=N] [--rollback-delay=N] [--latency=MS] "
+                "[--jitter=MS] [--loss=PERCENT] [--spectators=N] [--effects=N] [--seed=N] [--skew=PERCENT] "
+                "[--time-sync=0|1] [--auto-delay=0|1] [--loopback=0|1]", argv[0] );
+        return -1;
+    }
+
+    options.effects = min<uint32_t> ( options.effects, CC_EFFECTS_ARRAY_COUNT );
+    options.rollback = min<uint32_t> ( options.rollback, MAX_ROLLBACK );
+
+    Logger::get().initialize ( LOG_FILE, 0 );
+
+    bool success = false;
+
+    try
+    {
+        initGameMemory();
+
+        if ( options.loopback )
+            SocketManager::get().initialize();
+
+        success = runSimulation();
+    }
+    catch ( const Exception& exc )
+    {
+        PRINT ( "%s", exc.str() );
+    }
+
+    SocketManager::get().deinitialize();
+
+    Logger::get().deinitialize();
+    return ( success ? 0 : -1 );
+}